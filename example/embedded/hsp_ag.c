@@ -58,6 +58,7 @@
 #include "sdp_query_rfcomm.h"
 #include "sdp.h"
 #include "debug.h"
+#include "sco_stream.h"
 #include "hsp_ag.h"
 
 #define RFCOMM_SERVER_CHANNEL 1
@@ -256,6 +257,8 @@ void hsp_ag_init(uint8_t rfcomm_channel_nr){
 
     sdp_query_rfcomm_register_callback(handle_query_rfcomm_event, NULL);
 
+    sco_stream_init();
+
     hsp_ag_reset_state();
 }
 
@@ -520,6 +523,14 @@ static void packet_handler (void * connection, uint8_t packet_type, uint16_t cha
                 break;
             }
 
+            // CVSD, 8 kHz. eSCO packet length is fixed by the link
+            sco_stream_config_t sco_config;
+            memset(&sco_config, 0, sizeof(sco_config));
+            sco_config.sample_rate = 8000;
+            sco_config.packet_length = link_type == 0x02 ? tx_packet_length : 0;
+            sco_config.jitter_buffer_ms = 20;
+            sco_stream_open(sco_handle, &sco_config);
+
             hsp_state = HSP_ACTIVE;
             emit_event(HSP_SUBEVENT_AUDIO_CONNECTION_COMPLETE, 0);
             break;                
@@ -576,6 +587,7 @@ static void packet_handler (void * connection, uint8_t packet_type, uint16_t cha
             }
             handle = READ_BT_16(packet,3);
             if (handle == sco_handle){
+                sco_stream_close(sco_handle);
                 printf("SCO disconnected, w2 disconnect RFCOMM\n");
                 sco_handle = 0;
                 hsp_state = HSP_W2_DISCONNECT_RFCOMM;
@@ -55,6 +55,17 @@ void hal_tick_init(void);
 void hal_tick_set_handler(void (*tick_handler)(void));
 int  hal_tick_get_tick_period_in_ms(void);
 
+// Tickless extension, only used by the embedded run loop if HAVE_TICKLESS is defined.
+// Called before going to sleep with IRQs disabled.
+// Stop periodic ticks and call the tick handler only once after the given number of tick periods,
+// ticks == 0 requests no wakeup at all. The HAL may limit the number to the range of its timer.
+// @returns 0 if one-shot mode is not possible, periodic ticks continue then
+int      hal_tick_start_one_shot(uint32_t ticks);
+
+// Resume periodic ticks after wakeup, called with IRQs disabled.
+// @returns number of complete tick periods since hal_tick_start_one_shot
+uint32_t hal_tick_stop_one_shot(void);
+
 #if defined __cplusplus
 }
 #endif
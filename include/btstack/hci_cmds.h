@@ -625,11 +625,19 @@ extern "C" {
 //
 
 // from Bluetooth Core Specification
+#define ERROR_CODE_UNKNOWN_HCI_COMMAND                     0x01
 #define ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER           0x02
+#define ERROR_CODE_PAGE_TIMEOUT                            0x04
 #define ERROR_CODE_AUTHENTICATION_FAILURE				   0x05
+#define ERROR_CODE_PIN_OR_KEY_MISSING                      0x06
 #define ERROR_CODE_COMMAND_DISALLOWED                      0x0C
+#define ERROR_CODE_CONNECTION_REJECTED_DUE_TO_LIMITED_RESOURCES 0x0D
+#define ERROR_CODE_INVALID_HCI_COMMAND_PARAMETERS          0x12
+#define ERROR_CODE_REMOTE_USER_TERMINATED_CONNECTION       0x13
+#define ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST     0x16
 #define ERROR_CODE_PAIRING_NOT_ALLOWED                     0x18
 #define ERROR_CODE_INSUFFICIENT_SECURITY                   0x2F
+#define ERROR_CODE_CONNECTION_FAILED_TO_BE_ESTABLISHED     0x3E
  
 // last error code in 2.1 is 0x38 - we start with 0x50 for BTstack errors
 #define BTSTACK_CONNECTION_TO_BTDAEMON_FAILED              0x50
@@ -774,6 +782,7 @@ extern const hci_cmd_t btstack_get_system_bluetooth_enabled;
 extern const hci_cmd_t btstack_set_system_bluetooth_enabled;
 extern const hci_cmd_t btstack_set_discoverable;
 extern const hci_cmd_t btstack_set_bluetooth_enabled;    // only used by btstack config
+extern const hci_cmd_t btstack_dump_run_loop_profile;
     
 extern const hci_cmd_t hci_accept_connection_request;
 extern const hci_cmd_t hci_accept_synchronous_connection_command;
@@ -787,6 +796,7 @@ extern const hci_cmd_t hci_enhanced_setup_synchronous_connection_command;
 extern const hci_cmd_t hci_enhanced_accept_synchronous_connection_command;
 extern const hci_cmd_t hci_disconnect;
 extern const hci_cmd_t hci_host_buffer_size;
+extern const hci_cmd_t hci_host_number_of_completed_packets;
 extern const hci_cmd_t hci_inquiry;
 extern const hci_cmd_t hci_io_capability_request_reply;
 extern const hci_cmd_t hci_io_capability_request_negative_reply;
@@ -798,6 +808,7 @@ extern const hci_cmd_t hci_pin_code_request_negative_reply;
 extern const hci_cmd_t hci_qos_setup;
 extern const hci_cmd_t hci_read_bd_addr;
 extern const hci_cmd_t hci_read_buffer_size;
+extern const hci_cmd_t hci_read_local_version_information;
 extern const hci_cmd_t hci_read_le_host_supported;
 extern const hci_cmd_t hci_read_link_policy_settings;
 extern const hci_cmd_t hci_read_link_supervision_timeout;
@@ -813,6 +824,7 @@ extern const hci_cmd_t hci_reset;
 extern const hci_cmd_t hci_role_discovery;
 extern const hci_cmd_t hci_set_event_mask;
 extern const hci_cmd_t hci_set_connection_encryption;
+extern const hci_cmd_t hci_set_controller_to_host_flow_control;
 extern const hci_cmd_t hci_setup_synchronous_connection_command;
 extern const hci_cmd_t hci_sniff_mode;
 extern const hci_cmd_t hci_switch_role_command;
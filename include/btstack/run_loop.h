@@ -61,13 +61,20 @@ extern "C" {
 typedef enum {
 	RUN_LOOP_POSIX = 1,
 	RUN_LOOP_COCOA,
-	RUN_LOOP_EMBEDDED
+	RUN_LOOP_EMBEDDED,
+	RUN_LOOP_EPOLL
 } RUN_LOOP_TYPE;
 
+// data source callbacks
+#define DATA_SOURCE_CALLBACK_READ  0x01
+#define DATA_SOURCE_CALLBACK_WRITE 0x02
+
 typedef struct data_source {
     linked_item_t item;
     int  fd;                                 // <-- file descriptor to watch or 0
     int  (*process)(struct data_source *ds); // <-- do processing
+    uint8_t callbacks;                       // <-- used by run loop: enabled callbacks
+    uint8_t ready;                           // <-- used by run loop: callbacks that are ready in process
 } data_source_t;
 
 typedef struct timer {
@@ -79,12 +86,24 @@ typedef struct timer {
     uint32_t timeout;                       // timeout in system ticks
 #endif
     void  (*process)(struct timer *ts);      // <-- do processing
+    int   queue_index;                       // <-- used by run loop: position in timer queue + 1
+    uint32_t queue_sequence;                 // <-- used by run loop: insertion order for equal timeouts
 } timer_source_t;
 
+typedef struct run_loop_callback {
+    linked_item_t item;
+    void  (*process)(struct run_loop_callback *cb); // <-- do processing
+    volatile int pending;                           // <-- used by run loop: callback is queued
+} run_loop_callback_t;
+
 
 // Set timer based on current time in milliseconds.
 void run_loop_set_timer(timer_source_t *a, uint32_t timeout_in_ms);
 
+// Get current time in ms. Based on a monotonic clock where available, it does
+// not relate to wall clock time and wraps around after 2^32 ms.
+uint32_t run_loop_get_time_ms(void);
+
 // Set callback that will be executed when timer expires.
 void run_loop_set_timer_handler(timer_source_t *ts, void (*process)(timer_source_t *_ts));
 
@@ -94,6 +113,7 @@ int  run_loop_remove_timer(timer_source_t *timer);
 
 // Init must be called before any other run_loop call. 
 // Use RUN_LOOP_EMBEDDED for embedded devices.
+// On Linux, RUN_LOOP_EPOLL is available if USE_EPOLL_RUN_LOOP is defined.
 void run_loop_init(RUN_LOOP_TYPE type);
 
 // Set data source callback.
@@ -104,10 +124,34 @@ void run_loop_set_data_source_handler(data_source_t *ds, int (*process)(data_sou
 void run_loop_add_data_source(data_source_t *dataSource);
 int  run_loop_remove_data_source(data_source_t *dataSource);
 
+// Enable/Disable DATA_SOURCE_CALLBACK_READ/WRITE for an added data source. Data sources
+// are added with read callback. Write callbacks are not supported by RUN_LOOP_EMBEDDED.
+void run_loop_enable_data_source_callbacks(data_source_t *dataSource, uint8_t callbacks);
+void run_loop_disable_data_source_callbacks(data_source_t *dataSource, uint8_t callbacks);
+
 
 // Execute configured run loop. This function does not return.
 void run_loop_execute(void);
 
+// Set callback that will be executed on the run loop thread.
+void run_loop_set_callback_handler(run_loop_callback_t *cb, void (*process)(run_loop_callback_t *_cb));
+
+// Request execution of callback on the run loop thread. Can be called from any thread
+// without locking, the run loop is woken up if needed. Requesting a callback that is
+// still pending has no effect, it is executed only once.
+// For RUN_LOOP_EMBEDDED, it can be called from an interrupt handler or from the main thread
+// with interrupts disabled.
+void run_loop_execute_on_main_thread(run_loop_callback_t *cb);
+
+#ifdef ENABLE_RUN_LOOP_PROFILER
+// Log invocation counts, execution times and timer lateness per callback.
+void run_loop_profiler_dump(void);
+// Clear collected statistics.
+void run_loop_profiler_reset(void);
+// Log the longest callback of run loop iterations that take longer than threshold, 0 disables the check.
+void run_loop_profiler_set_stall_threshold_ms(uint32_t threshold_ms);
+#endif
+
 // hack to fix HCI timer handling
 #ifdef HAVE_TICK
 // Sets how many miliseconds has one tick.
@@ -49,6 +49,7 @@
 #import <Foundation/Foundation.h>
 #import <CoreFoundation/CoreFoundation.h>
 
+#include <mach/mach_time.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -64,15 +65,23 @@ static void socketDataCallback (
 						 const void *data,
 						 void *info) {
 	
-    if (callbackType == kCFSocketReadCallBack && info){
-        data_source_t *dataSource = (data_source_t *) info;
-        // printf("cocoa_data_source %x - fd %u, CFSocket %x, CFRunLoopSource %x\n", (int) dataSource, dataSource->fd, (int) s, (int) dataSource->item.next);
-        dataSource->process(dataSource);
+    if (!info) return;
+    data_source_t *dataSource = (data_source_t *) info;
+    if (callbackType == kCFSocketReadCallBack){
+        dataSource->ready = DATA_SOURCE_CALLBACK_READ;
+    } else if (callbackType == kCFSocketWriteCallBack){
+        dataSource->ready = DATA_SOURCE_CALLBACK_WRITE;
+    } else {
+        return;
     }
+    // printf("cocoa_data_source %x - fd %u, CFSocket %x, CFRunLoopSource %x\n", (int) dataSource, dataSource->fd, (int) s, (int) dataSource->item.next);
+    dataSource->process(dataSource);
 }
 
 void cocoa_add_data_source(data_source_t *dataSource){
 
+    dataSource->callbacks = DATA_SOURCE_CALLBACK_READ;
+
 	// add fd as CFSocket
 	
 	// store our dataSource in socket context
@@ -84,13 +93,14 @@ void cocoa_add_data_source(data_source_t *dataSource){
 	CFSocketRef socket = CFSocketCreateWithNative (
 										  kCFAllocatorDefault,
 										  dataSource->fd,
-										  kCFSocketReadCallBack,
+										  kCFSocketReadCallBack | kCFSocketWriteCallBack,
 										  socketDataCallback,
 										  &socketContext
     );
     
-    // don't close native fd on CFSocketInvalidate
-    CFSocketSetSocketFlags(socket, CFSocketGetSocketFlags(socket) & ~kCFSocketCloseOnInvalidate);
+    // don't close native fd on CFSocketInvalidate, keep write callback enabled until disabled by data source
+    CFSocketSetSocketFlags(socket, (CFSocketGetSocketFlags(socket) & ~kCFSocketCloseOnInvalidate) | kCFSocketAutomaticallyReenableWriteCallBack);
+    CFSocketDisableCallBacks(socket, kCFSocketWriteCallBack);
     
 	// create run loop source
 	CFRunLoopSourceRef socketRunLoop = CFSocketCreateRunLoopSource ( kCFAllocatorDefault, socket, 0);
@@ -114,6 +124,15 @@ int  cocoa_remove_data_source(data_source_t *dataSource){
 	return 0;
 }
 
+static void cocoa_update_data_source(data_source_t *dataSource){
+    CFSocketRef socket = (CFSocketRef) dataSource->item.next;
+    if (dataSource->callbacks & DATA_SOURCE_CALLBACK_WRITE){
+        CFSocketEnableCallBacks(socket, kCFSocketWriteCallBack);
+    } else {
+        CFSocketDisableCallBacks(socket, kCFSocketWriteCallBack);
+    }
+}
+
 void  cocoa_add_timer(timer_source_t * ts)
 {
     // note: ts uses unix time: seconds since Jan 1st 1970, CF uses Jan 1st 2001 as reference date
@@ -149,7 +168,27 @@ static void cocoa_set_timer(timer_source_t *a, uint32_t timeout_in_ms){
     }
 }
 
+// run loop source to wake up the main run loop for callbacks requested by other threads
+static CFRunLoopRef      main_run_loop;
+static CFRunLoopSourceRef callbacks_source;
+
+static void callbacksSourcePerform(void *info){
+    run_loop_callbacks_process();
+}
+
+static void cocoa_execute_on_main_thread(run_loop_callback_t *callback){
+    if (!run_loop_callbacks_add(callback)) return;
+    CFRunLoopSourceSignal(callbacks_source);
+    CFRunLoopWakeUp(main_run_loop);
+}
+
 void cocoa_init(void){
+    CFRunLoopSourceContext context;
+    memset(&context, 0, sizeof(CFRunLoopSourceContext));
+    context.perform = callbacksSourcePerform;
+    main_run_loop    = CFRunLoopGetCurrent();
+    callbacks_source = CFRunLoopSourceCreate(kCFAllocatorDefault, 0, &context);
+    CFRunLoopAddSource(main_run_loop, callbacks_source, kCFRunLoopCommonModes);
 }
 
 void cocoa_execute(void)
@@ -162,6 +201,16 @@ void cocoa_dump_timer(void){
 	return;
 }
 
+// monotonic, not affected by changes of the wall clock
+static uint32_t cocoa_get_time_ms(void){
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0){
+        mach_timebase_info(&timebase);
+    }
+    uint64_t time_ns = mach_absolute_time() * timebase.numer / timebase.denom;
+    return (uint32_t) (time_ns / 1000000);
+}
+
 run_loop_t run_loop_cocoa = {
     &cocoa_init,
     &cocoa_add_data_source,
@@ -171,5 +220,8 @@ run_loop_t run_loop_cocoa = {
     &cocoa_remove_timer,
     &cocoa_execute,
     &cocoa_dump_timer,
+    &cocoa_get_time_ms,
+    &cocoa_execute_on_main_thread,
+    &cocoa_update_data_source,
 };
 
@@ -92,6 +92,10 @@
 #include "../platforms/ios/src/platform_iphone.h"
 #endif
 
+#ifdef HAVE_TRANSPORT_VIRTUAL
+#include "virtual_controller.h"
+#endif
+
 #ifndef BTSTACK_LOG_FILE
 #define BTSTACK_LOG_FILE "/tmp/hci_dump.pklg"
 #endif
@@ -169,6 +173,9 @@ static client_state_t * client_for_connection(connection_t *connection);
 // MARK: globals
 static hci_transport_t * transport;
 static hci_uart_config_t config;
+#ifdef HAVE_TRANSPORT_VIRTUAL
+static virtual_controller_config_t virtual_config;
+#endif
 static timer_source_t timeout;
 static uint8_t timeout_active = 0;
 static int power_management_sleep = 0;
@@ -773,6 +780,16 @@ static int btstack_command_handler(connection_t *connection, uint8_t *packet, ui
                 hci_power_control(HCI_POWER_OFF);
             }
             break;
+        case BTSTACK_DUMP_RUN_LOOP_PROFILE:
+#ifdef ENABLE_RUN_LOOP_PROFILER
+            run_loop_profiler_dump();
+            if (packet[3]) {
+                run_loop_profiler_reset();
+            }
+#else
+            log_error("BTSTACK_DUMP_RUN_LOOP_PROFILE: run loop profiler not enabled");
+#endif
+            break;
         case L2CAP_CREATE_CHANNEL_MTU:
             bt_flip_addr(addr, &packet[3]);
             psm = READ_BT_16(packet, 9);
@@ -1718,6 +1735,7 @@ int main (int argc,  char * const * argv){
 #endif
 
     bt_control_t * control = NULL;
+    void * transport_config = &config;
     
 #ifdef HAVE_TRANSPORT_H4
     config.device_name   = UART_DEVICE;
@@ -1737,10 +1755,27 @@ int main (int argc,  char * const * argv){
 #endif
 #endif
 
+#ifdef HAVE_TRANSPORT_H5
+    config.device_name   = UART_DEVICE;
+    config.baudrate_init = UART_SPEED;
+    config.baudrate_main = 0;
+    config.flowcontrol = 0;
+    transport = hci_transport_h5_instance();
+#endif
+
 #ifdef HAVE_TRANSPORT_USB
     transport = hci_transport_usb_instance();
 #endif
 
+#ifdef HAVE_TRANSPORT_VIRTUAL
+    // reaches other BTstack instances that use the virtual transport on this host
+    bd_addr_t virtual_bd_addr;
+    sscan_bd_addr((uint8_t *) VIRTUAL_BD_ADDR, virtual_bd_addr);
+    virtual_controller_config_init(&virtual_config, virtual_bd_addr);
+    transport = hci_transport_virtual_instance();
+    transport_config = &virtual_config;
+#endif
+
 #ifdef USE_BLUETOOL
     control = &bt_control_iphone;
 #endif
@@ -1761,7 +1796,11 @@ int main (int argc,  char * const * argv){
     remote_device_db = &REMOTE_DEVICE_DB;
 #endif
 
+#ifdef USE_EPOLL_RUN_LOOP
+    run_loop_init(RUN_LOOP_EPOLL);
+#else
     run_loop_init(RUN_LOOP_POSIX);
+#endif
     
     // init power management notifications
     if (control && control->register_for_power_notifications){
@@ -1782,7 +1821,10 @@ int main (int argc,  char * const * argv){
     log_info("version %s, svn r%u, build %s", BTSTACK_VERSION, BTSTACK_REVISION, BTSTACK_DATE);
 
     // init HCI
-    hci_init(transport, &config, control, remote_device_db);
+    hci_init(transport, transport_config, control, remote_device_db);
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    hci_set_controller_cache(&hci_controller_cache_fs);
+#endif
 
 #ifdef USE_BLUETOOL
     // iPhone doesn't use SSP yet as there's no UI for it yet and auto accept is not an option
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_controller_cache_fs.c
+ *
+ *  Stores controller info in /tmp/btstack_controller_<bd addr>.bin
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hci_controller_cache.h"
+#include "debug.h"
+
+#define CONTROLLER_CACHE_PATH "/tmp/"
+#define CONTROLLER_CACHE_PREFIX "btstack_controller_"
+#define CONTROLLER_CACHE_SUFIX ".bin"
+
+static char cache_path[sizeof(CONTROLLER_CACHE_PATH) + sizeof(CONTROLLER_CACHE_PREFIX) + 17 + sizeof(CONTROLLER_CACHE_SUFIX) + 1];
+
+static void set_path(bd_addr_t bd_addr){
+    int i;
+    char * p;
+    strcpy(cache_path, CONTROLLER_CACHE_PATH);
+    strcat(cache_path, CONTROLLER_CACHE_PREFIX);
+    p = &cache_path[strlen(cache_path)];
+    for (i = 0; i < 6; i++){
+        sprintf(p, i < 5 ? "%02X-" : "%02X", bd_addr[i]);
+        p += strlen(p);
+    }
+    strcat(cache_path, CONTROLLER_CACHE_SUFIX);
+}
+
+static int cache_get(bd_addr_t bd_addr, hci_controller_info_t * info){
+    set_path(bd_addr);
+    FILE * rFile = fopen(cache_path, "rb");
+    if (!rFile) return 0;
+    // format and content are checked by hci.c
+    size_t objects_read = fread(info, sizeof(hci_controller_info_t), 1, rFile);
+    fclose(rFile);
+    if (objects_read != 1 || BD_ADDR_CMP(info->bd_addr, bd_addr)) {
+        log_info("Controller cache %s invalid", cache_path);
+        return 0;
+    }
+    return 1;
+}
+
+static void cache_put(hci_controller_info_t * info){
+    set_path(info->bd_addr);
+    // path is in a world-writable directory, don't follow a planted symlink
+    int fd = open(cache_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+    FILE * wFile = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!wFile) {
+        log_error("Controller cache %s cannot be written", cache_path);
+        if (fd >= 0) close(fd);
+        return;
+    }
+    fwrite(info, sizeof(hci_controller_info_t), 1, wFile);
+    fclose(wFile);
+}
+
+static void cache_remove(bd_addr_t bd_addr){
+    set_path(bd_addr);
+    remove(cache_path);
+}
+
+const hci_controller_cache_t hci_controller_cache_fs = {
+    cache_get,
+    cache_put,
+    cache_remove
+};
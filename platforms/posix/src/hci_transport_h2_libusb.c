@@ -51,6 +51,7 @@
 // SCO Data     0 0 0x83 Isochronous (IN)
 // SCO Data     0 0 0x03 Isochronous (Out)
 
+#include <poll.h>
 #include <stdio.h>
 #include <strings.h>
 #include <string.h>
@@ -104,14 +105,38 @@ static libusb_device        * dev;
 static libusb_device_handle * handle;
 
 #define ASYNC_BUFFERS 2
-#define AYSNC_POLLING_INTERVAL_MS 1
 #define NUM_ISO_PACKETS 4
 #define SCO_PACKET_SIZE 64
 
+// max number of bulk OUT transfers in flight, see hci_transport_usb_set_acl_out_transfers
+#ifndef HCI_USB_ACL_OUT_TRANSFERS
+#define HCI_USB_ACL_OUT_TRANSFERS 4
+#endif
+
+// number of bulk IN transfers kept submitted
+#ifndef HCI_USB_ACL_IN_TRANSFERS
+#define HCI_USB_ACL_IN_TRANSFERS 4
+#endif
+
+// number of interrupt IN transfers kept submitted
+#ifndef HCI_USB_EVENT_IN_TRANSFERS
+#define HCI_USB_EVENT_IN_TRANSFERS 2
+#endif
+
+// max number of file descriptors used by libusb
+#ifndef HCI_USB_MAX_POLLFDS
+#define HCI_USB_MAX_POLLFDS 8
+#endif
+
 static struct libusb_transfer *command_out_transfer;
-static struct libusb_transfer *acl_out_transfer;
-static struct libusb_transfer *event_in_transfer[ASYNC_BUFFERS];
-static struct libusb_transfer *acl_in_transfer[ASYNC_BUFFERS];
+static struct libusb_transfer *acl_out_transfer[HCI_USB_ACL_OUT_TRANSFERS];
+static struct libusb_transfer *event_in_transfer[HCI_USB_EVENT_IN_TRANSFERS];
+static struct libusb_transfer *acl_in_transfer[HCI_USB_ACL_IN_TRANSFERS];
+
+// idle ACL OUT transfers, used as stack
+static struct libusb_transfer *acl_out_transfers_free[HCI_USB_ACL_OUT_TRANSFERS];
+static int acl_out_transfers_free_count;
+static int acl_out_transfers_num = HCI_USB_ACL_OUT_TRANSFERS;
 
 static H2_SCO_STATE sco_state;
 static uint8_t  sco_buffer[255+3 + SCO_PACKET_SIZE];
@@ -125,22 +150,32 @@ static uint8_t hci_sco_in_buffer[ASYNC_BUFFERS][NUM_ISO_PACKETS * SCO_PACKET_SIZ
 #endif
 
 static uint8_t hci_cmd_buffer[3 + 256 + LIBUSB_CONTROL_SETUP_SIZE];
-static uint8_t hci_event_in_buffer[ASYNC_BUFFERS][HCI_ACL_BUFFER_SIZE]; // bigger than largest packet
-static uint8_t hci_acl_in_buffer[ASYNC_BUFFERS][HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE]; 
+static uint8_t hci_event_in_buffer[HCI_USB_EVENT_IN_TRANSFERS][HCI_ACL_BUFFER_SIZE]; // bigger than largest packet
+static uint8_t hci_acl_in_buffer[HCI_USB_ACL_IN_TRANSFERS][HCI_INCOMING_PRE_BUFFER_SIZE + HCI_ACL_BUFFER_SIZE]; 
+static uint8_t hci_acl_out_buffer[HCI_USB_ACL_OUT_TRANSFERS][HCI_ACL_BUFFER_SIZE];
+#ifdef HAVE_SCO
+static uint8_t hci_sco_out_buffer[3 + 255];
+#endif
 
 // For (ab)use as a linked list of received packets
 static struct libusb_transfer *handle_packet;
 
-static int doing_pollfds;
-static int num_pollfds;
-static data_source_t * pollfd_data_sources;
+// libusb file descriptors, unused if process == NULL
+static data_source_t usb_pollfd_data_sources[HCI_USB_MAX_POLLFDS];
+
+// timer for libusb timeouts, only needed if they are not signalled on a file descriptor
+static int usb_timeouts_need_timer;
 static timer_source_t usb_timer;
 static int usb_timer_active;
 
-static int usb_acl_out_active = 0;
 static int usb_sco_out_active = 0;
 static int usb_command_active = 0;
 
+// can_send_packet_now returned 0, send DAEMON_EVENT_HCI_PACKET_SENT when transfer completes
+static int usb_tx_blocked;
+
+static hci_transport_usb_stats_t usb_stats;
+
 // endpoint addresses
 static int event_in_addr;
 static int acl_in_addr;
@@ -176,6 +211,13 @@ static void async_callback(struct libusb_transfer *transfer)
     // log_info("begin async_callback endpoint %x, status %x, actual length %u", transfer->endpoint, transfer->status, transfer->actual_length );
 
     if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+        if (transfer->endpoint == acl_in_addr){
+            // not available to controller until re-submitted after processing
+            usb_stats.acl_in_pending--;
+            if (usb_stats.acl_in_pending < usb_stats.acl_in_pending_min){
+                usb_stats.acl_in_pending_min = usb_stats.acl_in_pending;
+            }
+        }
         queue_transfer(transfer);
     } else if (transfer->status == LIBUSB_TRANSFER_STALL){
         log_info("-> Transfer stalled, trying again");
@@ -263,7 +305,8 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
         signal_done = 1;
     } else if (transfer->endpoint == acl_out_addr){
         // log_info("acl out done, size %u", transfer->actual_length);
-        usb_acl_out_active = 0;
+        acl_out_transfers_free[acl_out_transfers_free_count++] = transfer;
+        usb_stats.acl_out_in_flight--;
         signal_done = 1;
     } else if (transfer->endpoint == sco_out_addr){
         log_info("sco out done, size %u/%u - status %x", transfer->actual_length, 
@@ -274,8 +317,9 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
         log_info("usb_process_ds endpoint unknown %x", transfer->endpoint);
     }
 
-    if (signal_done){
-        // notify upper stack that iit might be possible to send again
+    if (signal_done && usb_tx_blocked){
+        // notify upper stack that it is possible to send again
+        usb_tx_blocked = 0;
         uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0};
         packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
     }
@@ -288,10 +332,29 @@ static void handle_completed_transfer(struct libusb_transfer *transfer){
         int r = libusb_submit_transfer(transfer);
         if (r) {
             log_error("Error re-submitting transfer %d", r);
+            return;
+        }
+        if (transfer->endpoint == acl_in_addr){
+            usb_stats.acl_in_pending++;
         }
     }   
 }
 
+// arm timer for next libusb timeout if libusb cannot signal it on a file descriptor
+static void usb_update_timeout(void){
+    if (!usb_timeouts_need_timer) return;
+    if (usb_timer_active){
+        run_loop_remove_timer(&usb_timer);
+        usb_timer_active = 0;
+    }
+    struct timeval tv;
+    if (libusb_get_next_timeout(NULL, &tv) != 1) return;
+    uint32_t timeout_ms = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+    run_loop_set_timer(&usb_timer, timeout_ms);
+    run_loop_add_timer(&usb_timer);
+    usb_timer_active = 1;
+}
+
 static int usb_process_ds(struct data_source *ds) {
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return -1;
 
@@ -301,13 +364,17 @@ static int usb_process_ds(struct data_source *ds) {
     memset(&tv, 0, sizeof(struct timeval));
     libusb_handle_events_timeout(NULL, &tv);
 
-    // Handle any packet in the order that they were received
+    // Handle any packet in the order that they were received, as one batch
+    hci_batch_begin();
     while (handle_packet) {
         // log_info("handle packet %p, endpoint %x, status %x", handle_packet, handle_packet->endpoint, handle_packet->status);
         void * next = handle_packet->user_data;
         handle_completed_transfer(handle_packet);
         // handle case where libusb_close might be called by hci packet handler        
-        if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return -1;
+        if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) {
+            hci_batch_end();
+            return -1;
+        }
 
         // Move to next in the list of packets to handle
         if (next) {
@@ -316,30 +383,52 @@ static int usb_process_ds(struct data_source *ds) {
             handle_packet = NULL;
         }
     }
+    hci_batch_end();
+    usb_update_timeout();
     // log_info("end usb_process_ds");
     return 0;
 }
 
-void usb_process_ts(timer_source_t *timer) {
-    // log_info("in usb_process_ts");
-
+static void usb_process_ts(timer_source_t *timer) {
     // timer is deactive, when timer callback gets called
     usb_timer_active = 0;
 
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return;
 
-    // actually handled the packet in the pollfds function
     usb_process_ds((struct data_source *) NULL);
+}
 
-    // Get the amount of time until next event is due
-    long msec = AYSNC_POLLING_INTERVAL_MS;
-
-    // Activate timer
-    run_loop_set_timer(&usb_timer, msec);
-    run_loop_add_timer(&usb_timer);
-    usb_timer_active = 1;
+static void usb_pollfd_added(int fd, short events, void * user_data){
+    int i;
+    for (i = 0 ; i < HCI_USB_MAX_POLLFDS ; i++) {
+        data_source_t *ds = &usb_pollfd_data_sources[i];
+        if (ds->process) continue;
+        ds->fd = fd;
+        ds->process = usb_process_ds;
+        run_loop_add_data_source(ds);
+        // usbfs on Linux signals completed transfers with POLLOUT
+        if (events & POLLOUT) {
+            run_loop_enable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_WRITE);
+        }
+        if (!(events & POLLIN)) {
+            run_loop_disable_data_source_callbacks(ds, DATA_SOURCE_CALLBACK_READ);
+        }
+        log_info("usb pollfd added: fd %u, events %x", fd, events);
+        return;
+    }
+    log_error("usb pollfd added: no data source left for fd %u", fd);
+}
 
-    return;
+static void usb_pollfd_removed(int fd, void * user_data){
+    int i;
+    for (i = 0 ; i < HCI_USB_MAX_POLLFDS ; i++) {
+        data_source_t *ds = &usb_pollfd_data_sources[i];
+        if (!ds->process || ds->fd != fd) continue;
+        run_loop_remove_data_source(ds);
+        ds->process = NULL;
+        log_info("usb pollfd removed: fd %u", fd);
+        return;
+    }
 }
 
 #ifndef HAVE_USB_VENDOR_ID_AND_PRODUCT_ID
@@ -643,19 +732,41 @@ static int usb_open(void *transport_config){
     
     // allocate transfer handlers
     int c;
-    for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
+    for (c = 0 ; c < HCI_USB_EVENT_IN_TRANSFERS ; c++) {
         event_in_transfer[c] = libusb_alloc_transfer(0); // 0 isochronous transfers Events
+        if (!event_in_transfer[c]) {
+            usb_close(handle);
+            return LIBUSB_ERROR_NO_MEM;
+        }
+    }
+    for (c = 0 ; c < HCI_USB_ACL_IN_TRANSFERS ; c++) {
         acl_in_transfer[c]  =  libusb_alloc_transfer(0); // 0 isochronous transfers ACL in
-        if ( !event_in_transfer[c] || !acl_in_transfer[c]) {
+        if (!acl_in_transfer[c]) {
             usb_close(handle);
             return LIBUSB_ERROR_NO_MEM;
         }
     }
 
-    command_out_transfer = libusb_alloc_transfer(0);
-    acl_out_transfer     = libusb_alloc_transfer(0);
+    // ACL OUT transfers own their buffer and are recycled on completion
+    memset(&usb_stats, 0, sizeof(usb_stats));
+    usb_tx_blocked = 0;
+    acl_out_transfers_free_count = 0;
+    for (c = 0 ; c < acl_out_transfers_num ; c++) {
+        acl_out_transfer[c] = libusb_alloc_transfer(0);
+        if (!acl_out_transfer[c]) {
+            usb_close(handle);
+            return LIBUSB_ERROR_NO_MEM;
+        }
+        libusb_fill_bulk_transfer(acl_out_transfer[c], handle, acl_out_addr, hci_acl_out_buffer[c], 0, async_callback, NULL, 0);
+        acl_out_transfers_free[acl_out_transfers_free_count++] = acl_out_transfer[c];
+    }
+    usb_stats.acl_out_transfers = acl_out_transfers_num;
 
-    // TODO check for error
+    command_out_transfer = libusb_alloc_transfer(0);
+    if (!command_out_transfer) {
+        usb_close(handle);
+        return LIBUSB_ERROR_NO_MEM;
+    }
 
     libusb_state = LIB_USB_TRANSFERS_ALLOCATED;
 
@@ -687,7 +798,7 @@ static int usb_open(void *transport_config){
     sco_out_transfer = libusb_alloc_transfer(1); // 1 isochronous transfers SCO out
 #endif
 
-    for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
+    for (c = 0 ; c < HCI_USB_EVENT_IN_TRANSFERS ; c++) {
         // configure event_in handlers
         libusb_fill_interrupt_transfer(event_in_transfer[c], handle, event_in_addr, 
                 hci_event_in_buffer[c], HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
@@ -697,7 +808,9 @@ static int usb_open(void *transport_config){
             usb_close(handle);
             return r;
         }
- 
+    }
+
+    for (c = 0 ; c < HCI_USB_ACL_IN_TRANSFERS ; c++) {
         // configure acl_in handlers
         libusb_fill_bulk_transfer(acl_in_transfer[c], handle, acl_in_addr, 
                 hci_acl_in_buffer[c] + HCI_INCOMING_PRE_BUFFER_SIZE, HCI_ACL_BUFFER_SIZE, async_callback, NULL, 0) ;
@@ -707,42 +820,27 @@ static int usb_open(void *transport_config){
             usb_close(handle);
             return r;
         }
- 
-     }
-
-    // Check for pollfds functionality
-    doing_pollfds = libusb_pollfds_handle_timeouts(NULL);
-    
-    // NOTE: using pollfds doesn't work on Linux, so it is disable until further investigation here
-    doing_pollfds = 0;
-
-    if (doing_pollfds) {
-        log_info("Async using pollfds:");
-
-        const struct libusb_pollfd ** pollfd = libusb_get_pollfds(NULL);
-        for (num_pollfds = 0 ; pollfd[num_pollfds] ; num_pollfds++);
-        pollfd_data_sources = malloc(sizeof(data_source_t) * num_pollfds);
-        if (!pollfd_data_sources){
-            log_error("Cannot allocate data sources for pollfds");
-            usb_close(handle);
-            return 1;            
-        }
-        for (r = 0 ; r < num_pollfds ; r++) {
-            data_source_t *ds = &pollfd_data_sources[r];
-            ds->fd = pollfd[r]->fd;
-            ds->process = usb_process_ds;
-            run_loop_add_data_source(ds);
-            log_info("%u: %p fd: %u, events %x", r, pollfd[r], pollfd[r]->fd, pollfd[r]->events);
-        }
-        free(pollfd);
-    } else {
-        log_info("Async using timers:");
-
-        usb_timer.process = usb_process_ts;
-        run_loop_set_timer(&usb_timer, AYSNC_POLLING_INTERVAL_MS);
-        run_loop_add_timer(&usb_timer);
-        usb_timer_active = 1;
+        usb_stats.acl_in_pending++;
+    }
+    usb_stats.acl_in_transfers   = HCI_USB_ACL_IN_TRANSFERS;
+    usb_stats.acl_in_pending_min = usb_stats.acl_in_pending;
+
+    // process completions as soon as libusb's file descriptors signal them
+    usb_timer.process = usb_process_ts;
+    usb_timeouts_need_timer = !libusb_pollfds_handle_timeouts(NULL);
+    memset(usb_pollfd_data_sources, 0, sizeof(usb_pollfd_data_sources));
+    libusb_set_pollfd_notifiers(NULL, usb_pollfd_added, usb_pollfd_removed, NULL);
+    const struct libusb_pollfd ** pollfd = libusb_get_pollfds(NULL);
+    if (!pollfd){
+        log_error("Cannot get pollfds from libusb");
+        usb_close(handle);
+        return -1;
+    }
+    for (r = 0 ; pollfd[r] ; r++) {
+        usb_pollfd_added(pollfd[r]->fd, pollfd[r]->events, NULL);
     }
+    free(pollfd);
+    usb_update_timeout();
 
     return 0;
 }
@@ -765,41 +863,69 @@ static int usb_close(void *transport_config){
             }
 
             // Cancel any asynchronous transfers
-            for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
+            for (c = 0 ; c < HCI_USB_EVENT_IN_TRANSFERS ; c++) {
                 libusb_cancel_transfer(event_in_transfer[c]);
+            }
+            for (c = 0 ; c < HCI_USB_ACL_IN_TRANSFERS ; c++) {
                 libusb_cancel_transfer(acl_in_transfer[c]);
+            }
+            if (usb_command_active){
+                libusb_cancel_transfer(command_out_transfer);
+            }
+            // only submitted ACL OUT transfers are missing in free list
+            for (c = 0 ; c < HCI_USB_ACL_OUT_TRANSFERS ; c++) {
+                if (!acl_out_transfer[c]) continue;
+                int i;
+                for (i = 0 ; i < acl_out_transfers_free_count ; i++) {
+                    if (acl_out_transfers_free[i] == acl_out_transfer[c]) break;
+                }
+                if (i == acl_out_transfers_free_count) {
+                    libusb_cancel_transfer(acl_out_transfer[c]);
+                }
+            }
 #ifdef HAVE_SCO
+            for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
                 libusb_cancel_transfer(sco_in_transfer[c]);
-#endif
             }
+#endif
 
             /* TODO - find a better way to ensure that all transfers have completed */
             struct timeval tv;
             memset(&tv, 0, sizeof(struct timeval));
             libusb_handle_events_timeout(NULL, &tv);
 
-            if (doing_pollfds){
-                int r;
-                for (r = 0 ; r < num_pollfds ; r++) {
-                    data_source_t *ds = &pollfd_data_sources[r];
-                    run_loop_remove_data_source(ds);
-                }
-                free(pollfd_data_sources);
-                pollfd_data_sources = NULL;
-                num_pollfds = 0;
-                doing_pollfds = 0;
+            libusb_set_pollfd_notifiers(NULL, NULL, NULL, NULL);
+            for (c = 0 ; c < HCI_USB_MAX_POLLFDS ; c++) {
+                data_source_t *ds = &usb_pollfd_data_sources[c];
+                if (!ds->process) continue;
+                run_loop_remove_data_source(ds);
+                ds->process = NULL;
             }
 
         case LIB_USB_INTERFACE_CLAIMED:
-            for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
+            for (c = 0 ; c < HCI_USB_EVENT_IN_TRANSFERS ; c++) {
                 if (event_in_transfer[c]) libusb_free_transfer(event_in_transfer[c]);
+                event_in_transfer[c] = NULL;
+            }
+            for (c = 0 ; c < HCI_USB_ACL_IN_TRANSFERS ; c++) {
                 if (acl_in_transfer[c])   libusb_free_transfer(acl_in_transfer[c]);
+                acl_in_transfer[c] = NULL;
+            }
+            for (c = 0 ; c < HCI_USB_ACL_OUT_TRANSFERS ; c++) {
+                if (acl_out_transfer[c])  libusb_free_transfer(acl_out_transfer[c]);
+                acl_out_transfer[c] = NULL;
+            }
+            acl_out_transfers_free_count = 0;
+            if (command_out_transfer) libusb_free_transfer(command_out_transfer);
+            command_out_transfer = NULL;
 #ifdef HAVE_SCO
+            for (c = 0 ; c < ASYNC_BUFFERS ; c++) {
                 if (sco_in_transfer[c])   libusb_free_transfer(sco_in_transfer[c]);
-#endif
+                sco_in_transfer[c] = NULL;
             }
-
-            // TODO free control and acl out transfers
+            if (sco_out_transfer) libusb_free_transfer(sco_out_transfer);
+            sco_out_transfer = NULL;
+#endif
 
             libusb_release_interface(handle, 0);
 
@@ -828,7 +954,6 @@ static int usb_send_cmd_packet(uint8_t *packet, int size){
     // prepare transfer
     int completed = 0;
     libusb_fill_control_transfer(command_out_transfer, handle, hci_cmd_buffer, async_callback, &completed, 0);
-    command_out_transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
 
     // update stata before submitting transfer
     usb_command_active = 1;
@@ -845,29 +970,35 @@ static int usb_send_cmd_packet(uint8_t *packet, int size){
     return 0;
 }
 
+// copies packet into an idle transfer, hci.c reuses its buffer right away
 static int usb_send_acl_packet(uint8_t *packet, int size){
     int r;
 
     if (libusb_state != LIB_USB_TRANSFERS_ALLOCATED) return -1;
 
     // log_info("usb_send_acl_packet enter, size %u", size);
+
+    if (!acl_out_transfers_free_count || size > HCI_ACL_BUFFER_SIZE){
+        log_error("usb_send_acl_packet: no transfer available or packet too big, size %u", size);
+        return -1;
+    }
     
     // prepare transfer
-    int completed = 0;
-    libusb_fill_bulk_transfer(acl_out_transfer, handle, acl_out_addr, packet, size,
-        async_callback, &completed, 0);
-    acl_out_transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
+    struct libusb_transfer * transfer = acl_out_transfers_free[--acl_out_transfers_free_count];
+    memcpy(transfer->buffer, packet, size);
+    transfer->length = size;
 
-    // update stata before submitting transfer
-    usb_acl_out_active = 1;
-
-    r = libusb_submit_transfer(acl_out_transfer);
+    r = libusb_submit_transfer(transfer);
     if (r < 0) {
-        usb_acl_out_active = 0;
+        acl_out_transfers_free[acl_out_transfers_free_count++] = transfer;
         log_error("Error submitting acl transfer, %d", r);
         return -1;
     }
 
+    usb_stats.acl_out_in_flight++;
+    if (usb_stats.acl_out_in_flight > usb_stats.acl_out_in_flight_max){
+        usb_stats.acl_out_in_flight_max = usb_stats.acl_out_in_flight;
+    }
     return 0;
 }
 
@@ -879,9 +1010,12 @@ static int usb_send_sco_packet(uint8_t *packet, int size){
 
     // log_info("usb_send_acl_packet enter, size %u", size);
     
+    if (size > (int) sizeof(hci_sco_out_buffer)) return -1;
+
     // prepare transfer
     int completed = 0;
-    libusb_fill_iso_transfer(sco_out_transfer, handle, sco_out_addr, packet, size, 1,
+    memcpy(hci_sco_out_buffer, packet, size);
+    libusb_fill_iso_transfer(sco_out_transfer, handle, sco_out_addr, hci_sco_out_buffer, size, 1,
         async_callback, &completed, 0);
     sco_out_transfer->type = LIBUSB_TRANSFER_TYPE_ISOCHRONOUS;
     sco_out_transfer->iso_packet_desc[0].length = size;
@@ -900,16 +1034,27 @@ static int usb_send_sco_packet(uint8_t *packet, int size){
 }
 
 static int usb_can_send_packet_now(uint8_t packet_type){
+    int can_send;
     switch (packet_type){
         case HCI_COMMAND_DATA_PACKET:
-            return !usb_command_active;
+            can_send = !usb_command_active;
+            break;
         case HCI_ACL_DATA_PACKET:
-            return !usb_acl_out_active;
+            can_send = acl_out_transfers_free_count > 0;
+            if (!can_send){
+                usb_stats.acl_out_blocked++;
+            }
+            break;
         case HCI_SCO_DATA_PACKET:
-            return !usb_sco_out_active;
+            can_send = !usb_sco_out_active;
+            break;
         default:
             return 0;
     }
+    if (!can_send){
+        usb_tx_blocked = 1;
+    }
+    return can_send;
 }
 
 static int usb_send_packet(uint8_t packet_type, uint8_t * packet, int size){
@@ -948,6 +1093,25 @@ hci_transport_t * hci_transport_usb_instance() {
         hci_transport_usb->get_transport_name            = usb_get_transport_name;
         hci_transport_usb->set_baudrate                  = NULL;
         hci_transport_usb->can_send_packet_now           = usb_can_send_packet_now;
+        hci_transport_usb->tx_buffered                   = 1;
     }
     return hci_transport_usb;
 }
+
+void hci_transport_usb_set_acl_out_transfers(int num_transfers){
+    if (libusb_state == LIB_USB_TRANSFERS_ALLOCATED) {
+        log_error("usb: ACL OUT transfers cannot be changed while open");
+        return;
+    }
+    if (num_transfers < 1) {
+        num_transfers = 1;
+    }
+    if (num_transfers > HCI_USB_ACL_OUT_TRANSFERS) {
+        num_transfers = HCI_USB_ACL_OUT_TRANSFERS;
+    }
+    acl_out_transfers_num = num_transfers;
+}
+
+const hci_transport_usb_stats_t * hci_transport_usb_get_stats(void){
+    return &usb_stats;
+}
@@ -47,8 +47,12 @@
 
 #include <termios.h>  /* POSIX terminal control definitions */
 #include <fcntl.h>    /* File control definitions */
+#include <errno.h>
+#include <poll.h>
 #include <unistd.h>   /* UNIX standard function definitions */
+#include <sys/uio.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <pthread.h> 
 
@@ -60,13 +64,6 @@ static int  h4_process(struct data_source *ds);
 static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size); 
 static      hci_uart_config_t *hci_uart_config;
 
-typedef enum {
-    H4_W4_PACKET_TYPE,
-    H4_W4_EVENT_HEADER,
-    H4_W4_ACL_HEADER,
-    H4_W4_PAYLOAD,
-} H4_STATE;
-
 typedef struct hci_transport_h4 {
     hci_transport_t transport;
     data_source_t *ds;
@@ -81,13 +78,28 @@ static hci_transport_h4_t * hci_transport_h4 = NULL;
 
 static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size) = dummy_handler;
 
-// packet reader state machine
-static  H4_STATE h4_state;
-static int bytes_to_read;
-static int read_pos;
+// receive buffer, filled with as much data as available per read() and parsed in place
+// must hold at least one packet type byte + HCI_PACKET_BUFFER_SIZE
+#ifndef HCI_H4_RX_BUFFER_SIZE
+#define HCI_H4_RX_BUFFER_SIZE (4 * (1 + HCI_PACKET_BUFFER_SIZE))
+#endif
+
+// packets are delivered in place, the packet handler may use HCI_INCOMING_PRE_BUFFER_SIZE bytes
+// in front of each packet, which are either reserved here or belong to already delivered packets
+static uint8_t h4_rx_buffer_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + HCI_H4_RX_BUFFER_SIZE];
+static uint8_t * h4_rx_buffer = &h4_rx_buffer_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+static int h4_rx_len;
+
+// transmit ring buffer for data that could not be written right away
+// must hold at least one packet type byte + HCI_PACKET_BUFFER_SIZE
+#ifndef HCI_H4_TX_BUFFER_SIZE
+#define HCI_H4_TX_BUFFER_SIZE (4 * (1 + HCI_PACKET_BUFFER_SIZE))
+#endif
 
-static uint8_t hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 1 + HCI_PACKET_BUFFER_SIZE]; // packet type + max(acl header + acl payload, event header + event data)
-static uint8_t * hci_packet = &hci_packet_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+static uint8_t h4_tx_buffer[HCI_H4_TX_BUFFER_SIZE];
+static int h4_tx_pos;       // start of queued data
+static int h4_tx_len;
+static int h4_tx_blocked;   // can_send_packet_now returned 0, send DAEMON_EVENT_HCI_PACKET_SENT when space is available
 
 static int    h4_open(void *transport_config){
     hci_uart_config = (hci_uart_config_t*) transport_config;
@@ -155,10 +167,11 @@ static int    h4_open(void *transport_config){
     hci_transport_h4->ds->process = h4_process;
     run_loop_add_data_source(hci_transport_h4->ds);
     
-    // init state machine
-    bytes_to_read = 1;
-    h4_state = H4_W4_PACKET_TYPE;
-    read_pos = 0;
+    // init receive and transmit buffers
+    h4_rx_len = 0;
+    h4_tx_pos = 0;
+    h4_tx_len = 0;
+    h4_tx_blocked = 0;
 
     // bring bluetooth module into defined state
     uint8_t reset[] = { 0x01, 0x03, 0x0c, 0x00};
@@ -177,6 +190,7 @@ static int h4_close(void *transport_config){
     
     // close device 
     close(hci_transport_h4->ds->fd);
+    hci_transport_h4->uart_fd = 0;
 
     // free struct
     free(hci_transport_h4->ds);
@@ -184,95 +198,219 @@ static int h4_close(void *transport_config){
     return 0;
 }
 
+static int h4_tx_free(void){
+    return HCI_H4_TX_BUFFER_SIZE - h4_tx_len;
+}
+
+static void h4_tx_enqueue(const uint8_t * data, int size){
+    int pos = (h4_tx_pos + h4_tx_len) % HCI_H4_TX_BUFFER_SIZE;
+    int bytes_to_end = HCI_H4_TX_BUFFER_SIZE - pos;
+    if (size <= bytes_to_end){
+        memcpy(&h4_tx_buffer[pos], data, size);
+    } else {
+        memcpy(&h4_tx_buffer[pos], data, bytes_to_end);
+        memcpy(h4_tx_buffer, &data[bytes_to_end], size - bytes_to_end);
+    }
+    h4_tx_len += size;
+}
+
+// write as much of the queued data as the uart accepts with a single writev()
+// @returns -1 on error
+static int h4_tx_flush(void){
+    if (!h4_tx_len) return 0;
+    struct iovec iov[2];
+    int iov_count = 1;
+    int bytes_to_end = HCI_H4_TX_BUFFER_SIZE - h4_tx_pos;
+    iov[0].iov_base = &h4_tx_buffer[h4_tx_pos];
+    iov[0].iov_len  = h4_tx_len;
+    if (h4_tx_len > bytes_to_end){
+        iov[0].iov_len  = bytes_to_end;
+        iov[1].iov_base = h4_tx_buffer;
+        iov[1].iov_len  = h4_tx_len - bytes_to_end;
+        iov_count = 2;
+    }
+    ssize_t bytes_written = writev(hci_transport_h4->uart_fd, iov, iov_count);
+    if (bytes_written < 0){
+        if (errno == EAGAIN || errno == EINTR) return 0;
+        log_error("h4_tx_flush: writev failed, errno %u", errno);
+        return -1;
+    }
+    h4_tx_pos  = (h4_tx_pos + bytes_written) % HCI_H4_TX_BUFFER_SIZE;
+    h4_tx_len -= bytes_written;
+    if (!h4_tx_len){
+        h4_tx_pos = 0;
+    }
+    return 0;
+}
+
+// only used if caller ignored can_send_packet_now
+static int h4_tx_flush_blocking(int space_needed){
+    while (h4_tx_free() < space_needed){
+        struct pollfd pfd;
+        pfd.fd = hci_transport_h4->uart_fd;
+        pfd.events = POLLOUT;
+        poll(&pfd, 1, -1);
+        if (h4_tx_flush() < 0) return -1;
+    }
+    return 0;
+}
+
+static int h4_can_send_packet_now(uint8_t packet_type){
+    if (h4_tx_free() >= 1 + HCI_PACKET_BUFFER_SIZE) return 1;
+    h4_tx_blocked = 1;
+    return 0;
+}
+
 static int h4_send_packet(uint8_t packet_type, uint8_t * packet, int size){
     if (hci_transport_h4->ds == NULL) return -1;
     if (hci_transport_h4->uart_fd == 0) return -1;
 
-    char *data = (char*) packet;
-    int bytes_written = write(hci_transport_h4->uart_fd, &packet_type, 1);
-    while (bytes_written < 1) {
-        usleep(5000);
-        bytes_written = write(hci_transport_h4->uart_fd, &packet_type, 1);
-    };
-    while (size > 0) {
-        int bytes_written = write(hci_transport_h4->uart_fd, data, size);
-        if (bytes_written < 0) {
-            usleep(5000);
-            continue;
+    // write packet type and packet with a single syscall if nothing is queued
+    ssize_t bytes_written = 0;
+    if (!h4_tx_len){
+        struct iovec iov[2];
+        iov[0].iov_base = &packet_type;
+        iov[0].iov_len  = 1;
+        iov[1].iov_base = packet;
+        iov[1].iov_len  = size;
+        bytes_written = writev(hci_transport_h4->uart_fd, iov, 2);
+        if (bytes_written < 0){
+            if (errno != EAGAIN && errno != EINTR){
+                log_error("h4_send_packet: writev failed, errno %u", errno);
+                return -1;
+            }
+            bytes_written = 0;
         }
-        data += bytes_written;
-        size -= bytes_written;
+        if (bytes_written == 1 + size) return 0;
+    }
+
+    // queue remaining data and write it when uart becomes writable
+    if (h4_tx_free() < 1 + size - bytes_written){
+        log_error("h4_send_packet: TX buffer full, blocking");
+        if (h4_tx_flush_blocking(1 + size - bytes_written) < 0) return -1;
+    }
+    if (bytes_written == 0){
+        h4_tx_enqueue(&packet_type, 1);
+        h4_tx_enqueue(packet, size);
+    } else {
+        h4_tx_enqueue(&packet[bytes_written - 1], size - (bytes_written - 1));
     }
+    run_loop_enable_data_source_callbacks(hci_transport_h4->ds, DATA_SOURCE_CALLBACK_WRITE);
     return 0;
 }
 
-static void   h4_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
-    packet_handler = handler;
+static void h4_process_write(void){
+    if (h4_tx_flush() < 0) return;
+    if (!h4_tx_len){
+        run_loop_disable_data_source_callbacks(hci_transport_h4->ds, DATA_SOURCE_CALLBACK_WRITE);
+    }
+    if (!h4_tx_blocked) return;
+    if (h4_tx_free() < 1 + HCI_PACKET_BUFFER_SIZE) return;
+    // notify stack that it can send again
+    h4_tx_blocked = 0;
+    uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0};
+    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
 }
 
-static void   h4_deliver_packet(void){
-    if (read_pos < 3) return; // sanity check
-    packet_handler(hci_packet[0], &hci_packet[1], read_pos-1);
-    
-    h4_state = H4_W4_PACKET_TYPE;
-    read_pos = 0;
-    bytes_to_read = 1;
+static void   h4_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    packet_handler = handler;
 }
 
-static void h4_statemachine(void){
-    switch (h4_state) {
-            
-        case H4_W4_PACKET_TYPE:
-            if (hci_packet[0] == HCI_EVENT_PACKET){
-                bytes_to_read = HCI_EVENT_HEADER_SIZE;
-                h4_state = H4_W4_EVENT_HEADER;
-            } else if (hci_packet[0] == HCI_ACL_DATA_PACKET){
-                bytes_to_read = HCI_ACL_HEADER_SIZE;
-                h4_state = H4_W4_ACL_HEADER;
-            } else {
-                log_error("h4_process: invalid packet type 0x%02x", hci_packet[0]);
-                read_pos = 0;
-                bytes_to_read = 1;
-            }
+// @returns size of complete packet incl. packet type, 0 if more data is needed, -1 if invalid
+static int h4_packet_size(uint8_t * data, int len){
+    int header_size;
+    switch (data[0]){
+        case HCI_EVENT_PACKET:
+            header_size = HCI_EVENT_HEADER_SIZE;
             break;
-            
-        case H4_W4_EVENT_HEADER:
-            bytes_to_read = hci_packet[2];
-            h4_state = H4_W4_PAYLOAD;
+        case HCI_ACL_DATA_PACKET:
+            header_size = HCI_ACL_HEADER_SIZE;
             break;
-            
-        case H4_W4_ACL_HEADER:
-            bytes_to_read = READ_BT_16( hci_packet, 3);
-            h4_state = H4_W4_PAYLOAD;
+        case HCI_SCO_DATA_PACKET:
+            header_size = HCI_SCO_HEADER_SIZE;
             break;
-            
-        case H4_W4_PAYLOAD:
-            h4_deliver_packet();
+        default:
+            log_error("h4_process: invalid packet type 0x%02x", data[0]);
+            return -1;
+    }
+    if (len < 1 + header_size) return 0;
+
+    int payload_size;
+    switch (data[0]){
+        case HCI_EVENT_PACKET:
+            payload_size = data[2];
+            break;
+        case HCI_ACL_DATA_PACKET:
+            payload_size = READ_BT_16(data, 3);
             break;
         default:
+            payload_size = data[3];
             break;
     }
+    if (header_size + payload_size > HCI_PACKET_BUFFER_SIZE){
+        log_error("h4_process: packet type 0x%02x with %u bytes payload too large", data[0], payload_size);
+        return -1;
+    }
+    if (len < 1 + header_size + payload_size) return 0;
+    return 1 + header_size + payload_size;
+}
+
+// deliver all complete packets and move partial packet to start of receive buffer
+static void h4_deliver_packets(void){
+    int pos = 0;
+    while (pos < h4_rx_len){
+        int size = h4_packet_size(&h4_rx_buffer[pos], h4_rx_len - pos);
+        if (size == 0) break;
+        if (size < 0){
+            // skip byte to re-sync
+            pos++;
+            continue;
+        }
+        packet_handler(h4_rx_buffer[pos], &h4_rx_buffer[pos + 1], size - 1);
+        pos += size;
+        // handle case where transport was closed by packet handler
+        if (hci_transport_h4->uart_fd == 0) {
+            h4_rx_len = 0;
+            return;
+        }
+    }
+    h4_rx_len -= pos;
+    if (pos && h4_rx_len){
+        memmove(h4_rx_buffer, &h4_rx_buffer[pos], h4_rx_len);
+    }
 }
 
 static int    h4_process(struct data_source *ds) {
     if (hci_transport_h4->uart_fd == 0) return -1;
 
-    int read_now = bytes_to_read;
-    
-    // read up to bytes_to_read data in
-    ssize_t bytes_read = read(hci_transport_h4->uart_fd, &hci_packet[read_pos], read_now);
-    // log_info("h4_process: bytes read %u", bytes_read);
-    if (bytes_read < 0) {
-        return bytes_read;
+    if (ds->ready & DATA_SOURCE_CALLBACK_WRITE){
+        h4_process_write();
+        if (hci_transport_h4->uart_fd == 0) return 0;
     }
-    
-    bytes_to_read -= bytes_read;
-    read_pos      += bytes_read;
-    if (bytes_to_read > 0) {
-        return 0;
+    if (!(ds->ready & DATA_SOURCE_CALLBACK_READ)) return 0;
+
+    // deliver all packets already received as one batch
+    hci_batch_begin();
+    ssize_t bytes_read;
+    while (1){
+        int read_now = HCI_H4_RX_BUFFER_SIZE - h4_rx_len;
+
+        // read as much as fits into receive buffer
+        bytes_read = read(hci_transport_h4->uart_fd, &h4_rx_buffer[h4_rx_len], read_now);
+        // log_info("h4_process: bytes read %u", bytes_read);
+        if (bytes_read <= 0) break;
+
+        h4_rx_len += bytes_read;
+        h4_deliver_packets();
+        if (hci_transport_h4->uart_fd == 0) break;
+
+        // uart drained if buffer wasn't filled, more data will wake us up again
+        if (bytes_read < read_now) break;
+    }
+    hci_batch_end();
+    if (bytes_read < 0 && errno != EAGAIN) {
+        return bytes_read;
     }
-    
-    h4_statemachine();
     return 0;
 }
 
@@ -294,7 +432,8 @@ hci_transport_t * hci_transport_h4_instance() {
         hci_transport_h4->transport.register_packet_handler       = h4_register_packet_handler;
         hci_transport_h4->transport.get_transport_name            = h4_get_transport_name;
         hci_transport_h4->transport.set_baudrate                  = NULL;
-        hci_transport_h4->transport.can_send_packet_now           = NULL;
+        hci_transport_h4->transport.can_send_packet_now           = h4_can_send_packet_now;
+        hci_transport_h4->transport.tx_buffered                   = 1;
     }
     return (hci_transport_t *) hci_transport_h4;
 }
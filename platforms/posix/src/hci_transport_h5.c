@@ -38,58 +38,531 @@
 /*
  *  hci_transport_h5.c
  *
- *  HCI Transport API implementation for basic H5 protocol
+ *  HCI Transport API implementation for the Three-Wire UART Transport Layer (H5) over POSIX
+ *
+ *  SLIP framed packets with link establishment, reliable delivery of HCI commands, ACL data
+ *  and events with a sliding window of up to 7 packets, retransmission and optional CRC.
  *
  *  Created by Matthias Ringwald on 4/29/09.
  */
 
+#include "btstack-config.h"
+
 #include <termios.h>  /* POSIX terminal control definitions */
 #include <fcntl.h>    /* File control definitions */
+#include <errno.h>
 #include <unistd.h>   /* UNIX standard function definitions */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <btstack/run_loop.h>
+
+#include "debug.h"
 #include "hci.h"
 #include "hci_transport.h"
 
+// number of unacknowledged reliable packets, 1..7
+#ifndef HCI_H5_WINDOW_SIZE
+#define HCI_H5_WINDOW_SIZE 4
+#endif
+
+// resend unacknowledged packets after this time
+#ifndef HCI_H5_RESEND_TIMEOUT_MS
+#define HCI_H5_RESEND_TIMEOUT_MS 250
+#endif
+
+// interval of SYNC and CONFIG messages during link establishment
+#ifndef HCI_H5_LINK_TIMEOUT_MS
+#define HCI_H5_LINK_TIMEOUT_MS 250
+#endif
+
+// encoded frames waiting for the uart, frames that don't fit are dropped and resent later
+#ifndef HCI_H5_TX_BUFFER_SIZE
+#define HCI_H5_TX_BUFFER_SIZE (8 * H5_MAX_FRAME_SIZE)
+#endif
+
+#define H5_MAX_WINDOW_SIZE 7
+#define H5_HEADER_SIZE     4
+#define H5_CRC_SIZE        2
+#define H5_MAX_FRAME_LEN   (H5_HEADER_SIZE + HCI_PACKET_BUFFER_SIZE + H5_CRC_SIZE)
+// every byte might be escaped, plus frame delimiters
+#define H5_MAX_FRAME_SIZE  (2 + 2 * H5_MAX_FRAME_LEN)
+
+// packet types besides HCI packet types
+#define H5_ACK_PACKET          0
+#define H5_LINK_CONTROL_PACKET 15
+
+// header
+#define H5_HEADER_SEQ(header)         ((header)[0] & 0x07)
+#define H5_HEADER_ACK(header)         (((header)[0] >> 3) & 0x07)
+#define H5_HEADER_CRC_PRESENT(header) ((header)[0] & 0x40)
+#define H5_HEADER_RELIABLE(header)    ((header)[0] & 0x80)
+#define H5_HEADER_TYPE(header)        ((header)[1] & 0x0f)
+#define H5_HEADER_LENGTH(header)      (((header)[1] >> 4) | ((header)[2] << 4))
+
+// configuration field of CONFIG and CONFIG RESPONSE
+#define H5_CONFIG_WINDOW_MASK    0x07
+#define H5_CONFIG_DATA_INTEGRITY 0x10
+
+// SLIP
+#define SLIP_FRAME          0xc0
+#define SLIP_ESCAPE         0xdb
+#define SLIP_ESCAPED_FRAME  0xdc
+#define SLIP_ESCAPED_ESCAPE 0xdd
+
+typedef enum {
+    H5_LINK_UNINITIALIZED,
+    H5_LINK_INITIALIZED,
+    H5_LINK_ACTIVE,
+} H5_LINK_STATE;
+
+typedef enum {
+    SLIP_W4_FRAME,
+    SLIP_IN_FRAME,
+    SLIP_IN_ESCAPE,
+} SLIP_STATE;
+
 typedef struct hci_transport_h5 {
     hci_transport_t transport;
     data_source_t *ds;
+    timer_source_t link_timer;
+    timer_source_t resend_timer;
 } hci_transport_h5_t;
 
-// h5 slip state machine
-typedef enum {
-	unknown = 1,
-	decoding,
-	x_c0,
-	x_db
-} H5_STATE;
-
-typedef struct h5_slip {
-	state_t state;
-	uint16_t length;
-	uint8_t data[HCI_ACL_BUFFER_SIZE];
-} h5_slip_t;
-
-// Global State
-static h5_slip_t read_sm;
-static h5_slip_t write_sm;
-static int bt_filedesc = 0;
+// reliable packet waiting for acknowledgement
+typedef struct {
+    uint8_t  type;
+    uint16_t size;
+    uint8_t  data[HCI_PACKET_BUFFER_SIZE];
+} h5_packet_t;
+
+static const uint8_t link_control_sync[]            = { 0x01, 0x7e };
+static const uint8_t link_control_sync_response[]   = { 0x02, 0x7d };
+static const uint8_t link_control_config[]          = { 0x03, 0xfc };
+static const uint8_t link_control_config_response[] = { 0x04, 0x7b };
+static const uint8_t link_control_wakeup[]          = { 0x05, 0xfa };
+static const uint8_t link_control_woken[]           = { 0x06, 0xf9 };
+
+// CRC-CCITT as used by BCSP and H5, processed by nibbles
+static const uint16_t h5_crc_table[] = {
+    0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+    0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f,
+};
 
 // single instance
 static hci_transport_h5_t * hci_transport_h5 = NULL;
 
 static int  h5_process(struct data_source *ds);
-static void dummy_handler(uint8_t packet_type, uint8_t *packet, int size); 
+static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size); 
 static      hci_uart_config_t *hci_uart_config;
 
-static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, int size) = dummy_handler;
+static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size) = dummy_handler;
+
+// SLIP tables: escape code for encoder, non-zero for bytes that end a plain run in decoder
+static uint8_t slip_escape_table[256];
+
+// configuration
+static int h5_window_size_config = HCI_H5_WINDOW_SIZE;
+static int h5_crc_config = 1;
+
+// link
+static H5_LINK_STATE h5_link_state;
+static int h5_window_size;
+static int h5_crc_used;
+
+// receiver
+static SLIP_STATE h5_slip_state;
+static uint8_t h5_rx_frame_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + H5_MAX_FRAME_LEN];
+static uint8_t * h5_rx_frame = &h5_rx_frame_with_pre_buffer[HCI_INCOMING_PRE_BUFFER_SIZE];
+static int h5_rx_frame_len;
+static uint8_t h5_rx_buffer[1024];
+static uint8_t h5_rx_next_seq;
+static int h5_ack_pending;
+
+// reliable packets, oldest unacknowledged first
+static h5_packet_t h5_tx_packets[H5_MAX_WINDOW_SIZE];
+static int h5_tx_first;
+static int h5_tx_count;     // queued packets
+static int h5_tx_sent;      // queued packets that have been sent at least once
+static uint8_t h5_tx_first_seq;
+static int h5_tx_blocked;   // can_send_packet_now returned 0, send DAEMON_EVENT_HCI_PACKET_SENT when space is available
+
+// encoded frames
+static uint8_t h5_tx_buffer[HCI_H5_TX_BUFFER_SIZE];
+static int h5_tx_buffer_pos;
+static int h5_tx_buffer_len;
+
+static void h5_slip_init_tables(void){
+    memset(slip_escape_table, 0, sizeof(slip_escape_table));
+    slip_escape_table[SLIP_FRAME]  = SLIP_ESCAPED_FRAME;
+    slip_escape_table[SLIP_ESCAPE] = SLIP_ESCAPED_ESCAPE;
+}
+
+static uint16_t h5_crc_update(uint16_t crc, const uint8_t * data, int size){
+    int i;
+    for (i = 0; i < size; i++){
+        crc = (crc >> 4) ^ h5_crc_table[(crc ^ data[i]) & 0x0f];
+        crc = (crc >> 4) ^ h5_crc_table[(crc ^ (data[i] >> 4)) & 0x0f];
+    }
+    return crc;
+}
+
+// CRC is sent bit-reversed, most significant byte first
+static uint16_t h5_crc_finalize(uint16_t crc){
+    uint16_t result = 0;
+    int i;
+    for (i = 0; i < 16; i++){
+        result = (result << 1) | (crc & 1);
+        crc >>= 1;
+    }
+    return result;
+}
+
+// @returns size of encoded data
+static int h5_slip_encode(uint8_t * buffer, const uint8_t * data, int size){
+    int pos = 0;
+    int i;
+    for (i = 0; i < size; i++){
+        uint8_t escaped = slip_escape_table[data[i]];
+        if (escaped){
+            buffer[pos++] = SLIP_ESCAPE;
+            buffer[pos++] = escaped;
+        } else {
+            buffer[pos++] = data[i];
+        }
+    }
+    return pos;
+}
+
+static int h5_tx_buffer_flush(void){
+    if (!h5_tx_buffer_len) return 0;
+    ssize_t bytes_written = write(hci_transport_h5->ds->fd, &h5_tx_buffer[h5_tx_buffer_pos], h5_tx_buffer_len);
+    if (bytes_written < 0){
+        if (errno == EAGAIN || errno == EINTR) return 0;
+        log_error("h5_tx_buffer_flush: write failed, errno %u", errno);
+        return -1;
+    }
+    h5_tx_buffer_pos += bytes_written;
+    h5_tx_buffer_len -= bytes_written;
+    if (!h5_tx_buffer_len){
+        h5_tx_buffer_pos = 0;
+        run_loop_disable_data_source_callbacks(hci_transport_h5->ds, DATA_SOURCE_CALLBACK_WRITE);
+    } else {
+        run_loop_enable_data_source_callbacks(hci_transport_h5->ds, DATA_SOURCE_CALLBACK_WRITE);
+    }
+    return 0;
+}
+
+// encode and write frame, every frame carries the current acknowledgement number
+static void h5_send_frame(uint8_t type, int reliable, uint8_t seq, const uint8_t * payload, uint16_t size){
+    uint8_t header[H5_HEADER_SIZE];
+    header[0] = seq | (h5_rx_next_seq << 3) | (h5_crc_used ? 0x40 : 0) | (reliable ? 0x80 : 0);
+    header[1] = type | ((size & 0x0f) << 4);
+    header[2] = size >> 4;
+    header[3] = ~(header[0] + header[1] + header[2]);
+    h5_ack_pending = 0;
+
+    // make room at end of buffer
+    if (HCI_H5_TX_BUFFER_SIZE - h5_tx_buffer_pos - h5_tx_buffer_len < H5_MAX_FRAME_SIZE && h5_tx_buffer_pos){
+        memmove(h5_tx_buffer, &h5_tx_buffer[h5_tx_buffer_pos], h5_tx_buffer_len);
+        h5_tx_buffer_pos = 0;
+    }
+    if (HCI_H5_TX_BUFFER_SIZE - h5_tx_buffer_len < 2 + 2 * (H5_HEADER_SIZE + size + H5_CRC_SIZE)){
+        // reliable packets are resent, others are lost as on a noisy line
+        log_info("h5_send_frame: uart congested, drop frame type %u", type);
+        return;
+    }
+
+    uint8_t * buffer = &h5_tx_buffer[h5_tx_buffer_pos + h5_tx_buffer_len];
+    int pos = 0;
+    buffer[pos++] = SLIP_FRAME;
+    pos += h5_slip_encode(&buffer[pos], header, H5_HEADER_SIZE);
+    pos += h5_slip_encode(&buffer[pos], payload, size);
+    if (h5_crc_used){
+        uint16_t crc = h5_crc_update(0xffff, header, H5_HEADER_SIZE);
+        crc = h5_crc_finalize(h5_crc_update(crc, payload, size));
+        uint8_t crc_bytes[2];
+        net_store_16(crc_bytes, 0, crc);
+        pos += h5_slip_encode(&buffer[pos], crc_bytes, H5_CRC_SIZE);
+    }
+    buffer[pos++] = SLIP_FRAME;
+    h5_tx_buffer_len += pos;
+
+    // write now if nothing else is waiting
+    if (h5_tx_buffer_len == pos){
+        h5_tx_buffer_flush();
+    }
+}
+
+static void h5_send_link_control(const uint8_t * message, int size){
+    h5_send_frame(H5_LINK_CONTROL_PACKET, 0, 0, message, size);
+}
+
+static void h5_send_config(const uint8_t * message){
+    uint8_t config[3];
+    memcpy(config, message, 2);
+    config[2] = h5_window_size_config | (h5_crc_config ? H5_CONFIG_DATA_INTEGRITY : 0);
+    h5_send_link_control(config, sizeof(config));
+}
+
+static void h5_resend_timer_start(void){
+    run_loop_remove_timer(&hci_transport_h5->resend_timer);
+    run_loop_set_timer(&hci_transport_h5->resend_timer, HCI_H5_RESEND_TIMEOUT_MS);
+    run_loop_add_timer(&hci_transport_h5->resend_timer);
+}
+
+// send queued packets that fit into the window
+static void h5_tx_run(void){
+    if (h5_link_state != H5_LINK_ACTIVE) return;
+    int sent = 0;
+    while (h5_tx_sent < h5_tx_count && h5_tx_sent < h5_window_size){
+        h5_packet_t * packet = &h5_tx_packets[(h5_tx_first + h5_tx_sent) % H5_MAX_WINDOW_SIZE];
+        h5_send_frame(packet->type, 1, (h5_tx_first_seq + h5_tx_sent) & 0x07, packet->data, packet->size);
+        h5_tx_sent++;
+        sent = 1;
+    }
+    if (sent){
+        h5_resend_timer_start();
+    }
+}
+
+static void h5_resend_timeout_handler(timer_source_t * timer){
+    if (!h5_tx_sent) return;
+    log_info("h5: resend %u packets", h5_tx_sent);
+    // go back to oldest unacknowledged packet
+    h5_tx_sent = 0;
+    h5_tx_run();
+}
+
+static int h5_tx_space_available(void){
+    return h5_link_state == H5_LINK_ACTIVE && h5_tx_count < h5_window_size;
+}
+
+static void h5_notify_can_send(void){
+    if (!h5_tx_blocked) return;
+    if (!h5_tx_space_available()) return;
+    h5_tx_blocked = 0;
+    uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0};
+    packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+}
+
+// release packets acknowledged by peer
+static void h5_process_ack(uint8_t ack){
+    int num_acked = (ack - h5_tx_first_seq) & 0x07;
+    if (!num_acked) return;
+    if (num_acked > h5_tx_sent){
+        log_error("h5: invalid ack %u, first unacked seq %u, sent %u", ack, h5_tx_first_seq, h5_tx_sent);
+        return;
+    }
+    h5_tx_first      = (h5_tx_first + num_acked) % H5_MAX_WINDOW_SIZE;
+    h5_tx_first_seq  = ack;
+    h5_tx_count     -= num_acked;
+    h5_tx_sent      -= num_acked;
+    if (h5_tx_sent){
+        h5_resend_timer_start();
+    } else {
+        run_loop_remove_timer(&hci_transport_h5->resend_timer);
+    }
+}
+
+static void h5_link_timer_start(void){
+    run_loop_remove_timer(&hci_transport_h5->link_timer);
+    run_loop_set_timer(&hci_transport_h5->link_timer, HCI_H5_LINK_TIMEOUT_MS);
+    run_loop_add_timer(&hci_transport_h5->link_timer);
+}
+
+static void h5_link_timeout_handler(timer_source_t * timer){
+    switch (h5_link_state){
+        case H5_LINK_UNINITIALIZED:
+            h5_send_link_control(link_control_sync, sizeof(link_control_sync));
+            break;
+        case H5_LINK_INITIALIZED:
+            h5_send_config(link_control_config);
+            break;
+        default:
+            return;
+    }
+    h5_link_timer_start();
+}
+
+static void h5_link_reset(void){
+    h5_link_state   = H5_LINK_UNINITIALIZED;
+    h5_window_size  = 1;
+    h5_crc_used     = 0;
+    h5_slip_state   = SLIP_W4_FRAME;
+    h5_rx_frame_len = 0;
+    h5_rx_next_seq  = 0;
+    h5_ack_pending  = 0;
+    h5_tx_first     = 0;
+    h5_tx_count     = 0;
+    h5_tx_sent      = 0;
+    h5_tx_first_seq = 0;
+    run_loop_remove_timer(&hci_transport_h5->resend_timer);
+    h5_link_timeout_handler(&hci_transport_h5->link_timer);
+}
+
+static void h5_link_control_received(const uint8_t * payload, uint16_t size){
+    if (size < 2) return;
+    if (memcmp(payload, link_control_sync, 2) == 0){
+        if (h5_link_state == H5_LINK_ACTIVE){
+            // peer was reset, upper stack has to reset as well
+            log_error("h5: SYNC in active state, peer reset");
+            h5_link_reset();
+            uint8_t event[] = { HCI_EVENT_HARDWARE_ERROR, 1, 0};
+            packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
+            return;
+        }
+        h5_send_link_control(link_control_sync_response, sizeof(link_control_sync_response));
+        return;
+    }
+    if (memcmp(payload, link_control_sync_response, 2) == 0){
+        if (h5_link_state != H5_LINK_UNINITIALIZED) return;
+        h5_link_state = H5_LINK_INITIALIZED;
+        h5_link_timeout_handler(&hci_transport_h5->link_timer);
+        return;
+    }
+    if (memcmp(payload, link_control_config, 2) == 0){
+        if (h5_link_state == H5_LINK_UNINITIALIZED) return;
+        h5_send_config(link_control_config_response);
+        return;
+    }
+    if (memcmp(payload, link_control_config_response, 2) == 0){
+        if (h5_link_state != H5_LINK_INITIALIZED) return;
+        // peer without configuration field uses window size 1 and no CRC
+        uint8_t config = size > 2 ? payload[2] : 1;
+        h5_window_size = config & H5_CONFIG_WINDOW_MASK;
+        if (h5_window_size > h5_window_size_config){
+            h5_window_size = h5_window_size_config;
+        }
+        if (!h5_window_size){
+            h5_window_size = 1;
+        }
+        h5_crc_used = h5_crc_config && (config & H5_CONFIG_DATA_INTEGRITY);
+        h5_link_state = H5_LINK_ACTIVE;
+        run_loop_remove_timer(&hci_transport_h5->link_timer);
+        log_info("h5: link active, window size %u, crc %u", h5_window_size, h5_crc_used);
+        h5_tx_blocked = 1;
+        h5_notify_can_send();
+        return;
+    }
+    if (memcmp(payload, link_control_wakeup, 2) == 0){
+        h5_send_link_control(link_control_woken, sizeof(link_control_woken));
+        return;
+    }
+}
+
+static void h5_frame_received(void){
+    uint8_t * header = h5_rx_frame;
+    if (h5_rx_frame_len < H5_HEADER_SIZE) return;
+    if (((header[0] + header[1] + header[2] + header[3]) & 0xff) != 0xff){
+        log_error("h5: header checksum error");
+        return;
+    }
+    uint16_t size = H5_HEADER_LENGTH(header);
+    int crc_size = H5_HEADER_CRC_PRESENT(header) ? H5_CRC_SIZE : 0;
+    if (h5_rx_frame_len != H5_HEADER_SIZE + size + crc_size){
+        log_error("h5: frame length %u doesn't match payload length %u", h5_rx_frame_len, size);
+        return;
+    }
+    uint8_t * payload = &h5_rx_frame[H5_HEADER_SIZE];
+    if (crc_size){
+        uint16_t crc = h5_crc_finalize(h5_crc_update(0xffff, h5_rx_frame, H5_HEADER_SIZE + size));
+        if (crc != READ_NET_16(payload, size)){
+            log_error("h5: CRC error");
+            return;
+        }
+    }
+
+    uint8_t type = H5_HEADER_TYPE(header);
+    if (type == H5_LINK_CONTROL_PACKET){
+        h5_link_control_received(payload, size);
+        return;
+    }
+    if (h5_link_state != H5_LINK_ACTIVE) return;
+
+    h5_process_ack(H5_HEADER_ACK(header));
+
+    if (H5_HEADER_RELIABLE(header)){
+        // acknowledge in any case, duplicates are caused by lost acknowledgements
+        h5_ack_pending = 1;
+        if (H5_HEADER_SEQ(header) != h5_rx_next_seq) return;
+        h5_rx_next_seq = (h5_rx_next_seq + 1) & 0x07;
+    }
+
+    switch (type){
+        case HCI_EVENT_PACKET:
+        case HCI_ACL_DATA_PACKET:
+        case HCI_SCO_DATA_PACKET:
+            packet_handler(type, payload, size);
+            break;
+        default:
+            break;
+    }
+}
+
+// decode SLIP data, plain runs are copied at once
+static void h5_slip_decode(const uint8_t * data, int size){
+    int pos = 0;
+    while (pos < size){
+        switch (h5_slip_state){
+            case SLIP_W4_FRAME: {
+                const uint8_t * frame = (const uint8_t *) memchr(&data[pos], SLIP_FRAME, size - pos);
+                if (!frame) return;
+                pos = frame - data + 1;
+                h5_slip_state = SLIP_IN_FRAME;
+                h5_rx_frame_len = 0;
+                break;
+            }
+            case SLIP_IN_ESCAPE: {
+                uint8_t input = data[pos++];
+                h5_slip_state = SLIP_IN_FRAME;
+                if (h5_rx_frame_len == H5_MAX_FRAME_LEN){
+                    log_error("h5: frame too long");
+                    h5_slip_state = SLIP_W4_FRAME;
+                } else if (input == SLIP_ESCAPED_FRAME){
+                    h5_rx_frame[h5_rx_frame_len++] = SLIP_FRAME;
+                } else if (input == SLIP_ESCAPED_ESCAPE){
+                    h5_rx_frame[h5_rx_frame_len++] = SLIP_ESCAPE;
+                } else {
+                    log_error("h5: invalid escape sequence");
+                    h5_slip_state = SLIP_W4_FRAME;
+                }
+                break;
+            }
+            case SLIP_IN_FRAME: {
+                int start = pos;
+                while (pos < size && !slip_escape_table[data[pos]]) pos++;
+                int run = pos - start;
+                if (h5_rx_frame_len + run > H5_MAX_FRAME_LEN){
+                    log_error("h5: frame too long");
+                    h5_slip_state = SLIP_W4_FRAME;
+                    break;
+                }
+                memcpy(&h5_rx_frame[h5_rx_frame_len], &data[start], run);
+                h5_rx_frame_len += run;
+                if (pos == size) break;
+                if (data[pos++] == SLIP_ESCAPE){
+                    h5_slip_state = SLIP_IN_ESCAPE;
+                    break;
+                }
+                // end of frame, which is also start of next frame
+                if (h5_rx_frame_len){
+                    h5_frame_received();
+                    h5_rx_frame_len = 0;
+                }
+                // handle case where transport was closed by packet handler
+                if (hci_transport_h5->ds == NULL) return;
+                break;
+            }
+        }
+    }
+}
 
-// prototypes
 static int    h5_open(void *transport_config){
     hci_uart_config = (hci_uart_config_t*) transport_config;
     struct termios toptions;
-    int fd = open(hci_uart_config->device_name, O_RDWR | O_NOCTTY | O_NDELAY);
+    int fd = open(hci_uart_config->device_name, O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (fd == -1)  {
         perror("init_serialport: Unable to open port ");
         perror(hci_uart_config->device_name);
@@ -100,8 +573,8 @@ static int    h5_open(void *transport_config){
         perror("init_serialport: Couldn't get term attributes");
         return -1;
     }
-    speed_t brate = hci_uart_config->baudrate; // let you override switch below if needed
-    switch(hci_uart_config->baudrate) {
+    speed_t brate = hci_uart_config->baudrate_init; // let you override switch below if needed
+    switch(hci_uart_config->baudrate_init) {
         case 57600:  brate=B57600;  break;
         case 115200: brate=B115200; break;
 #ifdef B230400
@@ -116,11 +589,10 @@ static int    h5_open(void *transport_config){
     }
     cfsetispeed(&toptions, brate);
     cfsetospeed(&toptions, brate);
-    
-    // 8N1
-    toptions.c_cflag &= ~PARENB;
+    cfmakeraw(&toptions);   // make raw
+
+    // 8N1 - the spec recommends even parity, which can be set up by the chipset specific init
     toptions.c_cflag &= ~CSTOPB;
-    toptions.c_cflag &= ~CSIZE;
     toptions.c_cflag |= CS8;
 
     if (hci_uart_config->flowcontrol) {
@@ -134,9 +606,6 @@ static int    h5_open(void *transport_config){
     toptions.c_cflag |= CREAD | CLOCAL;  // turn on READ & ignore ctrl lines
     toptions.c_iflag &= ~(IXON | IXOFF | IXANY); // turn off s/w flow ctrl
     
-    toptions.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG); // make raw
-    toptions.c_oflag &= ~OPOST; // make raw
-    
     // see: http://unixwiz.net/techtips/termios-vmin-vtime.html
     toptions.c_cc[VMIN]  = 1;
     toptions.c_cc[VTIME] = 0;
@@ -147,19 +616,28 @@ static int    h5_open(void *transport_config){
     }
     
     // set up data_source
-    hci_transport_h5->ds = malloc(sizeof(data_source_t));
-    if (!hci_transport_h5) return -1;
+    hci_transport_h5->ds = (data_source_t*) malloc(sizeof(data_source_t));
+    if (!hci_transport_h5->ds) return -1;
     hci_transport_h5->ds->fd = fd;
     hci_transport_h5->ds->process = h5_process;
     run_loop_add_data_source(hci_transport_h5->ds);
     
-    // init state machine
-	h5_slip_init( &read_sm);
-	h5_slip_init( &write_sm);
+    run_loop_set_timer_handler(&hci_transport_h5->link_timer, h5_link_timeout_handler);
+    run_loop_set_timer_handler(&hci_transport_h5->resend_timer, h5_resend_timeout_handler);
+
+    // start link establishment
+    h5_slip_init_tables();
+    h5_tx_buffer_pos = 0;
+    h5_tx_buffer_len = 0;
+    h5_tx_blocked = 0;
+    h5_link_reset();
     return 0;
 }
 
-static int    h5_close(){
+static int    h5_close(void *transport_config){
+    run_loop_remove_timer(&hci_transport_h5->link_timer);
+    run_loop_remove_timer(&hci_transport_h5->resend_timer);
+
     // first remove run loop handler
 	run_loop_remove_data_source(hci_transport_h5->ds);
     
@@ -172,138 +650,104 @@ static int    h5_close(){
     return 0;
 }
 
+static int h5_can_send_packet_now(uint8_t packet_type){
+    // unreliable SCO packets don't use the window
+    if (packet_type == HCI_SCO_DATA_PACKET) return h5_link_state == H5_LINK_ACTIVE;
+    if (h5_tx_space_available()) return 1;
+    h5_tx_blocked = 1;
+    return 0;
+}
+
 static int    h5_send_packet(uint8_t packet_type, uint8_t *packet, int size){
     if (hci_transport_h5->ds == NULL) return -1;
-    if (hci_transport_h5->ds->fd == 0) return -1;
-    char *data = (char*) packet;
-    
-    write(hci_transport_h5->ds->fd, &packet_type, 1);
-    while (size > 0) {
-        int bytes_written = write(hci_transport_h5->ds->fd, data, size);
-        if (bytes_written < 0) {
-            usleep(5000);
-            continue;
-        }
-        data += bytes_written;
-        size -= bytes_written;
+    if (h5_link_state != H5_LINK_ACTIVE) {
+        log_error("h5_send_packet: link not active");
+        return -1;
+    }
+    if (packet_type == HCI_SCO_DATA_PACKET){
+        h5_send_frame(packet_type, 0, 0, packet, size);
+        return 0;
+    }
+    if (h5_tx_count == H5_MAX_WINDOW_SIZE || size > HCI_PACKET_BUFFER_SIZE){
+        log_error("h5_send_packet: cannot queue packet type %u, size %u", packet_type, size);
+        return -1;
     }
+    h5_packet_t * queued = &h5_tx_packets[(h5_tx_first + h5_tx_count) % H5_MAX_WINDOW_SIZE];
+    queued->type = packet_type;
+    queued->size = size;
+    memcpy(queued->data, packet, size);
+    h5_tx_count++;
+    h5_tx_run();
     return 0;
 }
 
-static void   h5_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, int size)){
+static void   h5_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
     packet_handler = handler;
 }
 
-static void h5_slip_init( h5_slip_t * sm){
-	sm->state = unknown;
-}
+static int    h5_process(struct data_source *ds) {
+    if (hci_transport_h5->ds == NULL) return -1;
 
-static void h5_slip_process( h5_slip_t * sm, uint8_t input, uint8_t in){
-	uint8_t type;
-	switch (sm->state) {
-		case unknown:
-			if (input == 0xc0){
-				sm->length = 0;
-				sm->state  = x_c0;
-			}
-			break;
-		case x_c0:
-			switch (input ){
-				case 0xc0:
-					break;
-				case 0xdb:
-					sm->state = x_db;
-					break;
-				default:
-					sm->data[sm->length] = input;
-					++sm->length;
-					sm->state   = decoding;
-					break;
-			}
-			break;
-		case decoding:
-			switch (input ){
-				case 0xc0:
-					sm->state = unknown;
-					// packet done - check if valid HCI packet
-					if (sm->length < 6) break;
-					type = sm->data[1] & 0x0f;
-					if (type < 1 || type > 4) break;
-					switch (type) {
-						case HCI_ACL_DATA_PACKET:
-							acl_packet_handler( &sm->data[4], sm->length-4-2);
-							break;
-						case HCI_EVENT_PACKET:
-							event_packet_handler( &sm->data[4], sm->length-4-2);
-							break;
-						default:
-							break;
-					}
-					break;
-				case 0xdb:
-					sm->state = x_db;
-					break;
-				default:
-					sm->data[sm->length] = input;
-					++sm->length;
-					break;
-			}
-			break;
-		case x_db:
-			switch (input) {
-				case 0xdc:
-					sm->data[sm->length] = 0xc0;
-					++sm->length;
-					sm->state = decoding;
-					break;
-				case 0xdd:
-					sm->data[sm->length] = 0xdb;
-					++sm->length;
-					sm->state = decoding;
-					break;
-				default:
-					sm->state = unknown;
-					break;
-			}
-			break;
-		default:
-			break;
-	}
-}
+    if (ds->ready & DATA_SOURCE_CALLBACK_WRITE){
+        if (h5_tx_buffer_flush() < 0) return -1;
+    }
+    if (!(ds->ready & DATA_SOURCE_CALLBACK_READ)) return 0;
 
+    // deliver all packets already received as one batch
+    hci_batch_begin();
+    ssize_t bytes_read;
+    while (1) {
+        bytes_read = read(ds->fd, h5_rx_buffer, sizeof(h5_rx_buffer));
+        if (bytes_read <= 0) break;
+        h5_slip_decode(h5_rx_buffer, bytes_read);
+        if (hci_transport_h5->ds == NULL) break;
+        if (bytes_read < (ssize_t) sizeof(h5_rx_buffer)) break;
+    };
+    hci_batch_end();
+    if (hci_transport_h5->ds == NULL) return 0;
 
-static int    h5_process(struct data_source *ds) {
-    if (hci_transport_h5->ds->fd == 0) return -1;
-
-    // read up to bytes_to_read data in
-	uint8_t data;
-	while (1) {
-		int bytes_read = read(hci_transport_h5->ds->fd, &data, 1);
-		if (bytes_read < 1) break;
-		h5_slip_process( &read_sm, data, 1);
-	};
+    // acknowledge received packets, if not done by a packet sent meanwhile
+    if (h5_ack_pending){
+        h5_send_frame(H5_ACK_PACKET, 0, 0, NULL, 0);
+    }
+    h5_notify_can_send();
+    if (bytes_read < 0 && errno != EAGAIN) {
+        return bytes_read;
+    }
     return 0;
 }
 
-static const char * h5_get_transport_name(){
+static const char * h5_get_transport_name(void){
     return "H5";
 }
 
-static void dummy_handler(uint8_t *packet, int size){
+static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+}
+
+void hci_transport_h5_set_window_size(int window_size){
+    if (window_size < 1) window_size = 1;
+    if (window_size > H5_MAX_WINDOW_SIZE) window_size = H5_MAX_WINDOW_SIZE;
+    h5_window_size_config = window_size;
+}
+
+void hci_transport_h5_enable_crc(int enable){
+    h5_crc_config = enable;
 }
 
 // get h5 singleton
 hci_transport_t * hci_transport_h5_instance() {
     if (hci_transport_h5 == NULL) {
-        hci_transport_h5 = malloc( sizeof(hci_transport_h5_t));
+        hci_transport_h5 = (hci_transport_h5_t*) malloc( sizeof(hci_transport_h5_t));
+        memset(hci_transport_h5, 0, sizeof(hci_transport_h5_t));
         hci_transport_h5->ds                                      = NULL;
         hci_transport_h5->transport.open                          = h5_open;
         hci_transport_h5->transport.close                         = h5_close;
         hci_transport_h5->transport.send_packet                   = h5_send_packet;
-        hci_transport_h5->transport.register_packet_handler       = h5_register_event_packet_handler;
+        hci_transport_h5->transport.register_packet_handler       = h5_register_packet_handler;
         hci_transport_h5->transport.get_transport_name            = h5_get_transport_name;
         hci_transport_h5->transport.set_baudrate                  = NULL;
-        hci_transport_h5->transport.can_send_packet_now           = NULL;
+        hci_transport_h5->transport.can_send_packet_now           = h5_can_send_packet_now;
+        hci_transport_h5->transport.tx_buffered                   = 1;
     }
     return (hci_transport_t *) hci_transport_h5;
 }
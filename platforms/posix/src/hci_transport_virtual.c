@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_transport_virtual.c
+ *
+ *  HCI Transport API implementation for a virtual controller over POSIX
+ *
+ *  The controller model in virtual_controller.c runs inside this process. Controllers of
+ *  different processes exchange air messages as datagrams over Unix domain sockets, one
+ *  socket per controller named after its BD_ADDR in a shared directory. Bandwidth, latency
+ *  and controller buffers are simulated by the model, no Bluetooth hardware is needed.
+ */
+
+#include "btstack-config.h"
+
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/utils.h>
+
+#include "debug.h"
+#include "hci.h"
+#include "hci_transport.h"
+#include "virtual_controller.h"
+
+#ifndef HCI_TRANSPORT_VIRTUAL_AIR_PATH
+#define HCI_TRANSPORT_VIRTUAL_AIR_PATH "/tmp/btstack-air"
+#endif
+
+static int  virtual_process(struct data_source *ds);
+static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size);
+
+typedef struct hci_transport_virtual {
+    hci_transport_t transport;
+    data_source_t *ds;
+    timer_source_t timer;
+} hci_transport_virtual_t;
+
+// single instance
+static hci_transport_virtual_t * hci_transport_virtual = NULL;
+
+static  void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size) = dummy_handler;
+
+static virtual_controller_t virtual_controller;
+static const char * virtual_air_path = HCI_TRANSPORT_VIRTUAL_AIR_PATH;
+static struct sockaddr_un virtual_local_addr;
+static uint8_t virtual_rx_buffer[VIRTUAL_AIR_MAX_SIZE];
+
+static uint32_t virtual_now_us(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// @returns -1 if path of socket doesn't fit into sun_path
+static int virtual_socket_addr(struct sockaddr_un * addr, const char * name){
+    size_t dir_len  = strlen(virtual_air_path);
+    size_t name_len = strlen(name);
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (dir_len + 1 + name_len >= sizeof(addr->sun_path)) return -1;
+    memcpy(addr->sun_path, virtual_air_path, dir_len);
+    addr->sun_path[dir_len] = '/';
+    memcpy(&addr->sun_path[dir_len + 1], name, name_len);
+    return 0;
+}
+
+// run model again when it has work
+static void virtual_schedule(void){
+    run_loop_remove_timer(&hci_transport_virtual->timer);
+    uint32_t now_us = virtual_now_us();
+    uint32_t when_us;
+    if (!virtual_controller_next_event(&virtual_controller, now_us, &when_us)) return;
+    run_loop_set_timer(&hci_transport_virtual->timer, (when_us - now_us + 999) / 1000);
+    run_loop_add_timer(&hci_transport_virtual->timer);
+}
+
+static void virtual_timeout_handler(timer_source_t * timer){
+    hci_batch_begin();
+    virtual_controller_process(&virtual_controller, virtual_now_us());
+    hci_batch_end();
+    if (hci_transport_virtual->ds == NULL) return;
+    virtual_schedule();
+}
+
+static void virtual_host_handler(virtual_controller_t * controller, uint8_t packet_type, uint8_t * packet, uint16_t size){
+    packet_handler(packet_type, packet, size);
+}
+
+// @returns 1 if receiver queue is full and message should be sent again later
+static int virtual_send_to(const struct sockaddr_un * addr, uint8_t * message, uint16_t size){
+    if (sendto(hci_transport_virtual->ds->fd, message, size, 0, (const struct sockaddr *) addr, sizeof(struct sockaddr_un)) >= 0) return 0;
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) return 1;
+    // receiver gone, message lost
+    return 0;
+}
+
+static int virtual_air_handler(virtual_controller_t * controller, const uint8_t * destination, uint8_t * message, uint16_t size){
+    struct sockaddr_un addr;
+    if (destination){
+        if (virtual_socket_addr(&addr, bd_addr_to_str((uint8_t *) destination)) < 0) return 0;
+        return virtual_send_to(&addr, message, size);
+    }
+    // broadcasts are lost if a receiver is busy
+    DIR * dir = opendir(virtual_air_path);
+    if (!dir) return 0;
+    struct dirent * entry;
+    while ((entry = readdir(dir)) != NULL){
+        if (entry->d_name[0] == '.') continue;
+        if (virtual_socket_addr(&addr, entry->d_name) < 0) continue;
+        if (strcmp(addr.sun_path, virtual_local_addr.sun_path) == 0) continue;
+        virtual_send_to(&addr, message, size);
+    }
+    closedir(dir);
+    return 0;
+}
+
+static int virtual_open(void *transport_config){
+    virtual_controller_config_t * config = (virtual_controller_config_t *) transport_config;
+    if (!config) {
+        log_error("virtual_open: no controller config");
+        return -1;
+    }
+    if (virtual_socket_addr(&virtual_local_addr, bd_addr_to_str(config->bd_addr)) < 0) {
+        log_error("virtual_open: air path %s too long", virtual_air_path);
+        return -1;
+    }
+    mkdir(virtual_air_path, 0700);
+    unlink(virtual_local_addr.sun_path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("virtual_open: socket");
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *) &virtual_local_addr, sizeof(virtual_local_addr)) < 0) {
+        perror("virtual_open: bind");
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    // set up data_source
+    hci_transport_virtual->ds = (data_source_t*) malloc(sizeof(data_source_t));
+    if (!hci_transport_virtual->ds) {
+        close(fd);
+        unlink(virtual_local_addr.sun_path);
+        return -1;
+    }
+    hci_transport_virtual->ds->fd = fd;
+    hci_transport_virtual->ds->process = virtual_process;
+    run_loop_add_data_source(hci_transport_virtual->ds);
+    run_loop_set_timer_handler(&hci_transport_virtual->timer, virtual_timeout_handler);
+
+    virtual_controller_init(&virtual_controller, config, virtual_host_handler, virtual_air_handler, NULL);
+    return 0;
+}
+
+static int virtual_close(void *transport_config){
+    if (hci_transport_virtual->ds == NULL) return 0;
+    run_loop_remove_timer(&hci_transport_virtual->timer);
+    virtual_controller_close(&virtual_controller);
+
+    // first remove run loop handler
+    run_loop_remove_data_source(hci_transport_virtual->ds);
+
+    // close socket
+    close(hci_transport_virtual->ds->fd);
+    unlink(virtual_local_addr.sun_path);
+    free(hci_transport_virtual->ds);
+    hci_transport_virtual->ds = NULL;
+    return 0;
+}
+
+static int virtual_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (hci_transport_virtual->ds == NULL) return -1;
+    // responses are delivered from the run loop, not from within send_packet
+    virtual_controller_send_packet(&virtual_controller, virtual_now_us(), packet_type, packet, size);
+    virtual_schedule();
+    return 0;
+}
+
+static void virtual_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    packet_handler = handler;
+}
+
+static int virtual_process(struct data_source *ds) {
+    if (hci_transport_virtual->ds == NULL) return -1;
+
+    while (1){
+        ssize_t bytes_read = recv(ds->fd, virtual_rx_buffer, sizeof(virtual_rx_buffer), 0);
+        if (bytes_read < 0) break;
+        virtual_controller_receive(&virtual_controller, virtual_now_us(), virtual_rx_buffer, bytes_read);
+    }
+    virtual_timeout_handler(&hci_transport_virtual->timer);
+    return 0;
+}
+
+static const char * virtual_get_transport_name(void){
+    return "virtual";
+}
+
+static void dummy_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+}
+
+// directory with sockets of all virtual controllers, used for next open
+void hci_transport_virtual_set_air_path(const char * path){
+    virtual_air_path = path;
+}
+
+// get virtual singleton
+hci_transport_t * hci_transport_virtual_instance() {
+    if (hci_transport_virtual == NULL) {
+        hci_transport_virtual = (hci_transport_virtual_t*)malloc( sizeof(hci_transport_virtual_t));
+        memset(hci_transport_virtual, 0, sizeof(hci_transport_virtual_t));
+        hci_transport_virtual->ds                                      = NULL;
+        hci_transport_virtual->transport.open                          = virtual_open;
+        hci_transport_virtual->transport.close                         = virtual_close;
+        hci_transport_virtual->transport.send_packet                   = virtual_send_packet;
+        hci_transport_virtual->transport.register_packet_handler       = virtual_register_packet_handler;
+        hci_transport_virtual->transport.get_transport_name            = virtual_get_transport_name;
+        hci_transport_virtual->transport.set_baudrate                  = NULL;
+        hci_transport_virtual->transport.can_send_packet_now           = NULL;
+        hci_transport_virtual->transport.tx_buffered                   = 0;
+    }
+    return (hci_transport_t *) hci_transport_virtual;
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  run_loop_epoll.c
+ *
+ *  Linux run loop based on epoll. Data sources are registered with the kernel
+ *  once when they are added, so the cost of a run loop iteration does not
+ *  depend on the number of watched file descriptors as with select().
+ */
+
+#include <btstack/run_loop.h>
+#include <btstack/linked_list.h>
+
+#include "debug.h"
+#include "run_loop_private.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/time.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// max number of ready events collected by a single epoll_wait call
+#define EPOLL_MAX_EVENTS 16
+
+static int epoll_timeval_compare(struct timeval *a, struct timeval *b);
+
+// the run loop
+static int epoll_fd = -1;
+static linked_list_t data_sources;
+static timer_queue_t timers;
+
+// eventfd to wake up epoll_wait for callbacks requested by other threads
+static data_source_t wakeup_data_source;
+
+// ready events of the current iteration, entries are cleared when a data source gets removed
+static struct epoll_event ready_events[EPOLL_MAX_EVENTS];
+static int num_ready_events;
+
+/**
+ * Add data_source to run_loop
+ */
+static void epoll_add_data_source(data_source_t *ds){
+    ds->callbacks = DATA_SOURCE_CALLBACK_READ;
+    linked_list_add(&data_sources, (linked_item_t *) ds);
+    if (ds->fd < 0) return;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events   = EPOLLIN;
+    event.data.ptr = ds;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ds->fd, &event) < 0){
+        log_error("epoll_add_data_source: epoll_ctl add fd %u failed, errno %u", ds->fd, errno);
+    }
+}
+
+/**
+ * Update events of data source after callbacks have been enabled or disabled
+ */
+static void epoll_update_data_source(data_source_t *ds){
+    if (ds->fd < 0) return;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    if (ds->callbacks & DATA_SOURCE_CALLBACK_READ){
+        event.events |= EPOLLIN;
+    }
+    if (ds->callbacks & DATA_SOURCE_CALLBACK_WRITE){
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = ds;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, ds->fd, &event) < 0){
+        log_error("epoll_update_data_source: epoll_ctl mod fd %u failed, errno %u", ds->fd, errno);
+    }
+}
+
+/**
+ * Remove data_source from run loop
+ */
+static int epoll_remove_data_source(data_source_t *ds){
+    int i;
+    // don't process data source if it's part of the current batch
+    for (i = 0; i < num_ready_events; i++){
+        if (ready_events[i].data.ptr == ds){
+            ready_events[i].data.ptr = NULL;
+        }
+    }
+    int err = linked_list_remove(&data_sources, (linked_item_t *) ds);
+    if (!err && ds->fd >= 0){
+        // fd might have been closed already, which removes it from the epoll set implicitly
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, ds->fd, NULL);
+    }
+    return err;
+}
+
+/**
+ * Add timer to run_loop
+ */
+static void epoll_add_timer(timer_source_t *ts){
+    timer_queue_add(&timers, ts);
+}
+
+/**
+ * Remove timer from run loop
+ */
+static int epoll_remove_timer(timer_source_t *ts){
+    return timer_queue_remove(&timers, ts);
+}
+
+static void epoll_dump_timer(void){
+    timer_queue_dump(&timers);
+}
+
+// get current time from monotonic clock, not affected by changes of the wall clock
+// pre: 0 <= tv_usec < 1000000
+static void epoll_get_time(struct timeval * tv){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    tv->tv_sec  = now.tv_sec;
+    tv->tv_usec = now.tv_nsec / 1000;
+}
+
+static uint32_t epoll_get_time_ms(void){
+    struct timeval tv;
+    epoll_get_time(&tv);
+    return (uint32_t) (tv.tv_sec * 1000 + tv.tv_usec / 1000);
+}
+
+// get timeout for epoll_wait in ms, -1 for infinite
+static int epoll_next_timeout_ms(void){
+    timer_source_t * ts = timer_queue_first(&timers);
+    if (!ts) return -1;
+    struct timeval current_tv;
+    epoll_get_time(&current_tv);
+    long delta_sec  = ts->timeout.tv_sec  - current_tv.tv_sec;
+    long delta_usec = ts->timeout.tv_usec - current_tv.tv_usec;
+    long delta_ms   = delta_sec * 1000 + delta_usec / 1000;
+    // round up to not wake up just before the timer expires
+    if (delta_usec % 1000 > 0) delta_ms++;
+    if (delta_ms < 0) return 0;
+    if (delta_ms > 0x7fffffff) return 0x7fffffff;
+    return (int) delta_ms;
+}
+
+/**
+ * Execute run_loop
+ */
+static void epoll_execute(void) {
+    timer_source_t *ts;
+    struct timeval current_tv;
+    int i;
+    
+    while (1) {
+        // wait for ready FDs
+        num_ready_events = epoll_wait(epoll_fd, ready_events, EPOLL_MAX_EVENTS, epoll_next_timeout_ms());
+        if (num_ready_events < 0){
+            if (errno != EINTR){
+                log_error("epoll_execute: epoll_wait failed, errno %u", errno);
+            }
+            num_ready_events = 0;
+        }
+        run_loop_iteration_start();
+        
+        // process data sources, removed data sources are cleared from the batch
+        for (i = 0; i < num_ready_events; i++){
+            data_source_t *ds = (data_source_t *) ready_events[i].data.ptr;
+            if (!ds) continue;
+            // errors and hang-up are reported as readable, the following read() will fail
+            ds->ready = 0;
+            if (ready_events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+                ds->ready |= DATA_SOURCE_CALLBACK_READ;
+            }
+            if (ready_events[i].events & EPOLLOUT){
+                ds->ready |= DATA_SOURCE_CALLBACK_WRITE;
+            }
+            run_loop_process_data_source(ds);
+        }
+        num_ready_events = 0;
+        
+        // process timers
+        // time is only read once, timers that expired by then are processed as one batch
+        epoll_get_time(&current_tv);
+        while ((ts = timer_queue_first(&timers)) != NULL) {
+            if (epoll_timeval_compare(&ts->timeout, &current_tv) > 0) break;
+            // remove timer before processing it to allow handler to re-register with run loop
+            run_loop_remove_timer(ts);
+            run_loop_process_timer(ts);
+        }
+        run_loop_iteration_end();
+    }
+}
+
+// set timer
+static void epoll_set_timer(timer_source_t *a, uint32_t timeout_in_ms){
+    epoll_get_time(&a->timeout);
+    a->timeout.tv_sec  +=  timeout_in_ms / 1000;
+    a->timeout.tv_usec += (timeout_in_ms % 1000) * 1000;
+    if (a->timeout.tv_usec  >= 1000000) {
+        a->timeout.tv_usec -= 1000000;
+        a->timeout.tv_sec++;
+    }
+}
+
+// pre: 0 <= tv_usec < 1000000
+static int epoll_timeval_compare(struct timeval *a, struct timeval *b){
+    if (a->tv_sec < b->tv_sec) {
+        return -1;
+    }
+    if (a->tv_sec > b->tv_sec) {
+        return 1;
+    }
+    if (a->tv_usec < b->tv_usec) {
+        return -1;
+    }
+    if (a->tv_usec > b->tv_usec) {
+        return 1;
+    }
+    return 0;
+}
+
+static int epoll_wakeup_process(data_source_t *ds){
+    // reset eventfd before taking requested callbacks, a request after this will signal again
+    uint64_t value;
+    if (read(ds->fd, &value, sizeof(value)) < 0){
+        // not signalled
+    }
+    run_loop_callbacks_process();
+    return 0;
+}
+
+static void epoll_execute_on_main_thread(run_loop_callback_t *callback){
+    if (!run_loop_callbacks_add(callback)) return;
+    uint64_t value = 1;
+    if (write(wakeup_data_source.fd, &value, sizeof(value)) < 0){
+        log_error("epoll_execute_on_main_thread: eventfd write failed, errno %u", errno);
+    }
+}
+
+static void epoll_init(void){
+    data_sources = NULL;
+    timer_queue_init(&timers);
+    num_ready_events = 0;
+    epoll_fd = epoll_create(EPOLL_MAX_EVENTS);
+    if (epoll_fd < 0){
+        log_error("epoll_init: epoll_create failed, errno %u", errno);
+        exit(10);
+    }
+    wakeup_data_source.fd = eventfd(0, EFD_NONBLOCK);
+    if (wakeup_data_source.fd < 0){
+        log_error("epoll_init: eventfd failed, errno %u", errno);
+        return;
+    }
+    wakeup_data_source.process = &epoll_wakeup_process;
+    epoll_add_data_source(&wakeup_data_source);
+}
+
+run_loop_t run_loop_epoll = {
+    &epoll_init,
+    &epoll_add_data_source,
+    &epoll_remove_data_source,
+    &epoll_set_timer,
+    &epoll_add_timer,
+    &epoll_remove_timer,
+    &epoll_execute,
+    &epoll_dump_timer,
+    &epoll_get_time_ms,
+    &epoll_execute_on_main_thread,
+    &epoll_update_data_source,
+};
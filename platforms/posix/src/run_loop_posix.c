@@ -51,25 +51,31 @@
 #include "Winsock2.h"
 #else
 #include <sys/select.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include <stdlib.h>
 #include <stdio.h>
-
-static void posix_dump_timer(void);
-static int posix_timeval_compare(struct timeval *a, struct timeval *b);
-static int posix_timer_compare(timer_source_t *a, timer_source_t *b);
+#include <time.h>
 
 // the run loop
 static linked_list_t data_sources;
 static int data_sources_modified;
-static linked_list_t timers;
+static timer_queue_t timers;
+
+#ifndef _WIN32
+// self-pipe to wake up select() for callbacks requested by other threads
+static int wakeup_pipe[2];
+static data_source_t wakeup_data_source;
+#endif
 
 /**
  * Add data_source to run_loop
  */
 static void posix_add_data_source(data_source_t *ds){
     data_sources_modified = 1;
+    ds->callbacks = DATA_SOURCE_CALLBACK_READ;
     // log_info("posix_add_data_source %x with fd %u\n", (int) ds, ds->fd);
     linked_list_add(&data_sources, (linked_item_t *) ds);
 }
@@ -84,21 +90,10 @@ static int posix_remove_data_source(data_source_t *ds){
 }
 
 /**
- * Add timer to run_loop (keep list sorted)
+ * Add timer to run_loop
  */
 static void posix_add_timer(timer_source_t *ts){
-    linked_item_t *it;
-    for (it = (linked_item_t *) &timers; it->next ; it = it->next){
-        if ((timer_source_t *) it->next == ts){
-            log_error( "run_loop_timer_add error: timer to add already in list!");
-            return;
-        }
-        if (posix_timer_compare( (timer_source_t *) it->next, ts) > 0) {
-            break;
-        }
-    }
-    ts->item.next = it->next;
-    it->next = (linked_item_t *) ts;
+    timer_queue_add(&timers, ts);
     // log_info("Added timer %x at %u\n", (int) ts, (unsigned int) ts->timeout.tv_sec);
     // posix_dump_timer();
 }
@@ -109,16 +104,30 @@ static void posix_add_timer(timer_source_t *ts){
 static int posix_remove_timer(timer_source_t *ts){
     // log_info("Removed timer %x at %u\n", (int) ts, (unsigned int) ts->timeout.tv_sec);
     // posix_dump_timer();
-    return linked_list_remove(&timers, (linked_item_t *) ts);
+    return timer_queue_remove(&timers, ts);
 }
 
 static void posix_dump_timer(void){
-    linked_item_t *it;
-    int i = 0;
-    for (it = (linked_item_t *) timers; it ; it = it->next){
-        timer_source_t *ts = (timer_source_t*) it;
-        log_info("timer %u, timeout %u\n", i, (unsigned int) ts->timeout.tv_sec);
-    }
+    timer_queue_dump(&timers);
+}
+
+// get current time from monotonic clock if available, so that timers are not affected by changes of the wall clock
+// pre: 0 <= tv_usec < 1000000
+static void posix_get_time(struct timeval * tv){
+#ifdef CLOCK_MONOTONIC
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    tv->tv_sec  = now.tv_sec;
+    tv->tv_usec = now.tv_nsec / 1000;
+#else
+    gettimeofday(tv, NULL);
+#endif
+}
+
+static uint32_t posix_get_time_ms(void){
+    struct timeval tv;
+    posix_get_time(&tv);
+    return (uint32_t) (tv.tv_sec * 1000 + tv.tv_usec / 1000);
 }
 
 /**
@@ -126,6 +135,7 @@ static void posix_dump_timer(void){
  */
 static void posix_execute(void) {
     fd_set descriptors;
+    fd_set write_descriptors;
     
     timer_source_t       *ts;
     struct timeval current_tv;
@@ -136,12 +146,18 @@ static void posix_execute(void) {
     while (1) {
         // collect FDs
         FD_ZERO(&descriptors);
+        FD_ZERO(&write_descriptors);
         int highest_fd = 0;
         linked_list_iterator_init(&it, &data_sources);
         while (linked_list_iterator_has_next(&it)){
             data_source_t *ds = (data_source_t*) linked_list_iterator_next(&it);
             if (ds->fd >= 0) {
-                FD_SET(ds->fd, &descriptors);
+                if (ds->callbacks & DATA_SOURCE_CALLBACK_READ){
+                    FD_SET(ds->fd, &descriptors);
+                }
+                if (ds->callbacks & DATA_SOURCE_CALLBACK_WRITE){
+                    FD_SET(ds->fd, &write_descriptors);
+                }
                 if (ds->fd > highest_fd) {
                     highest_fd = ds->fd;
                 }
@@ -151,9 +167,9 @@ static void posix_execute(void) {
         // get next timeout
         // pre: 0 <= tv_usec < 1000000
         timeout = NULL;
-        if (timers) {
-            gettimeofday(&current_tv, NULL);
-            ts = (timer_source_t *) timers;
+        ts = timer_queue_first(&timers);
+        if (ts) {
+            posix_get_time(&current_tv);
             next_tv.tv_usec = ts->timeout.tv_usec - current_tv.tv_usec;
             next_tv.tv_sec  = ts->timeout.tv_sec  - current_tv.tv_sec;
             while (next_tv.tv_usec < 0){
@@ -168,7 +184,8 @@ static void posix_execute(void) {
         }
                 
         // wait for ready FDs
-        select( highest_fd+1 , &descriptors, NULL, NULL, timeout);
+        select( highest_fd+1 , &descriptors, &write_descriptors, NULL, timeout);
+        run_loop_iteration_start();
         
         // process data sources very carefully
         // bt_control.close() triggered from a client can remove a different data source
@@ -179,77 +196,85 @@ static void posix_execute(void) {
         while (linked_list_iterator_has_next(&it) && !data_sources_modified){
             data_source_t *ds = (data_source_t*) linked_list_iterator_next(&it);
             // log_info("posix_execute: check %x with fd %u\n", (int) ds, ds->fd);
+            if (ds->fd < 0) continue;
+            ds->ready = 0;
             if (FD_ISSET(ds->fd, &descriptors)) {
+                ds->ready |= DATA_SOURCE_CALLBACK_READ;
+            }
+            if (FD_ISSET(ds->fd, &write_descriptors)) {
+                ds->ready |= DATA_SOURCE_CALLBACK_WRITE;
+            }
+            if (ds->ready) {
                 // log_info("posix_execute: process %x with fd %u\n", (int) ds, ds->fd);
-                ds->process(ds);
+                run_loop_process_data_source(ds);
             }
         }
         // log_info("posix_execute: after ds check\n");
         
         // process timers
+        // time is only read once, timers that expired by then are processed as one batch
         // pre: 0 <= tv_usec < 1000000
-        while (timers) {
-            gettimeofday(&current_tv, NULL);
-            ts = (timer_source_t *) timers;
+        posix_get_time(&current_tv);
+        while ((ts = timer_queue_first(&timers)) != NULL) {
             if (ts->timeout.tv_sec  > current_tv.tv_sec) break;
             if (ts->timeout.tv_sec == current_tv.tv_sec && ts->timeout.tv_usec > current_tv.tv_usec) break;
             // log_info("posix_execute: process times %x\n", (int) ts);
             
             // remove timer before processing it to allow handler to re-register with run loop
             run_loop_remove_timer(ts);
-            ts->process(ts);
+            run_loop_process_timer(ts);
         }
+        run_loop_iteration_end();
     }
 }
 
 // set timer
 static void posix_set_timer(timer_source_t *a, uint32_t timeout_in_ms){
-    gettimeofday(&a->timeout, NULL);
+    posix_get_time(&a->timeout);
     a->timeout.tv_sec  +=  timeout_in_ms / 1000;
     a->timeout.tv_usec += (timeout_in_ms % 1000) * 1000;
-    if (a->timeout.tv_usec  > 1000000) {
+    if (a->timeout.tv_usec >= 1000000) {
         a->timeout.tv_usec -= 1000000;
         a->timeout.tv_sec++;
     }
 }
 
-// compare timers - NULL is assumed to be before the Big Bang
-// pre: 0 <= tv_usec < 1000000
-static int posix_timeval_compare(struct timeval *a, struct timeval *b){
-    if (!a && !b) return 0;
-    if (!a) return -1;
-    if (!b) return 1;
-    
-    if (a->tv_sec < b->tv_sec) {
-        return -1;
-    }
-    if (a->tv_sec > b->tv_sec) {
-        return 1;
-    }
-    
-    if (a->tv_usec < b->tv_usec) {
-        return -1;
-    }
-    if (a->tv_usec > b->tv_usec) {
-        return 1;
-    }
-    
+#ifndef _WIN32
+static int posix_wakeup_process(data_source_t *ds){
+    // drain pipe before taking requested callbacks, a request after this will write again
+    uint8_t buffer[16];
+    while (read(ds->fd, buffer, sizeof(buffer)) > 0);
+    run_loop_callbacks_process();
     return 0;
-    
 }
+#endif
 
-// compare timers - NULL is assumed to be before the Big Bang
-// pre: 0 <= tv_usec < 1000000
-static int posix_timer_compare(timer_source_t *a, timer_source_t *b){
-    if (!a && !b) return 0;
-    if (!a) return -1;
-    if (!b) return 1;
-    return posix_timeval_compare(&a->timeout, &b->timeout);
+static void posix_execute_on_main_thread(run_loop_callback_t *callback){
+#ifdef _WIN32
+    log_error("posix_execute_on_main_thread not supported");
+#else
+    if (!run_loop_callbacks_add(callback)) return;
+    uint8_t wakeup = 0;
+    if (write(wakeup_pipe[1], &wakeup, 1) < 0){
+        // pipe full: run loop has not processed previous wakeup yet
+    }
+#endif
 }
 
 static void posix_init(void){
     data_sources = NULL;
-    timers = NULL;
+    timer_queue_init(&timers);
+#ifndef _WIN32
+    if (pipe(wakeup_pipe) < 0){
+        log_error("posix_init: cannot create wakeup pipe");
+        return;
+    }
+    fcntl(wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+    wakeup_data_source.fd = wakeup_pipe[0];
+    wakeup_data_source.process = &posix_wakeup_process;
+    posix_add_data_source(&wakeup_data_source);
+#endif
 }
 
 run_loop_t run_loop_posix = {
@@ -261,4 +286,7 @@ run_loop_t run_loop_posix = {
     &posix_remove_timer,
     &posix_execute,
     &posix_dump_timer,
+    &posix_get_time_ms,
+    &posix_execute_on_main_thread,
+    NULL,   // enabled callbacks are collected in every iteration
 };
@@ -0,0 +1,2002 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  virtual_controller.c
+ *
+ *  Software model of a Bluetooth controller, see virtual_controller.h
+ *
+ *  Packets from the host are processed immediately, all resulting events are queued with a
+ *  due time and handed to the host from virtual_controller_process only. ACL data occupies the
+ *  link for size / bandwidth, Number Of Completed Packets is reported when the transmission
+ *  is done and the peer receives the data after the configured latency. Air messages of one
+ *  connection are delivered in order.
+ */
+
+#include "btstack-config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "debug.h"
+#include "hci.h"
+#include "virtual_controller.h"
+
+// Num_HCI_Command_Packets reported in Command Complete and Command Status
+#ifndef VIRTUAL_CONTROLLER_NUM_CMD_PACKETS
+#define VIRTUAL_CONTROLLER_NUM_CMD_PACKETS 1
+#endif
+
+// delay before retrying an air message that could not be sent
+#define VIRTUAL_AIR_RETRY_US 1000
+
+// packet type of queued Number Of Completed Packets, event is created on delivery
+#define VIRTUAL_PACKET_COMPLETED 0xff
+
+#define VIRTUAL_HANDLE_NONE 0xffff
+
+// connection states
+#define VIRTUAL_CONNECTION_FREE            0
+#define VIRTUAL_CONNECTION_PAGING          1    // outgoing, waiting for remote host
+#define VIRTUAL_CONNECTION_W4_ACCEPT       2    // incoming, waiting for local host
+#define VIRTUAL_CONNECTION_OPEN            3
+#define VIRTUAL_CONNECTION_DISCONNECTING   4    // Disconnection Complete queued
+
+// link types, also stored in air message header
+#define VIRTUAL_LINK_NONE 0
+#define VIRTUAL_LINK_ACL  1
+#define VIRTUAL_LINK_SCO  2
+#define VIRTUAL_LINK_LE   3
+
+// authentication states
+#define VIRTUAL_AUTH_IDLE                          0
+#define VIRTUAL_AUTH_W4_LINK_KEY_REPLY             1
+#define VIRTUAL_AUTH_W4_PEER_AUTH_RESULT           2
+#define VIRTUAL_AUTH_W4_IO_CAPABILITY_REPLY        3
+#define VIRTUAL_AUTH_W4_PEER_IO_CAPABILITY         4
+#define VIRTUAL_AUTH_W4_USER_CONFIRMATION          5
+#define VIRTUAL_AUTH_W4_PIN_REPLY                  6
+#define VIRTUAL_AUTH_W4_PEER_PIN_RESULT            7
+#define VIRTUAL_AUTH_W4_LTK_REPLY                  8
+#define VIRTUAL_AUTH_W4_PEER_LE_ENCRYPTION         9
+
+#define VIRTUAL_AUTH_FLAG_INITIATOR       0x01
+#define VIRTUAL_AUTH_FLAG_SSP             0x02
+#define VIRTUAL_AUTH_FLAG_LOCAL_CONFIRMED 0x04
+#define VIRTUAL_AUTH_FLAG_PEER_CONFIRMED  0x08
+#define VIRTUAL_AUTH_FLAG_LINK_KEY_VALID  0x10
+
+// air messages: type, link type, source and destination address, payload
+#define AIR_INQUIRY                    0x01
+#define AIR_INQUIRY_RESPONSE           0x02     // class of device, extended inquiry response
+#define AIR_NAME_REQUEST               0x03
+#define AIR_NAME_RESPONSE              0x04     // name
+#define AIR_CONNECTION_REQUEST         0x05     // class of device, features
+#define AIR_CONNECTION_ACCEPT          0x06     // features
+#define AIR_CONNECTION_REJECT          0x07     // reason
+#define AIR_DISCONNECT                 0x08     // reason
+#define AIR_ACL_DATA                   0x09     // ACL packet
+#define AIR_SCO_DATA                   0x0a     // SCO packet
+#define AIR_AUTH_KEY                   0x0b     // link key of initiator
+#define AIR_AUTH_RESULT                0x0c     // status
+#define AIR_IO_CAPABILITY_REQUEST      0x0d     // io capability, oob data present, authentication requirements
+#define AIR_IO_CAPABILITY_RESPONSE     0x0e     // io capability, oob data present, authentication requirements
+#define AIR_USER_CONFIRMATION          0x0f     // link key from initiator
+#define AIR_PIN                        0x10     // pin length, pin
+#define AIR_PIN_RESULT                 0x11     // link key
+#define AIR_PAIRING_FAILED             0x12     // status
+#define AIR_ENCRYPTION                 0x13     // enable
+#define AIR_ENCRYPTION_RESULT          0x14     // enable
+#define AIR_LE_ADVERTISEMENT           0x15     // type, address type, address, direct address type, direct address, data, scan response
+#define AIR_LE_CONNECT                 0x16     // address type, address, interval, latency, timeout, advertiser address type, advertiser address
+#define AIR_LE_CONNECTION_UPDATE       0x17     // interval, latency, timeout
+#define AIR_LE_ENCRYPTION_REQUEST      0x18     // random, ediv, ltk
+#define AIR_LE_ENCRYPTION_RESULT       0x19     // status
+
+#define AIR_TYPE(message)      ((message)[0])
+#define AIR_LINK_TYPE(message) ((message)[1])
+#define AIR_SOURCE(message)    (&(message)[2])
+#define AIR_PAYLOAD(message)   (&(message)[VIRTUAL_AIR_HEADER_SIZE])
+
+// IO Capability NoInputNoOutput
+#define IO_CAPABILITY_NO_INPUT_NO_OUTPUT 3
+
+// advertising event types, also used in advertising reports
+#define LE_ADV_IND          0
+#define LE_ADV_DIRECT_IND   1
+#define LE_ADV_SCAN_IND     2
+#define LE_ADV_NONCONN_IND  3
+#define LE_SCAN_RSP         4
+
+static const bd_addr_t broadcast_addr = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+// written when no memory for an event is available
+static uint8_t discard_buffer[HCI_EVENT_BUFFER_SIZE];
+
+static int virtual_before(uint32_t a, uint32_t b){
+    return (int32_t) (a - b) < 0;
+}
+
+static uint32_t virtual_later(uint32_t a, uint32_t b){
+    return virtual_before(a, b) ? b : a;
+}
+
+static uint32_t virtual_transmission_us(uint32_t size, uint32_t bytes_per_second){
+    if (!bytes_per_second) return 0;
+    return (uint32_t) (((uint64_t) size * 1000000 + bytes_per_second - 1) / bytes_per_second);
+}
+
+// xorshift, seeded with BD ADDR to get reproducible runs
+static uint32_t virtual_random(virtual_controller_t * vc){
+    uint32_t x = vc->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    vc->random = x;
+    return x;
+}
+
+static void virtual_random_bytes(virtual_controller_t * vc, uint8_t * buffer, int len){
+    int i;
+    for (i = 0; i < len; i++){
+        buffer[i] = virtual_random(vc) >> 24;
+    }
+}
+
+// AES-128 for LE Encrypt, big endian key, plaintext and ciphertext as in FIPS-197
+static const uint8_t aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static uint8_t aes_xtime(uint8_t x){
+    return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static void virtual_aes128(const uint8_t * key, const uint8_t * plaintext, uint8_t * ciphertext){
+    uint8_t round_key[16];
+    uint8_t state[16];
+    uint8_t tmp[16];
+    uint8_t rcon = 1;
+    int i, round;
+
+    memcpy(round_key, key, 16);
+    for (i = 0; i < 16; i++){
+        state[i] = plaintext[i] ^ round_key[i];
+    }
+    for (round = 1; round <= 10; round++){
+        // SubBytes and ShiftRows, state is stored column by column
+        for (i = 0; i < 16; i++){
+            int row    = i & 3;
+            int column = i >> 2;
+            tmp[i] = aes_sbox[state[((column + row) & 3) * 4 + row]];
+        }
+        // MixColumns, skipped in last round
+        if (round < 10){
+            for (i = 0; i < 16; i += 4){
+                uint8_t a0 = tmp[i], a1 = tmp[i+1], a2 = tmp[i+2], a3 = tmp[i+3];
+                uint8_t all = a0 ^ a1 ^ a2 ^ a3;
+                tmp[i]   ^= all ^ aes_xtime(a0 ^ a1);
+                tmp[i+1] ^= all ^ aes_xtime(a1 ^ a2);
+                tmp[i+2] ^= all ^ aes_xtime(a2 ^ a3);
+                tmp[i+3] ^= all ^ aes_xtime(a3 ^ a0);
+            }
+        }
+        // next round key
+        round_key[0] ^= aes_sbox[round_key[13]] ^ rcon;
+        round_key[1] ^= aes_sbox[round_key[14]];
+        round_key[2] ^= aes_sbox[round_key[15]];
+        round_key[3] ^= aes_sbox[round_key[12]];
+        for (i = 4; i < 16; i++){
+            round_key[i] ^= round_key[i - 4];
+        }
+        rcon = aes_xtime(rcon);
+        // AddRoundKey
+        for (i = 0; i < 16; i++){
+            state[i] = tmp[i] ^ round_key[i];
+        }
+    }
+    memcpy(ciphertext, state, 16);
+}
+
+static void virtual_local_features(virtual_controller_t * vc, uint8_t * features){
+    memset(features, 0, 8);
+    if (vc->config.classic){
+        features[0] = 0xff;     // 3 and 5 slot packets, encryption, ...
+        features[1] = 0xff;     // SCO, HV2/HV3, ...
+        features[2] = 0x0f;
+        features[3] = 0x86;     // EDR 2 and 3 Mbps, eSCO
+        features[4] = 0x80;     // 3 slot EDR
+        features[5] = 0x01;     // 5 slot EDR
+    } else {
+        features[4] |= 0x20;    // BR/EDR not supported
+    }
+    if (vc->config.le){
+        features[4] |= 0x40;    // LE supported
+    }
+    if (vc->config.ssp){
+        features[6] |= 0x08;    // Secure Simple Pairing
+    }
+}
+
+//
+// queues
+//
+
+// insert packet after all packets with the same or earlier due time
+static void virtual_queue_insert(linked_list_t * queue, virtual_packet_t * packet){
+    linked_item_t * it;
+    for (it = (linked_item_t *) queue; it->next; it = it->next){
+        virtual_packet_t * next = (virtual_packet_t *) it->next;
+        if (virtual_before(packet->due_us, next->due_us)) break;
+    }
+    packet->item.next = it->next;
+    it->next = (linked_item_t *) packet;
+}
+
+static virtual_packet_t * virtual_packet_create(uint32_t due_us, uint8_t type, hci_con_handle_t handle, uint16_t size){
+    virtual_packet_t * packet = (virtual_packet_t *) malloc(sizeof(virtual_packet_t) + size);
+    if (!packet) {
+        log_error("virtual_controller: no memory for packet of size %u", size);
+        return NULL;
+    }
+    memset(packet, 0, sizeof(virtual_packet_t));
+    packet->due_us = due_us;
+    packet->type   = type;
+    packet->handle = handle;
+    packet->size   = size;
+    packet->data   = (uint8_t *) (packet + 1);
+    return packet;
+}
+
+static void virtual_queue_free(linked_list_t * queue){
+    while (*queue){
+        linked_item_t * item = *queue;
+        linked_list_remove(queue, item);
+        free(item);
+    }
+}
+
+// @returns buffer for packet, never NULL
+static uint8_t * virtual_host_packet(virtual_controller_t * vc, uint32_t due_us, uint8_t type, hci_con_handle_t handle, uint16_t size){
+    virtual_packet_t * packet = virtual_packet_create(due_us, type, handle, size);
+    if (!packet) return discard_buffer;
+    virtual_queue_insert(&vc->host_queue, packet);
+    return packet->data;
+}
+
+// @returns event with zeroed parameters
+static uint8_t * virtual_event(virtual_controller_t * vc, uint32_t due_us, uint8_t event_code, uint8_t param_len){
+    uint8_t * event = virtual_host_packet(vc, due_us, HCI_EVENT_PACKET, VIRTUAL_HANDLE_NONE, 2 + param_len);
+    memset(event, 0, 2 + param_len);
+    event[0] = event_code;
+    event[1] = param_len;
+    return event;
+}
+
+static uint8_t * virtual_le_event(virtual_controller_t * vc, uint32_t due_us, uint8_t subevent_code, uint8_t param_len){
+    uint8_t * event = virtual_event(vc, due_us, HCI_EVENT_LE_META, 1 + param_len);
+    event[2] = subevent_code;
+    return event;
+}
+
+// @returns return parameters, status is 0
+static uint8_t * virtual_command_complete(virtual_controller_t * vc, uint32_t now_us, uint16_t opcode, uint8_t return_len){
+    uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_COMMAND_COMPLETE, 3 + return_len);
+    event[2] = VIRTUAL_CONTROLLER_NUM_CMD_PACKETS;
+    bt_store_16(event, 3, opcode);
+    return &event[5];
+}
+
+static void virtual_command_complete_status(virtual_controller_t * vc, uint32_t now_us, uint16_t opcode, uint8_t status){
+    uint8_t * result = virtual_command_complete(vc, now_us, opcode, 1);
+    result[0] = status;
+}
+
+// for link key, pin code, io capability and user confirmation replies
+static void virtual_command_complete_addr(virtual_controller_t * vc, uint32_t now_us, uint16_t opcode, uint8_t status, bd_addr_t addr){
+    uint8_t * result = virtual_command_complete(vc, now_us, opcode, 7);
+    result[0] = status;
+    bt_flip_addr(&result[1], addr);
+}
+
+static void virtual_command_status(virtual_controller_t * vc, uint32_t now_us, uint16_t opcode, uint8_t status){
+    uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_COMMAND_STATUS, 4);
+    event[2] = status;
+    event[3] = VIRTUAL_CONTROLLER_NUM_CMD_PACKETS;
+    bt_store_16(event, 4, opcode);
+}
+
+//
+// air
+//
+
+// @returns last queued message for connection, messages of a connection are sent in order
+static virtual_packet_t * virtual_air_last_queued(virtual_controller_t * vc, virtual_connection_t * conn){
+    virtual_packet_t * last = NULL;
+    linked_item_t * it;
+    for (it = (linked_item_t *) vc->air_queue; it; it = it->next){
+        virtual_packet_t * packet = (virtual_packet_t *) it;
+        if (BD_ADDR_CMP(packet->destination, conn->peer)) continue;
+        if (AIR_LINK_TYPE(packet->data) != conn->link_type) continue;
+        last = packet;
+    }
+    return last;
+}
+
+// queue air message, messages of a connection stay in order
+// @returns due time of message
+static uint32_t virtual_air_send(virtual_controller_t * vc, uint32_t due_us, virtual_connection_t * conn, uint8_t type, uint8_t link_type,
+    const uint8_t * destination, const uint8_t * payload, uint16_t payload_len){
+
+    hci_con_handle_t handle = VIRTUAL_HANDLE_NONE;
+    due_us += vc->config.latency_us;
+    if (conn){
+        virtual_packet_t * last = virtual_air_last_queued(vc, conn);
+        if (last){
+            due_us = virtual_later(due_us, last->due_us);
+        }
+        // data is dropped when connection is closed
+        if (type == AIR_ACL_DATA || type == AIR_SCO_DATA){
+            handle = conn->handle;
+        }
+    }
+    virtual_packet_t * packet = virtual_packet_create(due_us, type, handle, VIRTUAL_AIR_HEADER_SIZE + payload_len);
+    if (!packet) return due_us;
+    packet->data[0] = type;
+    packet->data[1] = link_type;
+    BD_ADDR_COPY(&packet->data[2], vc->config.bd_addr);
+    BD_ADDR_COPY(&packet->data[8], destination ? destination : broadcast_addr);
+    BD_ADDR_COPY(packet->destination, destination ? destination : broadcast_addr);
+    if (payload_len){
+        memcpy(&packet->data[VIRTUAL_AIR_HEADER_SIZE], payload, payload_len);
+    }
+    virtual_queue_insert(&vc->air_queue, packet);
+    return due_us;
+}
+
+static uint32_t virtual_air_send_connection(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn, uint8_t type,
+    const uint8_t * payload, uint16_t payload_len){
+    return virtual_air_send(vc, now_us, conn, type, conn->link_type, conn->peer, payload, payload_len);
+}
+
+static uint32_t virtual_air_send_status(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn, uint8_t type, uint8_t status){
+    return virtual_air_send_connection(vc, now_us, conn, type, &status, 1);
+}
+
+//
+// connections
+//
+
+static virtual_connection_t * virtual_connection_for_handle(virtual_controller_t * vc, hci_con_handle_t handle){
+    int i;
+    for (i = 0; i < VIRTUAL_CONTROLLER_MAX_CONNECTIONS; i++){
+        virtual_connection_t * conn = &vc->connections[i];
+        if (conn->state == VIRTUAL_CONNECTION_FREE) continue;
+        if (conn->handle == handle) return conn;
+    }
+    return NULL;
+}
+
+// @param peer routing address for air messages, remote BD ADDR for Classic
+static virtual_connection_t * virtual_connection_for_peer(virtual_controller_t * vc, const uint8_t * peer, uint8_t link_type){
+    int i;
+    for (i = 0; i < VIRTUAL_CONTROLLER_MAX_CONNECTIONS; i++){
+        virtual_connection_t * conn = &vc->connections[i];
+        if (conn->state == VIRTUAL_CONNECTION_FREE) continue;
+        if (conn->link_type != link_type) continue;
+        if (BD_ADDR_CMP(conn->peer, peer) == 0) return conn;
+    }
+    return NULL;
+}
+
+static virtual_connection_t * virtual_connection_create(virtual_controller_t * vc, uint32_t now_us, const uint8_t * peer, uint8_t link_type, uint8_t state){
+    int i;
+    for (i = 0; i < VIRTUAL_CONTROLLER_MAX_CONNECTIONS; i++){
+        virtual_connection_t * conn = &vc->connections[i];
+        if (conn->state != VIRTUAL_CONNECTION_FREE) continue;
+        memset(conn, 0, sizeof(virtual_connection_t));
+        conn->state = state;
+        conn->link_type = link_type;
+        BD_ADDR_COPY(conn->peer, peer);
+        BD_ADDR_COPY(conn->peer_addr, peer);
+        conn->handle = vc->next_handle;
+        conn->acl_handle = VIRTUAL_HANDLE_NONE;
+        vc->next_handle = (vc->next_handle + 1) & 0x0eff;
+        if (!vc->next_handle) vc->next_handle = 1;
+        return conn;
+    }
+    log_error("virtual_controller: no connection available");
+    return NULL;
+}
+
+static uint16_t * virtual_buffer_counter_for_link_type(virtual_controller_t * vc, uint8_t link_type){
+    switch (link_type){
+        case VIRTUAL_LINK_SCO:
+            return &vc->sco_packets_in_buffer;
+        case VIRTUAL_LINK_LE:
+            if (vc->config.le_packet_length) return &vc->le_packets_in_buffer;
+            return &vc->acl_packets_in_buffer;
+        default:
+            return &vc->acl_packets_in_buffer;
+    }
+}
+
+// drop queued data of connection, incl. data waiting for host buffers, and return its controller buffers
+static void virtual_connection_free(virtual_controller_t * vc, virtual_connection_t * conn){
+    uint16_t * in_buffer = virtual_buffer_counter_for_link_type(vc, conn->link_type);
+    linked_list_iterator_t it;
+    linked_list_iterator_init(&it, &vc->host_queue);
+    while (linked_list_iterator_has_next(&it)){
+        virtual_packet_t * packet = (virtual_packet_t *) linked_list_iterator_next(&it);
+        if (packet->handle != conn->handle) continue;
+        if (packet->type == HCI_EVENT_PACKET) continue;
+        linked_list_iterator_remove(&it);
+        if (packet->type == VIRTUAL_PACKET_COMPLETED && *in_buffer){
+            (*in_buffer)--;
+        }
+        free(packet);
+    }
+    linked_list_iterator_init(&it, &vc->air_queue);
+    while (linked_list_iterator_has_next(&it)){
+        virtual_packet_t * packet = (virtual_packet_t *) linked_list_iterator_next(&it);
+        if (packet->handle != conn->handle) continue;
+        linked_list_iterator_remove(&it);
+        free(packet);
+    }
+    conn->state = VIRTUAL_CONNECTION_FREE;
+}
+
+static void virtual_emit_connection_complete(virtual_controller_t * vc, uint32_t due_us, virtual_connection_t * conn, uint8_t status){
+    uint8_t * event;
+    if (conn->link_type == VIRTUAL_LINK_SCO){
+        event = virtual_event(vc, due_us, HCI_EVENT_SYNCHRONOUS_CONNECTION_COMPLETE, 17);
+        event[2] = status;
+        bt_store_16(event, 3, conn->handle);
+        bt_flip_addr(&event[5], conn->peer_addr);
+        event[11] = 0x02;                                   // eSCO
+        event[12] = 0x0c;                                   // transmission interval
+        event[13] = 0x02;                                   // retransmission window
+        bt_store_16(event, 14, vc->config.sco_packet_length);
+        bt_store_16(event, 16, vc->config.sco_packet_length);
+        event[18] = 0x02;                                   // air mode transparent
+        return;
+    }
+    event = virtual_event(vc, due_us, HCI_EVENT_CONNECTION_COMPLETE, 11);
+    event[2] = status;
+    bt_store_16(event, 3, conn->handle);
+    bt_flip_addr(&event[5], conn->peer_addr);
+    event[11] = 0x01;                                       // ACL
+    event[12] = 0x00;                                       // encryption disabled
+}
+
+static void virtual_emit_le_connection_complete(virtual_controller_t * vc, uint32_t due_us, virtual_connection_t * conn){
+    uint8_t * event = virtual_le_event(vc, due_us, HCI_SUBEVENT_LE_CONNECTION_COMPLETE, 18);
+    event[3] = 0;
+    bt_store_16(event, 4, conn->handle);
+    event[6] = conn->role;
+    event[7] = conn->peer_addr_type;
+    bt_flip_addr(&event[8], conn->peer_addr);
+    bt_store_16(event, 14, conn->le_interval);
+    bt_store_16(event, 16, conn->le_latency);
+    bt_store_16(event, 18, conn->le_supervision_timeout);
+    event[20] = 0;                                          // master clock accuracy
+}
+
+static void virtual_emit_disconnection_complete(virtual_controller_t * vc, uint32_t due_us, virtual_connection_t * conn, uint8_t reason){
+    uint8_t * event = virtual_event(vc, due_us, HCI_EVENT_DISCONNECTION_COMPLETE, 4);
+    event[2] = 0;
+    bt_store_16(event, 3, conn->handle);
+    event[5] = reason;
+    conn->state = VIRTUAL_CONNECTION_DISCONNECTING;
+}
+
+// connection is freed when Disconnection Complete is delivered
+static void virtual_disconnect(virtual_controller_t * vc, uint32_t due_us, virtual_connection_t * conn, uint8_t reason){
+    virtual_emit_disconnection_complete(vc, due_us, conn, reason);
+    if (conn->link_type != VIRTUAL_LINK_ACL) return;
+    // SCO connections end with their ACL connection
+    int i;
+    for (i = 0; i < VIRTUAL_CONTROLLER_MAX_CONNECTIONS; i++){
+        virtual_connection_t * sco = &vc->connections[i];
+        if (sco->state != VIRTUAL_CONNECTION_OPEN) continue;
+        if (sco->link_type != VIRTUAL_LINK_SCO) continue;
+        if (BD_ADDR_CMP(sco->peer, conn->peer)) continue;
+        virtual_emit_disconnection_complete(vc, due_us, sco, reason);
+    }
+}
+
+//
+// security
+//
+
+static void virtual_emit_addr_event(virtual_controller_t * vc, uint32_t now_us, uint8_t event_code, virtual_connection_t * conn){
+    uint8_t * event = virtual_event(vc, now_us, event_code, 6);
+    bt_flip_addr(&event[2], conn->peer_addr);
+}
+
+static void virtual_emit_authentication_complete(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn, uint8_t status){
+    uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_AUTHENTICATION_COMPLETE_EVENT, 3);
+    event[2] = status;
+    bt_store_16(event, 3, conn->handle);
+}
+
+static void virtual_emit_simple_pairing_complete(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn, uint8_t status){
+    uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_SIMPLE_PAIRING_COMPLETE, 7);
+    event[2] = status;
+    bt_flip_addr(&event[3], conn->peer_addr);
+}
+
+static void virtual_emit_link_key_notification(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn){
+    uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_LINK_KEY_NOTIFICATION, 23);
+    bt_flip_addr(&event[2], conn->peer_addr);
+    memcpy(&event[8], conn->link_key, 16);
+    event[24] = conn->link_key_type;
+}
+
+static void virtual_emit_io_capability_response(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn, const uint8_t * io_capability){
+    uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_IO_CAPABILITY_RESPONSE, 9);
+    bt_flip_addr(&event[2], conn->peer_addr);
+    memcpy(&event[8], io_capability, 3);
+}
+
+// numeric comparison value, same on both sides
+static void virtual_emit_user_confirmation_request(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn){
+    uint32_t value = 0;
+    int i;
+    for (i = 0; i < 6; i++){
+        value += (vc->config.bd_addr[i] + conn->peer[i]) * (i + 1) * 7919;
+    }
+    uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_USER_CONFIRMATION_REQUEST, 10);
+    bt_flip_addr(&event[2], conn->peer_addr);
+    bt_store_32(event, 8, value % 1000000);
+}
+
+static void virtual_pairing_done(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn, uint8_t status){
+    if (conn->auth_flags & VIRTUAL_AUTH_FLAG_SSP){
+        virtual_emit_simple_pairing_complete(vc, now_us, conn, status);
+    }
+    if (!status){
+        conn->auth_flags |= VIRTUAL_AUTH_FLAG_LINK_KEY_VALID;
+        virtual_emit_link_key_notification(vc, now_us, conn);
+    }
+    if (conn->auth_flags & VIRTUAL_AUTH_FLAG_INITIATOR){
+        virtual_emit_authentication_complete(vc, now_us, conn, status);
+    }
+    conn->auth_state = VIRTUAL_AUTH_IDLE;
+    conn->auth_flags &= VIRTUAL_AUTH_FLAG_LINK_KEY_VALID;
+}
+
+static void virtual_pairing_failed(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn, uint8_t status){
+    virtual_air_send_status(vc, now_us, conn, AIR_PAIRING_FAILED, status);
+    virtual_pairing_done(vc, now_us, conn, status);
+}
+
+static void virtual_user_confirmation_check(virtual_controller_t * vc, uint32_t now_us, virtual_connection_t * conn){
+    uint8_t confirmed = VIRTUAL_AUTH_FLAG_LOCAL_CONFIRMED | VIRTUAL_AUTH_FLAG_PEER_CONFIRMED;
+    if ((conn->auth_flags & confirmed) != confirmed) return;
+    if (conn->local_io_capability == IO_CAPABILITY_NO_INPUT_NO_OUTPUT || conn->peer_io_capability == IO_CAPABILITY_NO_INPUT_NO_OUTPUT){
+        conn->link_key_type = UNAUTHENTICATED_COMBINATION_KEY_GENERATED_FROM_P192;
+    } else {
+        conn->link_key_type = AUTHENTICATED_COMBINATION_KEY_GENERATED_FROM_P192;
+    }
+    virtual_pairing_done(vc, now_us, conn, 0);
+}
+
+static int virtual_ssp_on_both_sides(virtual_controller_t * vc, virtual_connection_t * conn){
+    return vc->config.ssp && vc->simple_pairing_mode && (conn->peer_features[6] & 0x08);
+}
+
+//
+// LE
+//
+
+// @returns address used for advertising, scanning or initiating
+static const uint8_t * virtual_le_own_addr(virtual_controller_t * vc, uint8_t own_addr_type){
+    return own_addr_type ? vc->random_addr : vc->config.bd_addr;
+}
+
+static int virtual_le_white_list_contains(virtual_controller_t * vc, uint8_t addr_type, const uint8_t * addr){
+    int i;
+    for (i = 0; i < vc->white_list_num; i++){
+        if (vc->white_list_addr_type[i] != addr_type) continue;
+        if (BD_ADDR_CMP(vc->white_list_addr[i], addr) == 0) return 1;
+    }
+    return 0;
+}
+
+static void virtual_le_advertise(virtual_controller_t * vc, uint32_t now_us){
+    uint8_t payload[79];
+    memset(payload, 0, sizeof(payload));
+    payload[0] = vc->adv_type;
+    payload[1] = vc->adv_own_addr_type;
+    BD_ADDR_COPY(&payload[2], virtual_le_own_addr(vc, vc->adv_own_addr_type));
+    payload[8] = vc->adv_direct_addr_type;
+    BD_ADDR_COPY(&payload[9], vc->adv_direct_addr);
+    payload[15] = vc->adv_data_len;
+    memcpy(&payload[16], vc->adv_data, 31);
+    payload[47] = vc->scan_response_len;
+    memcpy(&payload[48], vc->scan_response, 31);
+    virtual_air_send(vc, now_us, NULL, AIR_LE_ADVERTISEMENT, VIRTUAL_LINK_LE, NULL, payload, sizeof(payload));
+}
+
+static void virtual_emit_advertising_report(virtual_controller_t * vc, uint32_t now_us, uint8_t event_type, const uint8_t * advertisement,
+    uint8_t data_len, const uint8_t * data){
+    uint8_t * event = virtual_le_event(vc, now_us, HCI_SUBEVENT_LE_ADVERTISING_REPORT, 11 + data_len);
+    event[3] = 1;
+    event[4] = event_type;
+    event[5] = advertisement[1];
+    bt_flip_addr(&event[6], (uint8_t *) &advertisement[2]);
+    event[12] = data_len;
+    memcpy(&event[13], data, data_len);
+    event[13 + data_len] = (uint8_t) -40;                   // RSSI
+}
+
+static void virtual_le_handle_advertisement(virtual_controller_t * vc, uint32_t now_us, uint8_t * message){
+    uint8_t * advertisement = AIR_PAYLOAD(message);
+    uint8_t   adv_type      = advertisement[0];
+    uint8_t   addr_type     = advertisement[1];
+    uint8_t * addr          = &advertisement[2];
+    int directed_to_us = adv_type == LE_ADV_DIRECT_IND
+        && BD_ADDR_CMP(&advertisement[9], virtual_le_own_addr(vc, vc->initiator_own_addr_type)) == 0;
+
+    if (vc->initiating && (adv_type == LE_ADV_IND || directed_to_us)){
+        int match;
+        if (vc->initiator_filter_policy){
+            match = virtual_le_white_list_contains(vc, addr_type, addr);
+        } else {
+            match = addr_type == vc->initiator_peer_addr_type && BD_ADDR_CMP(addr, vc->initiator_peer_addr) == 0;
+        }
+        if (match){
+            virtual_connection_t * conn = virtual_connection_create(vc, now_us, AIR_SOURCE(message), VIRTUAL_LINK_LE, VIRTUAL_CONNECTION_OPEN);
+            if (!conn) return;
+            vc->initiating = 0;
+            conn->role = 0;
+            conn->peer_addr_type = addr_type;
+            BD_ADDR_COPY(conn->peer_addr, addr);
+            conn->le_interval = vc->initiator_interval;
+            conn->le_latency = vc->initiator_latency;
+            conn->le_supervision_timeout = vc->initiator_supervision_timeout;
+            uint8_t payload[20];
+            payload[0] = vc->initiator_own_addr_type;
+            BD_ADDR_COPY(&payload[1], virtual_le_own_addr(vc, vc->initiator_own_addr_type));
+            bt_store_16(payload, 7, conn->le_interval);
+            bt_store_16(payload, 9, conn->le_latency);
+            bt_store_16(payload, 11, conn->le_supervision_timeout);
+            payload[13] = addr_type;
+            BD_ADDR_COPY(&payload[14], addr);
+            virtual_air_send_connection(vc, now_us, conn, AIR_LE_CONNECT, payload, sizeof(payload));
+            virtual_emit_le_connection_complete(vc, now_us, conn);
+            return;
+        }
+    }
+
+    if (!vc->scan_enabled) return;
+    if (adv_type == LE_ADV_DIRECT_IND && !directed_to_us) return;
+    if (vc->scan_filter_policy && !virtual_le_white_list_contains(vc, addr_type, addr)) return;
+    if (vc->scan_filter_duplicates){
+        int i;
+        for (i = 0; i < vc->scan_reported; i++){
+            if (BD_ADDR_CMP(vc->scan_reported_addr[i], addr) == 0) return;
+        }
+        if (vc->scan_reported < VIRTUAL_CONTROLLER_SCAN_FILTER_SIZE){
+            BD_ADDR_COPY(vc->scan_reported_addr[vc->scan_reported++], addr);
+        }
+    }
+    uint8_t adv_data_len = advertisement[15];
+    if (adv_data_len > 31) return;
+    virtual_emit_advertising_report(vc, now_us, adv_type, advertisement, adv_data_len, &advertisement[16]);
+    // active scanning: scan request and response
+    if (vc->scan_type && (adv_type == LE_ADV_IND || adv_type == LE_ADV_SCAN_IND)){
+        uint8_t scan_response_len = advertisement[47];
+        if (scan_response_len > 31) return;
+        virtual_emit_advertising_report(vc, now_us, LE_SCAN_RSP, advertisement, scan_response_len, &advertisement[48]);
+    }
+}
+
+static void virtual_le_handle_connect(virtual_controller_t * vc, uint32_t now_us, uint8_t * message){
+    uint8_t * request = AIR_PAYLOAD(message);
+    int accept = vc->adv_enabled
+        && (vc->adv_type == LE_ADV_IND || vc->adv_type == LE_ADV_DIRECT_IND)
+        && request[13] == vc->adv_own_addr_type
+        && BD_ADDR_CMP(&request[14], virtual_le_own_addr(vc, vc->adv_own_addr_type)) == 0
+        && !virtual_connection_for_peer(vc, AIR_SOURCE(message), VIRTUAL_LINK_LE);
+    virtual_connection_t * conn = NULL;
+    if (accept){
+        conn = virtual_connection_create(vc, now_us, AIR_SOURCE(message), VIRTUAL_LINK_LE, VIRTUAL_CONNECTION_OPEN);
+    }
+    if (!conn){
+        // initiator considers itself connected, let connection fail
+        uint8_t reason = ERROR_CODE_CONNECTION_FAILED_TO_BE_ESTABLISHED;
+        virtual_air_send(vc, now_us, NULL, AIR_DISCONNECT, VIRTUAL_LINK_LE, AIR_SOURCE(message), &reason, 1);
+        return;
+    }
+    vc->adv_enabled = 0;
+    conn->role = 1;
+    conn->peer_addr_type = request[0];
+    BD_ADDR_COPY(conn->peer_addr, &request[1]);
+    conn->le_interval = READ_BT_16(request, 7);
+    conn->le_latency = READ_BT_16(request, 9);
+    conn->le_supervision_timeout = READ_BT_16(request, 11);
+    virtual_emit_le_connection_complete(vc, now_us, conn);
+}
+
+static void virtual_emit_le_connection_update_complete(virtual_controller_t * vc, uint32_t due_us, virtual_connection_t * conn){
+    uint8_t * event = virtual_le_event(vc, due_us, HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE, 9);
+    event[3] = 0;
+    bt_store_16(event, 4, conn->handle);
+    bt_store_16(event, 6, conn->le_interval);
+    bt_store_16(event, 8, conn->le_latency);
+    bt_store_16(event, 10, conn->le_supervision_timeout);
+}
+
+static void virtual_emit_encryption_change(virtual_controller_t * vc, uint32_t due_us, virtual_connection_t * conn, uint8_t status){
+    uint8_t * event = virtual_event(vc, due_us, HCI_EVENT_ENCRYPTION_CHANGE, 4);
+    event[2] = status;
+    bt_store_16(event, 3, conn->handle);
+    event[5] = conn->encrypted;
+}
+
+//
+// HCI commands
+//
+
+static void virtual_reset(virtual_controller_t * vc){
+    virtual_queue_free(&vc->host_queue);
+    virtual_queue_free(&vc->air_queue);
+    memset(vc->connections, 0, sizeof(vc->connections));
+    memset(vc->local_name, 0, sizeof(vc->local_name));
+    memset(vc->class_of_device, 0, sizeof(vc->class_of_device));
+    memset(vc->eir, 0, sizeof(vc->eir));
+    memset(vc->random_addr, 0, sizeof(bd_addr_t));
+    vc->air_blocked = 0;
+    vc->scan_enable = 0;
+    vc->simple_pairing_mode = 0;
+    vc->inquiry_mode = 0;
+    vc->page_timeout = 0x2000;
+    vc->synchronous_flow_control = 0;
+    vc->host_flow_control = 0;
+    vc->host_acl_packets = 0;
+    vc->host_acl_packets_used = 0;
+    vc->acl_packets_in_buffer = 0;
+    vc->sco_packets_in_buffer = 0;
+    vc->le_packets_in_buffer = 0;
+    vc->next_handle = 1;
+    vc->inquiry_active = 0;
+    vc->name_request_active = 0;
+    vc->adv_interval = 0x0800;
+    vc->adv_type = LE_ADV_IND;
+    vc->adv_own_addr_type = 0;
+    vc->adv_data_len = 0;
+    vc->scan_response_len = 0;
+    vc->adv_enabled = 0;
+    vc->scan_type = 0;
+    vc->scan_own_addr_type = 0;
+    vc->scan_filter_policy = 0;
+    vc->scan_enabled = 0;
+    vc->initiating = 0;
+    vc->white_list_num = 0;
+}
+
+static void virtual_handle_link_control_command(virtual_controller_t * vc, uint32_t now_us, uint16_t opcode, uint8_t * packet){
+    virtual_connection_t * conn;
+    bd_addr_t addr;
+    uint8_t payload[16];
+
+    switch (READ_CMD_OCF(packet)){
+        case 0x01:  // Inquiry
+            vc->inquiry_active = 1;
+            vc->inquiry_end_us = now_us + packet[6] * 1280000;
+            vc->inquiry_max_responses = packet[7];
+            vc->inquiry_responses = 0;
+            virtual_command_status(vc, now_us, opcode, 0);
+            virtual_air_send(vc, now_us, NULL, AIR_INQUIRY, VIRTUAL_LINK_NONE, NULL, NULL, 0);
+            break;
+
+        case 0x02:  // Inquiry Cancel
+            vc->inquiry_active = 0;
+            virtual_command_complete_status(vc, now_us, opcode, 0);
+            break;
+
+        case 0x05:  // Create Connection
+            bt_flip_addr(addr, &packet[3]);
+            if (!vc->config.classic){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_HCI_COMMAND);
+                break;
+            }
+            if (virtual_connection_for_peer(vc, addr, VIRTUAL_LINK_ACL)){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            conn = virtual_connection_create(vc, now_us, addr, VIRTUAL_LINK_ACL, VIRTUAL_CONNECTION_PAGING);
+            if (!conn){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_CONNECTION_REJECTED_DUE_TO_LIMITED_RESOURCES);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            conn->timeout_us = now_us + vc->page_timeout * 625;
+            memcpy(&payload[0], vc->class_of_device, 3);
+            virtual_local_features(vc, &payload[3]);
+            virtual_air_send_connection(vc, now_us, conn, AIR_CONNECTION_REQUEST, payload, 11);
+            break;
+
+        case 0x06:  // Disconnect
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            // local Disconnection Complete when peer got the request, after pending data
+            virtual_disconnect(vc, virtual_air_send_status(vc, now_us, conn, AIR_DISCONNECT, packet[5]), conn,
+                ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST);
+            break;
+
+        case 0x08:  // Create Connection Cancel
+            bt_flip_addr(addr, &packet[3]);
+            conn = virtual_connection_for_peer(vc, addr, VIRTUAL_LINK_ACL);
+            if (!conn || conn->state != VIRTUAL_CONNECTION_PAGING){
+                virtual_command_complete_addr(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, addr);
+                break;
+            }
+            virtual_command_complete_addr(vc, now_us, opcode, 0, addr);
+            virtual_emit_connection_complete(vc, now_us, conn, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+            virtual_connection_free(vc, conn);
+            break;
+
+        case 0x09:  // Accept Connection Request
+        case 0x29:  // Accept Synchronous Connection Request
+            bt_flip_addr(addr, &packet[3]);
+            conn = virtual_connection_for_peer(vc, addr, READ_CMD_OCF(packet) == 0x09 ? VIRTUAL_LINK_ACL : VIRTUAL_LINK_SCO);
+            if (!conn || conn->state != VIRTUAL_CONNECTION_W4_ACCEPT){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            conn->state = VIRTUAL_CONNECTION_OPEN;
+            virtual_local_features(vc, payload);
+            virtual_emit_connection_complete(vc, virtual_air_send_connection(vc, now_us, conn, AIR_CONNECTION_ACCEPT, payload, 8), conn, 0);
+            break;
+
+        case 0x0a:  // Reject Connection Request
+        case 0x2a:  // Reject Synchronous Connection Request
+            bt_flip_addr(addr, &packet[3]);
+            conn = virtual_connection_for_peer(vc, addr, READ_CMD_OCF(packet) == 0x0a ? VIRTUAL_LINK_ACL : VIRTUAL_LINK_SCO);
+            if (!conn || conn->state != VIRTUAL_CONNECTION_W4_ACCEPT){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            virtual_air_send_status(vc, now_us, conn, AIR_CONNECTION_REJECT, packet[9]);
+            virtual_emit_connection_complete(vc, now_us, conn, packet[9]);
+            virtual_connection_free(vc, conn);
+            break;
+
+        case 0x0b:  // Link Key Request Reply
+        case 0x0c:  // Link Key Request Negative Reply
+            bt_flip_addr(addr, &packet[3]);
+            conn = virtual_connection_for_peer(vc, addr, VIRTUAL_LINK_ACL);
+            if (!conn || conn->auth_state != VIRTUAL_AUTH_W4_LINK_KEY_REPLY){
+                virtual_command_complete_addr(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED, addr);
+                break;
+            }
+            virtual_command_complete_addr(vc, now_us, opcode, 0, addr);
+            if (conn->auth_flags & VIRTUAL_AUTH_FLAG_INITIATOR){
+                if (READ_CMD_OCF(packet) == 0x0b){
+                    // authenticate with stored key
+                    memcpy(conn->link_key, &packet[9], 16);
+                    conn->auth_state = VIRTUAL_AUTH_W4_PEER_AUTH_RESULT;
+                    virtual_air_send_connection(vc, now_us, conn, AIR_AUTH_KEY, conn->link_key, 16);
+                    break;
+                }
+                // pairing
+                if (virtual_ssp_on_both_sides(vc, conn)){
+                    conn->auth_flags |= VIRTUAL_AUTH_FLAG_SSP;
+                    conn->auth_state = VIRTUAL_AUTH_W4_IO_CAPABILITY_REPLY;
+                    virtual_emit_addr_event(vc, now_us, HCI_EVENT_IO_CAPABILITY_REQUEST, conn);
+                } else {
+                    conn->auth_state = VIRTUAL_AUTH_W4_PIN_REPLY;
+                    virtual_emit_addr_event(vc, now_us, HCI_EVENT_PIN_CODE_REQUEST, conn);
+                }
+                break;
+            }
+            // responder: compare with key from initiator
+            if (READ_CMD_OCF(packet) == 0x0b && memcmp(conn->link_key, &packet[9], 16) == 0){
+                conn->auth_flags |= VIRTUAL_AUTH_FLAG_LINK_KEY_VALID;
+                virtual_air_send_status(vc, now_us, conn, AIR_AUTH_RESULT, 0);
+            } else {
+                virtual_air_send_status(vc, now_us, conn, AIR_AUTH_RESULT, ERROR_CODE_PIN_OR_KEY_MISSING);
+            }
+            conn->auth_state = VIRTUAL_AUTH_IDLE;
+            break;
+
+        case 0x0d:  // PIN Code Request Reply
+        case 0x0e:  // PIN Code Request Negative Reply
+            bt_flip_addr(addr, &packet[3]);
+            conn = virtual_connection_for_peer(vc, addr, VIRTUAL_LINK_ACL);
+            if (!conn || conn->auth_state != VIRTUAL_AUTH_W4_PIN_REPLY){
+                virtual_command_complete_addr(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED, addr);
+                break;
+            }
+            virtual_command_complete_addr(vc, now_us, opcode, 0, addr);
+            if (READ_CMD_OCF(packet) == 0x0e){
+                virtual_pairing_failed(vc, now_us, conn, ERROR_CODE_PIN_OR_KEY_MISSING);
+                break;
+            }
+            if (conn->auth_flags & VIRTUAL_AUTH_FLAG_INITIATOR){
+                conn->pin_len = packet[9] > 16 ? 16 : packet[9];
+                memcpy(conn->pin, &packet[10], 16);
+                conn->auth_state = VIRTUAL_AUTH_W4_PEER_PIN_RESULT;
+                // PIN length and PIN
+                virtual_air_send_connection(vc, now_us, conn, AIR_PIN, &packet[9], 17);
+                break;
+            }
+            // responder: compare PINs and create combination key
+            if (packet[9] != conn->pin_len || memcmp(&packet[10], conn->pin, conn->pin_len)){
+                virtual_pairing_failed(vc, now_us, conn, ERROR_CODE_AUTHENTICATION_FAILURE);
+                break;
+            }
+            virtual_random_bytes(vc, conn->link_key, 16);
+            conn->link_key_type = COMBINATION_KEY;
+            virtual_air_send_connection(vc, now_us, conn, AIR_PIN_RESULT, conn->link_key, 16);
+            virtual_pairing_done(vc, now_us, conn, 0);
+            break;
+
+        case 0x11:  // Authentication Requested
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN || conn->link_type != VIRTUAL_LINK_ACL){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            if (conn->auth_state != VIRTUAL_AUTH_IDLE){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            conn->auth_flags = (conn->auth_flags & VIRTUAL_AUTH_FLAG_LINK_KEY_VALID) | VIRTUAL_AUTH_FLAG_INITIATOR;
+            conn->auth_state = VIRTUAL_AUTH_W4_LINK_KEY_REPLY;
+            virtual_emit_addr_event(vc, now_us, HCI_EVENT_LINK_KEY_REQUEST, conn);
+            break;
+
+        case 0x13:  // Set Connection Encryption
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN || conn->link_type != VIRTUAL_LINK_ACL){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            if (packet[5] && !(conn->auth_flags & VIRTUAL_AUTH_FLAG_LINK_KEY_VALID)){
+                virtual_emit_encryption_change(vc, now_us, conn, ERROR_CODE_PIN_OR_KEY_MISSING);
+                break;
+            }
+            virtual_air_send_status(vc, now_us, conn, AIR_ENCRYPTION, packet[5] ? 1 : 0);
+            break;
+
+        case 0x19:  // Remote Name Request
+            bt_flip_addr(addr, &packet[3]);
+            if (vc->name_request_active){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            vc->name_request_active = 1;
+            BD_ADDR_COPY(vc->name_request_addr, addr);
+            vc->name_request_timeout_us = now_us + vc->page_timeout * 625;
+            virtual_air_send(vc, now_us, NULL, AIR_NAME_REQUEST, VIRTUAL_LINK_NONE, addr, NULL, 0);
+            break;
+
+        case 0x1a:  // Remote Name Request Cancel
+            bt_flip_addr(addr, &packet[3]);
+            if (!vc->name_request_active || BD_ADDR_CMP(addr, vc->name_request_addr)){
+                virtual_command_complete_addr(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, addr);
+                break;
+            }
+            virtual_command_complete_addr(vc, now_us, opcode, 0, addr);
+            vc->name_request_active = 0;
+            {
+                uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_REMOTE_NAME_REQUEST_COMPLETE, 255);
+                event[2] = ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+                bt_flip_addr(&event[3], addr);
+            }
+            break;
+
+        case 0x1b:  // Read Remote Supported Features
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            {
+                uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_READ_REMOTE_SUPPORTED_FEATURES_COMPLETE, 11);
+                bt_store_16(event, 3, conn->handle);
+                memcpy(&event[5], conn->peer_features, 8);
+            }
+            break;
+
+        case 0x1d:  // Read Remote Version Information
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            {
+                uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_READ_REMOTE_VERSION_INFORMATION_COMPLETE, 8);
+                bt_store_16(event, 3, conn->handle);
+                event[5] = 0x06;                            // Bluetooth 4.0
+                bt_store_16(event, 6, 0xffff);              // manufacturer for internal use
+            }
+            break;
+
+        case 0x28:  // Setup Synchronous Connection
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN || conn->link_type != VIRTUAL_LINK_ACL){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                break;
+            }
+            if (virtual_connection_for_peer(vc, conn->peer, VIRTUAL_LINK_SCO)){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                break;
+            }
+            {
+                virtual_connection_t * sco = virtual_connection_create(vc, now_us, conn->peer, VIRTUAL_LINK_SCO, VIRTUAL_CONNECTION_PAGING);
+                if (!sco){
+                    virtual_command_status(vc, now_us, opcode, ERROR_CODE_CONNECTION_REJECTED_DUE_TO_LIMITED_RESOURCES);
+                    break;
+                }
+                virtual_command_status(vc, now_us, opcode, 0);
+                sco->acl_handle = conn->handle;
+                sco->timeout_us = now_us + vc->page_timeout * 625;
+                memcpy(&payload[0], vc->class_of_device, 3);
+                virtual_local_features(vc, &payload[3]);
+                virtual_air_send_connection(vc, now_us, sco, AIR_CONNECTION_REQUEST, payload, 11);
+            }
+            break;
+
+        case 0x2b:  // IO Capability Request Reply
+        case 0x34:  // IO Capability Request Negative Reply
+            bt_flip_addr(addr, &packet[3]);
+            conn = virtual_connection_for_peer(vc, addr, VIRTUAL_LINK_ACL);
+            if (!conn || conn->auth_state != VIRTUAL_AUTH_W4_IO_CAPABILITY_REPLY){
+                virtual_command_complete_addr(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED, addr);
+                break;
+            }
+            virtual_command_complete_addr(vc, now_us, opcode, 0, addr);
+            if (READ_CMD_OCF(packet) == 0x34){
+                virtual_pairing_failed(vc, now_us, conn, packet[9]);
+                break;
+            }
+            conn->local_io_capability = packet[9];
+            if (conn->auth_flags & VIRTUAL_AUTH_FLAG_INITIATOR){
+                conn->auth_state = VIRTUAL_AUTH_W4_PEER_IO_CAPABILITY;
+                virtual_air_send_connection(vc, now_us, conn, AIR_IO_CAPABILITY_REQUEST, &packet[9], 3);
+                break;
+            }
+            conn->auth_state = VIRTUAL_AUTH_W4_USER_CONFIRMATION;
+            virtual_air_send_connection(vc, now_us, conn, AIR_IO_CAPABILITY_RESPONSE, &packet[9], 3);
+            virtual_emit_user_confirmation_request(vc, now_us, conn);
+            break;
+
+        case 0x2c:  // User Confirmation Request Reply
+        case 0x2e:  // User Passkey Request Reply
+        case 0x2d:  // User Confirmation Request Negative Reply
+        case 0x2f:  // User Passkey Request Negative Reply
+            bt_flip_addr(addr, &packet[3]);
+            conn = virtual_connection_for_peer(vc, addr, VIRTUAL_LINK_ACL);
+            if (!conn || conn->auth_state != VIRTUAL_AUTH_W4_USER_CONFIRMATION || (conn->auth_flags & VIRTUAL_AUTH_FLAG_LOCAL_CONFIRMED)){
+                virtual_command_complete_addr(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED, addr);
+                break;
+            }
+            virtual_command_complete_addr(vc, now_us, opcode, 0, addr);
+            if (READ_CMD_OCF(packet) == 0x2d || READ_CMD_OCF(packet) == 0x2f){
+                virtual_pairing_failed(vc, now_us, conn, ERROR_CODE_AUTHENTICATION_FAILURE);
+                break;
+            }
+            conn->auth_flags |= VIRTUAL_AUTH_FLAG_LOCAL_CONFIRMED;
+            // link key is chosen by initiator
+            virtual_air_send_connection(vc, now_us, conn, AIR_USER_CONFIRMATION, conn->link_key, 16);
+            virtual_user_confirmation_check(vc, now_us, conn);
+            break;
+
+        default:
+            virtual_command_complete_status(vc, now_us, opcode, 0);
+            break;
+    }
+}
+
+static void virtual_handle_controller_baseband_command(virtual_controller_t * vc, uint32_t now_us, uint16_t opcode, uint8_t * packet){
+    uint8_t * result;
+    switch (READ_CMD_OCF(packet)){
+        case 0x03:  // Reset
+            virtual_reset(vc);
+            break;
+        case 0x13:  // Write Local Name
+            memcpy(vc->local_name, &packet[3], 248);
+            break;
+        case 0x14:  // Read Local Name
+            result = virtual_command_complete(vc, now_us, opcode, 249);
+            memcpy(&result[1], vc->local_name, 248);
+            return;
+        case 0x18:  // Write Page Timeout
+            vc->page_timeout = READ_BT_16(packet, 3);
+            break;
+        case 0x1a:  // Write Scan Enable
+            vc->scan_enable = packet[3];
+            break;
+        case 0x24:  // Write Class of Device
+            memcpy(vc->class_of_device, &packet[3], 3);
+            break;
+        case 0x2f:  // Write Synchronous Flow Control Enable
+            vc->synchronous_flow_control = packet[3];
+            break;
+        case 0x31:  // Set Controller To Host Flow Control, ACL only
+            vc->host_flow_control = packet[3] & 0x01;
+            vc->host_acl_packets_used = 0;
+            break;
+        case 0x33:  // Host Buffer Size
+            vc->host_acl_packets = READ_BT_16(packet, 6);
+            break;
+        case 0x35:{ // Host Number Of Completed Packets, no Command Complete
+            int i;
+            int offset = 4;
+            for (i = 0; i < packet[3]; i++, offset += 4){
+                uint16_t num_packets = READ_BT_16(packet, offset + 2);
+                if (num_packets > vc->host_acl_packets_used){
+                    log_error("virtual_controller: host completed more packets than received");
+                    num_packets = vc->host_acl_packets_used;
+                }
+                vc->host_acl_packets_used -= num_packets;
+            }
+            return;
+        }
+        case 0x45:  // Write Inquiry Mode
+            vc->inquiry_mode = packet[3];
+            break;
+        case 0x52:  // Write Extended Inquiry Response
+            memcpy(vc->eir, &packet[4], sizeof(vc->eir));
+            break;
+        case 0x56:  // Write Simple Pairing Mode
+            vc->simple_pairing_mode = packet[3];
+            break;
+        default:
+            break;
+    }
+    virtual_command_complete_status(vc, now_us, opcode, 0);
+}
+
+static void virtual_handle_informational_command(virtual_controller_t * vc, uint32_t now_us, uint16_t opcode, uint8_t * packet){
+    uint8_t * result;
+    switch (READ_CMD_OCF(packet)){
+        case 0x01:  // Read Local Version Information
+            result = virtual_command_complete(vc, now_us, opcode, 9);
+            result[1] = 0x06;                               // HCI version 4.0
+            result[4] = 0x06;                               // LMP version 4.0
+            bt_store_16(result, 5, 0xffff);                 // manufacturer for internal use
+            break;
+        case 0x02:  // Read Local Supported Commands
+            result = virtual_command_complete(vc, now_us, opcode, 65);
+            memset(&result[1], 0xff, 64);
+            break;
+        case 0x03:  // Read Local Supported Features
+            result = virtual_command_complete(vc, now_us, opcode, 9);
+            virtual_local_features(vc, &result[1]);
+            break;
+        case 0x05:  // Read Buffer Size
+            result = virtual_command_complete(vc, now_us, opcode, 8);
+            bt_store_16(result, 1, vc->config.acl_packet_length);
+            result[3] = vc->config.sco_packet_length;
+            bt_store_16(result, 4, vc->config.acl_packets);
+            bt_store_16(result, 6, vc->config.sco_packets);
+            break;
+        case 0x09:  // Read BD ADDR
+            result = virtual_command_complete(vc, now_us, opcode, 7);
+            bt_flip_addr(&result[1], vc->config.bd_addr);
+            break;
+        default:
+            virtual_command_complete_status(vc, now_us, opcode, 0);
+            break;
+    }
+}
+
+static void virtual_handle_le_command(virtual_controller_t * vc, uint32_t now_us, uint16_t opcode, uint8_t * packet){
+    virtual_connection_t * conn;
+    uint8_t * result;
+    uint8_t * event;
+    int i;
+
+    if (!vc->config.le){
+        virtual_command_complete_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_HCI_COMMAND);
+        return;
+    }
+
+    switch (READ_CMD_OCF(packet)){
+        case 0x02:  // LE Read Buffer Size
+            result = virtual_command_complete(vc, now_us, opcode, 4);
+            bt_store_16(result, 1, vc->config.le_packet_length);
+            result[3] = vc->config.le_packets;
+            return;
+        case 0x03:  // LE Read Local Supported Features
+            result = virtual_command_complete(vc, now_us, opcode, 9);
+            result[1] = 0x01;                               // LE Encryption
+            return;
+        case 0x05:  // LE Set Random Address
+            bt_flip_addr(vc->random_addr, &packet[3]);
+            break;
+        case 0x06:  // LE Set Advertising Parameters
+            if (vc->adv_enabled){
+                virtual_command_complete_status(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                return;
+            }
+            vc->adv_interval = READ_BT_16(packet, 3);
+            vc->adv_type = packet[7];
+            vc->adv_own_addr_type = packet[8];
+            vc->adv_direct_addr_type = packet[9];
+            bt_flip_addr(vc->adv_direct_addr, &packet[10]);
+            break;
+        case 0x07:  // LE Read Advertising Channel TX Power, 0 dBm
+            virtual_command_complete(vc, now_us, opcode, 2);
+            return;
+        case 0x08:  // LE Set Advertising Data
+            vc->adv_data_len = packet[3] > 31 ? 31 : packet[3];
+            memcpy(vc->adv_data, &packet[4], 31);
+            break;
+        case 0x09:  // LE Set Scan Response Data
+            vc->scan_response_len = packet[3] > 31 ? 31 : packet[3];
+            memcpy(vc->scan_response, &packet[4], 31);
+            break;
+        case 0x0a:  // LE Set Advertise Enable
+            if (packet[3] && !vc->adv_enabled){
+                vc->adv_next_us = now_us;
+            }
+            vc->adv_enabled = packet[3];
+            break;
+        case 0x0b:  // LE Set Scan Parameters
+            if (vc->scan_enabled){
+                virtual_command_complete_status(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                return;
+            }
+            vc->scan_type = packet[3];
+            vc->scan_own_addr_type = packet[8];
+            vc->scan_filter_policy = packet[9];
+            break;
+        case 0x0c:  // LE Set Scan Enable
+            vc->scan_enabled = packet[3];
+            vc->scan_filter_duplicates = packet[4];
+            vc->scan_reported = 0;
+            break;
+        case 0x0d:  // LE Create Connection
+            if (vc->initiating){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                return;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            vc->initiating = 1;
+            vc->initiator_filter_policy = packet[7];
+            vc->initiator_peer_addr_type = packet[8];
+            bt_flip_addr(vc->initiator_peer_addr, &packet[9]);
+            vc->initiator_own_addr_type = packet[15];
+            vc->initiator_interval = READ_BT_16(packet, 16);
+            vc->initiator_latency = READ_BT_16(packet, 20);
+            vc->initiator_supervision_timeout = READ_BT_16(packet, 22);
+            return;
+        case 0x0e:  // LE Create Connection Cancel
+            if (!vc->initiating){
+                virtual_command_complete_status(vc, now_us, opcode, ERROR_CODE_COMMAND_DISALLOWED);
+                return;
+            }
+            vc->initiating = 0;
+            virtual_command_complete_status(vc, now_us, opcode, 0);
+            event = virtual_le_event(vc, now_us, HCI_SUBEVENT_LE_CONNECTION_COMPLETE, 18);
+            event[3] = ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+            event[7] = vc->initiator_peer_addr_type;
+            bt_flip_addr(&event[8], vc->initiator_peer_addr);
+            return;
+        case 0x0f:  // LE Read White List Size
+            result = virtual_command_complete(vc, now_us, opcode, 2);
+            result[1] = VIRTUAL_CONTROLLER_WHITE_LIST_SIZE;
+            return;
+        case 0x10:  // LE Clear White List
+            vc->white_list_num = 0;
+            break;
+        case 0x11:  // LE Add Device To White List
+            if (vc->white_list_num == VIRTUAL_CONTROLLER_WHITE_LIST_SIZE){
+                virtual_command_complete_status(vc, now_us, opcode, ERROR_CODE_CONNECTION_REJECTED_DUE_TO_LIMITED_RESOURCES);
+                return;
+            }
+            vc->white_list_addr_type[vc->white_list_num] = packet[3];
+            bt_flip_addr(vc->white_list_addr[vc->white_list_num], &packet[4]);
+            vc->white_list_num++;
+            break;
+        case 0x12:{ // LE Remove Device From White List
+            bd_addr_t addr;
+            bt_flip_addr(addr, &packet[4]);
+            for (i = 0; i < vc->white_list_num; i++){
+                if (vc->white_list_addr_type[i] != packet[3]) continue;
+                if (BD_ADDR_CMP(vc->white_list_addr[i], addr)) continue;
+                vc->white_list_num--;
+                vc->white_list_addr_type[i] = vc->white_list_addr_type[vc->white_list_num];
+                BD_ADDR_COPY(vc->white_list_addr[i], vc->white_list_addr[vc->white_list_num]);
+                break;
+            }
+            break;
+        }
+        case 0x13:  // LE Connection Update
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN || conn->link_type != VIRTUAL_LINK_LE){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                return;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            conn->le_interval = READ_BT_16(packet, 5);
+            conn->le_latency = READ_BT_16(packet, 9);
+            conn->le_supervision_timeout = READ_BT_16(packet, 11);
+            {
+                uint8_t payload[6];
+                bt_store_16(payload, 0, conn->le_interval);
+                bt_store_16(payload, 2, conn->le_latency);
+                bt_store_16(payload, 4, conn->le_supervision_timeout);
+                virtual_emit_le_connection_update_complete(vc,
+                    virtual_air_send_connection(vc, now_us, conn, AIR_LE_CONNECTION_UPDATE, payload, sizeof(payload)), conn);
+            }
+            return;
+        case 0x16:  // LE Read Remote Used Features
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN || conn->link_type != VIRTUAL_LINK_LE){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                return;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            event = virtual_le_event(vc, now_us, HCI_SUBEVENT_LE_READ_REMOTE_USED_FEATURES_COMPLETE, 11);
+            bt_store_16(event, 4, conn->handle);
+            event[6] = 0x01;                                // LE Encryption
+            return;
+        case 0x17:{ // LE Encrypt, parameters and result are little endian
+            uint8_t key[16];
+            uint8_t plaintext[16];
+            uint8_t ciphertext[16];
+            swap128(&packet[3], key);
+            swap128(&packet[19], plaintext);
+            virtual_aes128(key, plaintext, ciphertext);
+            result = virtual_command_complete(vc, now_us, opcode, 17);
+            swap128(ciphertext, &result[1]);
+            return;
+        }
+        case 0x18:  // LE Rand
+            result = virtual_command_complete(vc, now_us, opcode, 9);
+            virtual_random_bytes(vc, &result[1], 8);
+            return;
+        case 0x19:  // LE Start Encryption
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            if (!conn || conn->state != VIRTUAL_CONNECTION_OPEN || conn->link_type != VIRTUAL_LINK_LE || conn->role){
+                virtual_command_status(vc, now_us, opcode, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
+                return;
+            }
+            virtual_command_status(vc, now_us, opcode, 0);
+            conn->auth_state = VIRTUAL_AUTH_W4_PEER_LE_ENCRYPTION;
+            // random, ediv, ltk
+            virtual_air_send_connection(vc, now_us, conn, AIR_LE_ENCRYPTION_REQUEST, &packet[5], 26);
+            return;
+        case 0x1a:  // LE Long Term Key Request Reply
+        case 0x1b:  // LE Long Term Key Request Negative Reply
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet, 3));
+            result = virtual_command_complete(vc, now_us, opcode, 3);
+            bt_store_16(result, 1, READ_BT_16(packet, 3));
+            if (!conn || conn->auth_state != VIRTUAL_AUTH_W4_LTK_REPLY){
+                result[0] = ERROR_CODE_COMMAND_DISALLOWED;
+                return;
+            }
+            conn->auth_state = VIRTUAL_AUTH_IDLE;
+            if (READ_CMD_OCF(packet) == 0x1b || memcmp(&packet[5], conn->link_key, 16)){
+                virtual_air_send_status(vc, now_us, conn, AIR_LE_ENCRYPTION_RESULT, ERROR_CODE_PIN_OR_KEY_MISSING);
+                return;
+            }
+            conn->encrypted = 1;
+            virtual_emit_encryption_change(vc, virtual_air_send_status(vc, now_us, conn, AIR_LE_ENCRYPTION_RESULT, 0), conn, 0);
+            return;
+        case 0x1c:  // LE Read Supported States
+            result = virtual_command_complete(vc, now_us, opcode, 9);
+            memset(&result[1], 0xff, 8);
+            return;
+        default:
+            break;
+    }
+    virtual_command_complete_status(vc, now_us, opcode, 0);
+}
+
+static void virtual_handle_command(virtual_controller_t * vc, uint32_t now_us, uint8_t * packet, uint16_t size){
+    uint16_t opcode = READ_BT_16(packet, 0);
+    // commands are padded, short parameters read as zero
+    uint8_t command[HCI_CMD_BUFFER_SIZE];
+    memset(command, 0, sizeof(command));
+    memcpy(command, packet, size > sizeof(command) ? sizeof(command) : size);
+
+    switch (READ_CMD_OGF(command)){
+        case OGF_LINK_CONTROL:
+            virtual_handle_link_control_command(vc, now_us, opcode, command);
+            break;
+        case OGF_CONTROLLER_BASEBAND:
+            virtual_handle_controller_baseband_command(vc, now_us, opcode, command);
+            break;
+        case OGF_INFORMATIONAL_PARAMETERS:
+            virtual_handle_informational_command(vc, now_us, opcode, command);
+            break;
+        case OGF_LE_CONTROLLER:
+            virtual_handle_le_command(vc, now_us, opcode, command);
+            break;
+        default:
+            virtual_command_complete_status(vc, now_us, opcode, 0);
+            break;
+    }
+}
+
+//
+// data
+//
+
+static void virtual_handle_acl_data(virtual_controller_t * vc, uint32_t now_us, uint8_t * packet, uint16_t size){
+    virtual_connection_t * conn = virtual_connection_for_handle(vc, READ_ACL_CONNECTION_HANDLE(packet));
+    if (!conn || conn->link_type == VIRTUAL_LINK_SCO){
+        log_error("virtual_controller: ACL data for unknown handle 0x%04x", READ_ACL_CONNECTION_HANDLE(packet));
+        return;
+    }
+    if (conn->state != VIRTUAL_CONNECTION_OPEN){
+        log_info("virtual_controller: drop ACL data for handle 0x%04x, connection not open", conn->handle);
+        return;
+    }
+    uint16_t max_length = vc->config.acl_packet_length;
+    uint16_t max_packets = vc->config.acl_packets;
+    if (conn->link_type == VIRTUAL_LINK_LE && vc->config.le_packet_length){
+        max_length = vc->config.le_packet_length;
+        max_packets = vc->config.le_packets;
+    }
+    if (READ_ACL_LENGTH(packet) > max_length || size != HCI_ACL_HEADER_SIZE + READ_ACL_LENGTH(packet)){
+        log_error("virtual_controller: invalid ACL packet of size %u, max %u", size, max_length);
+        return;
+    }
+    uint16_t * in_buffer = virtual_buffer_counter_for_link_type(vc, conn->link_type);
+    if (*in_buffer >= max_packets){
+        log_error("virtual_controller: ACL data buffer overflow");
+        uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_DATA_BUFFER_OVERFLOW, 1);
+        event[2] = 0x01;
+        return;
+    }
+    // transmission occupies link, Number Of Completed Packets when done
+    uint32_t start_us = now_us;
+    if (vc->acl_packets_in_buffer || vc->le_packets_in_buffer){
+        start_us = virtual_later(now_us, vc->link_busy_until_us);
+    }
+    (*in_buffer)++;
+    vc->link_busy_until_us = start_us + virtual_transmission_us(size, vc->config.bandwidth);
+    virtual_host_packet(vc, vc->link_busy_until_us, VIRTUAL_PACKET_COMPLETED, conn->handle, 0);
+    virtual_air_send_connection(vc, vc->link_busy_until_us, conn, AIR_ACL_DATA, packet, size);
+}
+
+static void virtual_handle_sco_data(virtual_controller_t * vc, uint32_t now_us, uint8_t * packet, uint16_t size){
+    virtual_connection_t * conn = virtual_connection_for_handle(vc, READ_ACL_CONNECTION_HANDLE(packet));
+    if (!conn || conn->link_type != VIRTUAL_LINK_SCO || conn->state != VIRTUAL_CONNECTION_OPEN){
+        log_error("virtual_controller: SCO data for unknown handle 0x%04x", READ_ACL_CONNECTION_HANDLE(packet));
+        return;
+    }
+    if (size > HCI_SCO_HEADER_SIZE + vc->config.sco_packet_length){
+        log_error("virtual_controller: invalid SCO packet of size %u", size);
+        return;
+    }
+    // SCO link has a fixed rate, independent from ACL traffic, transmission of
+    // queued packet ends one latency before it is due at peer
+    uint32_t start_us = now_us;
+    virtual_packet_t * last = virtual_air_last_queued(vc, conn);
+    if (last){
+        start_us = virtual_later(now_us, last->due_us - vc->config.latency_us);
+    }
+    uint32_t end_us = start_us + virtual_transmission_us(size - HCI_SCO_HEADER_SIZE, vc->config.sco_bandwidth);
+    if (vc->synchronous_flow_control){
+        if (vc->sco_packets_in_buffer >= vc->config.sco_packets){
+            log_error("virtual_controller: SCO data buffer overflow");
+            uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_DATA_BUFFER_OVERFLOW, 1);
+            event[2] = 0x00;
+            return;
+        }
+        vc->sco_packets_in_buffer++;
+        virtual_host_packet(vc, end_us, VIRTUAL_PACKET_COMPLETED, conn->handle, 0);
+    }
+    virtual_air_send_connection(vc, end_us, conn, AIR_SCO_DATA, packet, size);
+}
+
+//
+// air messages from other controllers
+//
+
+static void virtual_receive_connection_request(virtual_controller_t * vc, uint32_t now_us, uint8_t * message){
+    uint8_t   link_type = AIR_LINK_TYPE(message);
+    uint8_t * payload   = AIR_PAYLOAD(message);
+    // not connectable: initiator runs into page timeout
+    if (!vc->config.classic || !(vc->scan_enable & 0x02)) return;
+    if (virtual_connection_for_peer(vc, AIR_SOURCE(message), link_type)) return;
+    if (link_type == VIRTUAL_LINK_SCO && !virtual_connection_for_peer(vc, AIR_SOURCE(message), VIRTUAL_LINK_ACL)) return;
+
+    virtual_connection_t * conn = virtual_connection_create(vc, now_us, AIR_SOURCE(message), link_type, VIRTUAL_CONNECTION_W4_ACCEPT);
+    if (!conn){
+        uint8_t reason = ERROR_CODE_CONNECTION_REJECTED_DUE_TO_LIMITED_RESOURCES;
+        virtual_air_send(vc, now_us, NULL, AIR_CONNECTION_REJECT, link_type, AIR_SOURCE(message), &reason, 1);
+        return;
+    }
+    conn->role = 1;
+    memcpy(conn->peer_features, &payload[3], 8);
+    if (link_type == VIRTUAL_LINK_SCO){
+        conn->acl_handle = virtual_connection_for_peer(vc, AIR_SOURCE(message), VIRTUAL_LINK_ACL)->handle;
+    }
+    uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_CONNECTION_REQUEST, 10);
+    bt_flip_addr(&event[2], conn->peer_addr);
+    memcpy(&event[8], payload, 3);
+    event[11] = link_type == VIRTUAL_LINK_SCO ? 0x02 : 0x01;  // eSCO or ACL
+}
+
+static void virtual_receive_inquiry_response(virtual_controller_t * vc, uint32_t now_us, uint8_t * message){
+    uint8_t * payload = AIR_PAYLOAD(message);
+    uint8_t * event;
+    if (!vc->inquiry_active) return;
+    switch (vc->inquiry_mode){
+        case 0:
+            event = virtual_event(vc, now_us, HCI_EVENT_INQUIRY_RESULT, 15);
+            event[3 + 6] = 1;                               // page scan repetition mode R1
+            memcpy(&event[3 + 9], payload, 3);
+            break;
+        case 1:
+            event = virtual_event(vc, now_us, HCI_EVENT_INQUIRY_RESULT_WITH_RSSI, 15);
+            event[3 + 6] = 1;
+            memcpy(&event[3 + 8], payload, 3);
+            event[3 + 13] = (uint8_t) -40;
+            break;
+        default:
+            event = virtual_event(vc, now_us, HCI_EVENT_EXTENDED_INQUIRY_RESPONSE, 255);
+            event[3 + 6] = 1;
+            memcpy(&event[3 + 8], payload, 3);
+            event[3 + 13] = (uint8_t) -40;
+            memcpy(&event[3 + 14], &payload[3], 240);
+            break;
+    }
+    event[2] = 1;
+    bt_flip_addr(&event[3], AIR_SOURCE(message));
+    vc->inquiry_responses++;
+    if (vc->inquiry_max_responses && vc->inquiry_responses >= vc->inquiry_max_responses){
+        vc->inquiry_active = 0;
+        virtual_event(vc, now_us, HCI_EVENT_INQUIRY_COMPLETE, 1);
+    }
+}
+
+void virtual_controller_receive(virtual_controller_t * vc, uint32_t now_us, uint8_t * message, uint16_t size){
+    if (size < VIRTUAL_AIR_HEADER_SIZE) return;
+    // own broadcasts
+    if (BD_ADDR_CMP(AIR_SOURCE(message), vc->config.bd_addr) == 0) return;
+
+    uint8_t   type      = AIR_TYPE(message);
+    uint8_t   link_type = AIR_LINK_TYPE(message);
+    uint8_t * payload   = AIR_PAYLOAD(message);
+    uint8_t * event;
+
+    // connection-less messages
+    switch (type){
+        case AIR_INQUIRY:
+            if (!vc->config.classic || !(vc->scan_enable & 0x01)) return;
+            {
+                uint8_t response[243];
+                memcpy(&response[0], vc->class_of_device, 3);
+                memcpy(&response[3], vc->eir, 240);
+                virtual_air_send(vc, now_us, NULL, AIR_INQUIRY_RESPONSE, VIRTUAL_LINK_NONE, AIR_SOURCE(message), response, sizeof(response));
+            }
+            return;
+        case AIR_INQUIRY_RESPONSE:
+            virtual_receive_inquiry_response(vc, now_us, message);
+            return;
+        case AIR_NAME_REQUEST:
+            if (!vc->config.classic) return;
+            if (!(vc->scan_enable & 0x02) && !virtual_connection_for_peer(vc, AIR_SOURCE(message), VIRTUAL_LINK_ACL)) return;
+            virtual_air_send(vc, now_us, NULL, AIR_NAME_RESPONSE, VIRTUAL_LINK_NONE, AIR_SOURCE(message), vc->local_name, 248);
+            return;
+        case AIR_NAME_RESPONSE:
+            if (!vc->name_request_active || BD_ADDR_CMP(vc->name_request_addr, AIR_SOURCE(message))) return;
+            vc->name_request_active = 0;
+            event = virtual_event(vc, now_us, HCI_EVENT_REMOTE_NAME_REQUEST_COMPLETE, 255);
+            bt_flip_addr(&event[3], vc->name_request_addr);
+            memcpy(&event[9], payload, 248);
+            return;
+        case AIR_CONNECTION_REQUEST:
+            virtual_receive_connection_request(vc, now_us, message);
+            return;
+        case AIR_LE_ADVERTISEMENT:
+            if (vc->config.le) {
+                virtual_le_handle_advertisement(vc, now_us, message);
+            }
+            return;
+        case AIR_LE_CONNECT:
+            if (vc->config.le) {
+                virtual_le_handle_connect(vc, now_us, message);
+            }
+            return;
+        default:
+            break;
+    }
+
+    virtual_connection_t * conn = virtual_connection_for_peer(vc, AIR_SOURCE(message), link_type);
+    if (!conn){
+        // accepted after outgoing connection was cancelled or timed out
+        if (type == AIR_CONNECTION_ACCEPT){
+            uint8_t reason = ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST;
+            virtual_air_send(vc, now_us, NULL, AIR_DISCONNECT, link_type, AIR_SOURCE(message), &reason, 1);
+        }
+        return;
+    }
+
+    switch (type){
+        case AIR_CONNECTION_ACCEPT:
+            if (conn->state != VIRTUAL_CONNECTION_PAGING) break;
+            conn->state = VIRTUAL_CONNECTION_OPEN;
+            memcpy(conn->peer_features, payload, 8);
+            virtual_emit_connection_complete(vc, now_us, conn, 0);
+            break;
+        case AIR_CONNECTION_REJECT:
+            if (conn->state != VIRTUAL_CONNECTION_PAGING && conn->state != VIRTUAL_CONNECTION_W4_ACCEPT) break;
+            virtual_emit_connection_complete(vc, now_us, conn, payload[0]);
+            virtual_connection_free(vc, conn);
+            break;
+        case AIR_DISCONNECT:
+            if (conn->state != VIRTUAL_CONNECTION_OPEN) break;
+            virtual_disconnect(vc, now_us, conn, payload[0]);
+            break;
+
+        case AIR_ACL_DATA:
+            if (conn->state != VIRTUAL_CONNECTION_OPEN) break;
+            bt_store_16(message, VIRTUAL_AIR_HEADER_SIZE, (READ_BT_16(payload, 0) & 0xf000) | conn->handle);
+            {
+                uint8_t * packet = virtual_host_packet(vc, now_us, HCI_ACL_DATA_PACKET, conn->handle, size - VIRTUAL_AIR_HEADER_SIZE);
+                memcpy(packet, payload, size - VIRTUAL_AIR_HEADER_SIZE);
+            }
+            break;
+        case AIR_SCO_DATA:
+            if (conn->state != VIRTUAL_CONNECTION_OPEN) break;
+            bt_store_16(message, VIRTUAL_AIR_HEADER_SIZE, (READ_BT_16(payload, 0) & 0xf000) | conn->handle);
+            {
+                uint8_t * packet = virtual_host_packet(vc, now_us, HCI_SCO_DATA_PACKET, conn->handle, size - VIRTUAL_AIR_HEADER_SIZE);
+                memcpy(packet, payload, size - VIRTUAL_AIR_HEADER_SIZE);
+            }
+            break;
+
+        // Classic authentication and pairing
+        case AIR_AUTH_KEY:
+            memcpy(conn->link_key, payload, 16);
+            conn->auth_flags &= VIRTUAL_AUTH_FLAG_LINK_KEY_VALID;
+            conn->auth_state = VIRTUAL_AUTH_W4_LINK_KEY_REPLY;
+            virtual_emit_addr_event(vc, now_us, HCI_EVENT_LINK_KEY_REQUEST, conn);
+            break;
+        case AIR_AUTH_RESULT:
+            if (conn->auth_state != VIRTUAL_AUTH_W4_PEER_AUTH_RESULT) break;
+            if (!payload[0]){
+                conn->auth_flags |= VIRTUAL_AUTH_FLAG_LINK_KEY_VALID;
+            }
+            conn->auth_state = VIRTUAL_AUTH_IDLE;
+            virtual_emit_authentication_complete(vc, now_us, conn, payload[0]);
+            break;
+        case AIR_IO_CAPABILITY_REQUEST:
+            conn->auth_flags = (conn->auth_flags & VIRTUAL_AUTH_FLAG_LINK_KEY_VALID) | VIRTUAL_AUTH_FLAG_SSP;
+            conn->auth_state = VIRTUAL_AUTH_W4_IO_CAPABILITY_REPLY;
+            conn->peer_io_capability = payload[0];
+            virtual_emit_io_capability_response(vc, now_us, conn, payload);
+            virtual_emit_addr_event(vc, now_us, HCI_EVENT_IO_CAPABILITY_REQUEST, conn);
+            break;
+        case AIR_IO_CAPABILITY_RESPONSE:
+            if (conn->auth_state != VIRTUAL_AUTH_W4_PEER_IO_CAPABILITY) break;
+            conn->peer_io_capability = payload[0];
+            conn->auth_state = VIRTUAL_AUTH_W4_USER_CONFIRMATION;
+            virtual_random_bytes(vc, conn->link_key, 16);
+            virtual_emit_io_capability_response(vc, now_us, conn, payload);
+            virtual_emit_user_confirmation_request(vc, now_us, conn);
+            break;
+        case AIR_USER_CONFIRMATION:
+            if (conn->auth_state != VIRTUAL_AUTH_W4_USER_CONFIRMATION) break;
+            conn->auth_flags |= VIRTUAL_AUTH_FLAG_PEER_CONFIRMED;
+            if (!(conn->auth_flags & VIRTUAL_AUTH_FLAG_INITIATOR)){
+                memcpy(conn->link_key, payload, 16);
+            }
+            virtual_user_confirmation_check(vc, now_us, conn);
+            break;
+        case AIR_PIN:
+            conn->auth_flags &= VIRTUAL_AUTH_FLAG_LINK_KEY_VALID;
+            conn->auth_state = VIRTUAL_AUTH_W4_PIN_REPLY;
+            conn->pin_len = payload[0] > 16 ? 16 : payload[0];
+            memcpy(conn->pin, &payload[1], 16);
+            virtual_emit_addr_event(vc, now_us, HCI_EVENT_PIN_CODE_REQUEST, conn);
+            break;
+        case AIR_PIN_RESULT:
+            if (conn->auth_state != VIRTUAL_AUTH_W4_PEER_PIN_RESULT) break;
+            memcpy(conn->link_key, payload, 16);
+            conn->link_key_type = COMBINATION_KEY;
+            virtual_pairing_done(vc, now_us, conn, 0);
+            break;
+        case AIR_PAIRING_FAILED:
+            if (conn->auth_state == VIRTUAL_AUTH_IDLE) break;
+            virtual_pairing_done(vc, now_us, conn, payload[0]);
+            break;
+        case AIR_ENCRYPTION:
+            conn->encrypted = payload[0];
+            virtual_emit_encryption_change(vc, now_us, conn, 0);
+            virtual_air_send_status(vc, now_us, conn, AIR_ENCRYPTION_RESULT, payload[0]);
+            break;
+        case AIR_ENCRYPTION_RESULT:
+            conn->encrypted = payload[0];
+            virtual_emit_encryption_change(vc, now_us, conn, 0);
+            break;
+
+        // LE
+        case AIR_LE_CONNECTION_UPDATE:
+            conn->le_interval = READ_BT_16(payload, 0);
+            conn->le_latency = READ_BT_16(payload, 2);
+            conn->le_supervision_timeout = READ_BT_16(payload, 4);
+            virtual_emit_le_connection_update_complete(vc, now_us, conn);
+            break;
+        case AIR_LE_ENCRYPTION_REQUEST:
+            conn->auth_state = VIRTUAL_AUTH_W4_LTK_REPLY;
+            memcpy(conn->link_key, &payload[10], 16);
+            event = virtual_le_event(vc, now_us, HCI_SUBEVENT_LE_LONG_TERM_KEY_REQUEST, 12);
+            bt_store_16(event, 3, conn->handle);
+            memcpy(&event[5], payload, 10);                 // random, ediv
+            break;
+        case AIR_LE_ENCRYPTION_RESULT:
+            if (conn->auth_state != VIRTUAL_AUTH_W4_PEER_LE_ENCRYPTION) break;
+            conn->auth_state = VIRTUAL_AUTH_IDLE;
+            if (!payload[0]){
+                conn->encrypted = 1;
+            }
+            virtual_emit_encryption_change(vc, now_us, conn, payload[0]);
+            break;
+        default:
+            log_error("virtual_controller: unknown air message 0x%02x", type);
+            break;
+    }
+}
+
+//
+// API
+//
+
+void virtual_controller_config_init(virtual_controller_config_t * config, const bd_addr_t bd_addr){
+    memset(config, 0, sizeof(virtual_controller_config_t));
+    BD_ADDR_COPY(config->bd_addr, bd_addr);
+    config->classic = 1;
+    config->le = 1;
+    config->ssp = 1;
+    config->acl_packet_length = 1021;
+    config->acl_packets = 4;
+    config->sco_packet_length = 60;
+    config->sco_packets = 4;
+    config->le_packet_length = 27;
+    config->le_packets = 8;
+    config->bandwidth = 125000;
+    config->latency_us = 1000;
+    config->sco_bandwidth = 8000;
+}
+
+void virtual_controller_init(virtual_controller_t * vc, const virtual_controller_config_t * config,
+    virtual_controller_host_handler_t host_handler, virtual_controller_air_handler_t air_handler, void * context){
+    memset(vc, 0, sizeof(virtual_controller_t));
+    vc->config = *config;
+    vc->host_handler = host_handler;
+    vc->air_handler = air_handler;
+    vc->context = context;
+    vc->random = READ_BT_32(config->bd_addr, 0) ^ (READ_BT_16(config->bd_addr, 4) << 16) ^ 0x9e3779b9;
+    if (!vc->random) vc->random = 1;
+    virtual_reset(vc);
+}
+
+void virtual_controller_close(virtual_controller_t * vc){
+    virtual_reset(vc);
+}
+
+void virtual_controller_send_packet(virtual_controller_t * vc, uint32_t now_us, uint8_t packet_type, uint8_t * packet, uint16_t size){
+    switch (packet_type){
+        case HCI_COMMAND_DATA_PACKET:
+            if (size < 3) return;
+            virtual_handle_command(vc, now_us, packet, size);
+            break;
+        case HCI_ACL_DATA_PACKET:
+            if (size < HCI_ACL_HEADER_SIZE) return;
+            virtual_handle_acl_data(vc, now_us, packet, size);
+            break;
+        case HCI_SCO_DATA_PACKET:
+            if (size < HCI_SCO_HEADER_SIZE) return;
+            virtual_handle_sco_data(vc, now_us, packet, size);
+            break;
+        default:
+            break;
+    }
+}
+
+// @returns first packet for host that can be delivered, ACL data waits for host buffers
+static virtual_packet_t * virtual_next_host_packet(virtual_controller_t * vc){
+    int host_full = vc->host_flow_control && vc->host_acl_packets && vc->host_acl_packets_used >= vc->host_acl_packets;
+    linked_item_t * it;
+    for (it = (linked_item_t *) vc->host_queue; it; it = it->next){
+        virtual_packet_t * packet = (virtual_packet_t *) it;
+        if (host_full && packet->type == HCI_ACL_DATA_PACKET) continue;
+        return packet;
+    }
+    return NULL;
+}
+
+static void virtual_deliver(virtual_controller_t * vc, virtual_packet_t * packet){
+    virtual_connection_t * conn;
+    switch (packet->type){
+        case VIRTUAL_PACKET_COMPLETED:{
+            conn = virtual_connection_for_handle(vc, packet->handle);
+            if (!conn) return;
+            uint16_t * in_buffer = virtual_buffer_counter_for_link_type(vc, conn->link_type);
+            if (*in_buffer) (*in_buffer)--;
+            uint8_t event[7];
+            event[0] = HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS;
+            event[1] = sizeof(event) - 2;
+            event[2] = 1;
+            bt_store_16(event, 3, packet->handle);
+            bt_store_16(event, 5, 1);
+            vc->host_handler(vc, HCI_EVENT_PACKET, event, sizeof(event));
+            return;
+        }
+        case HCI_ACL_DATA_PACKET:
+            if (vc->host_flow_control){
+                vc->host_acl_packets_used++;
+            }
+            break;
+        case HCI_EVENT_PACKET:
+            // connection handle becomes invalid with Disconnection Complete
+            if (packet->data[0] != HCI_EVENT_DISCONNECTION_COMPLETE || packet->data[2]) break;
+            conn = virtual_connection_for_handle(vc, READ_BT_16(packet->data, 3));
+            if (conn){
+                virtual_connection_free(vc, conn);
+            }
+            break;
+        default:
+            break;
+    }
+    vc->host_handler(vc, packet->type, packet->data, packet->size);
+}
+
+static void virtual_process_timeouts(virtual_controller_t * vc, uint32_t now_us){
+    int i;
+    for (i = 0; i < VIRTUAL_CONTROLLER_MAX_CONNECTIONS; i++){
+        virtual_connection_t * conn = &vc->connections[i];
+        if (conn->state != VIRTUAL_CONNECTION_PAGING) continue;
+        if (virtual_before(now_us, conn->timeout_us)) continue;
+        virtual_emit_connection_complete(vc, now_us, conn, ERROR_CODE_PAGE_TIMEOUT);
+        virtual_connection_free(vc, conn);
+    }
+    if (vc->name_request_active && !virtual_before(now_us, vc->name_request_timeout_us)){
+        vc->name_request_active = 0;
+        uint8_t * event = virtual_event(vc, now_us, HCI_EVENT_REMOTE_NAME_REQUEST_COMPLETE, 255);
+        event[2] = ERROR_CODE_PAGE_TIMEOUT;
+        bt_flip_addr(&event[3], vc->name_request_addr);
+    }
+    if (vc->inquiry_active && !virtual_before(now_us, vc->inquiry_end_us)){
+        vc->inquiry_active = 0;
+        virtual_event(vc, now_us, HCI_EVENT_INQUIRY_COMPLETE, 1);
+    }
+    if (vc->adv_enabled && !virtual_before(now_us, vc->adv_next_us)){
+        virtual_le_advertise(vc, now_us);
+        uint32_t interval_us = vc->adv_interval * 625;
+        vc->adv_next_us += interval_us;
+        // don't catch up on missed advertisements
+        if (virtual_before(vc->adv_next_us, now_us)){
+            vc->adv_next_us = now_us + interval_us;
+        }
+    }
+}
+
+void virtual_controller_process(virtual_controller_t * vc, uint32_t now_us){
+    virtual_process_timeouts(vc, now_us);
+
+    // air messages
+    if (vc->air_blocked && virtual_before(now_us, vc->air_retry_us)) return;
+    vc->air_blocked = 0;
+    while (vc->air_queue){
+        virtual_packet_t * packet = (virtual_packet_t *) vc->air_queue;
+        if (virtual_before(now_us, packet->due_us)) break;
+        const uint8_t * destination = BD_ADDR_CMP(packet->destination, broadcast_addr) ? packet->destination : NULL;
+        if (vc->air_handler(vc, destination, packet->data, packet->size)){
+            vc->air_blocked = 1;
+            vc->air_retry_us = now_us + VIRTUAL_AIR_RETRY_US;
+            break;
+        }
+        linked_list_remove(&vc->air_queue, (linked_item_t *) packet);
+        free(packet);
+    }
+
+    // host, packets can be added while host handler runs
+    while (1){
+        virtual_packet_t * packet = virtual_next_host_packet(vc);
+        if (!packet) break;
+        if (virtual_before(now_us, packet->due_us)) break;
+        linked_list_remove(&vc->host_queue, (linked_item_t *) packet);
+        virtual_deliver(vc, packet);
+        free(packet);
+    }
+}
+
+int virtual_controller_next_event(virtual_controller_t * vc, uint32_t now_us, uint32_t * when_us){
+    int pending = 0;
+    uint32_t next = 0;
+    int i;
+
+#define VIRTUAL_NEXT(time) { uint32_t t = (time); if (!pending || virtual_before(t, next)) next = t; pending = 1; }
+
+    virtual_packet_t * packet = virtual_next_host_packet(vc);
+    if (packet) VIRTUAL_NEXT(packet->due_us);
+    if (vc->air_blocked){
+        VIRTUAL_NEXT(vc->air_retry_us);
+    } else if (vc->air_queue){
+        VIRTUAL_NEXT(((virtual_packet_t *) vc->air_queue)->due_us);
+    }
+    for (i = 0; i < VIRTUAL_CONTROLLER_MAX_CONNECTIONS; i++){
+        if (vc->connections[i].state != VIRTUAL_CONNECTION_PAGING) continue;
+        VIRTUAL_NEXT(vc->connections[i].timeout_us);
+    }
+    if (vc->name_request_active) VIRTUAL_NEXT(vc->name_request_timeout_us);
+    if (vc->inquiry_active)      VIRTUAL_NEXT(vc->inquiry_end_us);
+    if (vc->adv_enabled)         VIRTUAL_NEXT(vc->adv_next_us);
+
+#undef VIRTUAL_NEXT
+
+    if (!pending) return 0;
+    // due already
+    if (virtual_before(next, now_us)) next = now_us;
+    *when_us = next;
+    return 1;
+}
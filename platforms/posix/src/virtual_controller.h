@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  virtual_controller.h
+ *
+ *  Software model of a Bluetooth controller for simulation and benchmarks
+ *
+ *  A virtual controller executes HCI commands from its host and talks to other virtual
+ *  controllers through "air" messages. It models connection setup for Classic, SCO and LE,
+ *  ACL flow control with the configured buffer count and size, link bandwidth and latency,
+ *  inquiry, advertising and scanning, pairing and encryption.
+ *
+ *  The model has no notion of time or I/O: all functions get the current time, packets for
+ *  the host and air messages are passed to the handlers given to virtual_controller_init.
+ *  See hci_transport_virtual.c for an HCI transport that runs it on the POSIX run loop.
+ */
+
+#ifndef __VIRTUAL_CONTROLLER_H
+#define __VIRTUAL_CONTROLLER_H
+
+#include <stdint.h>
+
+#include <btstack/linked_list.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#ifndef VIRTUAL_CONTROLLER_MAX_CONNECTIONS
+#define VIRTUAL_CONTROLLER_MAX_CONNECTIONS 8
+#endif
+
+#ifndef VIRTUAL_CONTROLLER_WHITE_LIST_SIZE
+#define VIRTUAL_CONTROLLER_WHITE_LIST_SIZE 8
+#endif
+
+// advertisers reported since LE Set Scan Enable with duplicate filtering
+#ifndef VIRTUAL_CONTROLLER_SCAN_FILTER_SIZE
+#define VIRTUAL_CONTROLLER_SCAN_FILTER_SIZE 16
+#endif
+
+// type, link type, source and destination address
+#define VIRTUAL_AIR_HEADER_SIZE 14
+// largest air message: ACL packet, or advertisement and remote name
+#define VIRTUAL_AIR_MAX_SIZE (VIRTUAL_AIR_HEADER_SIZE + (HCI_PACKET_BUFFER_SIZE > 300 ? HCI_PACKET_BUFFER_SIZE : 300))
+
+typedef struct {
+    bd_addr_t bd_addr;              // public address, also used to route air messages
+    uint8_t   classic;              // BR/EDR supported
+    uint8_t   le;                   // LE supported
+    uint8_t   ssp;                  // Secure Simple Pairing supported, otherwise legacy PIN pairing
+    // Read Buffer Size / LE Read Buffer Size
+    uint16_t  acl_packet_length;
+    uint16_t  acl_packets;
+    uint8_t   sco_packet_length;
+    uint16_t  sco_packets;
+    uint16_t  le_packet_length;     // 0 = LE shares ACL buffers
+    uint8_t   le_packets;
+    // link model, shared by all ACL and LE connections
+    uint32_t  bandwidth;            // bytes per second, 0 = unlimited
+    uint32_t  latency_us;           // added to every air message
+    uint32_t  sco_bandwidth;        // bytes per second of each SCO connection
+} virtual_controller_config_t;
+
+// packet for host or air message waiting for its due time
+typedef struct {
+    linked_item_t    item;
+    uint32_t         due_us;
+    uint8_t          type;          // HCI packet type, VIRTUAL_PACKET_COMPLETED or air message type
+    hci_con_handle_t handle;        // connection the packet belongs to, 0xffff for none
+    bd_addr_t        destination;   // air messages only
+    uint16_t         size;
+    uint8_t        * data;
+} virtual_packet_t;
+
+typedef struct {
+    uint8_t          state;
+    uint8_t          link_type;     // VIRTUAL_LINK_ACL, VIRTUAL_LINK_SCO or VIRTUAL_LINK_LE
+    uint8_t          role;          // 0 = master, 1 = slave
+    hci_con_handle_t handle;
+    hci_con_handle_t acl_handle;    // SCO: ACL connection to the same device
+    bd_addr_t        peer;          // routing address of the remote controller
+    uint8_t          peer_addr_type;
+    bd_addr_t        peer_addr;     // remote address as reported to the host
+    uint8_t          peer_features[8];
+    uint32_t         timeout_us;    // outgoing connection: page timeout
+    uint16_t         le_interval;
+    uint16_t         le_latency;
+    uint16_t         le_supervision_timeout;
+    // security
+    uint8_t          auth_state;
+    uint8_t          auth_flags;
+    uint8_t          link_key[16];
+    uint8_t          link_key_type;
+    uint8_t          encrypted;
+    uint8_t          peer_io_capability;
+    uint8_t          local_io_capability;
+    uint8_t          pin[16];
+    uint8_t          pin_len;
+} virtual_connection_t;
+
+typedef struct virtual_controller virtual_controller_t;
+
+// @param packet is only valid during the call
+typedef void (*virtual_controller_host_handler_t)(virtual_controller_t * controller, uint8_t packet_type, uint8_t * packet, uint16_t size);
+// @param destination of unicast message, NULL for broadcast
+// @returns 0 if sent, != 0 if message could not be queued and should be retried later
+typedef int  (*virtual_controller_air_handler_t)(virtual_controller_t * controller, const uint8_t * destination, uint8_t * message, uint16_t size);
+
+struct virtual_controller {
+    virtual_controller_config_t config;
+    virtual_controller_host_handler_t host_handler;
+    virtual_controller_air_handler_t  air_handler;
+    void * context;
+
+    linked_list_t    host_queue;    // events and data for host, sorted by due time
+    linked_list_t    air_queue;     // air messages, sorted by due time
+    uint32_t         link_busy_until_us;    // valid while ACL or LE packets are in controller buffers
+    uint32_t         air_retry_us;
+    uint8_t          air_blocked;
+    uint32_t         random;
+
+    // host configuration
+    uint8_t          local_name[248];
+    uint8_t          class_of_device[3];
+    uint8_t          scan_enable;
+    uint8_t          simple_pairing_mode;
+    uint8_t          inquiry_mode;
+    uint8_t          eir[240];
+    uint16_t         page_timeout;
+    uint8_t          synchronous_flow_control;
+    uint8_t          host_flow_control;
+    uint16_t         host_acl_packets;
+    uint16_t         host_acl_packets_used;
+    uint16_t         acl_packets_in_buffer;
+    uint16_t         sco_packets_in_buffer;
+    uint16_t         le_packets_in_buffer;
+    hci_con_handle_t next_handle;
+
+    // inquiry and remote name request
+    uint8_t          inquiry_active;
+    uint8_t          inquiry_max_responses;
+    uint8_t          inquiry_responses;
+    uint32_t         inquiry_end_us;
+    uint8_t          name_request_active;
+    bd_addr_t        name_request_addr;
+    uint32_t         name_request_timeout_us;
+
+    // LE
+    bd_addr_t        random_addr;
+    uint16_t         adv_interval;
+    uint8_t          adv_type;
+    uint8_t          adv_own_addr_type;
+    uint8_t          adv_direct_addr_type;
+    bd_addr_t        adv_direct_addr;
+    uint8_t          adv_data_len;
+    uint8_t          adv_data[31];
+    uint8_t          scan_response_len;
+    uint8_t          scan_response[31];
+    uint8_t          adv_enabled;
+    uint32_t         adv_next_us;
+    uint8_t          scan_type;
+    uint8_t          scan_own_addr_type;
+    uint8_t          scan_filter_policy;
+    uint8_t          scan_enabled;
+    uint8_t          scan_filter_duplicates;
+    uint8_t          scan_reported;
+    bd_addr_t        scan_reported_addr[VIRTUAL_CONTROLLER_SCAN_FILTER_SIZE];
+    uint8_t          initiating;
+    uint8_t          initiator_filter_policy;
+    uint8_t          initiator_peer_addr_type;
+    bd_addr_t        initiator_peer_addr;
+    uint8_t          initiator_own_addr_type;
+    uint16_t         initiator_interval;
+    uint16_t         initiator_latency;
+    uint16_t         initiator_supervision_timeout;
+    uint8_t          white_list_num;
+    uint8_t          white_list_addr_type[VIRTUAL_CONTROLLER_WHITE_LIST_SIZE];
+    bd_addr_t        white_list_addr[VIRTUAL_CONTROLLER_WHITE_LIST_SIZE];
+
+    virtual_connection_t connections[VIRTUAL_CONTROLLER_MAX_CONNECTIONS];
+};
+
+// Classic, LE and SSP, 4 ACL buffers of 1021 bytes, 1 Mbit/s link with 1 ms latency
+void virtual_controller_config_init(virtual_controller_config_t * config, const bd_addr_t bd_addr);
+
+void virtual_controller_init(virtual_controller_t * controller, const virtual_controller_config_t * config,
+    virtual_controller_host_handler_t host_handler, virtual_controller_air_handler_t air_handler, void * context);
+
+// free queued packets
+void virtual_controller_close(virtual_controller_t * controller);
+
+// HCI command, ACL or SCO packet from host
+void virtual_controller_send_packet(virtual_controller_t * controller, uint32_t now_us, uint8_t packet_type, uint8_t * packet, uint16_t size);
+
+// air message from another virtual controller
+void virtual_controller_receive(virtual_controller_t * controller, uint32_t now_us, uint8_t * message, uint16_t size);
+
+// deliver packets and air messages that are due, run timeouts, advertise
+void virtual_controller_process(virtual_controller_t * controller, uint32_t now_us);
+
+// @returns 1 and time of the next virtual_controller_process call that has work, 0 if idle
+int virtual_controller_next_event(virtual_controller_t * controller, uint32_t now_us, uint32_t * when_us);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __VIRTUAL_CONTROLLER_H
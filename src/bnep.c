@@ -74,6 +74,9 @@ static void (*app_packet_handler)(void * connection, uint8_t packet_type,
 static bnep_channel_t * bnep_channel_for_l2cap_cid(uint16_t l2cap_cid);
 static void bnep_channel_finalize(bnep_channel_t *channel);
 static void bnep_run(void);
+
+// bnep_run is called once after a batch of packets
+static hci_deferred_run_t bnep_deferred_run;
 static void bnep_channel_start_timer(bnep_channel_t *channel, int timeout);
 inline static void bnep_channel_state_add(bnep_channel_t *channel, BNEP_CHANNEL_STATE_VAR event);
 
@@ -1521,6 +1524,8 @@ static void bnep_run(void)
 {
     linked_item_t *it;
     linked_item_t *next;
+
+    if (hci_defer_run(&bnep_deferred_run)) return;
     
     for (it = (linked_item_t *) bnep_channels; it ; it = next){
 
@@ -1541,6 +1546,7 @@ static void bnep_run(void)
 void bnep_init(void)
 {
     bnep_security_level = LEVEL_0;
+    hci_register_deferred_run(&bnep_deferred_run, &bnep_run);
 }
 
 void bnep_set_required_security_level(gap_security_level_t security_level)
@@ -48,6 +48,7 @@
 #include "gap.h"
 
 #include <stdarg.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -63,13 +64,21 @@
 #include "btstack_memory.h"
 #include "debug.h"
 #include "hci_dump.h"
+#include "hci_cmds_encoder.h"
 
 #include <btstack/linked_list.h>
 #include <btstack/hci_cmds.h>
 
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+#include "ad_parser.h"
+#endif
+
 #define HCI_CONNECTION_TIMEOUT_MS 10000
 
-#define HCI_INTIALIZING_SUBSTATE_AFTER_SLEEP 11
+// granularity of idle detection
+#define HCI_CONNECTION_IDLE_SWEEP_MS 1000
+
+#define HCI_INTIALIZING_SUBSTATE_AFTER_SLEEP 19
 
 #ifdef USE_BLUETOOL
 #include "../platforms/ios/src/bt_control_iphone.h"
@@ -77,11 +86,15 @@
 
 static void hci_update_scan_enable(void);
 static gap_security_level_t gap_security_level_for_connection(hci_connection_t * connection);
-static void hci_connection_timeout_handler(timer_source_t *timer);
-static void hci_connection_timestamp(hci_connection_t *connection);
+static void hci_connection_idle_sweep_handler(timer_source_t *timer);
+static void hci_connection_idle_sweep_stop(void);
 static int  hci_power_control_on(void);
 static void hci_power_control_off(void);
 static void hci_state_reset();
+static void hci_acl_tx_queue_flush(hci_connection_t * connection);
+static void hci_acl_rx_reset(hci_connection_t * connection);
+static int  hci_acl_tx_queue_can_accept(hci_connection_t * connection);
+static uint8_t * hci_cmd_buffer(void);
 
 // the STACK is here
 #ifndef HAVE_MALLOC
@@ -92,6 +105,99 @@ static hci_stack_t * hci_stack = NULL;
 // test helper
 static uint8_t disable_l2cap_timeouts = 0;
 
+static int hci_connection_handle_hash(hci_con_handle_t con_handle){
+    return con_handle % HCI_CONNECTION_HASH_SIZE;
+}
+
+static int hci_connection_address_hash(bd_addr_t addr, bd_addr_type_t addr_type){
+    uint32_t hash = addr_type;
+    int i;
+    for (i = 0; i < BD_ADDR_LEN; i++){
+        hash = hash * 31 + addr[i];
+    }
+    return hash % HCI_CONNECTION_HASH_SIZE;
+}
+
+// remove connection from hash bucket chain
+static void hci_connection_unlink(hci_connection_t ** bucket, hci_connection_t * conn, int by_handle){
+    while (*bucket){
+        if (*bucket == conn){
+            *bucket = by_handle ? conn->next_for_handle : conn->next_for_address;
+            return;
+        }
+        bucket = by_handle ? &(*bucket)->next_for_handle : &(*bucket)->next_for_address;
+    }
+}
+
+static void hci_connection_set_handle(hci_connection_t * conn, hci_con_handle_t con_handle){
+    hci_connection_unlink(&hci_stack->connections_by_handle[hci_connection_handle_hash(conn->con_handle)], conn, 1);
+    conn->con_handle = con_handle;
+    hci_connection_t ** bucket = &hci_stack->connections_by_handle[hci_connection_handle_hash(con_handle)];
+    conn->next_for_handle = *bucket;
+    *bucket = conn;
+}
+
+void hci_connection_request_service(hci_connection_t * connection){
+    if (connection->service_requested) return;
+    connection->service_requested = 1;
+    connection->next_to_service = NULL;
+    if (hci_stack->connections_to_service_last){
+        hci_stack->connections_to_service_last->next_to_service = connection;
+    } else {
+        hci_stack->connections_to_service = connection;
+    }
+    hci_stack->connections_to_service_last = connection;
+}
+
+static void hci_connection_service_done(hci_connection_t * connection){
+    if (!connection->service_requested) return;
+    connection->service_requested = 0;
+    hci_connection_t * previous = NULL;
+    hci_connection_t * it;
+    for (it = hci_stack->connections_to_service; it ; previous = it, it = it->next_to_service){
+        if (it != connection) continue;
+        if (previous){
+            previous->next_to_service = connection->next_to_service;
+        } else {
+            hci_stack->connections_to_service = connection->next_to_service;
+        }
+        if (hci_stack->connections_to_service_last == connection){
+            hci_stack->connections_to_service_last = previous;
+        }
+        return;
+    }
+}
+
+// update ACL packets in controller, counted separately for classic and LE as LE might have own buffers
+static void hci_acl_packets_sent_add(hci_connection_t * conn, int num_packets){
+    conn->num_acl_packets_sent += num_packets;
+    if (conn->address_type == BD_ADDR_TYPE_CLASSIC){
+        hci_stack->acl_packets_sent_classic += num_packets;
+    } else {
+        hci_stack->acl_packets_sent_le += num_packets;
+    }
+}
+
+// remove connection from list and hash tables and free it
+static void hci_connection_free(hci_connection_t * conn){
+    hci_connection_service_done(conn);
+    hci_connection_unlink(&hci_stack->connections_by_handle[hci_connection_handle_hash(conn->con_handle)], conn, 1);
+    hci_connection_unlink(&hci_stack->connections_by_address[hci_connection_address_hash(conn->address, conn->address_type)], conn, 0);
+    hci_acl_tx_queue_flush(conn);
+    hci_acl_rx_reset(conn);
+    // controller frees buffers of closed connections
+    hci_acl_packets_sent_add(conn, -conn->num_acl_packets_sent);
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    // controller drops buffer accounting for closed connections
+    hci_stack->host_acl_packets_completed -= conn->host_acl_packets_completed;
+#endif
+    linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
+    btstack_memory_hci_connection_free( conn );
+    if (!hci_stack->connections){
+        hci_connection_idle_sweep_stop();
+    }
+}
+
 /**
  * create connection for given address
  *
@@ -104,19 +210,28 @@ static hci_connection_t * create_connection_for_bd_addr_and_type(bd_addr_t addr,
     memset(conn, 0, sizeof(hci_connection_t));
     BD_ADDR_COPY(conn->address, addr);
     conn->address_type = addr_type;
-    conn->con_handle = 0xffff;
     conn->authentication_flags = AUTH_FLAGS_NONE;
     conn->bonding_flags = 0;
     conn->requested_security_level = LEVEL_0;
-    linked_item_set_user(&conn->timeout.item, conn);
-    conn->timeout.process = hci_connection_timeout_handler;
-    hci_connection_timestamp(conn);
+    conn->timestamp = run_loop_get_time_ms();
+    conn->acl_recombination_buffer = NULL;
     conn->acl_recombination_length = 0;
     conn->acl_recombination_pos = 0;
     conn->num_acl_packets_sent = 0;
     conn->num_sco_packets_sent = 0;
+    conn->acl_tx_queue = NULL;
+    conn->acl_tx_queue_len = 0;
+    conn->acl_tx_weight = HCI_ACL_TX_DEFAULT_WEIGHT;
+    conn->acl_tx_deficit = 0;
+    memset(&conn->acl_tx_stats, 0, sizeof(hci_acl_tx_stats_t));
     conn->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE;
     linked_list_add(&hci_stack->connections, (linked_item_t *) conn);
+    hci_connection_t ** bucket = &hci_stack->connections_by_address[hci_connection_address_hash(addr, addr_type)];
+    conn->next_for_address = *bucket;
+    *bucket = conn;
+    // index with invalid handle until connection is established
+    conn->con_handle = 0xffff;
+    hci_connection_set_handle(conn, 0xffff);
     return conn;
 }
 
@@ -160,10 +275,8 @@ void hci_connections_get_iterator(linked_list_iterator_t *it){
  * @return connection OR NULL, if not found
  */
 hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
-    linked_list_iterator_t it;
-    linked_list_iterator_init(&it, &hci_stack->connections);
-    while (linked_list_iterator_has_next(&it)){
-        hci_connection_t * item = (hci_connection_t *) linked_list_iterator_next(&it);
+    hci_connection_t * item = hci_stack->connections_by_handle[hci_connection_handle_hash(con_handle)];
+    for ( ; item ; item = item->next_for_handle){
         if ( item->con_handle == con_handle ) {
             return item;
         }
@@ -177,10 +290,8 @@ hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle){
  * @return connection OR NULL, if not found
  */
 hci_connection_t * hci_connection_for_bd_addr_and_type(bd_addr_t  addr, bd_addr_type_t addr_type){
-    linked_list_iterator_t it;
-    linked_list_iterator_init(&it, &hci_stack->connections);
-    while (linked_list_iterator_has_next(&it)){
-        hci_connection_t * connection = (hci_connection_t *) linked_list_iterator_next(&it);
+    hci_connection_t * connection = hci_stack->connections_by_address[hci_connection_address_hash(addr, addr_type)];
+    for ( ; connection ; connection = connection->next_for_address){
         if (connection->address_type != addr_type)  continue;
         if (memcmp(addr, connection->address, 6) != 0) continue;
         return connection;   
@@ -188,38 +299,52 @@ hci_connection_t * hci_connection_for_bd_addr_and_type(bd_addr_t  addr, bd_addr_
     return NULL;
 }
 
-static void hci_connection_timeout_handler(timer_source_t *timer){
-    hci_connection_t * connection = (hci_connection_t *) linked_item_get_user(&timer->item);
-#ifdef HAVE_TIME
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    if (tv.tv_sec >= connection->timestamp.tv_sec + HCI_CONNECTION_TIMEOUT_MS/1000) {
-        // connections might be timed out
+// single timer checks all connections for inactivity, packets only mark their connection as active
+static void hci_connection_idle_sweep_start(void){
+    if (hci_stack->connection_idle_timer_active) return;
+    hci_stack->connection_idle_timer_active = 1;
+    hci_stack->connection_idle_timer.process = hci_connection_idle_sweep_handler;
+    run_loop_set_timer(&hci_stack->connection_idle_timer, HCI_CONNECTION_IDLE_SWEEP_MS);
+    run_loop_add_timer(&hci_stack->connection_idle_timer);
+}
+
+static void hci_connection_idle_sweep_stop(void){
+    if (!hci_stack->connection_idle_timer_active) return;
+    hci_stack->connection_idle_timer_active = 0;
+    run_loop_remove_timer(&hci_stack->connection_idle_timer);
+}
+
+static void hci_connection_idle_sweep_handler(timer_source_t *timer){
+    hci_stack->connection_idle_timer_active = 0;
+    uint32_t now = run_loop_get_time_ms();
+    linked_list_iterator_t it;
+    linked_list_iterator_init(&it, &hci_stack->connections);
+    while (linked_list_iterator_has_next(&it)){
+        hci_connection_t * connection = (hci_connection_t *) linked_list_iterator_next(&it);
+        if (connection->address_type != BD_ADDR_TYPE_CLASSIC || connection->state != OPEN) continue;
+        if (connection->active){
+            connection->active = 0;
+            connection->timestamp = now;
+            continue;
+        }
+        if (now - connection->timestamp < HCI_CONNECTION_TIMEOUT_MS) continue;
+        // connections might be timed out, check again after HCI_CONNECTION_TIMEOUT_MS
+        connection->timestamp = now;
         hci_emit_l2cap_check_timeout(connection);
     }
-#endif
-#ifdef HAVE_TICK
-    if (embedded_get_ticks() > connection->timestamp + embedded_ticks_for_ms(HCI_CONNECTION_TIMEOUT_MS)){
-        // connections might be timed out
-        hci_emit_l2cap_check_timeout(connection);
+    if (hci_stack->connections){
+        hci_connection_idle_sweep_start();
     }
-#endif
-    run_loop_set_timer(timer, HCI_CONNECTION_TIMEOUT_MS);
-    run_loop_add_timer(timer);
 }
 
-static void hci_connection_timestamp(hci_connection_t *connection){
-#ifdef HAVE_TIME
-    gettimeofday(&connection->timestamp, NULL);
-#endif
-#ifdef HAVE_TICK
-    connection->timestamp = embedded_get_ticks();
-#endif
+static inline void hci_connection_set_active(hci_connection_t *connection){
+    connection->active = 1;
 }
 
 
 inline static void connectionSetAuthenticationFlags(hci_connection_t * conn, hci_authentication_flags_t flags){
     conn->authentication_flags = (hci_authentication_flags_t)(conn->authentication_flags | flags);
+    hci_connection_request_service(conn);
 }
 
 inline static void connectionClearAuthenticationFlags(hci_connection_t * conn, hci_authentication_flags_t flags){
@@ -238,7 +363,7 @@ static void hci_add_connection_flags_for_flipped_bd_addr(uint8_t *bd_addr, hci_a
     hci_connection_t * conn = hci_connection_for_bd_addr_and_type(addr, BD_ADDR_TYPE_CLASSIC);
     if (conn) {
         connectionSetAuthenticationFlags(conn, flags);
-        hci_connection_timestamp(conn);
+        hci_connection_set_active(conn);
     }
 }
 
@@ -287,26 +412,27 @@ uint8_t hci_number_outgoing_packets(hci_con_handle_t handle){
     return connection->num_acl_packets_sent;
 }
 
-uint8_t hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle){
-    
-    int num_packets_sent_classic = 0;
-    int num_packets_sent_le = 0;
+void hci_connection_set_acl_tx_weight(hci_con_handle_t con_handle, uint8_t weight){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) {
+        log_error("hci_connection_set_acl_tx_weight: connection for handle %u does not exist!", con_handle);
+        return;
+    }
+    // each turn must allow for at least one fragment
+    if (weight == 0) weight = 1;
+    connection->acl_tx_weight = weight;
+}
 
-    bd_addr_type_t address_type = BD_ADDR_TYPE_UNKNOWN;
+const hci_acl_tx_stats_t * hci_connection_get_acl_tx_stats(hci_con_handle_t con_handle){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    if (!connection) return NULL;
+    return &connection->acl_tx_stats;
+}
 
-    linked_item_t *it;
-    for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
-        hci_connection_t * connection = (hci_connection_t *) it;
-        if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
-            num_packets_sent_classic += connection->num_acl_packets_sent;
-        } else {
-            num_packets_sent_le += connection->num_acl_packets_sent;
-        }
-        // ignore connections that are not open, e.g., in state RECEIVED_DISCONNECTION_COMPLETE
-        if (connection->con_handle == con_handle && connection->state == OPEN){
-            address_type = connection->address_type;
-        }
-    }
+static int hci_number_free_acl_slots_for_connection(hci_connection_t * connection){
+
+    int num_packets_sent_classic = hci_stack->acl_packets_sent_classic;
+    int num_packets_sent_le = hci_stack->acl_packets_sent_le;
 
     int free_slots_classic = hci_stack->acl_packets_total_num - num_packets_sent_classic;
     int free_slots_le = 0;
@@ -332,20 +458,23 @@ uint8_t hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle){
         }
     }
 
-    switch (address_type){
-        case BD_ADDR_TYPE_UNKNOWN:
-            log_error("hci_number_free_acl_slots: handle 0x%04x not in connection list", con_handle);
-            return 0;
-
-        case BD_ADDR_TYPE_CLASSIC:
-            return free_slots_classic;
+    if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
+        return free_slots_classic;
+    }
+    if (hci_stack->le_acl_packets_total_num){
+        return free_slots_le;
+    }
+    return free_slots_classic;
+}
 
-        default:
-           if (hci_stack->le_acl_packets_total_num){
-               return free_slots_le;
-           }
-           return free_slots_classic; 
+uint8_t hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle){
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    // ignore connections that are not open, e.g., in state RECEIVED_DISCONNECTION_COMPLETE
+    if (!connection || connection->state != OPEN){
+        log_error("hci_number_free_acl_slots: handle 0x%04x not in connection list", con_handle);
+        return 0;
     }
+    return hci_number_free_acl_slots_for_connection(connection);
 }
 
 int hci_number_free_sco_slots_for_handle(hci_con_handle_t handle){
@@ -362,6 +491,98 @@ int hci_number_free_sco_slots_for_handle(hci_con_handle_t handle){
     return hci_stack->sco_packets_total_num - num_sco_packets_sent;
 }
 
+// track opcodes of outstanding commands to match command complete/status events
+static void hci_cmds_in_flight_add(uint16_t opcode){
+    if (hci_stack->num_cmds_in_flight == HCI_MAX_CMDS_IN_FLIGHT){
+        // controller accepted more commands than we can track, forget oldest
+        log_info("hci_cmds_in_flight_add: no completion for opcode %04x tracked anymore", hci_stack->cmds_in_flight[0]);
+        memmove(&hci_stack->cmds_in_flight[0], &hci_stack->cmds_in_flight[1], (HCI_MAX_CMDS_IN_FLIGHT - 1) * sizeof(uint16_t));
+        hci_stack->num_cmds_in_flight--;
+    }
+    hci_stack->cmds_in_flight[hci_stack->num_cmds_in_flight++] = opcode;
+}
+
+static void hci_cmds_in_flight_remove(uint16_t opcode){
+    int i;
+    for (i = 0; i < hci_stack->num_cmds_in_flight; i++){
+        if (hci_stack->cmds_in_flight[i] != opcode) continue;
+        hci_stack->num_cmds_in_flight--;
+        memmove(&hci_stack->cmds_in_flight[i], &hci_stack->cmds_in_flight[i+1], (hci_stack->num_cmds_in_flight - i) * sizeof(uint16_t));
+        return;
+    }
+}
+
+int hci_number_commands_in_flight(void){
+    return hci_stack->num_cmds_in_flight;
+}
+
+uint32_t hci_get_init_duration_ms(void){
+    return hci_stack->init_duration_ms;
+}
+
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+void hci_set_controller_cache(const hci_controller_cache_t * cache){
+    hci_stack->controller_cache = cache;
+}
+
+int hci_controller_info_from_cache(void){
+    return hci_stack->controller_info_used;
+}
+#endif
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+static void hci_host_acl_packets_completed(hci_connection_t * conn, int num_packets){
+    if (!hci_stack->host_flow_control_enabled) return;
+    conn->host_acl_packets_completed += num_packets;
+    hci_stack->host_acl_packets_completed += num_packets;
+}
+
+// report released host buffers via Host_Number_Of_Completed_Packets, which doesn't need a command credit
+static void hci_host_acl_packets_report(void){
+    // report when half of the host buffers are free again, the controller can still use the other half meanwhile
+    if (hci_stack->host_acl_packets_completed * 2 < HCI_HOST_ACL_PACKET_NUM) return;
+    linked_item_t * it;
+    for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
+        hci_connection_t * conn = (hci_connection_t *) it;
+        if (!conn->host_acl_packets_completed) continue;
+        if (hci_stack->hci_packet_buffer_reserved) return;
+        if (hci_stack->hci_transport->can_send_packet_now && !hci_stack->hci_transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET)) return;
+        uint16_t num_packets = conn->host_acl_packets_completed;
+        conn->host_acl_packets_completed = 0;
+        hci_stack->host_acl_packets_completed -= num_packets;
+        uint8_t * packet = hci_cmd_buffer();
+        hci_send_cmd_packet(packet, hci_cmd_host_number_of_completed_packets_create(packet, 1, conn->con_handle, num_packets));
+    }
+}
+
+void hci_set_host_acl_packets_manual_release(int enable){
+    hci_stack->host_acl_packets_manual_release = enable;
+}
+
+void hci_host_acl_packet_release(hci_con_handle_t con_handle){
+    hci_connection_t * conn = hci_connection_for_handle(con_handle);
+    if (!conn || !conn->host_acl_packets_held) {
+        log_error("hci_host_acl_packet_release: no ACL packet held for handle 0x%04x", con_handle);
+        return;
+    }
+    conn->host_acl_packets_held--;
+    hci_host_acl_packets_completed(conn, 1);
+    hci_run();
+}
+#endif
+
+// forward complete L2CAP packet to upper layer
+static void hci_acl_deliver(hci_connection_t * conn, uint8_t * packet, uint16_t size){
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    if (hci_stack->host_flow_control_enabled && hci_stack->host_acl_packets_manual_release){
+        // controller buffer stays in use until hci_host_acl_packet_release
+        hci_host_acl_packets_completed(conn, -1);
+        conn->host_acl_packets_held++;
+    }
+#endif
+    hci_stack->packet_handler(HCI_ACL_DATA_PACKET, packet, size);
+}
+
 // new functions replacing hci_can_send_packet_now[_using_packet_buffer]
 int hci_can_send_command_packet_now(void){
     if (hci_stack->hci_packet_buffer_reserved) return 0;
@@ -376,14 +597,12 @@ int hci_can_send_command_packet_now(void){
     return hci_stack->num_cmd_packets > 0;
 }
 
+// ACL packets are queued per connection and sent when the controller has free buffers
 int hci_can_send_prepared_acl_packet_now(hci_con_handle_t con_handle) {
-    // check for async hci transport implementations
-    if (hci_stack->hci_transport->can_send_packet_now){
-        if (!hci_stack->hci_transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
-            return 0;
-        }
-    }
-    return hci_number_free_acl_slots_for_handle(con_handle) > 0;
+    hci_connection_t * connection = hci_connection_for_handle(con_handle);
+    // ignore connections that are not open, e.g., in state RECEIVED_DISCONNECTION_COMPLETE
+    if (!connection || connection->state != OPEN) return 0;
+    return hci_acl_tx_queue_can_accept(connection);
 }
 
 int hci_can_send_acl_packet_now(hci_con_handle_t con_handle){
@@ -424,85 +643,228 @@ void hci_release_packet_buffer(void){
     hci_stack->hci_packet_buffer_reserved = 0;
 }
 
+// reserve packet buffer for one of the typed encoders in hci_cmds_encoder.h
+static uint8_t * hci_cmd_buffer(void){
+    hci_reserve_packet_buffer();
+    return hci_stack->hci_packet_buffer;
+}
+
+// send command created in hci_cmd_buffer()
+static int hci_send_cmd_buffer(uint16_t size){
+    uint8_t * packet = hci_stack->hci_packet_buffer;
+    hci_stack->last_cmd_opcode = READ_BT_16(packet, 0);
+    return hci_send_cmd_packet(packet, size);
+}
+
 // assumption: synchronous implementations don't provide can_send_packet_now as they don't keep the buffer after the call
+// transports with TX buffer provide it for flow control, but copy the packet as well
 int hci_transport_synchronous(void){
-    return hci_stack->hci_transport->can_send_packet_now == NULL;
+    return hci_stack->hci_transport->can_send_packet_now == NULL || hci_stack->hci_transport->tx_buffered;
 }
 
 uint16_t hci_max_acl_le_data_packet_length(void){
     return hci_stack->le_data_packets_length > 0 ? hci_stack->le_data_packets_length : hci_stack->acl_data_packet_length;
 }
 
-static int hci_send_acl_packet_fragments(hci_connection_t *connection){
+static void hci_acl_buffer_free(hci_acl_buffer_t * buffer){
+    linked_list_add(&hci_stack->acl_buffers_free, (linked_item_t *) buffer);
+}
 
-    // log_info("hci_send_acl_packet_fragments  %u/%u (con 0x%04x)", hci_stack->acl_fragmentation_pos, hci_stack->acl_fragmentation_total_size, connection->con_handle);
+static void hci_acl_buffers_init(void){
+    hci_stack->acl_buffers_free = NULL;
+    int i;
+    for (i = 1; i <= HCI_ACL_TX_BUFFERS; i++){
+        hci_acl_buffer_free(&hci_stack->acl_buffers[i]);
+    }
+    hci_stack->hci_packet_buffer_current = &hci_stack->acl_buffers[0];
+    hci_stack->hci_packet_buffer = hci_stack->acl_buffers[0].data;
+    hci_stack->acl_buffer_in_transport = NULL;
+}
+
+// return queued packets of a connection to the free list
+static void hci_acl_tx_queue_flush(hci_connection_t * connection){
+    while (connection->acl_tx_queue){
+        hci_acl_buffer_t * buffer = (hci_acl_buffer_t *) connection->acl_tx_queue;
+        connection->acl_tx_queue = buffer->item.next;
+        if (buffer == hci_stack->acl_buffer_in_transport){
+            // still used by transport, mark as done and free on DAEMON_EVENT_HCI_PACKET_SENT
+            buffer->pos = buffer->size;
+            continue;
+        }
+        hci_acl_buffer_free(buffer);
+    }
+    hci_stack->acl_tx_queued -= connection->acl_tx_queue_len;
+    connection->acl_tx_queue_len = 0;
+    connection->acl_tx_deficit = 0;
+    connection->acl_tx_quantum_granted = 0;
+}
+
+static int hci_acl_tx_queue_can_accept(hci_connection_t * connection){
+    if (!hci_stack->acl_buffers_free) return 0;
+    return connection->acl_tx_queue_len < HCI_ACL_TX_QUEUE_MAX;
+}
 
+static uint16_t hci_acl_tx_max_fragment_length(hci_connection_t * connection){
     // max ACL data packet length depends on connection type (LE vs. Classic) and available buffers
-    uint16_t max_acl_data_packet_length = hci_stack->acl_data_packet_length;
     if (hci_is_le_connection(connection) && hci_stack->le_data_packets_length > 0){
-        max_acl_data_packet_length = hci_stack->le_data_packets_length;
+        return hci_stack->le_data_packets_length;
     }
+    return hci_stack->acl_data_packet_length;
+}
+
+static int hci_acl_tx_can_send_fragment(hci_connection_t * connection){
+    if (!connection->acl_tx_queue) return 0;
+    if (connection->state != OPEN) return 0;
+    // check for async hci transport implementations
+    if (hci_stack->hci_transport->can_send_packet_now){
+        if (!hci_stack->hci_transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+            return 0;
+        }
+    }
+    return hci_number_free_acl_slots_for_connection(connection) > 0;
+}
+
+// payload length of next fragment of first queued packet
+static uint16_t hci_acl_tx_next_fragment_length(hci_connection_t * connection){
+    hci_acl_buffer_t * buffer = (hci_acl_buffer_t *) connection->acl_tx_queue;
+    uint16_t max_acl_data_packet_length = hci_acl_tx_max_fragment_length(connection);
 
     // testing: reduce buffer to minimum
     // max_acl_data_packet_length = 52;
 
-    int err;
-    // multiple packets could be send on a synchronous HCI transport
-    while (1){
+    // if ACL packet is larger than Bluetooth packet buffer, only send max_acl_data_packet_length
+    uint16_t current_acl_data_packet_length = buffer->size - buffer->pos;
+    if (current_acl_data_packet_length > max_acl_data_packet_length){
+        current_acl_data_packet_length = max_acl_data_packet_length;
+    }
+    return current_acl_data_packet_length;
+}
 
-        // get current data
-        const uint16_t acl_header_pos = hci_stack->acl_fragmentation_pos - 4;
-        int current_acl_data_packet_length = hci_stack->acl_fragmentation_total_size - hci_stack->acl_fragmentation_pos;
-        int more_fragments = 0;
+// send next fragment of first queued packet
+static void hci_acl_tx_send_fragment(hci_connection_t *connection, int * packets_completed){
 
-        // if ACL packet is larger than Bluetooth packet buffer, only send max_acl_data_packet_length
-        if (current_acl_data_packet_length > max_acl_data_packet_length){
-            more_fragments = 1;
-            current_acl_data_packet_length = max_acl_data_packet_length;
-        }
+    hci_acl_buffer_t * buffer = (hci_acl_buffer_t *) connection->acl_tx_queue;
 
-        // copy handle_and_flags if not first fragment and update packet boundary flags to be 01 (continuing fragmnent)
-        if (acl_header_pos > 0){
-            uint16_t handle_and_flags = READ_BT_16(hci_stack->hci_packet_buffer, 0);
-            handle_and_flags = (handle_and_flags & 0xcfff) | (1 << 12);
-            bt_store_16(hci_stack->hci_packet_buffer, acl_header_pos, handle_and_flags);
-        }
+    // log_info("hci_acl_tx_send_fragment  %u/%u (con 0x%04x)", buffer->pos, buffer->size, connection->con_handle);
+
+    // get current data
+    const uint16_t acl_header_pos = buffer->pos - 4;
+    const uint16_t current_acl_data_packet_length = hci_acl_tx_next_fragment_length(connection);
 
-        // update header len
-        bt_store_16(hci_stack->hci_packet_buffer, acl_header_pos + 2, current_acl_data_packet_length);
+    // copy handle_and_flags if not first fragment and update packet boundary flags to be 01 (continuing fragmnent)
+    if (acl_header_pos > 0){
+        uint16_t handle_and_flags = READ_BT_16(buffer->data, 0);
+        handle_and_flags = (handle_and_flags & 0xcfff) | (1 << 12);
+        bt_store_16(buffer->data, acl_header_pos, handle_and_flags);
+    }
 
-        // count packet
-        connection->num_acl_packets_sent++;
+    // update header len
+    bt_store_16(buffer->data, acl_header_pos + 2, current_acl_data_packet_length);
 
-        // send packet
-        uint8_t * packet = &hci_stack->hci_packet_buffer[acl_header_pos];
-        const int size = current_acl_data_packet_length + 4;
-        hci_dump_packet(HCI_ACL_DATA_PACKET, 0, packet, size);
-        err = hci_stack->hci_transport->send_packet(HCI_ACL_DATA_PACKET, packet, size);
+    // count packet
+    hci_acl_packets_sent_add(connection, 1);
+    connection->acl_tx_stats.fragments_sent++;
+    connection->acl_tx_stats.bytes_sent += current_acl_data_packet_length;
 
-        // done yet?
-        if (!more_fragments) break;
+    // update start of next fragment to send
+    buffer->pos += current_acl_data_packet_length;
 
-        // update start of next fragment to send
-        hci_stack->acl_fragmentation_pos += current_acl_data_packet_length;
+    // dequeue packet after last fragment
+    if (buffer->pos >= buffer->size){
+        connection->acl_tx_queue = buffer->item.next;
+        connection->acl_tx_queue_len--;
+        hci_stack->acl_tx_queued--;
+    }
 
-        // can send more?
-        if (!hci_can_send_prepared_acl_packet_now(connection->con_handle)) return err;
+    // async transport keeps buffer until DAEMON_EVENT_HCI_PACKET_SENT
+    if (!hci_transport_synchronous()){
+        hci_stack->acl_buffer_in_transport = buffer;
     }
 
-    // done    
-    hci_stack->acl_fragmentation_pos = 0;
-    hci_stack->acl_fragmentation_total_size = 0;
+    // send packet
+    uint8_t * packet = &buffer->data[acl_header_pos];
+    const int size = current_acl_data_packet_length + 4;
+    hci_dump_packet(HCI_ACL_DATA_PACKET, 0, packet, size);
+    hci_stack->hci_transport->send_packet(HCI_ACL_DATA_PACKET, packet, size);
 
     // release buffer now for synchronous transport
-    if (hci_transport_synchronous()){
-        hci_release_packet_buffer();
-        // notify upper stack that iit might be possible to send again
+    if (hci_transport_synchronous() && buffer->pos >= buffer->size){
+        hci_acl_buffer_free(buffer);
+        (*packets_completed)++;
+    }
+}
+
+// deficit round robin: the connection in turn sends fragments as long as its deficit covers them.
+// on each turn, a connection that can send gets weight * max fragment length added to its deficit.
+static void hci_acl_tx_schedule(int * packets_completed){
+
+    // nothing queued, don't visit idle connections
+    if (!hci_stack->acl_tx_queued) return;
+
+    hci_connection_t * connection = hci_connection_for_handle(hci_stack->acl_tx_con_handle);
+    if (!connection) {
+        connection = (hci_connection_t *) hci_stack->connections;
+    }
+    if (!connection) return;
+
+    // first connection visited since last fragment was sent
+    hci_connection_t * idle_since = NULL;
+    while (1){
+        if (hci_acl_tx_can_send_fragment(connection)){
+            uint16_t fragment_length = hci_acl_tx_next_fragment_length(connection);
+            if (connection->acl_tx_deficit >= fragment_length){
+                connection->acl_tx_deficit -= fragment_length;
+                hci_acl_tx_send_fragment(connection, packets_completed);
+                // connections without queued data don't keep their deficit
+                if (!connection->acl_tx_queue){
+                    connection->acl_tx_deficit = 0;
+                    connection->acl_tx_quantum_granted = 0;
+                }
+                idle_since = NULL;
+                continue;
+            }
+            // a connection picked up from the last run might not have been granted a quantum yet
+            if (connection->acl_tx_quantum_granted){
+                connection->acl_tx_quantum_granted = 0;
+                connection->acl_tx_stats.turns_exhausted++;
+            }
+        }
+
+        // pass turn to next connection
+        connection = (hci_connection_t *) connection->item.next;
+        if (!connection){
+            connection = (hci_connection_t *) hci_stack->connections;
+        }
+        if (connection == idle_since) break;
+        if (!idle_since){
+            idle_since = connection;
+        }
+        hci_stack->acl_tx_con_handle = connection->con_handle;
+        if (hci_acl_tx_can_send_fragment(connection)){
+            connection->acl_tx_deficit += connection->acl_tx_weight * hci_acl_tx_max_fragment_length(connection);
+            connection->acl_tx_quantum_granted = 1;
+        }
+    }
+}
+
+// drain connection transmit queues as long as the controller has free ACL buffers
+static void hci_acl_tx_run(void){
+
+    // not re-entrant: packets queued by upper layers during DAEMON_EVENT_HCI_PACKET_SENT are picked up below
+    if (hci_stack->acl_tx_running) return;
+    hci_stack->acl_tx_running = 1;
+
+    while (1){
+        int packets_completed = 0;
+        hci_acl_tx_schedule(&packets_completed);
+        if (!packets_completed) break;
+
+        // notify upper stack that it might be possible to send again
         uint8_t event[] = { DAEMON_EVENT_HCI_PACKET_SENT, 0};
         hci_stack->packet_handler(HCI_EVENT_PACKET, &event[0], sizeof(event));
     }
 
-    return err;
+    hci_stack->acl_tx_running = 0;
 }
 
 // pre: caller has reserved the packet buffer
@@ -518,28 +880,40 @@ int hci_send_acl_packet_buffer(int size){
     uint8_t * packet = hci_stack->hci_packet_buffer;
     hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(packet);
 
-    // check for free places on Bluetooth module
-    if (!hci_can_send_prepared_acl_packet_now(con_handle)) {
-        log_error("hci_send_acl_packet_buffer called but no free ACL buffers on controller");
-        hci_release_packet_buffer();
-        return BTSTACK_ACL_BUFFERS_FULL;
-    }
-
     hci_connection_t *connection = hci_connection_for_handle( con_handle);
     if (!connection) {
         log_error("hci_send_acl_packet_buffer called but no connection for handle 0x%04x", con_handle);
         hci_release_packet_buffer();
         return 0;
     }
-    hci_connection_timestamp(connection);
+
+    // check for free places in transmit queue
+    if (!hci_acl_tx_queue_can_accept(connection)) {
+        connection->acl_tx_stats.queue_full++;
+        log_error("hci_send_acl_packet_buffer called but no free ACL buffers");
+        hci_release_packet_buffer();
+        return BTSTACK_ACL_BUFFERS_FULL;
+    }
+    hci_connection_set_active(connection);
     
     // hci_dump_packet( HCI_ACL_DATA_PACKET, 0, packet, size);
 
-    // setup data
-    hci_stack->acl_fragmentation_total_size = size;
-    hci_stack->acl_fragmentation_pos = 4;   // start of L2CAP packet
-
-    return hci_send_acl_packet_fragments(connection);
+    // queue prepared buffer and continue with a free one
+    hci_acl_buffer_t * buffer = hci_stack->hci_packet_buffer_current;
+    buffer->size = size;
+    buffer->pos  = 4;   // start of L2CAP packet
+    linked_list_add_tail(&connection->acl_tx_queue, (linked_item_t *) buffer);
+    connection->acl_tx_queue_len++;
+    hci_stack->acl_tx_queued++;
+    connection->acl_tx_stats.packets_queued++;
+
+    hci_stack->hci_packet_buffer_current = (hci_acl_buffer_t *) hci_stack->acl_buffers_free;
+    hci_stack->acl_buffers_free = hci_stack->acl_buffers_free->next;
+    hci_stack->hci_packet_buffer = hci_stack->hci_packet_buffer_current->data;
+    hci_release_packet_buffer();
+
+    hci_acl_tx_run();
+    return 0;
 }
 
 // pre: caller has reserved the packet buffer
@@ -569,10 +943,84 @@ int hci_send_sco_packet_buffer(int size){
         hci_release_packet_buffer();
         return 0;
     }
-    connection->num_sco_packets_sent++;
+    // without synchronous flow control, SCO packets have to be paced by the sender, see sco_stream.c
+    if (hci_stack->synchronous_flow_control_enabled){
+        connection->num_sco_packets_sent++;
+    }
 
     hci_dump_packet( HCI_SCO_DATA_PACKET, 0, packet, size);
-    return hci_stack->hci_transport->send_packet(HCI_SCO_DATA_PACKET, packet, size);
+    int err = hci_stack->hci_transport->send_packet(HCI_SCO_DATA_PACKET, packet, size);
+
+    // release packet buffer for synchronous transport implementations
+    if (hci_transport_synchronous()){
+        hci_release_packet_buffer();
+    }
+    return err;
+}
+
+static void hci_acl_rx_buffers_init(void){
+#ifndef HAVE_MALLOC
+    hci_stack->acl_rx_buffers_free = NULL;
+    int i;
+    for (i = 0; i < HCI_ACL_RX_BUFFERS; i++){
+        linked_list_add(&hci_stack->acl_rx_buffers_free, (linked_item_t *) &hci_stack->acl_rx_buffers[i]);
+    }
+#endif
+    hci_stack->acl_rx_stats.buffers_in_use = 0;
+    hci_stack->acl_rx_stats.bytes_in_use = 0;
+}
+
+// get reassembly buffer for ACL header + L2CAP packet of given size
+static uint8_t * hci_acl_rx_buffer_alloc(uint16_t size){
+    hci_acl_rx_stats_t * stats = &hci_stack->acl_rx_stats;
+#ifdef HAVE_MALLOC
+    uint8_t * buffer = (uint8_t *) malloc(HCI_INCOMING_PRE_BUFFER_SIZE + size);
+#else
+    uint8_t * buffer = NULL;
+    hci_acl_rx_buffer_t * rx_buffer = (hci_acl_rx_buffer_t *) hci_stack->acl_rx_buffers_free;
+    if (rx_buffer){
+        hci_stack->acl_rx_buffers_free = rx_buffer->item.next;
+        buffer = rx_buffer->data;
+    }
+#endif
+    if (!buffer){
+        stats->alloc_failures++;
+        return NULL;
+    }
+    stats->buffers_in_use++;
+    if (stats->buffers_in_use > stats->buffers_in_use_max){
+        stats->buffers_in_use_max = stats->buffers_in_use;
+    }
+    stats->bytes_in_use += size;
+    if (stats->bytes_in_use > stats->bytes_in_use_max){
+        stats->bytes_in_use_max = stats->bytes_in_use;
+    }
+    return buffer;
+}
+
+static void hci_acl_rx_buffer_free(uint8_t * buffer, uint16_t size){
+#ifdef HAVE_MALLOC
+    free(buffer);
+#else
+    hci_acl_rx_buffer_t * rx_buffer = (hci_acl_rx_buffer_t *) (buffer - offsetof(hci_acl_rx_buffer_t, data));
+    linked_list_add(&hci_stack->acl_rx_buffers_free, (linked_item_t *) rx_buffer);
+#endif
+    hci_stack->acl_rx_stats.buffers_in_use--;
+    hci_stack->acl_rx_stats.bytes_in_use -= size;
+}
+
+// drop partially received packet
+static void hci_acl_rx_reset(hci_connection_t * connection){
+    if (connection->acl_recombination_buffer){
+        hci_acl_rx_buffer_free(connection->acl_recombination_buffer, connection->acl_recombination_length + 4 + 4);
+        connection->acl_recombination_buffer = NULL;
+    }
+    connection->acl_recombination_length = 0;
+    connection->acl_recombination_pos = 0;
+}
+
+const hci_acl_rx_stats_t * hci_get_acl_rx_stats(void){
+    return &hci_stack->acl_rx_stats;
 }
 
 static void acl_handler(uint8_t *packet, int size){
@@ -591,14 +1039,19 @@ static void acl_handler(uint8_t *packet, int size){
         return;
     }
 
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    // packet is either dropped, copied for reassembly or delivered below
+    hci_host_acl_packets_completed(conn, 1);
+#endif
+
     // assert packet is complete    
     if (acl_length + 4 != size){
         log_error("hci.c: acl_handler called with ACL packet of wrong size %u, expected %u => dropping packet", size, acl_length + 4);
         return;
     }
 
-    // update idle timestamp
-    hci_connection_timestamp(conn);
+    // not idle
+    hci_connection_set_active(conn);
     
     // handle different packet types
     switch (acl_flags & 0x03) {
@@ -606,14 +1059,14 @@ static void acl_handler(uint8_t *packet, int size){
         case 0x01: // continuation fragment
             
             // sanity checks
-            if (conn->acl_recombination_pos == 0) {
+            if (!conn->acl_recombination_buffer) {
                 log_error( "ACL Cont Fragment but no first fragment for handle 0x%02x", con_handle);
                 return;
             }
-            if (conn->acl_recombination_pos + acl_length > 4 + HCI_ACL_BUFFER_SIZE){
-                log_error( "ACL Cont Fragment to large: combined packet %u > buffer size %u for handle 0x%02x",
-                    conn->acl_recombination_pos + acl_length, 4 + HCI_ACL_BUFFER_SIZE, con_handle);
-                conn->acl_recombination_pos = 0;
+            if (conn->acl_recombination_pos + acl_length > conn->acl_recombination_length + 4 + 4){
+                log_error( "ACL Cont Fragment to large: combined packet %u > L2CAP packet size %u for handle 0x%02x",
+                    conn->acl_recombination_pos + acl_length, conn->acl_recombination_length + 4 + 4, con_handle);
+                hci_acl_rx_reset(conn);
                 return;
             }
 
@@ -627,19 +1080,19 @@ static void acl_handler(uint8_t *packet, int size){
             // forward complete L2CAP packet if complete. 
             if (conn->acl_recombination_pos >= conn->acl_recombination_length + 4 + 4){ // pos already incl. ACL header
                 
-                hci_stack->packet_handler(HCI_ACL_DATA_PACKET, &conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE], conn->acl_recombination_pos);
-                // reset recombination buffer
-                conn->acl_recombination_length = 0;
-                conn->acl_recombination_pos = 0;
+                hci_stack->acl_rx_stats.packets_reassembled++;
+                hci_acl_deliver(conn, &conn->acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE], conn->acl_recombination_pos);
+                // release recombination buffer
+                hci_acl_rx_reset(conn);
             }
             break;
             
         case 0x02: { // first fragment
             
             // sanity check
-            if (conn->acl_recombination_pos) {
+            if (conn->acl_recombination_buffer) {
                 log_error( "ACL First Fragment but data in buffer for handle 0x%02x, dropping stale fragments", con_handle);
-                conn->acl_recombination_pos = 0;
+                hci_acl_rx_reset(conn);
             }
 
             // peek into L2CAP packet!
@@ -651,13 +1104,20 @@ static void acl_handler(uint8_t *packet, int size){
             if (acl_length >= l2cap_length + 4){
                 
                 // forward fragment as L2CAP packet
-                hci_stack->packet_handler(HCI_ACL_DATA_PACKET, packet, acl_length + 4);
+                hci_stack->acl_rx_stats.packets_direct++;
+                hci_acl_deliver(conn, packet, acl_length + 4);
             
             } else {
 
-                if (acl_length > HCI_ACL_BUFFER_SIZE){
-                    log_error( "ACL First Fragment to large: fragment %u > buffer size %u for handle 0x%02x",
-                        4 + acl_length, 4 + HCI_ACL_BUFFER_SIZE, con_handle);
+                if (l2cap_length + 4 > HCI_ACL_BUFFER_SIZE){
+                    log_error( "ACL First Fragment to large: L2CAP packet %u > buffer size %u for handle 0x%02x",
+                        4 + 4 + l2cap_length, 4 + HCI_ACL_BUFFER_SIZE, con_handle);
+                    return;
+                }
+
+                conn->acl_recombination_buffer = hci_acl_rx_buffer_alloc(l2cap_length + 4 + 4);
+                if (!conn->acl_recombination_buffer){
+                    log_error( "ACL First Fragment but no reassembly buffer available for handle 0x%02x", con_handle);
                     return;
                 }
 
@@ -682,10 +1142,7 @@ static void acl_handler(uint8_t *packet, int size){
 static void hci_shutdown_connection(hci_connection_t *conn){
     log_info("Connection closed: handle 0x%x, %s", conn->con_handle, bd_addr_to_str(conn->address));
 
-    run_loop_remove_timer(&conn->timeout);
-    
-    linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
-    btstack_memory_hci_connection_free( conn );
+    hci_connection_free(conn);
     
     // now it's gone
     hci_emit_nr_connections_changed();
@@ -750,6 +1207,10 @@ uint16_t hci_max_acl_data_packet_length(void){
     return hci_stack->acl_data_packet_length;
 }
 
+uint16_t hci_max_sco_data_packet_length(void){
+    return hci_stack->sco_data_packet_length;
+}
+
 int hci_non_flushable_packet_boundary_flag_supported(void){
     // No. 54, byte 6, bit 6
     return (hci_stack->local_supported_features[6] & (1 << 6)) != 0;
@@ -780,11 +1241,123 @@ void hci_le_advertisement_address(uint8_t * addr_type, bd_addr_t  addr){
     if (hci_stack->adv_addr_type){
         memcpy(addr, hci_stack->adv_address, 6);
     } else {
-        memcpy(addr, hci_stack->local_bd_addr, 6);
+        memcpy(addr, hci_stack->local_bd_addr, 6);
+    }
+}
+
+#ifdef HAVE_BLE
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+static int le_advertising_report_has_ad_type(uint8_t data_length, uint8_t * data){
+    ad_context_t context;
+    for (ad_iterator_init(&context, data_length, data) ; ad_iterator_has_more(&context) ; ad_iterator_next(&context)){
+        uint8_t data_type = ad_iterator_get_data_type(&context);
+        if (hci_stack->le_adv_report_ad_types[data_type >> 3] & (1 << (data_type & 7))) return 1;
+    }
+    return 0;
+}
+
+// FNV-1a over event type and advertising data
+static uint32_t le_advertising_report_hash(uint8_t event_type, uint8_t data_length, uint8_t * data){
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ event_type) * 16777619u;
+    int i;
+    for (i = 0; i < data_length; i++){
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// report: event type, address type, address, data length, data, rssi
+static int le_advertising_report_filter_accepts(uint8_t * report){
+    le_advertising_report_stats_t * stats = &hci_stack->le_adv_report_stats;
+    uint8_t   data_length = report[8];
+    uint8_t * data        = &report[9];
+    int8_t    rssi        = (int8_t) report[9 + data_length];
+
+    stats->reports_received++;
+    uint32_t seen = ++hci_stack->le_adv_report_counter;
+
+    if (hci_stack->le_adv_report_ad_types_set && !le_advertising_report_has_ad_type(data_length, data)){
+        stats->reports_filtered++;
+        return 0;
+    }
+
+    uint32_t data_hash = le_advertising_report_hash(report[0], data_length, data);
+    uint32_t now = run_loop_get_time_ms();
+    le_advertising_report_cache_entry_t * entry = NULL;
+    int i;
+    for (i = 0; i < hci_stack->le_adv_report_cache_len; i++){
+        le_advertising_report_cache_entry_t * it = &hci_stack->le_adv_report_cache[i];
+        if (it->data_hash != data_hash) continue;
+        if (it->addr_type != report[1]) continue;
+        if (memcmp(it->addr, &report[2], 6)) continue;
+        entry = it;
+        break;
+    }
+
+    if (entry){
+        entry->seen = seen;
+        int rssi_change = rssi - entry->rssi;
+        if (rssi_change < 0) {
+            rssi_change = -rssi_change;
+        }
+        int rssi_changed = hci_stack->le_adv_report_rssi_threshold && rssi_change >= hci_stack->le_adv_report_rssi_threshold;
+        if ((now - entry->reported_ms) < hci_stack->le_adv_report_window_ms && !rssi_changed){
+            stats->duplicates_dropped++;
+            return 0;
+        }
+    } else {
+        if (hci_stack->le_adv_report_cache_len < LE_ADVERTISING_REPORT_CACHE_SIZE){
+            entry = &hci_stack->le_adv_report_cache[hci_stack->le_adv_report_cache_len++];
+        } else {
+            // replace least recently seen advertiser
+            entry = &hci_stack->le_adv_report_cache[0];
+            for (i = 1; i < LE_ADVERTISING_REPORT_CACHE_SIZE; i++){
+                if ((seen - hci_stack->le_adv_report_cache[i].seen) > (seen - entry->seen)){
+                    entry = &hci_stack->le_adv_report_cache[i];
+                }
+            }
+        }
+        memcpy(entry->addr, &report[2], 6);
+        entry->addr_type = report[1];
+        entry->data_hash = data_hash;
+        entry->seen      = seen;
+    }
+    entry->rssi = rssi;
+    entry->reported_ms = now;
+    stats->reports_delivered++;
+    return 1;
+}
+
+// removes dropped reports from LE Advertising Report event, so raw event and GAP events see the same reports
+// @returns number of remaining reports
+static int le_advertising_report_filter_apply(uint8_t * packet, int * size){
+    int num_reports = packet[3];
+    int offset = 4;
+    int pos = 4;
+    int remaining = 0;
+    int i;
+    for (i = 0; i < num_reports; i++){
+        int report_size = 10 + packet[offset + 8];
+        if (le_advertising_report_filter_accepts(&packet[offset])){
+            memmove(&packet[pos], &packet[offset], report_size);
+            pos += report_size;
+            remaining++;
+        }
+        offset += report_size;
     }
+    packet[1] = pos - 2;
+    packet[3] = remaining;
+    *size = pos;
+    return remaining;
 }
 
-#ifdef HAVE_BLE
+static void le_advertising_report_filter_reset(void){
+    hci_stack->le_adv_report_cache_len = 0;
+    memset(&hci_stack->le_adv_report_stats, 0, sizeof(hci_stack->le_adv_report_stats));
+}
+#endif
+
 void le_handle_advertisement_report(uint8_t *packet, int size){
     int offset = 3;
     int num_reports = packet[offset];
@@ -850,18 +1423,105 @@ static void hci_initializing_event_handler(uint8_t * packet, uint16_t size){
     }
 }
 
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+// called with BD ADDR and version before init script
+static int hci_controller_info_valid(hci_controller_info_t * info){
+    if (info->magic != HCI_CONTROLLER_INFO_MAGIC) return 0;
+    if (info->version != HCI_CONTROLLER_INFO_VERSION) return 0;
+    if (info->size != sizeof(hci_controller_info_t)) return 0;
+    if (BD_ADDR_CMP(info->bd_addr, hci_stack->local_bd_addr)) return 0;
+    // controller without ACL buffers would stall all connections
+    if (info->acl_data_packet_length == 0 || info->acl_packets_total_num == 0) return 0;
+    return 1;
+}
+
+static void hci_controller_cache_check(void){
+    hci_controller_info_t * info = &hci_stack->controller_info;
+    if (!hci_stack->controller_cache->get(hci_stack->local_bd_addr, info)){
+        log_info("Controller %s not in cache", bd_addr_to_str(hci_stack->local_bd_addr));
+    } else if (!hci_controller_info_valid(info)){
+        log_error("Controller %s cache entry invalid, full init", bd_addr_to_str(hci_stack->local_bd_addr));
+    } else if (memcmp(info->local_version, hci_stack->controller_version, HCI_CONTROLLER_VERSION_LEN) == 0){
+        hci_stack->controller_info_verified = 1;
+        // version differs from power on version only if init script (e.g. patches) is still active
+        if (memcmp(info->local_version, info->local_version_before_init_script, HCI_CONTROLLER_VERSION_LEN)){
+            hci_stack->controller_init_script_active = 1;
+        }
+    } else if (memcmp(info->local_version_before_init_script, hci_stack->controller_version, HCI_CONTROLLER_VERSION_LEN) == 0){
+        // same controller after power cycle, init script is run again
+        hci_stack->controller_info_verified = 1;
+    } else {
+        log_info("Controller %s version changed, full init", bd_addr_to_str(hci_stack->local_bd_addr));
+    }
+    if (hci_stack->controller_info_verified) {
+        log_info("Controller %s cache valid, init script active %u", bd_addr_to_str(hci_stack->local_bd_addr),
+            hci_stack->controller_init_script_active);
+        return;
+    }
+    // collect new info
+    memset(info, 0, sizeof(hci_controller_info_t));
+    info->magic   = HCI_CONTROLLER_INFO_MAGIC;
+    info->version = HCI_CONTROLLER_INFO_VERSION;
+    info->size    = sizeof(hci_controller_info_t);
+    BD_ADDR_COPY(info->bd_addr, hci_stack->local_bd_addr);
+    memcpy(info->local_version_before_init_script, hci_stack->controller_version, HCI_CONTROLLER_VERSION_LEN);
+}
+
+static void hci_controller_info_apply(void){
+    hci_controller_info_t * info = &hci_stack->controller_info;
+    hci_stack->acl_data_packet_length   = info->acl_data_packet_length;
+    hci_stack->acl_packets_total_num    = info->acl_packets_total_num;
+    hci_stack->sco_data_packet_length   = info->sco_data_packet_length;
+    hci_stack->sco_packets_total_num    = info->sco_packets_total_num;
+    hci_stack->le_data_packets_length   = info->le_data_packets_length;
+    hci_stack->le_acl_packets_total_num = info->le_acl_packets_total_num;
+    // same limits as for values read from the controller
+    if (HCI_ACL_PAYLOAD_SIZE < hci_stack->acl_data_packet_length){
+        hci_stack->acl_data_packet_length = HCI_ACL_PAYLOAD_SIZE;
+    }
+    if (HCI_ACL_PAYLOAD_SIZE < hci_stack->le_data_packets_length){
+        hci_stack->le_data_packets_length = HCI_ACL_PAYLOAD_SIZE;
+    }
+    memcpy(hci_stack->local_supported_features, info->local_supported_features, 8);
+    hci_stack->packet_types = hci_acl_packet_types_for_buffer_size_and_local_features(HCI_ACL_PAYLOAD_SIZE, &hci_stack->local_supported_features[0]);
+    hci_stack->controller_info_used = 1;
+    log_info("Using cached controller info: acl size %u, count %u, le size %u, count %u, packet types %04x",
+        hci_stack->acl_data_packet_length, hci_stack->acl_packets_total_num,
+        hci_stack->le_data_packets_length, hci_stack->le_acl_packets_total_num, hci_stack->packet_types);
+}
+
+// called when init is done
+static void hci_controller_info_store(void){
+    if (hci_stack->controller_info_verified) return;
+    hci_controller_info_t * info = &hci_stack->controller_info;
+    memcpy(info->local_version, hci_stack->controller_version, HCI_CONTROLLER_VERSION_LEN);
+    info->acl_data_packet_length   = hci_stack->acl_data_packet_length;
+    info->acl_packets_total_num    = hci_stack->acl_packets_total_num;
+    info->sco_data_packet_length   = hci_stack->sco_data_packet_length;
+    info->sco_packets_total_num    = hci_stack->sco_packets_total_num;
+    info->le_data_packets_length   = hci_stack->le_data_packets_length;
+    info->le_acl_packets_total_num = hci_stack->le_acl_packets_total_num;
+    memcpy(info->local_supported_features, hci_stack->local_supported_features, 8);
+    hci_stack->controller_cache->put(info);
+}
+#endif
+
 static void hci_initializing_state_machine(){
     if (hci_stack->substate % 2) {
         // odd: waiting for command completion
         return;
     }
+    // independent commands don't wait for command completion but skip the odd substate
+    int pipelined = 0;
     // log_info("hci_init: substate %u", hci_stack->substate >> 1);
     switch (hci_stack->substate >> 1){
         case 0: // RESET
             hci_state_reset();
         
-            hci_send_cmd(&hci_reset);
-            if (hci_stack->config == NULL || ((hci_uart_config_t *)hci_stack->config)->baudrate_main == 0){
+            hci_send_cmd_buffer(hci_cmd_reset_create(hci_cmd_buffer()));
+            // config is only a hci_uart_config_t if the chipset can change the baud rate
+            if (hci_stack->control == NULL || hci_stack->control->baudrate_cmd == NULL
+              || hci_stack->config == NULL || ((hci_uart_config_t *)hci_stack->config)->baudrate_main == 0){
                 // skip baud change
                 hci_stack->substate = 2 << 1; 
             }
@@ -889,6 +1549,40 @@ static void hci_initializing_state_machine(){
             // break missing here for fall through
 
         case 4:
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            // identify controller before init script
+            if (hci_stack->controller_cache){
+                hci_send_cmd_buffer(hci_cmd_read_local_version_information_create(hci_cmd_buffer()));
+                pipelined = 1;
+                break;
+            }
+#endif
+            hci_stack->substate = 6 << 1;
+            hci_initializing_state_machine();
+            return;
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+        case 5:
+            hci_send_cmd_buffer(hci_cmd_read_bd_addr_create(hci_cmd_buffer()));
+            pipelined = 1;
+            break;
+#endif
+        case 6:
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            if (hci_stack->controller_cache){
+                // wait for identification
+                if (hci_stack->num_cmds_in_flight) return;
+                if (!hci_stack->controller_info_checked){
+                    hci_stack->controller_info_checked = 1;
+                    hci_controller_cache_check();
+                }
+                if (hci_stack->controller_init_script_active){
+                    log_info("Init script already active, skipped");
+                    hci_stack->substate = 7 << 1;
+                    hci_initializing_state_machine();
+                    return;
+                }
+            }
+#endif
             log_info("Custom init");
             // Custom initialization
             if (hci_stack->control && hci_stack->control->next_cmd){
@@ -898,56 +1592,94 @@ static void hci_initializing_state_machine(){
                     hci_stack->last_cmd_opcode = READ_BT_16(hci_stack->hci_packet_buffer, 0);
                     hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, hci_stack->hci_packet_buffer, size);
                     hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, hci_stack->hci_packet_buffer, size);
-                    hci_stack->substate = 3 << 1; // more init commands
+                    hci_stack->substate = 5 << 1; // more init commands
                     break;
                 }
                 log_info("hci_run: init script done");
             }
             // otherwise continue
-            hci_send_cmd(&hci_read_bd_addr);
+            hci_stack->substate = 7 << 1;
+            // break missing here for fall through
+        case 7:
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            if (hci_stack->controller_info_verified){
+                // BD ADDR known from identification
+                hci_stack->substate = 8 << 1;
+                hci_initializing_state_machine();
+                return;
+            }
+#endif
+            hci_send_cmd_buffer(hci_cmd_read_bd_addr_create(hci_cmd_buffer()));
+            pipelined = 1;
             break;
-        case 5:
-            hci_send_cmd(&hci_read_buffer_size);
+        case 8:
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            // version after init script, stored in cache
+            if (hci_stack->controller_cache && !hci_stack->controller_info_verified){
+                hci_send_cmd_buffer(hci_cmd_read_local_version_information_create(hci_cmd_buffer()));
+                pipelined = 1;
+                break;
+            }
+            if (hci_stack->controller_info_verified){
+                // use cached buffer sizes and features
+                hci_controller_info_apply();
+                hci_stack->substate = 11 << 1;
+                hci_initializing_state_machine();
+                return;
+            }
+#endif
+            hci_stack->substate = 9 << 1;
+            // break missing here for fall through
+        case 9:
+            hci_send_cmd_buffer(hci_cmd_read_buffer_size_create(hci_cmd_buffer()));
+            pipelined = 1;
             break;
-        case 6:
-            hci_send_cmd(&hci_read_local_supported_features);
+        case 10:
+            hci_send_cmd_buffer(hci_cmd_read_local_supported_features_create(hci_cmd_buffer()));
+            pipelined = 1;
             break;                
-        case 7:
+        case 11:
+            // remaining init depends on local features and bd addr
+            if (hci_stack->num_cmds_in_flight) return;
+            pipelined = 1;
             if (hci_le_supported()){
-                hci_send_cmd(&hci_set_event_mask,0xffffffff, 0x3FFFFFFF);
+                hci_send_cmd_buffer(hci_cmd_set_event_mask_create(hci_cmd_buffer(),0xffffffff, 0x3FFFFFFF));
             } else {
                 // Kensington Bluetooth 2.1 USB Dongle (CSR Chipset) returns an error for 0xffff... 
-                hci_send_cmd(&hci_set_event_mask,0xffffffff, 0x1FFFFFFF);
+                hci_send_cmd_buffer(hci_cmd_set_event_mask_create(hci_cmd_buffer(),0xffffffff, 0x1FFFFFFF));
             }
 
             // skip Classic init commands for LE only chipsets
             if (!hci_classic_supported()){
                 if (hci_le_supported()){
-                    hci_stack->substate = 12 << 1;    // skip all classic command
+                    hci_stack->substate = 16 << 1;    // skip all classic command
                 } else {
                     log_error("Neither BR/EDR nor LE supported");
-                    hci_stack->substate = 15 << 1;    // skip all
+                    hci_stack->substate = 19 << 1;    // skip all
                 }
             }
             break;
-        case 8:
+        case 12:
             if (hci_ssp_supported()){
-                hci_send_cmd(&hci_write_simple_pairing_mode, hci_stack->ssp_enable);
+                hci_send_cmd_buffer(hci_cmd_write_simple_pairing_mode_create(hci_cmd_buffer(), hci_stack->ssp_enable));
+                pipelined = 1;
                 break;
             }
             hci_stack->substate += 2;
             // break missing here for fall through
 
-        case 9:
+        case 13:
             // ca. 15 sec
-            hci_send_cmd(&hci_write_page_timeout, 0x6000);
+            hci_send_cmd_buffer(hci_cmd_write_page_timeout_create(hci_cmd_buffer(), 0x6000));
+            pipelined = 1;
             break;
-        case 10:
-            hci_send_cmd(&hci_write_class_of_device, hci_stack->class_of_device);
+        case 14:
+            hci_send_cmd_buffer(hci_cmd_write_class_of_device_create(hci_cmd_buffer(), hci_stack->class_of_device));
+            pipelined = 1;
             break;
-        case 11:
+        case 15:
             if (hci_stack->local_name){
-                hci_send_cmd(&hci_write_local_name, hci_stack->local_name);
+                hci_send_cmd_buffer(hci_cmd_write_local_name_create(hci_cmd_buffer(), hci_stack->local_name));
             } else {
                 char hostname[30];
 #ifdef EMBEDDED
@@ -960,42 +1692,79 @@ static void hci_initializing_state_machine(){
                 gethostname(hostname, 30);
                 hostname[29] = '\0';
 #endif                        
-                hci_send_cmd(&hci_write_local_name, hostname);
+                hci_send_cmd_buffer(hci_cmd_write_local_name_create(hci_cmd_buffer(), hostname));
             }
+            pipelined = 1;
             break;
-        case 12:
-            hci_send_cmd(&hci_write_scan_enable, (hci_stack->connectable << 1) | hci_stack->discoverable); // page scan
+        case 16:
+            hci_send_cmd_buffer(hci_cmd_write_scan_enable_create(hci_cmd_buffer(), (hci_stack->connectable << 1) | hci_stack->discoverable)); // page scan
+            pipelined = 1;
             if (!hci_le_supported()){
                 // SKIP LE init for Classic only configuration
-                hci_stack->substate = 15 << 1;
+                hci_stack->substate = 19 << 1;
             }
             break;
 
 #ifdef HAVE_BLE
         // LE INIT
-        case 13:
-            hci_send_cmd(&hci_le_read_buffer_size);
+        case 17:
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            if (hci_stack->controller_info_used){
+                hci_stack->substate = 18 << 1;
+                hci_initializing_state_machine();
+                return;
+            }
+#endif
+            hci_send_cmd_buffer(hci_cmd_le_read_buffer_size_create(hci_cmd_buffer()));
+            pipelined = 1;
             break;
-        case 14:
+        case 18:
             // LE Supported Host = 1, Simultaneous Host = 0
-            hci_send_cmd(&hci_write_le_host_supported, 1, 0);
+            hci_send_cmd_buffer(hci_cmd_write_le_host_supported_create(hci_cmd_buffer(), 1, 0));
+            pipelined = 1;
             break;
-        case 15:
+        case 19:
             // LE Scan Parameters: active scanning, 300 ms interval, 30 ms window, public address, accept all advs
-            hci_send_cmd(&hci_le_set_scan_parameters, 1, 0x1e0, 0x30, 0, 0);
+            hci_send_cmd_buffer(hci_cmd_le_set_scan_parameters_create(hci_cmd_buffer(), 1, 0x1e0, 0x30, 0, 0));
+            pipelined = 1;
+            break;
+#endif
+
+        case 20:
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+            hci_send_cmd_buffer(hci_cmd_host_buffer_size_create(hci_cmd_buffer(), HCI_HOST_ACL_PACKET_LEN, 0, HCI_HOST_ACL_PACKET_NUM, 0));
+            pipelined = 1;
             break;
+        case 21:
+            // ACL only
+            hci_send_cmd_buffer(hci_cmd_set_controller_to_host_flow_control_create(hci_cmd_buffer(), 1));
+            pipelined = 1;
+            break;
+#else
+            hci_stack->substate = 22 << 1;
+            // break missing here for fall through
 #endif
 
         // DONE
-        case 16:
+        case 22:
+            // wait for completion of pipelined commands
+            if (hci_stack->num_cmds_in_flight) return;
             // done.
+            hci_stack->init_duration_ms = run_loop_get_time_ms() - hci_stack->init_start_ms;
+            log_info("hci_init: done after %u ms", hci_stack->init_duration_ms);
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            if (hci_stack->controller_cache){
+                log_info("hci_init: cached controller info used %u", hci_stack->controller_info_used);
+                hci_controller_info_store();
+            }
+#endif
             hci_stack->state = HCI_STATE_WORKING;
             hci_emit_state();
             break;
         default:
             break;
     }
-    hci_stack->substate++;
+    hci_stack->substate += pipelined ? 2 : 1;
 }
 
 // avoid huge local variables
@@ -1027,6 +1796,7 @@ static void event_handler(uint8_t *packet, int size){
             // get num cmd packets
             // log_info("HCI_EVENT_COMMAND_COMPLETE cmds old %u - new %u", hci_stack->num_cmd_packets, packet[2]);
             hci_stack->num_cmd_packets = packet[2];
+            hci_cmds_in_flight_remove(READ_BT_16(packet, 3));
 
             if (COMMAND_COMPLETE_EVENT(packet, hci_read_buffer_size)){
                 // from offset 5
@@ -1057,6 +1827,11 @@ static void event_handler(uint8_t *packet, int size){
                     }
                 log_info("hci_le_read_buffer_size: size %u, count %u", hci_stack->le_data_packets_length, hci_stack->le_acl_packets_total_num);
             }            
+#endif
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+            if (COMMAND_COMPLETE_EVENT(packet, hci_read_local_version_information)){
+                memcpy(hci_stack->controller_version, &packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1], HCI_CONTROLLER_VERSION_LEN);
+            }
 #endif
             // Dump local address
             if (COMMAND_COMPLETE_EVENT(packet, hci_read_bd_addr)) {
@@ -1067,6 +1842,12 @@ static void event_handler(uint8_t *packet, int size){
             if (COMMAND_COMPLETE_EVENT(packet, hci_write_scan_enable)){
                 hci_emit_discoverable_enabled(hci_stack->discoverable);
             }
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+            if (COMMAND_COMPLETE_EVENT(packet, hci_set_controller_to_host_flow_control)){
+                hci_stack->host_flow_control_enabled = packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE] == 0;
+                log_info("Controller to host flow control enabled %u", hci_stack->host_flow_control_enabled);
+            }
+#endif
             // Note: HCI init checks 
             if (COMMAND_COMPLETE_EVENT(packet, hci_read_local_supported_features)){
                 memcpy(hci_stack->local_supported_features, &packet[OFFSET_OF_DATA_IN_COMMAND_COMPLETE+1], 8);
@@ -1089,6 +1870,7 @@ static void event_handler(uint8_t *packet, int size){
             // get num cmd packets
             // log_info("HCI_EVENT_COMMAND_STATUS cmds - old %u - new %u", hci_stack->num_cmd_packets, packet[3]);
             hci_stack->num_cmd_packets = packet[3];
+            hci_cmds_in_flight_remove(READ_BT_16(packet, 4));
             break;
             
         case HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS:{
@@ -1114,12 +1896,11 @@ static void event_handler(uint8_t *packet, int size){
                     }
 
                 } else {
-                    if (conn->num_acl_packets_sent >= num_packets){
-                        conn->num_acl_packets_sent -= num_packets;
-                    } else {
+                    if (conn->num_acl_packets_sent < num_packets){
                         log_error("hci_number_completed_packets, more acl slots freed then sent.");
-                        conn->num_acl_packets_sent = 0;
+                        num_packets = conn->num_acl_packets_sent;
                     }
+                    hci_acl_packets_sent_add(conn, -num_packets);
                 }
                 // log_info("hci_number_completed_packet %u processed for handle %u, outstanding %u", num_packets, handle, conn->num_acl_packets_sent);
             }
@@ -1142,6 +1923,7 @@ static void event_handler(uint8_t *packet, int size){
                 break;
             }
             conn->state = RECEIVED_CONNECTION_REQUEST;
+            hci_connection_request_service(conn);
             hci_run();
             break;
             
@@ -1154,12 +1936,13 @@ static void event_handler(uint8_t *packet, int size){
             if (conn) {
                 if (!packet[2]){
                     conn->state = OPEN;
-                    conn->con_handle = READ_BT_16(packet, 3);
+                    hci_connection_set_handle(conn, READ_BT_16(packet, 3));
                     conn->bonding_flags |= BONDING_REQUEST_REMOTE_FEATURES;
+                    hci_connection_request_service(conn);
 
-                    // restart timer
-                    run_loop_set_timer(&conn->timeout, HCI_CONNECTION_TIMEOUT_MS);
-                    run_loop_add_timer(&conn->timeout);
+                    // check for idle connections
+                    conn->timestamp = run_loop_get_time_ms();
+                    hci_connection_idle_sweep_start();
                     
                     log_info("New connection: handle %u, %s", conn->con_handle, bd_addr_to_str(conn->address));
                     
@@ -1171,8 +1954,7 @@ static void event_handler(uint8_t *packet, int size){
                     memcpy(&bd_address, conn->address, 6);
 
                     // connection failed, remove entry
-                    linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
-                    btstack_memory_hci_connection_free( conn );
+                    hci_connection_free(conn);
                     
                     // notify client if dedicated bonding
                     if (notify_dedicated_bonding_failed){
@@ -1203,7 +1985,7 @@ static void event_handler(uint8_t *packet, int size){
                 break;
             }
             conn->state = OPEN;
-            conn->con_handle = READ_BT_16(packet, 3);            
+            hci_connection_set_handle(conn, READ_BT_16(packet, 3));
             break;
 
         case HCI_EVENT_READ_REMOTE_SUPPORTED_FEATURES_COMPLETE:
@@ -1220,6 +2002,7 @@ static void event_handler(uint8_t *packet, int size){
             log_info("HCI_EVENT_READ_REMOTE_SUPPORTED_FEATURES_COMPLETE, bonding flags %x", conn->bonding_flags);
             if (conn->bonding_flags & BONDING_DEDICATED){
                 conn->bonding_flags |= BONDING_SEND_AUTHENTICATE_REQUEST;
+                hci_connection_request_service(conn);
             }
             break;
 
@@ -1303,6 +2086,7 @@ static void event_handler(uint8_t *packet, int size){
             if (conn->bonding_flags & BONDING_DEDICATED){
                 conn->bonding_flags &= ~BONDING_DEDICATED;
                 conn->bonding_flags |= BONDING_DISCONNECT_DEDICATED_DONE;
+                hci_connection_request_service(conn);
                 conn->bonding_status = packet[2];
                 break;
             }
@@ -1310,6 +2094,7 @@ static void event_handler(uint8_t *packet, int size){
             if (packet[2] == 0 && gap_security_level_for_link_key_type(conn->link_key_type) >= conn->requested_security_level){
                 // link key sufficient for requested security
                 conn->bonding_flags |= BONDING_SEND_ENCRYPTION_REQUEST;
+                hci_connection_request_service(conn);
                 break;
             }
             // not enough
@@ -1357,7 +2142,7 @@ static void event_handler(uint8_t *packet, int size){
         case HCI_EVENT_DISCONNECTION_COMPLETE:
             if (packet[2]) break;   // status != 0
             handle = READ_BT_16(packet, 3);
-            hci_connection_t * conn = hci_connection_for_handle(handle);
+            conn = hci_connection_for_handle(handle);
             if (!conn) break;       // no conn struct anymore
             conn->state = RECEIVED_DISCONNECTION_COMPLETE;
             break;
@@ -1373,12 +2158,22 @@ static void event_handler(uint8_t *packet, int size){
             break;
 
         case DAEMON_EVENT_HCI_PACKET_SENT:
+            // transport with TX buffer has space again, nothing to release
+            if (hci_stack->hci_transport->tx_buffered) break;
             // release packet buffer only for asynchronous transport and if there are not further fragements
             if (hci_transport_synchronous()) {
                 log_error("Synchronous HCI Transport shouldn't send DAEMON_EVENT_HCI_PACKET_SENT");
                 return; // instead of break: to avoid re-entering hci_run()
             }
-            if (hci_stack->acl_fragmentation_total_size) break;
+            if (hci_stack->acl_buffer_in_transport){
+                hci_acl_buffer_t * buffer = hci_stack->acl_buffer_in_transport;
+                hci_stack->acl_buffer_in_transport = NULL;
+                // free buffer after last fragment
+                if (buffer->pos >= buffer->size){
+                    hci_acl_buffer_free(buffer);
+                }
+                break;
+            }
             hci_release_packet_buffer();
             break;
 
@@ -1388,6 +2183,10 @@ static void event_handler(uint8_t *packet, int size){
                 case HCI_SUBEVENT_LE_ADVERTISING_REPORT:
                     log_info("advertising report received");
                     if (hci_stack->le_scanning_state != LE_SCANNING) break;
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+                    // don't forward raw event without new reports either
+                    if (!le_advertising_report_filter_apply(packet, &size)) return;
+#endif
                     le_handle_advertisement_report(packet, size);
                     break;
                 case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
@@ -1400,8 +2199,7 @@ static void event_handler(uint8_t *packet, int size){
                     if (packet[3]){
                         if (conn){
                             // outgoing connection failed, remove entry
-                            linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
-                            btstack_memory_hci_connection_free( conn );
+                            hci_connection_free(conn);
                         }
                         // if authentication error, also delete link key
                         if (packet[3] == 0x05) {
@@ -1418,14 +2216,10 @@ static void event_handler(uint8_t *packet, int size){
                     }
                     
                     conn->state = OPEN;
-                    conn->con_handle = READ_BT_16(packet, 4);
+                    hci_connection_set_handle(conn, READ_BT_16(packet, 4));
                     
                     // TODO: store - role, peer address type, conn_interval, conn_latency, supervision timeout, master clock
 
-                    // restart timer
-                    // run_loop_set_timer(&conn->timeout, HCI_CONNECTION_TIMEOUT_MS);
-                    // run_loop_add_timer(&conn->timeout);
-                    
                     log_info("New connection: handle %u, %s", conn->con_handle, bd_addr_to_str(conn->address));
                     
                     hci_emit_nr_connections_changed();
@@ -1481,7 +2275,8 @@ static void event_handler(uint8_t *packet, int size){
 }
 
 static void sco_handler(uint8_t * packet, uint16_t size){
-    // not handled yet
+    if (!hci_stack->sco_packet_handler) return;
+    hci_stack->sco_packet_handler(HCI_SCO_DATA_PACKET, packet, size);
 }
 
 static void packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
@@ -1495,6 +2290,7 @@ static void packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
             break;
         case HCI_SCO_DATA_PACKET:
             sco_handler(packet, size);
+            break;
         default:
             break;
     }
@@ -1505,9 +2301,28 @@ void hci_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *p
     hci_stack->packet_handler = handler;
 }
 
+/** Register handler for incoming SCO packets */
+void hci_register_sco_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    hci_stack->sco_packet_handler = handler;
+}
+
 static void hci_state_reset(){
+    // return reassembly buffers of connections that are dropped
+    linked_item_t *it;
+    for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
+        hci_acl_rx_reset((hci_connection_t *) it);
+    }
+
     // no connections yet
     hci_stack->connections = NULL;
+    hci_stack->acl_packets_sent_classic = 0;
+    hci_stack->acl_packets_sent_le = 0;
+    memset(hci_stack->connections_by_handle,  0, sizeof(hci_stack->connections_by_handle));
+    memset(hci_stack->connections_by_address, 0, sizeof(hci_stack->connections_by_address));
+    hci_stack->connections_to_service = NULL;
+    hci_stack->connections_to_service_last = NULL;
+    // queued packets were dropped with their connections
+    hci_stack->acl_tx_queued = 0;
 
     // keep discoverable/connectable as this has been requested by the client(s)
     // hci_stack->discoverable = 0;
@@ -1516,6 +2331,14 @@ static void hci_state_reset(){
 
     // buffer is free
     hci_stack->hci_packet_buffer_reserved = 0;
+    hci_acl_buffers_init();
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    // enabled during init
+    hci_stack->host_flow_control_enabled = 0;
+    hci_stack->host_acl_packets_completed = 0;
+#endif
+    hci_stack->synchronous_flow_control_enabled = 0;
 
     // no pending cmds
     hci_stack->decline_reason = 0;
@@ -1532,6 +2355,9 @@ static void hci_state_reset(){
     hci_stack->le_connection_parameter_range.le_conn_latency_max = 0x03E8;
     hci_stack->le_connection_parameter_range.le_supervision_timeout_min = 0x000A;
     hci_stack->le_connection_parameter_range.le_supervision_timeout_max = 0x0C80;
+#if defined(HAVE_BLE) && defined(ENABLE_LE_ADVERTISING_REPORT_FILTER)
+    le_advertising_report_filter_reset();
+#endif
 }
 
 void hci_init(hci_transport_t *transport, void *config, bt_control_t *control, remote_device_db_t const* remote_device_db){
@@ -1583,6 +2409,12 @@ void hci_init(hci_transport_t *transport, void *config, bt_control_t *control, r
     hci_stack->ssp_authentication_requirement = SSP_IO_AUTHREQ_MITM_PROTECTION_NOT_REQUIRED_GENERAL_BONDING;
     hci_stack->ssp_auto_accept = 1;
 
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+    hci_stack->le_adv_report_window_ms = LE_ADVERTISING_REPORT_WINDOW_MS;
+    hci_stack->le_adv_report_rssi_threshold = LE_ADVERTISING_REPORT_RSSI_THRESHOLD;
+#endif
+
+    hci_acl_rx_buffers_init();
     hci_state_reset();
 }
 
@@ -1718,7 +2550,15 @@ static int hci_power_control_wake(void){
 static void hci_power_transition_to_initializing(void){
     // set up state machine
     hci_stack->num_cmd_packets = 1; // assume that one cmd can be sent
+    hci_stack->num_cmds_in_flight = 0;
     hci_stack->hci_packet_buffer_reserved = 0;
+    hci_stack->init_start_ms = run_loop_get_time_ms();
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    hci_stack->controller_info_checked = 0;
+    hci_stack->controller_info_verified = 0;
+    hci_stack->controller_init_script_active = 0;
+    hci_stack->controller_info_used = 0;
+#endif
     hci_stack->state = HCI_STATE_INITIALIZING;
     hci_stack->substate = 0;
 }
@@ -1890,26 +2730,231 @@ void hci_local_bd_addr(bd_addr_t address_buffer){
     memcpy(address_buffer, hci_stack->local_bd_addr, 6);
 }
 
-void hci_run(){
-        
-    hci_connection_t * connection;
+static void hci_run_once(void);
+
+// run functions of protocol layers, kept over hci_init as layers register only once
+static linked_list_t hci_deferred_runs;
+
+void hci_register_deferred_run(hci_deferred_run_t * deferred_run, void (*run)(void)){
+    deferred_run->run = run;
+    deferred_run->requested = 0;
+    linked_list_add_tail(&hci_deferred_runs, (linked_item_t *) deferred_run);
+}
+
+int hci_defer_run(hci_deferred_run_t * deferred_run){
+    if (!hci_stack || !hci_stack->batch_depth) return 0;
+    deferred_run->requested = 1;
+    return 1;
+}
+
+void hci_batch_begin(void){
+    if (!hci_stack) return;
+    hci_stack->batch_depth++;
+}
+
+// hci_stack is gone if hci_close was called during the batch
+void hci_batch_end(void){
+    if (!hci_stack || !hci_stack->batch_depth) return;
+    hci_stack->batch_depth--;
+    if (hci_stack->batch_depth) return;
+
+    // hci first, then protocol layers in order of registration
+    if (hci_stack->run_requested){
+        hci_stack->run_requested = 0;
+        hci_run();
+    }
     linked_item_t * it;
+    for (it = (linked_item_t *) hci_deferred_runs; it ; it = it->next){
+        hci_deferred_run_t * deferred_run = (hci_deferred_run_t *) it;
+        if (!deferred_run->requested) continue;
+        deferred_run->requested = 0;
+        (*deferred_run->run)();
+    }
+}
 
-    // send continuation fragments first, as they block the prepared packet buffer
-    if (hci_stack->acl_fragmentation_total_size > 0) {
-        hci_con_handle_t con_handle = READ_ACL_CONNECTION_HANDLE(hci_stack->hci_packet_buffer);
-        if (hci_can_send_prepared_acl_packet_now(con_handle)){
-            hci_connection_t *connection = hci_connection_for_handle(con_handle);
-            if (connection) {
-                hci_send_acl_packet_fragments(connection);
-                return;
+void hci_run(){
+    if (hci_stack->batch_depth){
+        hci_stack->run_requested = 1;
+        return;
+    }
+    // send commands as long as the controller accepts them, so independent commands are pipelined
+    while (1){
+        uint32_t num_cmds_sent = hci_stack->num_cmds_sent;
+        hci_run_once();
+        if (hci_stack->num_cmds_sent == num_cmds_sent) break;
+        if (!hci_can_send_command_packet_now()) break;
+    }
+}
+
+// send next pending command of connection
+// @returns 1 if a command was sent, the connection might have more
+static int hci_connection_run(hci_connection_t * connection){
+
+    switch(connection->state){
+        case SEND_CREATE_CONNECTION:
+            switch(connection->address_type){
+                case BD_ADDR_TYPE_CLASSIC:
+                    log_info("sending hci_create_connection");
+                    hci_send_cmd_buffer(hci_cmd_create_connection_create(hci_cmd_buffer(), connection->address, hci_usable_acl_packet_types(), 0, 0, 0, 1));
+                    break;
+                default:
+#ifdef HAVE_BLE
+                    log_info("sending hci_le_create_connection");
+                    hci_send_cmd_buffer(hci_cmd_le_create_connection_create(hci_cmd_buffer(),
+                                 0x0060,    // scan interval: 60 ms
+                                 0x0030,    // scan interval: 30 ms
+                                 0,         // don't use whitelist
+                                 connection->address_type, // peer address type
+                                 connection->address,      // peer bd addr
+                                 hci_stack->adv_addr_type, // our addr type:
+                                 0x0008,    // conn interval min
+                                 0x0018,    // conn interval max
+                                 0,         // conn latency
+                                 0x0048,    // supervision timeout
+                                 0x0001,    // min ce length
+                                 0x0001     // max ce length
+                                 ));
+                    
+                    connection->state = SENT_CREATE_CONNECTION;
+#endif
+                    break;
+            }
+            return 1;
+           
+        case RECEIVED_CONNECTION_REQUEST:
+            log_info("sending hci_accept_connection_request");
+            connection->state = ACCEPTED_CONNECTION_REQUEST;
+            if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
+                hci_send_cmd_buffer(hci_cmd_accept_connection_request_create(hci_cmd_buffer(), connection->address, 1));
+            } else {
+                // TODO: allows to customize synchronous connection parameters
+                hci_send_cmd_buffer(hci_cmd_accept_synchronous_connection_command_create(hci_cmd_buffer(), connection->address, 8000, 8000, 0xFFFF, 0x0060, 0xFF, 0x003F));
+            }
+            return 1;
+
+#ifdef HAVE_BLE
+        case SEND_CANCEL_CONNECTION:
+            connection->state = SENT_CANCEL_CONNECTION;
+            hci_send_cmd_buffer(hci_cmd_le_create_connection_cancel_create(hci_cmd_buffer()));
+            return 1;
+#endif                
+        case SEND_DISCONNECT:
+            connection->state = SENT_DISCONNECT;
+            hci_send_cmd_buffer(hci_cmd_disconnect_create(hci_cmd_buffer(), connection->con_handle, 0x13)); // remote closed connection
+            return 1;
+            
+        default:
+            break;
+    }
+    
+    if (connection->authentication_flags & HANDLE_LINK_KEY_REQUEST){
+        log_info("responding to link key request");
+        connectionClearAuthenticationFlags(connection, HANDLE_LINK_KEY_REQUEST);
+        link_key_t link_key;
+        link_key_type_t link_key_type;
+        if ( hci_stack->remote_device_db
+          && hci_stack->remote_device_db->get_link_key(connection->address, link_key, &link_key_type)
+          && gap_security_level_for_link_key_type(link_key_type) >= connection->requested_security_level){
+           connection->link_key_type = link_key_type;
+           hci_send_cmd_buffer(hci_cmd_link_key_request_reply_create(hci_cmd_buffer(), connection->address, link_key));
+        } else {
+           hci_send_cmd_buffer(hci_cmd_link_key_request_negative_reply_create(hci_cmd_buffer(), connection->address));
+        }
+        return 1;
+    }
+
+    if (connection->authentication_flags & DENY_PIN_CODE_REQUEST){
+        log_info("denying to pin request");
+        connectionClearAuthenticationFlags(connection, DENY_PIN_CODE_REQUEST);
+        hci_send_cmd_buffer(hci_cmd_pin_code_request_negative_reply_create(hci_cmd_buffer(), connection->address));
+        return 1;
+    }
+
+    if (connection->authentication_flags & SEND_IO_CAPABILITIES_REPLY){
+        connectionClearAuthenticationFlags(connection, SEND_IO_CAPABILITIES_REPLY);
+        log_info("IO Capability Request received, stack bondable %u, io cap %u", hci_stack->bondable, hci_stack->ssp_io_capability);
+        if (hci_stack->bondable && (hci_stack->ssp_io_capability != SSP_IO_CAPABILITY_UNKNOWN)){
+            // tweak authentication requirements
+            uint8_t authreq = hci_stack->ssp_authentication_requirement;
+            if (connection->bonding_flags & BONDING_DEDICATED){
+                authreq = SSP_IO_AUTHREQ_MITM_PROTECTION_NOT_REQUIRED_DEDICATED_BONDING;
+            }
+            if (gap_mitm_protection_required_for_security_level(connection->requested_security_level)){
+                authreq |= 1;
             } 
-            // connection gone -> discard further fragments
-            hci_stack->acl_fragmentation_total_size = 0;
-            hci_stack->acl_fragmentation_pos = 0;
-        }        
+            hci_send_cmd_buffer(hci_cmd_io_capability_request_reply_create(hci_cmd_buffer(), connection->address, hci_stack->ssp_io_capability, 0, authreq));
+        } else {
+            hci_send_cmd_buffer(hci_cmd_io_capability_request_negative_reply_create(hci_cmd_buffer(), connection->address, ERROR_CODE_PAIRING_NOT_ALLOWED));
+        }
+        return 1;
+    }
+    
+    if (connection->authentication_flags & SEND_USER_CONFIRM_REPLY){
+        connectionClearAuthenticationFlags(connection, SEND_USER_CONFIRM_REPLY);
+        hci_send_cmd_buffer(hci_cmd_user_confirmation_request_reply_create(hci_cmd_buffer(), connection->address));
+        return 1;
     }
 
+    if (connection->authentication_flags & SEND_USER_PASSKEY_REPLY){
+        connectionClearAuthenticationFlags(connection, SEND_USER_PASSKEY_REPLY);
+        hci_send_cmd_buffer(hci_cmd_user_passkey_request_reply_create(hci_cmd_buffer(), connection->address, 000000));
+        return 1;
+    }
+
+    if (connection->bonding_flags & BONDING_REQUEST_REMOTE_FEATURES){
+        connection->bonding_flags &= ~BONDING_REQUEST_REMOTE_FEATURES;
+        hci_send_cmd_buffer(hci_cmd_read_remote_supported_features_command_create(hci_cmd_buffer(), connection->con_handle));
+        return 1;
+    }
+
+    if (connection->bonding_flags & BONDING_DISCONNECT_SECURITY_BLOCK){
+        connection->bonding_flags &= ~BONDING_DISCONNECT_SECURITY_BLOCK;
+        hci_send_cmd_buffer(hci_cmd_disconnect_create(hci_cmd_buffer(), connection->con_handle, 0x0005));  // authentication failure
+        return 1;
+    }
+    if (connection->bonding_flags & BONDING_DISCONNECT_DEDICATED_DONE){
+        connection->bonding_flags &= ~BONDING_DISCONNECT_DEDICATED_DONE;
+        connection->bonding_flags |= BONDING_EMIT_COMPLETE_ON_DISCONNECT;
+        hci_send_cmd_buffer(hci_cmd_disconnect_create(hci_cmd_buffer(), connection->con_handle, 0x13));  // authentication done
+        return 1;
+    }
+    if (connection->bonding_flags & BONDING_SEND_AUTHENTICATE_REQUEST){
+        connection->bonding_flags &= ~BONDING_SEND_AUTHENTICATE_REQUEST;
+        hci_send_cmd_buffer(hci_cmd_authentication_requested_create(hci_cmd_buffer(), connection->con_handle));
+        return 1;
+    }
+    if (connection->bonding_flags & BONDING_SEND_ENCRYPTION_REQUEST){
+        connection->bonding_flags &= ~BONDING_SEND_ENCRYPTION_REQUEST;
+        hci_send_cmd_buffer(hci_cmd_set_connection_encryption_create(hci_cmd_buffer(), connection->con_handle, 1));
+        return 1;
+    }
+
+#ifdef HAVE_BLE
+    if (connection->le_con_parameter_update_state == CON_PARAMETER_UPDATE_CHANGE_HCI_CON_PARAMETERS){
+        connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE; 
+        
+        uint16_t connection_interval_min = connection->le_conn_interval_min;
+        connection->le_conn_interval_min = 0;
+        hci_send_cmd_buffer(hci_cmd_le_connection_update_create(hci_cmd_buffer(), connection->con_handle, connection_interval_min,
+            connection->le_conn_interval_max, connection->le_conn_latency, connection->le_supervision_timeout,
+            0x0000, 0xffff));
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+static void hci_run_once(void){
+        
+    hci_connection_t * connection;
+
+    // send queued ACL packets as controller buffers become available
+    hci_acl_tx_run();
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    hci_host_acl_packets_report();
+#endif
+
     if (!hci_can_send_command_packet_now()) return;
 
     // global/non-connection oriented commands
@@ -1918,13 +2963,13 @@ void hci_run(){
     if (hci_stack->decline_reason){
         uint8_t reason = hci_stack->decline_reason;
         hci_stack->decline_reason = 0;
-        hci_send_cmd(&hci_reject_connection_request, hci_stack->decline_addr, reason);
+        hci_send_cmd_buffer(hci_cmd_reject_connection_request_create(hci_cmd_buffer(), hci_stack->decline_addr, reason));
         return;
     }
 
     // send scan enable
     if (hci_stack->state == HCI_STATE_WORKING && hci_stack->new_scan_enable_value != 0xff && hci_classic_supported()){
-        hci_send_cmd(&hci_write_scan_enable, hci_stack->new_scan_enable_value);
+        hci_send_cmd_buffer(hci_cmd_write_scan_enable_create(hci_cmd_buffer(), hci_stack->new_scan_enable_value));
         hci_stack->new_scan_enable_value = 0xff;
         return;
     }
@@ -1935,12 +2980,12 @@ void hci_run(){
         switch(hci_stack->le_scanning_state){
             case LE_START_SCAN:
                 hci_stack->le_scanning_state = LE_SCANNING;
-                hci_send_cmd(&hci_le_set_scan_enable, 1, 0);
+                hci_send_cmd_buffer(hci_cmd_le_set_scan_enable_create(hci_cmd_buffer(), 1, 0));
                 return;
                 
             case LE_STOP_SCAN:
                 hci_stack->le_scanning_state = LE_SCAN_IDLE;
-                hci_send_cmd(&hci_le_set_scan_enable, 0, 0);
+                hci_send_cmd_buffer(hci_cmd_le_set_scan_enable_create(hci_cmd_buffer(), 0, 0));
                 return;
             default:
                 break;
@@ -1949,166 +2994,17 @@ void hci_run(){
             // defaults: active scanning, accept all advertisement packets
             int scan_type = hci_stack->le_scan_type;
             hci_stack->le_scan_type = 0xff;
-            hci_send_cmd(&hci_le_set_scan_parameters, scan_type, hci_stack->le_scan_interval, hci_stack->le_scan_window, hci_stack->adv_addr_type, 0);
+            hci_send_cmd_buffer(hci_cmd_le_set_scan_parameters_create(hci_cmd_buffer(), scan_type, hci_stack->le_scan_interval, hci_stack->le_scan_window, hci_stack->adv_addr_type, 0));
             return;
         }
     }
 #endif
     
-    // send pending HCI commands
-    for (it = (linked_item_t *) hci_stack->connections; it ; it = it->next){
-        connection = (hci_connection_t *) it;
-        
-        switch(connection->state){
-            case SEND_CREATE_CONNECTION:
-                switch(connection->address_type){
-                    case BD_ADDR_TYPE_CLASSIC:
-                        log_info("sending hci_create_connection");
-                        hci_send_cmd(&hci_create_connection, connection->address, hci_usable_acl_packet_types(), 0, 0, 0, 1);
-                        break;
-                    default:
-#ifdef HAVE_BLE
-                        log_info("sending hci_le_create_connection");
-                        hci_send_cmd(&hci_le_create_connection,
-                                     0x0060,    // scan interval: 60 ms
-                                     0x0030,    // scan interval: 30 ms
-                                     0,         // don't use whitelist
-                                     connection->address_type, // peer address type
-                                     connection->address,      // peer bd addr
-                                     hci_stack->adv_addr_type, // our addr type:
-                                     0x0008,    // conn interval min
-                                     0x0018,    // conn interval max
-                                     0,         // conn latency
-                                     0x0048,    // supervision timeout
-                                     0x0001,    // min ce length
-                                     0x0001     // max ce length
-                                     );
-                        
-                        connection->state = SENT_CREATE_CONNECTION;
-#endif
-                        break;
-                }
-                return;
-               
-            case RECEIVED_CONNECTION_REQUEST:
-                log_info("sending hci_accept_connection_request");
-                connection->state = ACCEPTED_CONNECTION_REQUEST;
-                if (connection->address_type == BD_ADDR_TYPE_CLASSIC){
-                    hci_send_cmd(&hci_accept_connection_request, connection->address, 1);
-                } else {
-                    // TODO: allows to customize synchronous connection parameters
-                    hci_send_cmd(&hci_accept_synchronous_connection_command, connection->address, 8000, 8000, 0xFFFF, 0x0060, 0xFF, 0x003F);
-                }
-                return;
-
-#ifdef HAVE_BLE
-            case SEND_CANCEL_CONNECTION:
-                connection->state = SENT_CANCEL_CONNECTION;
-                hci_send_cmd(&hci_le_create_connection_cancel);
-                return;
-#endif                
-            case SEND_DISCONNECT:
-                connection->state = SENT_DISCONNECT;
-                hci_send_cmd(&hci_disconnect, connection->con_handle, 0x13); // remote closed connection
-                return;
-                
-            default:
-                break;
-        }
-        
-        if (connection->authentication_flags & HANDLE_LINK_KEY_REQUEST){
-            log_info("responding to link key request");
-            connectionClearAuthenticationFlags(connection, HANDLE_LINK_KEY_REQUEST);
-            link_key_t link_key;
-            link_key_type_t link_key_type;
-            if ( hci_stack->remote_device_db
-              && hci_stack->remote_device_db->get_link_key(connection->address, link_key, &link_key_type)
-              && gap_security_level_for_link_key_type(link_key_type) >= connection->requested_security_level){
-               connection->link_key_type = link_key_type;
-               hci_send_cmd(&hci_link_key_request_reply, connection->address, &link_key);
-            } else {
-               hci_send_cmd(&hci_link_key_request_negative_reply, connection->address);
-            }
-            return;
-        }
-
-        if (connection->authentication_flags & DENY_PIN_CODE_REQUEST){
-            log_info("denying to pin request");
-            connectionClearAuthenticationFlags(connection, DENY_PIN_CODE_REQUEST);
-            hci_send_cmd(&hci_pin_code_request_negative_reply, connection->address);
-            return;
-        }
-
-        if (connection->authentication_flags & SEND_IO_CAPABILITIES_REPLY){
-            connectionClearAuthenticationFlags(connection, SEND_IO_CAPABILITIES_REPLY);
-            log_info("IO Capability Request received, stack bondable %u, io cap %u", hci_stack->bondable, hci_stack->ssp_io_capability);
-            if (hci_stack->bondable && (hci_stack->ssp_io_capability != SSP_IO_CAPABILITY_UNKNOWN)){
-                // tweak authentication requirements
-                uint8_t authreq = hci_stack->ssp_authentication_requirement;
-                if (connection->bonding_flags & BONDING_DEDICATED){
-                    authreq = SSP_IO_AUTHREQ_MITM_PROTECTION_NOT_REQUIRED_DEDICATED_BONDING;
-                }
-                if (gap_mitm_protection_required_for_security_level(connection->requested_security_level)){
-                    authreq |= 1;
-                } 
-                hci_send_cmd(&hci_io_capability_request_reply, &connection->address, hci_stack->ssp_io_capability, NULL, authreq);
-            } else {
-                hci_send_cmd(&hci_io_capability_request_negative_reply, &connection->address, ERROR_CODE_PAIRING_NOT_ALLOWED);
-            }
-            return;
-        }
-        
-        if (connection->authentication_flags & SEND_USER_CONFIRM_REPLY){
-            connectionClearAuthenticationFlags(connection, SEND_USER_CONFIRM_REPLY);
-            hci_send_cmd(&hci_user_confirmation_request_reply, &connection->address);
-            return;
-        }
-
-        if (connection->authentication_flags & SEND_USER_PASSKEY_REPLY){
-            connectionClearAuthenticationFlags(connection, SEND_USER_PASSKEY_REPLY);
-            hci_send_cmd(&hci_user_passkey_request_reply, &connection->address, 000000);
-            return;
-        }
-
-        if (connection->bonding_flags & BONDING_REQUEST_REMOTE_FEATURES){
-            connection->bonding_flags &= ~BONDING_REQUEST_REMOTE_FEATURES;
-            hci_send_cmd(&hci_read_remote_supported_features_command, connection->con_handle);
-            return;
-        }
-
-        if (connection->bonding_flags & BONDING_DISCONNECT_SECURITY_BLOCK){
-            connection->bonding_flags &= ~BONDING_DISCONNECT_SECURITY_BLOCK;
-            hci_send_cmd(&hci_disconnect, connection->con_handle, 0x0005);  // authentication failure
-            return;
-        }
-        if (connection->bonding_flags & BONDING_DISCONNECT_DEDICATED_DONE){
-            connection->bonding_flags &= ~BONDING_DISCONNECT_DEDICATED_DONE;
-            connection->bonding_flags |= BONDING_EMIT_COMPLETE_ON_DISCONNECT;
-            hci_send_cmd(&hci_disconnect, connection->con_handle, 0x13);  // authentication done
-            return;
-        }
-        if (connection->bonding_flags & BONDING_SEND_AUTHENTICATE_REQUEST){
-            connection->bonding_flags &= ~BONDING_SEND_AUTHENTICATE_REQUEST;
-            hci_send_cmd(&hci_authentication_requested, connection->con_handle);
-            return;
-        }
-        if (connection->bonding_flags & BONDING_SEND_ENCRYPTION_REQUEST){
-            connection->bonding_flags &= ~BONDING_SEND_ENCRYPTION_REQUEST;
-            hci_send_cmd(&hci_set_connection_encryption, connection->con_handle, 1);
-            return;
-        }
-
-#ifdef HAVE_BLE
-        if (connection->le_con_parameter_update_state == CON_PARAMETER_UPDATE_CHANGE_HCI_CON_PARAMETERS){
-            connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_NONE; 
-            
-            uint16_t connection_interval_min = connection->le_conn_interval_min;
-            connection->le_conn_interval_min = 0;
-            hci_send_cmd(&hci_le_connection_update, connection->con_handle, connection_interval_min,
-                connection->le_conn_interval_max, connection->le_conn_latency, connection->le_supervision_timeout,
-                0x0000, 0xffff);
-        }
-#endif
+    // send pending HCI commands, connections stay queued until they have nothing left to send
+    while (hci_stack->connections_to_service){
+        connection = hci_stack->connections_to_service;
+        if (hci_connection_run(connection)) return;
+        hci_connection_service_done(connection);
     }
 
     switch (hci_stack->state){
@@ -2127,7 +3023,7 @@ void hci_run(){
                 if (!hci_can_send_command_packet_now()) return;
                 
                 log_info("HCI_STATE_HALTING, connection %p, handle %u", connection, (uint16_t)connection->con_handle);
-                hci_send_cmd(&hci_disconnect, connection->con_handle, 0x13);  // remote closed connection
+                hci_send_cmd_buffer(hci_cmd_disconnect_create(hci_cmd_buffer(), connection->con_handle, 0x13));  // remote closed connection
 
                 // send disconnected event right away - causes higher layer connections to get closed, too.
                 hci_shutdown_connection(connection);
@@ -2162,7 +3058,7 @@ void hci_run(){
                         if (!hci_can_send_command_packet_now()) return;
 
                         log_info("HCI_STATE_FALLING_ASLEEP, connection %p, handle %u", connection, (uint16_t)connection->con_handle);
-                        hci_send_cmd(&hci_disconnect, connection->con_handle, 0x13);  // remote closed connection
+                        hci_send_cmd_buffer(hci_cmd_disconnect_create(hci_cmd_buffer(), connection->con_handle, 0x13));  // remote closed connection
                         
                         // send disconnected event right away - causes higher layer connections to get closed, too.
                         hci_shutdown_connection(connection);
@@ -2174,7 +3070,7 @@ void hci_run(){
                         if (!hci_can_send_command_packet_now()) return;
                         
                         log_info("HCI_STATE_HALTING, disabling inq scans");
-                        hci_send_cmd(&hci_write_scan_enable, hci_stack->connectable << 1); // drop inquiry scan but keep page scan
+                        hci_send_cmd_buffer(hci_cmd_write_scan_enable_create(hci_cmd_buffer(), hci_stack->connectable << 1)); // drop inquiry scan but keep page scan
                         
                         // continue in next sub state
                         hci_stack->substate++;
@@ -2227,6 +3123,7 @@ int hci_send_cmd_packet(uint8_t *packet, int size){
                 return 0; // don't sent packet to controller
             }
             conn->state = SEND_CREATE_CONNECTION;
+            hci_connection_request_service(conn);
         }
         log_info("conn state %u", conn->state);
         switch (conn->state){
@@ -2278,6 +3175,11 @@ int hci_send_cmd_packet(uint8_t *packet, int size){
         }
     }
 
+    // controller reports completed SCO packets only with synchronous flow control
+    if (IS_COMMAND(packet, hci_write_synchronous_flow_control_enable)){
+        hci_stack->synchronous_flow_control_enabled = packet[3];
+    }
+
 #ifdef HAVE_BLE
     if (IS_COMMAND(packet, hci_le_set_advertising_parameters)){
         hci_stack->adv_addr_type = packet[8];
@@ -2287,7 +3189,17 @@ int hci_send_cmd_packet(uint8_t *packet, int size){
     }
 #endif
 
-    hci_stack->num_cmd_packets--;
+    // commands sent before reset won't complete
+    if (IS_COMMAND(packet, hci_reset)){
+        hci_stack->num_cmds_in_flight = 0;
+    }
+
+    // Host Number Of Completed Packets doesn't use a command credit and isn't acknowledged
+    if (!IS_COMMAND(packet, hci_host_number_of_completed_packets)){
+        hci_stack->num_cmd_packets--;
+        hci_cmds_in_flight_add(READ_BT_16(packet, 0));
+        hci_stack->num_cmds_sent++;
+    }
 
     hci_dump_packet(HCI_COMMAND_DATA_PACKET, 0, packet, size);
     int err = hci_stack->hci_transport->send_packet(HCI_COMMAND_DATA_PACKET, packet, size);
@@ -2305,6 +3217,7 @@ void hci_disconnect_security_block(hci_con_handle_t con_handle){
     hci_connection_t * connection = hci_connection_for_handle(con_handle);
     if (!connection) return;
     connection->bonding_flags |= BONDING_DISCONNECT_SECURITY_BLOCK;
+    hci_connection_request_service(connection);
 }
 
 
@@ -2603,6 +3516,7 @@ void gap_request_security_level(hci_con_handle_t con_handle, gap_security_level_
         if (hci_stack->remote_device_db->get_link_key( &connection->address, &link_key, &link_key_type)){
             if (gap_security_level_for_link_key_type(link_key_type) >= requested_level){
                 connection->bonding_flags |= BONDING_SEND_ENCRYPTION_REQUEST;
+                hci_connection_request_service(connection);
                 return;
             }
         }
@@ -2611,6 +3525,7 @@ void gap_request_security_level(hci_con_handle_t con_handle, gap_security_level_
 
     // try to authenticate connection
     connection->bonding_flags |= BONDING_SEND_AUTHENTICATE_REQUEST;
+    hci_connection_request_service(connection);
     hci_run();
 }
 
@@ -2634,6 +3549,7 @@ int gap_dedicated_bonding(bd_addr_t device, int mitm_protection_required){
 
     // configure LEVEL_2/3, dedicated bonding
     connection->state = SEND_CREATE_CONNECTION;    
+    hci_connection_request_service(connection);
     connection->requested_security_level = mitm_protection_required ? LEVEL_3 : LEVEL_2;
     log_info("gap_dedicated_bonding, mitm %u -> level %u", mitm_protection_required, connection->requested_security_level);
     connection->bonding_flags = BONDING_DEDICATED;
@@ -2655,6 +3571,10 @@ void gap_set_local_name(const char * local_name){
 
 le_command_status_t le_central_start_scan(){
     if (hci_stack->le_scanning_state == LE_SCANNING) return BLE_PERIPHERAL_OK;
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+    // report all advertisers again
+    le_advertising_report_filter_reset();
+#endif
     hci_stack->le_scanning_state = LE_START_SCAN;
     hci_run();
     return BLE_PERIPHERAL_OK;
@@ -2674,6 +3594,27 @@ void le_central_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval, u
     hci_run();
 }
 
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+void gap_le_set_advertising_report_filter(uint32_t window_ms, uint8_t rssi_threshold){
+    hci_stack->le_adv_report_window_ms = window_ms;
+    hci_stack->le_adv_report_rssi_threshold = rssi_threshold;
+}
+
+void gap_le_advertising_report_filter_add_ad_type(uint8_t ad_type){
+    hci_stack->le_adv_report_ad_types[ad_type >> 3] |= 1 << (ad_type & 7);
+    hci_stack->le_adv_report_ad_types_set = 1;
+}
+
+void gap_le_advertising_report_filter_clear_ad_types(void){
+    memset(hci_stack->le_adv_report_ad_types, 0, sizeof(hci_stack->le_adv_report_ad_types));
+    hci_stack->le_adv_report_ad_types_set = 0;
+}
+
+const le_advertising_report_stats_t * gap_le_get_advertising_report_stats(void){
+    return &hci_stack->le_adv_report_stats;
+}
+#endif
+
 le_command_status_t le_central_connect(bd_addr_t  addr, bd_addr_type_t addr_type){
     hci_connection_t * conn = hci_connection_for_bd_addr_and_type(addr, addr_type);
     if (!conn){
@@ -2686,6 +3627,7 @@ le_command_status_t le_central_connect(bd_addr_t  addr, bd_addr_type_t addr_type
             return BLE_PERIPHERAL_NOT_CONNECTED; // don't sent packet to controller
         }
         conn->state = SEND_CREATE_CONNECTION;
+        hci_connection_request_service(conn);
         log_info("le_central_connect: send create connection next");
         hci_run();
         return BLE_PERIPHERAL_OK;
@@ -2728,12 +3670,12 @@ le_command_status_t le_central_connect_cancel(){
         case SEND_CREATE_CONNECTION:
             // skip sending create connection and emit event instead
             hci_emit_le_connection_complete(conn->address_type, conn->address, 0, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER);
-            linked_list_remove(&hci_stack->connections, (linked_item_t *) conn);
-            btstack_memory_hci_connection_free( conn );
+            hci_connection_free(conn);
             break;            
         case SENT_CREATE_CONNECTION:
             // request to send cancel connection
             conn->state = SEND_CANCEL_CONNECTION;
+            hci_connection_request_service(conn);
             hci_run();
             break;
         default:
@@ -2769,6 +3711,7 @@ le_command_status_t gap_disconnect(hci_con_handle_t handle){
         return BLE_PERIPHERAL_OK;
     }
     conn->state = SEND_DISCONNECT;
+    hci_connection_request_service(conn);
     hci_run();
     return BLE_PERIPHERAL_OK;
 }
@@ -2780,6 +3723,7 @@ void hci_disconnect_all(){
         hci_connection_t * con = (hci_connection_t*) linked_list_iterator_next(&it);
         if (con->state == SENT_DISCONNECT) continue;
         con->state = SEND_DISCONNECT;
+        hci_connection_request_service(con);
     }
     hci_run();
 }
@@ -52,6 +52,9 @@
 #include "hci_transport.h"
 #include "bt_control.h"
 #include "remote_device_db.h"
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+#include "hci_controller_cache.h"
+#endif
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -121,6 +124,72 @@ extern "C" {
     #define HCI_INCOMING_PRE_BUFFER_SIZE 0
 #endif
 
+// number of hash buckets for connection lookup by handle and by address
+#ifndef HCI_CONNECTION_HASH_SIZE
+    #define HCI_CONNECTION_HASH_SIZE 16
+#endif
+
+// number of outgoing ACL buffers shared by all connection transmit queues, in addition to the HCI packet buffer.
+// each one takes HCI_OUTGOING_PRE_BUFFER_SIZE + HCI_PACKET_BUFFER_SIZE bytes in hci_stack. at least one is
+// needed to queue a packet while the next one is assembled, more allow other connections to queue while one waits
+#ifndef HCI_ACL_TX_BUFFERS
+#ifdef HAVE_MALLOC
+    #define HCI_ACL_TX_BUFFERS 4
+#else
+    #define HCI_ACL_TX_BUFFERS 1
+#endif
+#endif
+#if HCI_ACL_TX_BUFFERS < 1
+    #error HCI_ACL_TX_BUFFERS must be at least 1
+#endif
+
+// max number of ACL packets queued per connection
+#ifndef HCI_ACL_TX_QUEUE_MAX
+    #define HCI_ACL_TX_QUEUE_MAX 2
+#endif
+
+// number of incoming ACL reassembly buffers shared by all connections, only used without HAVE_MALLOC
+// each buffer takes HCI_ACL_BUFFER_SIZE bytes but is only needed while a fragmented L2CAP packet is received.
+// if more connections receive fragmented packets at the same time, their packets are dropped (see alloc_failures)
+#ifndef HAVE_MALLOC
+#ifndef HCI_ACL_RX_BUFFERS
+    #define HCI_ACL_RX_BUFFERS 1
+#endif
+#endif
+
+// number of outstanding HCI commands tracked for opcode matching
+#ifndef HCI_MAX_CMDS_IN_FLIGHT
+    #define HCI_MAX_CMDS_IN_FLIGHT 8
+#endif
+
+// share of controller ACL buffers for new connections, see hci_connection_set_acl_tx_weight
+#ifndef HCI_ACL_TX_DEFAULT_WEIGHT
+    #define HCI_ACL_TX_DEFAULT_WEIGHT 1
+#endif
+
+// controller to host flow control: number and size of incoming ACL packets announced via Host_Buffer_Size
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+#ifndef HCI_HOST_ACL_PACKET_NUM
+    #define HCI_HOST_ACL_PACKET_NUM 4
+#endif
+#ifndef HCI_HOST_ACL_PACKET_LEN
+    #define HCI_HOST_ACL_PACKET_LEN HCI_ACL_PAYLOAD_SIZE
+#endif
+#endif
+
+// LE advertising report filter: number of cached reports, duplicate suppression window, and RSSI change reported again (0 = ignore RSSI)
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+#ifndef LE_ADVERTISING_REPORT_CACHE_SIZE
+    #define LE_ADVERTISING_REPORT_CACHE_SIZE 16
+#endif
+#ifndef LE_ADVERTISING_REPORT_WINDOW_MS
+    #define LE_ADVERTISING_REPORT_WINDOW_MS 1000
+#endif
+#ifndef LE_ADVERTISING_REPORT_RSSI_THRESHOLD
+    #define LE_ADVERTISING_REPORT_RSSI_THRESHOLD 10
+#endif
+#endif
+
 // OGFs
 #define OGF_LINK_CONTROL          0x01
 #define OGF_LINK_POLICY           0x02
@@ -156,6 +225,9 @@ extern "C" {
 // set global Bluetooth state
 #define BTSTACK_SET_BLUETOOTH_ENABLED                      0x08
 
+// log run loop profile: @param reset
+#define BTSTACK_DUMP_RUN_LOOP_PROFILE                      0x09
+
 // create l2cap channel: @param bd_addr(48), psm (16)
 #define L2CAP_CREATE_CHANNEL                               0x20
 
@@ -461,10 +533,80 @@ typedef struct sm_connection {
     int                      sm_le_db_index;
 } sm_connection_t;
 
+// outgoing packet buffer, queued on a connection until all fragments are sent
 typedef struct {
+    // linked list - assert: first field
+    linked_item_t item;
+
+    // ACL packet size incl. header and start of next fragment
+    uint16_t size;
+    uint16_t pos;
+
+    // additional prebuffer for H4 drivers
+    uint8_t  prefix[HCI_OUTGOING_PRE_BUFFER_SIZE];
+    uint8_t  data[HCI_PACKET_BUFFER_SIZE];
+} hci_acl_buffer_t;
+
+#ifndef HAVE_MALLOC
+// incoming ACL reassembly buffer - PRE_BUFFER + ACL Header + ACL payload
+typedef struct {
+    // linked list - assert: first field
+    linked_item_t item;
+    uint8_t data[HCI_INCOMING_PRE_BUFFER_SIZE + 4 + HCI_ACL_BUFFER_SIZE];
+} hci_acl_rx_buffer_t;
+#endif
+
+// incoming ACL reassembly statistics
+typedef struct {
+    uint32_t packets_direct;        // L2CAP packets delivered from transport buffer
+    uint32_t packets_reassembled;   // L2CAP packets delivered from reassembly buffer
+    uint32_t alloc_failures;        // L2CAP packets dropped as no reassembly buffer was available
+    uint16_t buffers_in_use;
+    uint16_t buffers_in_use_max;
+    uint32_t bytes_in_use;
+    uint32_t bytes_in_use_max;
+} hci_acl_rx_stats_t;
+
+// outgoing ACL statistics per connection
+typedef struct {
+    uint32_t packets_queued;    // packets accepted by hci_send_acl_packet_buffer
+    uint32_t queue_full;        // packets rejected as transmit queue was full
+    uint32_t fragments_sent;    // ACL packets sent to controller
+    uint32_t bytes_sent;        // ACL payload sent to controller
+    uint32_t turns_exhausted;   // turns passed on with data left as deficit was used up
+} hci_acl_tx_stats_t;
+
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+// last delivered report per advertiser and advertising data
+typedef struct {
+    uint8_t   addr[6];          // as in HCI event
+    uint8_t   addr_type;
+    int8_t    rssi;
+    uint32_t  data_hash;        // event type and advertising data
+    uint32_t  reported_ms;      // delivered to packet handler
+    uint32_t  seen;             // value of report counter when last received, for LRU replacement
+} le_advertising_report_cache_entry_t;
+
+typedef struct {
+    uint32_t reports_received;
+    uint32_t reports_delivered;
+    uint32_t duplicates_dropped;
+    uint32_t reports_filtered;  // no requested AD type
+} le_advertising_report_stats_t;
+#endif
+
+typedef struct hci_connection {
     // linked list - assert: first field
     linked_item_t    item;
     
+    // hash bucket chains for lookup by handle and by address
+    struct hci_connection * next_for_handle;
+    struct hci_connection * next_for_address;
+
+    // queue of connections with pending commands, see hci_connection_request_service
+    struct hci_connection * next_to_service;
+    uint8_t service_requested;
+
     // remote side
     bd_addr_t address;
     
@@ -489,18 +631,14 @@ typedef struct {
     // errands
     uint32_t authentication_flags;
 
-    timer_source_t timeout;
+    // set by incoming and outgoing packets, cleared by idle sweep
+    uint8_t  active;
     
-#ifdef HAVE_TIME
-    // timer
-    struct timeval timestamp;
-#endif
-#ifdef HAVE_TICK
-    uint32_t timestamp; // timeout in system ticks
-#endif
+    // last activity seen by idle sweep in ms, see run_loop_get_time_ms()
+    uint32_t timestamp;
     
-    // ACL packet recombination - PRE_BUFFER + ACL Header + ACL payload
-    uint8_t  acl_recombination_buffer[HCI_INCOMING_PRE_BUFFER_SIZE + 4 + HCI_ACL_BUFFER_SIZE];
+    // ACL packet recombination - PRE_BUFFER + ACL Header + ACL payload, allocated on first fragment
+    uint8_t * acl_recombination_buffer;
     uint16_t acl_recombination_pos;
     uint16_t acl_recombination_length;
     
@@ -508,6 +646,23 @@ typedef struct {
     uint8_t num_acl_packets_sent;
     uint8_t num_sco_packets_sent;
 
+    // outgoing ACL packets waiting for controller buffers
+    linked_list_t acl_tx_queue;
+    uint8_t       acl_tx_queue_len;
+
+    // ACL scheduler: share and payload bytes left in current turn
+    uint8_t       acl_tx_weight;
+    uint32_t      acl_tx_deficit;
+    uint8_t       acl_tx_quantum_granted;   // deficit was increased and not used up yet
+    hci_acl_tx_stats_t acl_tx_stats;
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    // incoming ACL packets released but not reported to controller yet
+    uint16_t host_acl_packets_completed;
+    // incoming ACL packets delivered but not released by upper layer
+    uint16_t host_acl_packets_held;
+#endif
+
     // LE Connection parameter update
     le_con_parameter_update_state_t le_con_parameter_update_state;
     uint16_t le_conn_interval_min;
@@ -523,6 +678,15 @@ typedef struct {
 
 } hci_connection_t;
 
+/**
+ * run function of a protocol layer that is deferred while the transport delivers a batch of packets
+ */
+typedef struct {
+    linked_item_t item;
+    void (*run)(void);
+    uint8_t requested;
+} hci_deferred_run_t;
+
 /**
  * main data structure
  */
@@ -546,19 +710,78 @@ typedef struct {
     // list of existing baseband connections
     linked_list_t     connections;
 
-    // single buffer for HCI packet assembly + additional prebuffer for H4 drivers
-    uint8_t   hci_packet_buffer_prefix[HCI_OUTGOING_PRE_BUFFER_SIZE];
-    uint8_t   hci_packet_buffer[HCI_PACKET_BUFFER_SIZE]; // opcode (16), len(8)
-    uint8_t   hci_packet_buffer_reserved;
-    uint16_t  acl_fragmentation_pos;
-    uint16_t  acl_fragmentation_total_size;
+    // hash tables on top of connections list
+    hci_connection_t * connections_by_handle[HCI_CONNECTION_HASH_SIZE];
+    hci_connection_t * connections_by_address[HCI_CONNECTION_HASH_SIZE];
+
+    // connections with pending commands in order of request, hci_run only visits these
+    hci_connection_t * connections_to_service;
+    hci_connection_t * connections_to_service_last;
+
+    // outgoing buffers: one for HCI packet assembly, others queued on connections or free
+    hci_acl_buffer_t   acl_buffers[1 + HCI_ACL_TX_BUFFERS];
+    linked_list_t      acl_buffers_free;
+    hci_acl_buffer_t * hci_packet_buffer_current;
+    uint8_t *          hci_packet_buffer;   // data of current buffer: opcode (16), len(8)
+    uint8_t            hci_packet_buffer_reserved;
+
+    // incoming ACL reassembly
+#ifndef HAVE_MALLOC
+    hci_acl_rx_buffer_t acl_rx_buffers[HCI_ACL_RX_BUFFERS];
+    linked_list_t       acl_rx_buffers_free;
+#endif
+    hci_acl_rx_stats_t  acl_rx_stats;
+
+    // ACL transmit scheduling
+    hci_acl_buffer_t * acl_buffer_in_transport;
+    hci_con_handle_t   acl_tx_con_handle;   // connection in turn
+    uint16_t           acl_tx_queued;       // packets in all connection queues
+    uint16_t           acl_packets_sent_classic;    // num_acl_packets_sent of all classic connections
+    uint16_t           acl_packets_sent_le;         // num_acl_packets_sent of all LE connections
+    uint8_t            acl_tx_running;
      
     /* host to controller flow control */
     uint8_t  num_cmd_packets;
+
+    // opcodes of sent commands waiting for command complete or command status, oldest first
+    uint16_t cmds_in_flight[HCI_MAX_CMDS_IN_FLIGHT];
+    uint8_t  num_cmds_in_flight;
+    uint32_t num_cmds_sent;
+
+    // periodic check for idle connections
+    timer_source_t connection_idle_timer;
+    uint8_t        connection_idle_timer_active;
+
+    // batch of packets from transport, hci_run is called once at the end
+    uint8_t  batch_depth;
+    uint8_t  run_requested;
+
+    // time from power on to HCI_STATE_WORKING
+    uint32_t init_start_ms;
+    uint32_t init_duration_ms;
+
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+    // capabilities of known controllers
+    const hci_controller_cache_t * controller_cache;
+    hci_controller_info_t controller_info;          // cached or collected during init
+    uint8_t  controller_version[HCI_CONTROLLER_VERSION_LEN];   // last Read Local Version Information result
+    uint8_t  controller_info_checked;
+    uint8_t  controller_info_verified;              // controller_info matches controller
+    uint8_t  controller_init_script_active;         // controller kept state of previous init script
+    uint8_t  controller_info_used;                  // last init used cached info
+#endif
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+    /* controller to host flow control */
+    uint8_t  host_flow_control_enabled;
+    uint8_t  host_acl_packets_manual_release;
+    uint16_t host_acl_packets_completed;    // sum over all connections
+#endif
     uint8_t  acl_packets_total_num;
     uint16_t acl_data_packet_length;
     uint8_t  sco_packets_total_num;
     uint8_t  sco_data_packet_length;
+    uint8_t  synchronous_flow_control_enabled;
     uint8_t  le_acl_packets_total_num;
     uint16_t le_data_packets_length;
 
@@ -571,6 +794,9 @@ typedef struct {
     /* callback to L2CAP layer */
     void (*packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
 
+    /* callback for SCO data */
+    void (*sco_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+
     /* remote device db */
     remote_device_db_t const*remote_device_db;
     
@@ -604,6 +830,17 @@ typedef struct {
 
     le_connection_parameter_range_t le_connection_parameter_range;
 
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+    le_advertising_report_cache_entry_t le_adv_report_cache[LE_ADVERTISING_REPORT_CACHE_SIZE];
+    uint8_t  le_adv_report_cache_len;
+    uint32_t le_adv_report_counter;
+    uint32_t le_adv_report_window_ms;
+    uint8_t  le_adv_report_rssi_threshold;
+    uint8_t  le_adv_report_ad_types[32];    // bitmap
+    uint8_t  le_adv_report_ad_types_set;
+    le_advertising_report_stats_t le_adv_report_stats;
+#endif
+
     // custom BD ADDR
     bd_addr_t custom_bd_addr; 
     uint8_t   custom_bd_addr_set;
@@ -627,6 +864,16 @@ le_command_status_t le_central_connect_cancel(void);
 le_command_status_t gap_disconnect(hci_con_handle_t handle);
 void le_central_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window);
 
+#ifdef ENABLE_LE_ADVERTISING_REPORT_FILTER
+// drop reports with same address and data within window_ms unless RSSI changed by rssi_threshold dB (0 = ignore RSSI)
+void gap_le_set_advertising_report_filter(uint32_t window_ms, uint8_t rssi_threshold);
+// only deliver reports that contain one of the added AD types
+void gap_le_advertising_report_filter_add_ad_type(uint8_t ad_type);
+void gap_le_advertising_report_filter_clear_ad_types(void);
+// reset on power on and when scanning starts
+const le_advertising_report_stats_t * gap_le_get_advertising_report_stats(void);
+#endif
+
 // *************** le client end
     
 // create and send hci command packets based on a template and a list of parameters
@@ -641,6 +888,19 @@ void hci_close(void);
  */
 void hci_run(void);
 
+// Transport delivers several packets in a row, e.g. from a single read. Until hci_batch_end,
+// hci_run and registered protocol run functions only note the request and run once at the end.
+// Calls can be nested.
+void hci_batch_begin(void);
+void hci_batch_end(void);
+
+// register run function of a protocol layer, e.g. l2cap_run
+void hci_register_deferred_run(hci_deferred_run_t * deferred_run, void (*run)(void));
+
+// called at start of a run function
+// @returns 1 if the run was deferred to the end of the current batch, the run function returns then
+int  hci_defer_run(hci_deferred_run_t * deferred_run);
+
 // send complete CMD packet
 int hci_send_cmd_packet(uint8_t *packet, int size);
 
@@ -671,13 +931,44 @@ uint8_t* hci_get_outgoing_packet_buffer(void);
 void hci_local_bd_addr(bd_addr_t address_buffer);
 
 hci_connection_t * hci_connection_for_handle(hci_con_handle_t con_handle);
+
+// mark connection for hci_run after setting a flag or state that requires a command
+void hci_connection_request_service(hci_connection_t * connection);
 hci_connection_t * hci_connection_for_bd_addr_and_type(bd_addr_t addr, bd_addr_type_t addr_type);
 int hci_is_le_connection(hci_connection_t * connection);
 uint8_t  hci_number_outgoing_packets(hci_con_handle_t handle);
 uint8_t  hci_number_free_acl_slots_for_handle(hci_con_handle_t con_handle);
+
+// share of controller ACL buffers relative to other connections with queued data, default HCI_ACL_TX_DEFAULT_WEIGHT
+void hci_connection_set_acl_tx_weight(hci_con_handle_t con_handle, uint8_t weight);
+// @returns outgoing ACL statistics or NULL if connection does not exist
+const hci_acl_tx_stats_t * hci_connection_get_acl_tx_stats(hci_con_handle_t con_handle);
+// @returns incoming ACL reassembly statistics
+const hci_acl_rx_stats_t * hci_get_acl_rx_stats(void);
+
+// @returns number of sent commands without command complete or command status
+int      hci_number_commands_in_flight(void);
+// @returns time of last initialization from power on to HCI_STATE_WORKING in ms
+uint32_t hci_get_init_duration_ms(void);
+
+#ifdef ENABLE_HCI_CONTROLLER_CACHE
+// use cached controller capabilities to skip init commands, NULL to disable
+void hci_set_controller_cache(const hci_controller_cache_t * cache);
+// @returns 1 if last initialization used cached controller info
+int  hci_controller_info_from_cache(void);
+#endif
+
+#ifdef ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+// if enabled, incoming ACL packets count as used host buffers until released with hci_host_acl_packet_release
+// otherwise, they are released when the packet handler returns
+void hci_set_host_acl_packets_manual_release(int enable);
+// release one incoming ACL packet delivered to packet handler
+void hci_host_acl_packet_release(hci_con_handle_t con_handle);
+#endif
 int      hci_authentication_active_for_handle(hci_con_handle_t handle);
 uint16_t hci_max_acl_data_packet_length(void);
 uint16_t hci_max_acl_le_data_packet_length(void);
+uint16_t hci_max_sco_data_packet_length(void);
 uint16_t hci_usable_acl_packet_types(void);
 int      hci_non_flushable_packet_boundary_flag_supported(void);
 
@@ -726,6 +1017,9 @@ void hci_set_bd_addr(bd_addr_t addr);
 // Registers a packet handler. Used if L2CAP is not used (rarely). 
 void hci_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size));
 
+// Registers a handler for incoming SCO packets, e.g. sco_stream
+void hci_register_sco_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size));
+
 // Requests the change of BTstack power mode.
 int  hci_power_control(HCI_POWER_MODE mode);
 
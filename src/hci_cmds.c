@@ -621,6 +621,13 @@ const hci_cmd_t hci_write_synchronous_flow_control_enable = {
 OPCODE(OGF_CONTROLLER_BASEBAND, 0x2f), "1"
 };
 
+/**
+ * @param flow_control_enable - 0: off, 1: ACL only, 2: SCO only, 3: ACL + SCO
+ */
+const hci_cmd_t hci_set_controller_to_host_flow_control = {
+OPCODE(OGF_CONTROLLER_BASEBAND, 0x31), "1"
+};
+
 /**
  * @param host_acl_data_packet_length
  * @param host_synchronous_data_packet_length
@@ -631,6 +638,16 @@ const hci_cmd_t hci_host_buffer_size = {
 OPCODE(OGF_CONTROLLER_BASEBAND, 0x33), "2122"
 };
 
+/**
+ * @note only single handle supported by BTstack command generator
+ * @param number_of_handles
+ * @param connection_handle
+ * @param host_num_of_completed_packets
+ */
+const hci_cmd_t hci_host_number_of_completed_packets = {
+OPCODE(OGF_CONTROLLER_BASEBAND, 0x35), "1H2"
+};
+
 /**
  * @param handle
  */
@@ -689,6 +706,9 @@ OPCODE(OGF_CONTROLLER_BASEBAND, 0x6d), "11"
  * Informational Parameters
  */
 
+const hci_cmd_t hci_read_local_version_information = {
+OPCODE(OGF_INFORMATIONAL_PARAMETERS, 0x01), ""
+};
 const hci_cmd_t hci_read_local_supported_features = {
 OPCODE(OGF_INFORMATIONAL_PARAMETERS, 0x03), ""
 };
@@ -1030,6 +1050,13 @@ const hci_cmd_t btstack_set_bluetooth_enabled = {
 OPCODE(OGF_BTSTACK, BTSTACK_SET_BLUETOOTH_ENABLED), "1"
 };
 
+/**
+ * @param reset_flag (0 = keep statistics, 1 = reset statistics after dump)
+ */
+const hci_cmd_t btstack_dump_run_loop_profile = {
+OPCODE(OGF_BTSTACK, BTSTACK_DUMP_RUN_LOOP_PROFILE), "1"
+};
+
 /**
  * @param bd_addr (48)
  * @param psm (16)
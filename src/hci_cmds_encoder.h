@@ -0,0 +1,1340 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_cmds_encoder.h
+ *
+ *  @brief Typed encoders for HCI commands
+ *
+ *  @note code automatically generated by tools/hci_cmds_encoder_generator.py from src/hci_cmds.c
+ *
+ *  Each hci_cmd_NAME_create(buffer, ...) writes the same bytes as
+ *  hci_create_cmd(buffer, &hci_NAME, ...) and returns the command size.
+ *  The hci_cmd_t table is still used for the daemon's socket protocol.
+ */
+
+#ifndef __HCI_CMDS_ENCODER_H
+#define __HCI_CMDS_ENCODER_H
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <btstack/utils.h>
+
+// UTF-8 name, zero padded to 248 bytes
+static inline void hci_cmd_store_name(uint8_t * buffer, const char * name){
+    uint16_t len = strlen(name);
+    if (len > 248) {
+        len = 248;
+    }
+    memcpy(buffer, name, len);
+    memset(&buffer[len], 0, 248 - len);
+}
+
+// hci_inquiry, opcode 0x0401, format "311"
+static inline uint16_t hci_cmd_inquiry_create(uint8_t * buffer, uint32_t lap, uint8_t inquiry_length, uint8_t num_responses){
+    buffer[0] = 0x01;
+    buffer[1] = 0x04;
+    buffer[2] = 5;
+    buffer[3] = lap;
+    buffer[4] = lap >> 8;
+    buffer[5] = lap >> 16;
+    buffer[6] = inquiry_length;
+    buffer[7] = num_responses;
+    return 8;
+}
+
+// hci_inquiry_cancel, opcode 0x0402, format ""
+static inline uint16_t hci_cmd_inquiry_cancel_create(uint8_t * buffer){
+    buffer[0] = 0x02;
+    buffer[1] = 0x04;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_create_connection, opcode 0x0405, format "B21121"
+static inline uint16_t hci_cmd_create_connection_create(uint8_t * buffer, const bd_addr_t bd_addr, uint16_t packet_type, uint8_t page_scan_repetition_mode, uint8_t reserved, uint16_t clock_offset, uint8_t allow_role_switch){
+    buffer[0] = 0x05;
+    buffer[1] = 0x04;
+    buffer[2] = 13;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = packet_type;
+    buffer[10] = packet_type >> 8;
+    buffer[11] = page_scan_repetition_mode;
+    buffer[12] = reserved;
+    buffer[13] = clock_offset;
+    buffer[14] = clock_offset >> 8;
+    buffer[15] = allow_role_switch;
+    return 16;
+}
+
+// hci_disconnect, opcode 0x0406, format "H1"
+static inline uint16_t hci_cmd_disconnect_create(uint8_t * buffer, hci_con_handle_t handle, uint8_t reason){
+    buffer[0] = 0x06;
+    buffer[1] = 0x04;
+    buffer[2] = 3;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = reason;
+    return 6;
+}
+
+// hci_create_connection_cancel, opcode 0x0408, format "B"
+static inline uint16_t hci_cmd_create_connection_cancel_create(uint8_t * buffer, const bd_addr_t bd_addr){
+    buffer[0] = 0x08;
+    buffer[1] = 0x04;
+    buffer[2] = 6;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    return 9;
+}
+
+// hci_accept_connection_request, opcode 0x0409, format "B1"
+static inline uint16_t hci_cmd_accept_connection_request_create(uint8_t * buffer, const bd_addr_t bd_addr, uint8_t role){
+    buffer[0] = 0x09;
+    buffer[1] = 0x04;
+    buffer[2] = 7;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = role;
+    return 10;
+}
+
+// hci_reject_connection_request, opcode 0x040a, format "B1"
+static inline uint16_t hci_cmd_reject_connection_request_create(uint8_t * buffer, const bd_addr_t bd_addr, uint8_t reason){
+    buffer[0] = 0x0a;
+    buffer[1] = 0x04;
+    buffer[2] = 7;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = reason;
+    return 10;
+}
+
+// hci_link_key_request_reply, opcode 0x040b, format "BP"
+static inline uint16_t hci_cmd_link_key_request_reply_create(uint8_t * buffer, const bd_addr_t bd_addr, const uint8_t * link_key){
+    buffer[0] = 0x0b;
+    buffer[1] = 0x04;
+    buffer[2] = 22;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    memcpy(&buffer[9], link_key, 16);
+    return 25;
+}
+
+// hci_link_key_request_negative_reply, opcode 0x040c, format "B"
+static inline uint16_t hci_cmd_link_key_request_negative_reply_create(uint8_t * buffer, const bd_addr_t bd_addr){
+    buffer[0] = 0x0c;
+    buffer[1] = 0x04;
+    buffer[2] = 6;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    return 9;
+}
+
+// hci_pin_code_request_reply, opcode 0x040d, format "B1P"
+static inline uint16_t hci_cmd_pin_code_request_reply_create(uint8_t * buffer, const bd_addr_t bd_addr, uint8_t pin_length, const uint8_t * pin){
+    buffer[0] = 0x0d;
+    buffer[1] = 0x04;
+    buffer[2] = 23;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = pin_length;
+    memcpy(&buffer[10], pin, 16);
+    return 26;
+}
+
+// hci_pin_code_request_negative_reply, opcode 0x040e, format "B"
+static inline uint16_t hci_cmd_pin_code_request_negative_reply_create(uint8_t * buffer, const bd_addr_t bd_addr){
+    buffer[0] = 0x0e;
+    buffer[1] = 0x04;
+    buffer[2] = 6;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    return 9;
+}
+
+// hci_change_connection_packet_type, opcode 0x040f, format "H2"
+static inline uint16_t hci_cmd_change_connection_packet_type_create(uint8_t * buffer, hci_con_handle_t handle, uint16_t packet_type){
+    buffer[0] = 0x0f;
+    buffer[1] = 0x04;
+    buffer[2] = 4;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = packet_type;
+    buffer[6] = packet_type >> 8;
+    return 7;
+}
+
+// hci_authentication_requested, opcode 0x0411, format "H"
+static inline uint16_t hci_cmd_authentication_requested_create(uint8_t * buffer, hci_con_handle_t handle){
+    buffer[0] = 0x11;
+    buffer[1] = 0x04;
+    buffer[2] = 2;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    return 5;
+}
+
+// hci_set_connection_encryption, opcode 0x0413, format "H1"
+static inline uint16_t hci_cmd_set_connection_encryption_create(uint8_t * buffer, hci_con_handle_t handle, uint8_t encryption_enable){
+    buffer[0] = 0x13;
+    buffer[1] = 0x04;
+    buffer[2] = 3;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = encryption_enable;
+    return 6;
+}
+
+// hci_change_connection_link_key, opcode 0x0415, format "H"
+static inline uint16_t hci_cmd_change_connection_link_key_create(uint8_t * buffer, hci_con_handle_t handle){
+    buffer[0] = 0x15;
+    buffer[1] = 0x04;
+    buffer[2] = 2;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    return 5;
+}
+
+// hci_remote_name_request, opcode 0x0419, format "B112"
+static inline uint16_t hci_cmd_remote_name_request_create(uint8_t * buffer, const bd_addr_t bd_addr, uint8_t page_scan_repetition_mode, uint8_t reserved, uint16_t clock_offset){
+    buffer[0] = 0x19;
+    buffer[1] = 0x04;
+    buffer[2] = 10;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = page_scan_repetition_mode;
+    buffer[10] = reserved;
+    buffer[11] = clock_offset;
+    buffer[12] = clock_offset >> 8;
+    return 13;
+}
+
+// hci_remote_name_request_cancel, opcode 0x041a, format "B"
+static inline uint16_t hci_cmd_remote_name_request_cancel_create(uint8_t * buffer, const bd_addr_t bd_addr){
+    buffer[0] = 0x1a;
+    buffer[1] = 0x04;
+    buffer[2] = 6;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    return 9;
+}
+
+// hci_read_remote_supported_features_command, opcode 0x041b, format "H"
+static inline uint16_t hci_cmd_read_remote_supported_features_command_create(uint8_t * buffer, hci_con_handle_t handle){
+    buffer[0] = 0x1b;
+    buffer[1] = 0x04;
+    buffer[2] = 2;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    return 5;
+}
+
+// hci_setup_synchronous_connection_command, opcode 0x0428, format "H442212"
+static inline uint16_t hci_cmd_setup_synchronous_connection_command_create(uint8_t * buffer, hci_con_handle_t handle, uint32_t transmit_bandwidth, uint32_t receive_bandwidth, uint16_t max_latency, uint16_t voice_settings, uint8_t retransmission_effort, uint16_t packet_type){
+    buffer[0] = 0x28;
+    buffer[1] = 0x04;
+    buffer[2] = 17;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = transmit_bandwidth;
+    buffer[6] = transmit_bandwidth >> 8;
+    buffer[7] = transmit_bandwidth >> 16;
+    buffer[8] = transmit_bandwidth >> 24;
+    buffer[9] = receive_bandwidth;
+    buffer[10] = receive_bandwidth >> 8;
+    buffer[11] = receive_bandwidth >> 16;
+    buffer[12] = receive_bandwidth >> 24;
+    buffer[13] = max_latency;
+    buffer[14] = max_latency >> 8;
+    buffer[15] = voice_settings;
+    buffer[16] = voice_settings >> 8;
+    buffer[17] = retransmission_effort;
+    buffer[18] = packet_type;
+    buffer[19] = packet_type >> 8;
+    return 20;
+}
+
+// hci_accept_synchronous_connection_command, opcode 0x0429, format "B442212"
+static inline uint16_t hci_cmd_accept_synchronous_connection_command_create(uint8_t * buffer, const bd_addr_t bd_addr, uint32_t transmit_bandwidth, uint32_t receive_bandwidth, uint16_t max_latency, uint16_t voice_settings, uint8_t retransmission_effort, uint16_t packet_type){
+    buffer[0] = 0x29;
+    buffer[1] = 0x04;
+    buffer[2] = 21;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = transmit_bandwidth;
+    buffer[10] = transmit_bandwidth >> 8;
+    buffer[11] = transmit_bandwidth >> 16;
+    buffer[12] = transmit_bandwidth >> 24;
+    buffer[13] = receive_bandwidth;
+    buffer[14] = receive_bandwidth >> 8;
+    buffer[15] = receive_bandwidth >> 16;
+    buffer[16] = receive_bandwidth >> 24;
+    buffer[17] = max_latency;
+    buffer[18] = max_latency >> 8;
+    buffer[19] = voice_settings;
+    buffer[20] = voice_settings >> 8;
+    buffer[21] = retransmission_effort;
+    buffer[22] = packet_type;
+    buffer[23] = packet_type >> 8;
+    return 24;
+}
+
+// hci_io_capability_request_reply, opcode 0x042b, format "B111"
+static inline uint16_t hci_cmd_io_capability_request_reply_create(uint8_t * buffer, const bd_addr_t bd_addr, uint8_t io_capability, uint8_t oob_data_present, uint8_t authentication_requirements){
+    buffer[0] = 0x2b;
+    buffer[1] = 0x04;
+    buffer[2] = 9;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = io_capability;
+    buffer[10] = oob_data_present;
+    buffer[11] = authentication_requirements;
+    return 12;
+}
+
+// hci_user_confirmation_request_reply, opcode 0x042c, format "B"
+static inline uint16_t hci_cmd_user_confirmation_request_reply_create(uint8_t * buffer, const bd_addr_t bd_addr){
+    buffer[0] = 0x2c;
+    buffer[1] = 0x04;
+    buffer[2] = 6;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    return 9;
+}
+
+// hci_user_confirmation_request_negative_reply, opcode 0x042d, format "B"
+static inline uint16_t hci_cmd_user_confirmation_request_negative_reply_create(uint8_t * buffer, const bd_addr_t bd_addr){
+    buffer[0] = 0x2d;
+    buffer[1] = 0x04;
+    buffer[2] = 6;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    return 9;
+}
+
+// hci_user_passkey_request_reply, opcode 0x042e, format "B4"
+static inline uint16_t hci_cmd_user_passkey_request_reply_create(uint8_t * buffer, const bd_addr_t bd_addr, uint32_t numeric_value){
+    buffer[0] = 0x2e;
+    buffer[1] = 0x04;
+    buffer[2] = 10;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = numeric_value;
+    buffer[10] = numeric_value >> 8;
+    buffer[11] = numeric_value >> 16;
+    buffer[12] = numeric_value >> 24;
+    return 13;
+}
+
+// hci_user_passkey_request_negative_reply, opcode 0x042f, format "B"
+static inline uint16_t hci_cmd_user_passkey_request_negative_reply_create(uint8_t * buffer, const bd_addr_t bd_addr){
+    buffer[0] = 0x2f;
+    buffer[1] = 0x04;
+    buffer[2] = 6;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    return 9;
+}
+
+// hci_remote_oob_data_request_negative_reply, opcode 0x0433, format "B"
+static inline uint16_t hci_cmd_remote_oob_data_request_negative_reply_create(uint8_t * buffer, const bd_addr_t bd_addr){
+    buffer[0] = 0x33;
+    buffer[1] = 0x04;
+    buffer[2] = 6;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    return 9;
+}
+
+// hci_io_capability_request_negative_reply, opcode 0x0434, format "B1"
+static inline uint16_t hci_cmd_io_capability_request_negative_reply_create(uint8_t * buffer, const bd_addr_t bd_addr, uint8_t reason){
+    buffer[0] = 0x34;
+    buffer[1] = 0x04;
+    buffer[2] = 7;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = reason;
+    return 10;
+}
+
+// hci_enhanced_setup_synchronous_connection, opcode 0x043d, format "H4412212222441221222211111111221"
+static inline uint16_t hci_cmd_enhanced_setup_synchronous_connection_create(uint8_t * buffer, hci_con_handle_t handle, uint32_t transmit_bandwidth, uint32_t receive_bandwidth, uint8_t transmit_coding_format_type, uint16_t transmit_coding_format_company, uint16_t transmit_coding_format_codec, uint8_t receive_coding_format_type, uint16_t receive_coding_format_company, uint16_t receive_coding_format_codec, uint16_t transmit_coding_frame_size, uint16_t receive_coding_frame_size, uint32_t input_bandwidth, uint32_t output_bandwidth, uint8_t input_coding_format_type, uint16_t input_coding_format_company, uint16_t input_coding_format_codec, uint8_t output_coding_format_type, uint16_t output_coding_format_company, uint16_t output_coding_format_codec, uint16_t input_coded_data_size, uint16_t outupt_coded_data_size, uint8_t input_pcm_data_format, uint8_t output_pcm_data_format, uint8_t input_pcm_sample_payload_msb_position, uint8_t output_pcm_sample_payload_msb_position, uint8_t input_data_path, uint8_t output_data_path, uint8_t input_transport_unit_size, uint8_t output_transport_unit_size, uint16_t max_latency, uint16_t packet_type, uint8_t retransmission_effort){
+    buffer[0] = 0x3d;
+    buffer[1] = 0x04;
+    buffer[2] = 59;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = transmit_bandwidth;
+    buffer[6] = transmit_bandwidth >> 8;
+    buffer[7] = transmit_bandwidth >> 16;
+    buffer[8] = transmit_bandwidth >> 24;
+    buffer[9] = receive_bandwidth;
+    buffer[10] = receive_bandwidth >> 8;
+    buffer[11] = receive_bandwidth >> 16;
+    buffer[12] = receive_bandwidth >> 24;
+    buffer[13] = transmit_coding_format_type;
+    buffer[14] = transmit_coding_format_company;
+    buffer[15] = transmit_coding_format_company >> 8;
+    buffer[16] = transmit_coding_format_codec;
+    buffer[17] = transmit_coding_format_codec >> 8;
+    buffer[18] = receive_coding_format_type;
+    buffer[19] = receive_coding_format_company;
+    buffer[20] = receive_coding_format_company >> 8;
+    buffer[21] = receive_coding_format_codec;
+    buffer[22] = receive_coding_format_codec >> 8;
+    buffer[23] = transmit_coding_frame_size;
+    buffer[24] = transmit_coding_frame_size >> 8;
+    buffer[25] = receive_coding_frame_size;
+    buffer[26] = receive_coding_frame_size >> 8;
+    buffer[27] = input_bandwidth;
+    buffer[28] = input_bandwidth >> 8;
+    buffer[29] = input_bandwidth >> 16;
+    buffer[30] = input_bandwidth >> 24;
+    buffer[31] = output_bandwidth;
+    buffer[32] = output_bandwidth >> 8;
+    buffer[33] = output_bandwidth >> 16;
+    buffer[34] = output_bandwidth >> 24;
+    buffer[35] = input_coding_format_type;
+    buffer[36] = input_coding_format_company;
+    buffer[37] = input_coding_format_company >> 8;
+    buffer[38] = input_coding_format_codec;
+    buffer[39] = input_coding_format_codec >> 8;
+    buffer[40] = output_coding_format_type;
+    buffer[41] = output_coding_format_company;
+    buffer[42] = output_coding_format_company >> 8;
+    buffer[43] = output_coding_format_codec;
+    buffer[44] = output_coding_format_codec >> 8;
+    buffer[45] = input_coded_data_size;
+    buffer[46] = input_coded_data_size >> 8;
+    buffer[47] = outupt_coded_data_size;
+    buffer[48] = outupt_coded_data_size >> 8;
+    buffer[49] = input_pcm_data_format;
+    buffer[50] = output_pcm_data_format;
+    buffer[51] = input_pcm_sample_payload_msb_position;
+    buffer[52] = output_pcm_sample_payload_msb_position;
+    buffer[53] = input_data_path;
+    buffer[54] = output_data_path;
+    buffer[55] = input_transport_unit_size;
+    buffer[56] = output_transport_unit_size;
+    buffer[57] = max_latency;
+    buffer[58] = max_latency >> 8;
+    buffer[59] = packet_type;
+    buffer[60] = packet_type >> 8;
+    buffer[61] = retransmission_effort;
+    return 62;
+}
+
+// hci_enhanced_accept_synchronous_connection, opcode 0x043e, format "B4412212222441221222211111111221"
+static inline uint16_t hci_cmd_enhanced_accept_synchronous_connection_create(uint8_t * buffer, const bd_addr_t bd_addr, uint32_t transmit_bandwidth, uint32_t receive_bandwidth, uint8_t transmit_coding_format_type, uint16_t transmit_coding_format_company, uint16_t transmit_coding_format_codec, uint8_t receive_coding_format_type, uint16_t receive_coding_format_company, uint16_t receive_coding_format_codec, uint16_t transmit_coding_frame_size, uint16_t receive_coding_frame_size, uint32_t input_bandwidth, uint32_t output_bandwidth, uint8_t input_coding_format_type, uint16_t input_coding_format_company, uint16_t input_coding_format_codec, uint8_t output_coding_format_type, uint16_t output_coding_format_company, uint16_t output_coding_format_codec, uint16_t input_coded_data_size, uint16_t outupt_coded_data_size, uint8_t input_pcm_data_format, uint8_t output_pcm_data_format, uint8_t input_pcm_sample_payload_msb_position, uint8_t output_pcm_sample_payload_msb_position, uint8_t input_data_path, uint8_t output_data_path, uint8_t input_transport_unit_size, uint8_t output_transport_unit_size, uint16_t max_latency, uint16_t packet_type, uint8_t retransmission_effort){
+    buffer[0] = 0x3e;
+    buffer[1] = 0x04;
+    buffer[2] = 63;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = transmit_bandwidth;
+    buffer[10] = transmit_bandwidth >> 8;
+    buffer[11] = transmit_bandwidth >> 16;
+    buffer[12] = transmit_bandwidth >> 24;
+    buffer[13] = receive_bandwidth;
+    buffer[14] = receive_bandwidth >> 8;
+    buffer[15] = receive_bandwidth >> 16;
+    buffer[16] = receive_bandwidth >> 24;
+    buffer[17] = transmit_coding_format_type;
+    buffer[18] = transmit_coding_format_company;
+    buffer[19] = transmit_coding_format_company >> 8;
+    buffer[20] = transmit_coding_format_codec;
+    buffer[21] = transmit_coding_format_codec >> 8;
+    buffer[22] = receive_coding_format_type;
+    buffer[23] = receive_coding_format_company;
+    buffer[24] = receive_coding_format_company >> 8;
+    buffer[25] = receive_coding_format_codec;
+    buffer[26] = receive_coding_format_codec >> 8;
+    buffer[27] = transmit_coding_frame_size;
+    buffer[28] = transmit_coding_frame_size >> 8;
+    buffer[29] = receive_coding_frame_size;
+    buffer[30] = receive_coding_frame_size >> 8;
+    buffer[31] = input_bandwidth;
+    buffer[32] = input_bandwidth >> 8;
+    buffer[33] = input_bandwidth >> 16;
+    buffer[34] = input_bandwidth >> 24;
+    buffer[35] = output_bandwidth;
+    buffer[36] = output_bandwidth >> 8;
+    buffer[37] = output_bandwidth >> 16;
+    buffer[38] = output_bandwidth >> 24;
+    buffer[39] = input_coding_format_type;
+    buffer[40] = input_coding_format_company;
+    buffer[41] = input_coding_format_company >> 8;
+    buffer[42] = input_coding_format_codec;
+    buffer[43] = input_coding_format_codec >> 8;
+    buffer[44] = output_coding_format_type;
+    buffer[45] = output_coding_format_company;
+    buffer[46] = output_coding_format_company >> 8;
+    buffer[47] = output_coding_format_codec;
+    buffer[48] = output_coding_format_codec >> 8;
+    buffer[49] = input_coded_data_size;
+    buffer[50] = input_coded_data_size >> 8;
+    buffer[51] = outupt_coded_data_size;
+    buffer[52] = outupt_coded_data_size >> 8;
+    buffer[53] = input_pcm_data_format;
+    buffer[54] = output_pcm_data_format;
+    buffer[55] = input_pcm_sample_payload_msb_position;
+    buffer[56] = output_pcm_sample_payload_msb_position;
+    buffer[57] = input_data_path;
+    buffer[58] = output_data_path;
+    buffer[59] = input_transport_unit_size;
+    buffer[60] = output_transport_unit_size;
+    buffer[61] = max_latency;
+    buffer[62] = max_latency >> 8;
+    buffer[63] = packet_type;
+    buffer[64] = packet_type >> 8;
+    buffer[65] = retransmission_effort;
+    return 66;
+}
+
+// hci_sniff_mode, opcode 0x0803, format "H2222"
+static inline uint16_t hci_cmd_sniff_mode_create(uint8_t * buffer, hci_con_handle_t handle, uint16_t sniff_max_interval, uint16_t sniff_min_interval, uint16_t sniff_attempt, uint16_t sniff_timeout){
+    buffer[0] = 0x03;
+    buffer[1] = 0x08;
+    buffer[2] = 10;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = sniff_max_interval;
+    buffer[6] = sniff_max_interval >> 8;
+    buffer[7] = sniff_min_interval;
+    buffer[8] = sniff_min_interval >> 8;
+    buffer[9] = sniff_attempt;
+    buffer[10] = sniff_attempt >> 8;
+    buffer[11] = sniff_timeout;
+    buffer[12] = sniff_timeout >> 8;
+    return 13;
+}
+
+// hci_qos_setup, opcode 0x0807, format "H114444"
+static inline uint16_t hci_cmd_qos_setup_create(uint8_t * buffer, hci_con_handle_t handle, uint8_t flags, uint8_t service_type, uint32_t token_rate, uint32_t peak_bandwith, uint32_t latency, uint32_t delay_variation){
+    buffer[0] = 0x07;
+    buffer[1] = 0x08;
+    buffer[2] = 20;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = flags;
+    buffer[6] = service_type;
+    buffer[7] = token_rate;
+    buffer[8] = token_rate >> 8;
+    buffer[9] = token_rate >> 16;
+    buffer[10] = token_rate >> 24;
+    buffer[11] = peak_bandwith;
+    buffer[12] = peak_bandwith >> 8;
+    buffer[13] = peak_bandwith >> 16;
+    buffer[14] = peak_bandwith >> 24;
+    buffer[15] = latency;
+    buffer[16] = latency >> 8;
+    buffer[17] = latency >> 16;
+    buffer[18] = latency >> 24;
+    buffer[19] = delay_variation;
+    buffer[20] = delay_variation >> 8;
+    buffer[21] = delay_variation >> 16;
+    buffer[22] = delay_variation >> 24;
+    return 23;
+}
+
+// hci_role_discovery, opcode 0x0809, format "H"
+static inline uint16_t hci_cmd_role_discovery_create(uint8_t * buffer, hci_con_handle_t handle){
+    buffer[0] = 0x09;
+    buffer[1] = 0x08;
+    buffer[2] = 2;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    return 5;
+}
+
+// hci_switch_role_command, opcode 0x080b, format "B1"
+static inline uint16_t hci_cmd_switch_role_command_create(uint8_t * buffer, const bd_addr_t bd_addr, uint8_t role){
+    buffer[0] = 0x0b;
+    buffer[1] = 0x08;
+    buffer[2] = 7;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = role;
+    return 10;
+}
+
+// hci_read_link_policy_settings, opcode 0x080c, format "H"
+static inline uint16_t hci_cmd_read_link_policy_settings_create(uint8_t * buffer, hci_con_handle_t handle){
+    buffer[0] = 0x0c;
+    buffer[1] = 0x08;
+    buffer[2] = 2;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    return 5;
+}
+
+// hci_write_link_policy_settings, opcode 0x080d, format "H2"
+static inline uint16_t hci_cmd_write_link_policy_settings_create(uint8_t * buffer, hci_con_handle_t handle, uint16_t settings){
+    buffer[0] = 0x0d;
+    buffer[1] = 0x08;
+    buffer[2] = 4;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = settings;
+    buffer[6] = settings >> 8;
+    return 7;
+}
+
+// hci_set_event_mask, opcode 0x0c01, format "44"
+static inline uint16_t hci_cmd_set_event_mask_create(uint8_t * buffer, uint32_t event_mask_lover_octets, uint32_t event_mask_higher_octets){
+    buffer[0] = 0x01;
+    buffer[1] = 0x0c;
+    buffer[2] = 8;
+    buffer[3] = event_mask_lover_octets;
+    buffer[4] = event_mask_lover_octets >> 8;
+    buffer[5] = event_mask_lover_octets >> 16;
+    buffer[6] = event_mask_lover_octets >> 24;
+    buffer[7] = event_mask_higher_octets;
+    buffer[8] = event_mask_higher_octets >> 8;
+    buffer[9] = event_mask_higher_octets >> 16;
+    buffer[10] = event_mask_higher_octets >> 24;
+    return 11;
+}
+
+// hci_reset, opcode 0x0c03, format ""
+static inline uint16_t hci_cmd_reset_create(uint8_t * buffer){
+    buffer[0] = 0x03;
+    buffer[1] = 0x0c;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_delete_stored_link_key, opcode 0x0c12, format "B1"
+static inline uint16_t hci_cmd_delete_stored_link_key_create(uint8_t * buffer, const bd_addr_t bd_addr, uint8_t delete_all_flags){
+    buffer[0] = 0x12;
+    buffer[1] = 0x0c;
+    buffer[2] = 7;
+    buffer[3] = bd_addr[5];
+    buffer[4] = bd_addr[4];
+    buffer[5] = bd_addr[3];
+    buffer[6] = bd_addr[2];
+    buffer[7] = bd_addr[1];
+    buffer[8] = bd_addr[0];
+    buffer[9] = delete_all_flags;
+    return 10;
+}
+
+// hci_write_local_name, opcode 0x0c13, format "N"
+static inline uint16_t hci_cmd_write_local_name_create(uint8_t * buffer, const char * local_name){
+    buffer[0] = 0x13;
+    buffer[1] = 0x0c;
+    buffer[2] = 248;
+    hci_cmd_store_name(&buffer[3], local_name);
+    return 251;
+}
+
+// hci_write_page_timeout, opcode 0x0c18, format "2"
+static inline uint16_t hci_cmd_write_page_timeout_create(uint8_t * buffer, uint16_t page_timeout){
+    buffer[0] = 0x18;
+    buffer[1] = 0x0c;
+    buffer[2] = 2;
+    buffer[3] = page_timeout;
+    buffer[4] = page_timeout >> 8;
+    return 5;
+}
+
+// hci_write_scan_enable, opcode 0x0c1a, format "1"
+static inline uint16_t hci_cmd_write_scan_enable_create(uint8_t * buffer, uint8_t scan_enable){
+    buffer[0] = 0x1a;
+    buffer[1] = 0x0c;
+    buffer[2] = 1;
+    buffer[3] = scan_enable;
+    return 4;
+}
+
+// hci_write_authentication_enable, opcode 0x0c20, format "1"
+static inline uint16_t hci_cmd_write_authentication_enable_create(uint8_t * buffer, uint8_t authentication_enable){
+    buffer[0] = 0x20;
+    buffer[1] = 0x0c;
+    buffer[2] = 1;
+    buffer[3] = authentication_enable;
+    return 4;
+}
+
+// hci_write_class_of_device, opcode 0x0c24, format "3"
+static inline uint16_t hci_cmd_write_class_of_device_create(uint8_t * buffer, uint32_t class_of_device){
+    buffer[0] = 0x24;
+    buffer[1] = 0x0c;
+    buffer[2] = 3;
+    buffer[3] = class_of_device;
+    buffer[4] = class_of_device >> 8;
+    buffer[5] = class_of_device >> 16;
+    return 6;
+}
+
+// hci_read_num_broadcast_retransmissions, opcode 0x0c29, format ""
+static inline uint16_t hci_cmd_read_num_broadcast_retransmissions_create(uint8_t * buffer){
+    buffer[0] = 0x29;
+    buffer[1] = 0x0c;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_write_num_broadcast_retransmissions, opcode 0x0c2a, format "1"
+static inline uint16_t hci_cmd_write_num_broadcast_retransmissions_create(uint8_t * buffer, uint8_t num_broadcast_retransmissions){
+    buffer[0] = 0x2a;
+    buffer[1] = 0x0c;
+    buffer[2] = 1;
+    buffer[3] = num_broadcast_retransmissions;
+    return 4;
+}
+
+// hci_write_synchronous_flow_control_enable, opcode 0x0c2f, format "1"
+static inline uint16_t hci_cmd_write_synchronous_flow_control_enable_create(uint8_t * buffer, uint8_t synchronous_flow_control_enable){
+    buffer[0] = 0x2f;
+    buffer[1] = 0x0c;
+    buffer[2] = 1;
+    buffer[3] = synchronous_flow_control_enable;
+    return 4;
+}
+
+// hci_set_controller_to_host_flow_control, opcode 0x0c31, format "1"
+static inline uint16_t hci_cmd_set_controller_to_host_flow_control_create(uint8_t * buffer, uint8_t flow_control_enable){
+    buffer[0] = 0x31;
+    buffer[1] = 0x0c;
+    buffer[2] = 1;
+    buffer[3] = flow_control_enable;
+    return 4;
+}
+
+// hci_host_buffer_size, opcode 0x0c33, format "2122"
+static inline uint16_t hci_cmd_host_buffer_size_create(uint8_t * buffer, uint16_t host_acl_data_packet_length, uint8_t host_synchronous_data_packet_length, uint16_t host_total_num_acl_data_packets, uint16_t host_total_num_synchronous_data_packets){
+    buffer[0] = 0x33;
+    buffer[1] = 0x0c;
+    buffer[2] = 7;
+    buffer[3] = host_acl_data_packet_length;
+    buffer[4] = host_acl_data_packet_length >> 8;
+    buffer[5] = host_synchronous_data_packet_length;
+    buffer[6] = host_total_num_acl_data_packets;
+    buffer[7] = host_total_num_acl_data_packets >> 8;
+    buffer[8] = host_total_num_synchronous_data_packets;
+    buffer[9] = host_total_num_synchronous_data_packets >> 8;
+    return 10;
+}
+
+// hci_host_number_of_completed_packets, opcode 0x0c35, format "1H2"
+static inline uint16_t hci_cmd_host_number_of_completed_packets_create(uint8_t * buffer, uint8_t number_of_handles, hci_con_handle_t connection_handle, uint16_t host_num_of_completed_packets){
+    buffer[0] = 0x35;
+    buffer[1] = 0x0c;
+    buffer[2] = 5;
+    buffer[3] = number_of_handles;
+    buffer[4] = connection_handle;
+    buffer[5] = connection_handle >> 8;
+    buffer[6] = host_num_of_completed_packets;
+    buffer[7] = host_num_of_completed_packets >> 8;
+    return 8;
+}
+
+// hci_read_link_supervision_timeout, opcode 0x0c36, format "H"
+static inline uint16_t hci_cmd_read_link_supervision_timeout_create(uint8_t * buffer, hci_con_handle_t handle){
+    buffer[0] = 0x36;
+    buffer[1] = 0x0c;
+    buffer[2] = 2;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    return 5;
+}
+
+// hci_write_link_supervision_timeout, opcode 0x0c37, format "H2"
+static inline uint16_t hci_cmd_write_link_supervision_timeout_create(uint8_t * buffer, hci_con_handle_t handle, uint16_t timeout){
+    buffer[0] = 0x37;
+    buffer[1] = 0x0c;
+    buffer[2] = 4;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    buffer[5] = timeout;
+    buffer[6] = timeout >> 8;
+    return 7;
+}
+
+// hci_write_inquiry_mode, opcode 0x0c45, format "1"
+static inline uint16_t hci_cmd_write_inquiry_mode_create(uint8_t * buffer, uint8_t inquiry_mode){
+    buffer[0] = 0x45;
+    buffer[1] = 0x0c;
+    buffer[2] = 1;
+    buffer[3] = inquiry_mode;
+    return 4;
+}
+
+// hci_write_extended_inquiry_response, opcode 0x0c52, format "1E"
+static inline uint16_t hci_cmd_write_extended_inquiry_response_create(uint8_t * buffer, uint8_t fec_required, const uint8_t * exstended_inquiry_response){
+    buffer[0] = 0x52;
+    buffer[1] = 0x0c;
+    buffer[2] = 241;
+    buffer[3] = fec_required;
+    memcpy(&buffer[4], exstended_inquiry_response, 240);
+    return 244;
+}
+
+// hci_write_simple_pairing_mode, opcode 0x0c56, format "1"
+static inline uint16_t hci_cmd_write_simple_pairing_mode_create(uint8_t * buffer, uint8_t mode){
+    buffer[0] = 0x56;
+    buffer[1] = 0x0c;
+    buffer[2] = 1;
+    buffer[3] = mode;
+    return 4;
+}
+
+// hci_read_le_host_supported, opcode 0x0c6c, format ""
+static inline uint16_t hci_cmd_read_le_host_supported_create(uint8_t * buffer){
+    buffer[0] = 0x6c;
+    buffer[1] = 0x0c;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_write_le_host_supported, opcode 0x0c6d, format "11"
+static inline uint16_t hci_cmd_write_le_host_supported_create(uint8_t * buffer, uint8_t le_supported_host, uint8_t simultaneous_le_host){
+    buffer[0] = 0x6d;
+    buffer[1] = 0x0c;
+    buffer[2] = 2;
+    buffer[3] = le_supported_host;
+    buffer[4] = simultaneous_le_host;
+    return 5;
+}
+
+// hci_read_local_version_information, opcode 0x1001, format ""
+static inline uint16_t hci_cmd_read_local_version_information_create(uint8_t * buffer){
+    buffer[0] = 0x01;
+    buffer[1] = 0x10;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_read_local_supported_features, opcode 0x1003, format ""
+static inline uint16_t hci_cmd_read_local_supported_features_create(uint8_t * buffer){
+    buffer[0] = 0x03;
+    buffer[1] = 0x10;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_read_buffer_size, opcode 0x1005, format ""
+static inline uint16_t hci_cmd_read_buffer_size_create(uint8_t * buffer){
+    buffer[0] = 0x05;
+    buffer[1] = 0x10;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_read_bd_addr, opcode 0x1009, format ""
+static inline uint16_t hci_cmd_read_bd_addr_create(uint8_t * buffer){
+    buffer[0] = 0x09;
+    buffer[1] = 0x10;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_read_rssi, opcode 0x1405, format "H"
+static inline uint16_t hci_cmd_read_rssi_create(uint8_t * buffer, hci_con_handle_t handle){
+    buffer[0] = 0x05;
+    buffer[1] = 0x14;
+    buffer[2] = 2;
+    buffer[3] = handle;
+    buffer[4] = handle >> 8;
+    return 5;
+}
+
+// hci_le_set_event_mask, opcode 0x2001, format "44"
+static inline uint16_t hci_cmd_le_set_event_mask_create(uint8_t * buffer, uint32_t event_mask_lower_octets, uint32_t event_mask_higher_octets){
+    buffer[0] = 0x01;
+    buffer[1] = 0x20;
+    buffer[2] = 8;
+    buffer[3] = event_mask_lower_octets;
+    buffer[4] = event_mask_lower_octets >> 8;
+    buffer[5] = event_mask_lower_octets >> 16;
+    buffer[6] = event_mask_lower_octets >> 24;
+    buffer[7] = event_mask_higher_octets;
+    buffer[8] = event_mask_higher_octets >> 8;
+    buffer[9] = event_mask_higher_octets >> 16;
+    buffer[10] = event_mask_higher_octets >> 24;
+    return 11;
+}
+
+// hci_le_read_buffer_size, opcode 0x2002, format ""
+static inline uint16_t hci_cmd_le_read_buffer_size_create(uint8_t * buffer){
+    buffer[0] = 0x02;
+    buffer[1] = 0x20;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_le_read_supported_features, opcode 0x2003, format ""
+static inline uint16_t hci_cmd_le_read_supported_features_create(uint8_t * buffer){
+    buffer[0] = 0x03;
+    buffer[1] = 0x20;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_le_set_random_address, opcode 0x2005, format "B"
+static inline uint16_t hci_cmd_le_set_random_address_create(uint8_t * buffer, const bd_addr_t random_bd_addr){
+    buffer[0] = 0x05;
+    buffer[1] = 0x20;
+    buffer[2] = 6;
+    buffer[3] = random_bd_addr[5];
+    buffer[4] = random_bd_addr[4];
+    buffer[5] = random_bd_addr[3];
+    buffer[6] = random_bd_addr[2];
+    buffer[7] = random_bd_addr[1];
+    buffer[8] = random_bd_addr[0];
+    return 9;
+}
+
+// hci_le_set_advertising_parameters, opcode 0x2006, format "22111B11"
+static inline uint16_t hci_cmd_le_set_advertising_parameters_create(uint8_t * buffer, uint16_t advertising_interval_min, uint16_t advertising_interval_max, uint8_t advertising_type, uint8_t own_address_type, uint8_t direct_address_type, const bd_addr_t direct_address, uint8_t advertising_channel_map, uint8_t advertising_filter_policy){
+    buffer[0] = 0x06;
+    buffer[1] = 0x20;
+    buffer[2] = 15;
+    buffer[3] = advertising_interval_min;
+    buffer[4] = advertising_interval_min >> 8;
+    buffer[5] = advertising_interval_max;
+    buffer[6] = advertising_interval_max >> 8;
+    buffer[7] = advertising_type;
+    buffer[8] = own_address_type;
+    buffer[9] = direct_address_type;
+    buffer[10] = direct_address[5];
+    buffer[11] = direct_address[4];
+    buffer[12] = direct_address[3];
+    buffer[13] = direct_address[2];
+    buffer[14] = direct_address[1];
+    buffer[15] = direct_address[0];
+    buffer[16] = advertising_channel_map;
+    buffer[17] = advertising_filter_policy;
+    return 18;
+}
+
+// hci_le_read_advertising_channel_tx_power, opcode 0x2007, format ""
+static inline uint16_t hci_cmd_le_read_advertising_channel_tx_power_create(uint8_t * buffer){
+    buffer[0] = 0x07;
+    buffer[1] = 0x20;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_le_set_advertising_data, opcode 0x2008, format "1A"
+static inline uint16_t hci_cmd_le_set_advertising_data_create(uint8_t * buffer, uint8_t advertising_data_length, const uint8_t * advertising_data){
+    buffer[0] = 0x08;
+    buffer[1] = 0x20;
+    buffer[2] = 32;
+    buffer[3] = advertising_data_length;
+    memcpy(&buffer[4], advertising_data, 31);
+    return 35;
+}
+
+// hci_le_set_scan_response_data, opcode 0x2009, format "1A"
+static inline uint16_t hci_cmd_le_set_scan_response_data_create(uint8_t * buffer, uint8_t scan_response_data_length, const uint8_t * scan_response_data){
+    buffer[0] = 0x09;
+    buffer[1] = 0x20;
+    buffer[2] = 32;
+    buffer[3] = scan_response_data_length;
+    memcpy(&buffer[4], scan_response_data, 31);
+    return 35;
+}
+
+// hci_le_set_advertise_enable, opcode 0x200a, format "1"
+static inline uint16_t hci_cmd_le_set_advertise_enable_create(uint8_t * buffer, uint8_t advertise_enable){
+    buffer[0] = 0x0a;
+    buffer[1] = 0x20;
+    buffer[2] = 1;
+    buffer[3] = advertise_enable;
+    return 4;
+}
+
+// hci_le_set_scan_parameters, opcode 0x200b, format "12211"
+static inline uint16_t hci_cmd_le_set_scan_parameters_create(uint8_t * buffer, uint8_t le_scan_type, uint16_t le_scan_interval, uint16_t le_scan_window, uint8_t own_address_type, uint8_t scanning_filter_policy){
+    buffer[0] = 0x0b;
+    buffer[1] = 0x20;
+    buffer[2] = 7;
+    buffer[3] = le_scan_type;
+    buffer[4] = le_scan_interval;
+    buffer[5] = le_scan_interval >> 8;
+    buffer[6] = le_scan_window;
+    buffer[7] = le_scan_window >> 8;
+    buffer[8] = own_address_type;
+    buffer[9] = scanning_filter_policy;
+    return 10;
+}
+
+// hci_le_set_scan_enable, opcode 0x200c, format "11"
+static inline uint16_t hci_cmd_le_set_scan_enable_create(uint8_t * buffer, uint8_t le_scan_enable, uint8_t filter_duplices){
+    buffer[0] = 0x0c;
+    buffer[1] = 0x20;
+    buffer[2] = 2;
+    buffer[3] = le_scan_enable;
+    buffer[4] = filter_duplices;
+    return 5;
+}
+
+// hci_le_create_connection, opcode 0x200d, format "2211B1222222"
+static inline uint16_t hci_cmd_le_create_connection_create(uint8_t * buffer, uint16_t le_scan_interval, uint16_t le_scan_window, uint8_t initiator_filter_policy, uint8_t peer_address_type, const bd_addr_t peer_address, uint8_t own_address_type, uint16_t conn_interval_min, uint16_t conn_interval_max, uint16_t conn_latency, uint16_t supervision_timeout, uint16_t minimum_ce_length, uint16_t maximum_ce_length){
+    buffer[0] = 0x0d;
+    buffer[1] = 0x20;
+    buffer[2] = 25;
+    buffer[3] = le_scan_interval;
+    buffer[4] = le_scan_interval >> 8;
+    buffer[5] = le_scan_window;
+    buffer[6] = le_scan_window >> 8;
+    buffer[7] = initiator_filter_policy;
+    buffer[8] = peer_address_type;
+    buffer[9] = peer_address[5];
+    buffer[10] = peer_address[4];
+    buffer[11] = peer_address[3];
+    buffer[12] = peer_address[2];
+    buffer[13] = peer_address[1];
+    buffer[14] = peer_address[0];
+    buffer[15] = own_address_type;
+    buffer[16] = conn_interval_min;
+    buffer[17] = conn_interval_min >> 8;
+    buffer[18] = conn_interval_max;
+    buffer[19] = conn_interval_max >> 8;
+    buffer[20] = conn_latency;
+    buffer[21] = conn_latency >> 8;
+    buffer[22] = supervision_timeout;
+    buffer[23] = supervision_timeout >> 8;
+    buffer[24] = minimum_ce_length;
+    buffer[25] = minimum_ce_length >> 8;
+    buffer[26] = maximum_ce_length;
+    buffer[27] = maximum_ce_length >> 8;
+    return 28;
+}
+
+// hci_le_create_connection_cancel, opcode 0x200e, format ""
+static inline uint16_t hci_cmd_le_create_connection_cancel_create(uint8_t * buffer){
+    buffer[0] = 0x0e;
+    buffer[1] = 0x20;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_le_read_white_list_size, opcode 0x200f, format ""
+static inline uint16_t hci_cmd_le_read_white_list_size_create(uint8_t * buffer){
+    buffer[0] = 0x0f;
+    buffer[1] = 0x20;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_le_clear_white_list, opcode 0x2010, format ""
+static inline uint16_t hci_cmd_le_clear_white_list_create(uint8_t * buffer){
+    buffer[0] = 0x10;
+    buffer[1] = 0x20;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_le_add_device_to_whitelist, opcode 0x2011, format "1B"
+static inline uint16_t hci_cmd_le_add_device_to_whitelist_create(uint8_t * buffer, uint8_t address_type, const bd_addr_t bd_addr){
+    buffer[0] = 0x11;
+    buffer[1] = 0x20;
+    buffer[2] = 7;
+    buffer[3] = address_type;
+    buffer[4] = bd_addr[5];
+    buffer[5] = bd_addr[4];
+    buffer[6] = bd_addr[3];
+    buffer[7] = bd_addr[2];
+    buffer[8] = bd_addr[1];
+    buffer[9] = bd_addr[0];
+    return 10;
+}
+
+// hci_le_remove_device_from_whitelist, opcode 0x2012, format "1B"
+static inline uint16_t hci_cmd_le_remove_device_from_whitelist_create(uint8_t * buffer, uint8_t address_type, const bd_addr_t bd_addr){
+    buffer[0] = 0x12;
+    buffer[1] = 0x20;
+    buffer[2] = 7;
+    buffer[3] = address_type;
+    buffer[4] = bd_addr[5];
+    buffer[5] = bd_addr[4];
+    buffer[6] = bd_addr[3];
+    buffer[7] = bd_addr[2];
+    buffer[8] = bd_addr[1];
+    buffer[9] = bd_addr[0];
+    return 10;
+}
+
+// hci_le_connection_update, opcode 0x2013, format "H222222"
+static inline uint16_t hci_cmd_le_connection_update_create(uint8_t * buffer, hci_con_handle_t conn_handle, uint16_t conn_interval_min, uint16_t conn_interval_max, uint16_t conn_latency, uint16_t supervision_timeout, uint16_t minimum_ce_length, uint16_t maximum_ce_length){
+    buffer[0] = 0x13;
+    buffer[1] = 0x20;
+    buffer[2] = 14;
+    buffer[3] = conn_handle;
+    buffer[4] = conn_handle >> 8;
+    buffer[5] = conn_interval_min;
+    buffer[6] = conn_interval_min >> 8;
+    buffer[7] = conn_interval_max;
+    buffer[8] = conn_interval_max >> 8;
+    buffer[9] = conn_latency;
+    buffer[10] = conn_latency >> 8;
+    buffer[11] = supervision_timeout;
+    buffer[12] = supervision_timeout >> 8;
+    buffer[13] = minimum_ce_length;
+    buffer[14] = minimum_ce_length >> 8;
+    buffer[15] = maximum_ce_length;
+    buffer[16] = maximum_ce_length >> 8;
+    return 17;
+}
+
+// hci_le_set_host_channel_classification, opcode 0x2014, format "41"
+static inline uint16_t hci_cmd_le_set_host_channel_classification_create(uint8_t * buffer, uint32_t channel_map_lower_32bits, uint8_t channel_map_higher_5bits){
+    buffer[0] = 0x14;
+    buffer[1] = 0x20;
+    buffer[2] = 5;
+    buffer[3] = channel_map_lower_32bits;
+    buffer[4] = channel_map_lower_32bits >> 8;
+    buffer[5] = channel_map_lower_32bits >> 16;
+    buffer[6] = channel_map_lower_32bits >> 24;
+    buffer[7] = channel_map_higher_5bits;
+    return 8;
+}
+
+// hci_le_read_channel_map, opcode 0x2015, format "H"
+static inline uint16_t hci_cmd_le_read_channel_map_create(uint8_t * buffer, hci_con_handle_t conn_handle){
+    buffer[0] = 0x15;
+    buffer[1] = 0x20;
+    buffer[2] = 2;
+    buffer[3] = conn_handle;
+    buffer[4] = conn_handle >> 8;
+    return 5;
+}
+
+// hci_le_read_remote_used_features, opcode 0x2016, format "H"
+static inline uint16_t hci_cmd_le_read_remote_used_features_create(uint8_t * buffer, hci_con_handle_t conn_handle){
+    buffer[0] = 0x16;
+    buffer[1] = 0x20;
+    buffer[2] = 2;
+    buffer[3] = conn_handle;
+    buffer[4] = conn_handle >> 8;
+    return 5;
+}
+
+// hci_le_encrypt, opcode 0x2017, format "PP"
+static inline uint16_t hci_cmd_le_encrypt_create(uint8_t * buffer, const uint8_t * key, const uint8_t * plain_text){
+    buffer[0] = 0x17;
+    buffer[1] = 0x20;
+    buffer[2] = 32;
+    memcpy(&buffer[3], key, 16);
+    memcpy(&buffer[19], plain_text, 16);
+    return 35;
+}
+
+// hci_le_rand, opcode 0x2018, format ""
+static inline uint16_t hci_cmd_le_rand_create(uint8_t * buffer){
+    buffer[0] = 0x18;
+    buffer[1] = 0x20;
+    buffer[2] = 0;
+    return 3;
+}
+
+// hci_le_start_encryption, opcode 0x2019, format "H442P"
+static inline uint16_t hci_cmd_le_start_encryption_create(uint8_t * buffer, hci_con_handle_t conn_handle, uint32_t random_number_lower_32bits, uint32_t random_number_higher_32bits, uint16_t encryption_diversifier, const uint8_t * long_term_key){
+    buffer[0] = 0x19;
+    buffer[1] = 0x20;
+    buffer[2] = 28;
+    buffer[3] = conn_handle;
+    buffer[4] = conn_handle >> 8;
+    buffer[5] = random_number_lower_32bits;
+    buffer[6] = random_number_lower_32bits >> 8;
+    buffer[7] = random_number_lower_32bits >> 16;
+    buffer[8] = random_number_lower_32bits >> 24;
+    buffer[9] = random_number_higher_32bits;
+    buffer[10] = random_number_higher_32bits >> 8;
+    buffer[11] = random_number_higher_32bits >> 16;
+    buffer[12] = random_number_higher_32bits >> 24;
+    buffer[13] = encryption_diversifier;
+    buffer[14] = encryption_diversifier >> 8;
+    memcpy(&buffer[15], long_term_key, 16);
+    return 31;
+}
+
+// hci_le_long_term_key_request_reply, opcode 0x201a, format "HP"
+static inline uint16_t hci_cmd_le_long_term_key_request_reply_create(uint8_t * buffer, hci_con_handle_t connection_handle, const uint8_t * long_term_key){
+    buffer[0] = 0x1a;
+    buffer[1] = 0x20;
+    buffer[2] = 18;
+    buffer[3] = connection_handle;
+    buffer[4] = connection_handle >> 8;
+    memcpy(&buffer[5], long_term_key, 16);
+    return 21;
+}
+
+// hci_le_long_term_key_negative_reply, opcode 0x201b, format "H"
+static inline uint16_t hci_cmd_le_long_term_key_negative_reply_create(uint8_t * buffer, hci_con_handle_t conn_handle){
+    buffer[0] = 0x1b;
+    buffer[1] = 0x20;
+    buffer[2] = 2;
+    buffer[3] = conn_handle;
+    buffer[4] = conn_handle >> 8;
+    return 5;
+}
+
+// hci_le_read_supported_states, opcode 0x201c, format "H"
+static inline uint16_t hci_cmd_le_read_supported_states_create(uint8_t * buffer, hci_con_handle_t conn_handle){
+    buffer[0] = 0x1c;
+    buffer[1] = 0x20;
+    buffer[2] = 2;
+    buffer[3] = conn_handle;
+    buffer[4] = conn_handle >> 8;
+    return 5;
+}
+
+// hci_le_receiver_test, opcode 0x201d, format "1"
+static inline uint16_t hci_cmd_le_receiver_test_create(uint8_t * buffer, uint8_t rx_frequency){
+    buffer[0] = 0x1d;
+    buffer[1] = 0x20;
+    buffer[2] = 1;
+    buffer[3] = rx_frequency;
+    return 4;
+}
+
+// hci_le_transmitter_test, opcode 0x201e, format "111"
+static inline uint16_t hci_cmd_le_transmitter_test_create(uint8_t * buffer, uint8_t tx_frequency, uint8_t test_payload_lengh, uint8_t packet_payload){
+    buffer[0] = 0x1e;
+    buffer[1] = 0x20;
+    buffer[2] = 3;
+    buffer[3] = tx_frequency;
+    buffer[4] = test_payload_lengh;
+    buffer[5] = packet_payload;
+    return 6;
+}
+
+// hci_le_test_end, opcode 0x201f, format "1"
+static inline uint16_t hci_cmd_le_test_end_create(uint8_t * buffer, uint8_t end_test_cmd){
+    buffer[0] = 0x1f;
+    buffer[1] = 0x20;
+    buffer[2] = 1;
+    buffer[3] = end_test_cmd;
+    return 4;
+}
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __HCI_CMDS_ENCODER_H
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/**
+ * interface to store controller capabilities across restarts
+ *
+ * Cached capabilities are used if the controller reports the same BD ADDR
+ * and local version information as when they were stored.
+ */
+
+#ifndef __HCI_CONTROLLER_CACHE_H
+#define __HCI_CONTROLLER_CACHE_H
+
+#include <stdint.h>
+#include <btstack/utils.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+// Read Local Version Information: HCI version, HCI revision, LMP version, manufacturer, LMP subversion
+#define HCI_CONTROLLER_VERSION_LEN 8
+
+// entries with other magic, version or size are ignored
+#define HCI_CONTROLLER_INFO_MAGIC   0x42544349  // 'BTCI'
+#define HCI_CONTROLLER_INFO_VERSION 1
+
+typedef struct {
+    // format
+    uint32_t  magic;
+    uint16_t  version;
+    uint16_t  size;             // sizeof(hci_controller_info_t)
+
+    // identity
+    bd_addr_t bd_addr;
+    uint8_t   local_version[HCI_CONTROLLER_VERSION_LEN];                    // after init script
+    uint8_t   local_version_before_init_script[HCI_CONTROLLER_VERSION_LEN];
+
+    // capabilities, ACL sizes limited to HCI_ACL_PAYLOAD_SIZE
+    uint16_t  acl_data_packet_length;
+    uint8_t   acl_packets_total_num;
+    uint8_t   sco_data_packet_length;
+    uint8_t   sco_packets_total_num;
+    uint16_t  le_data_packets_length;
+    uint8_t   le_acl_packets_total_num;
+    uint8_t   local_supported_features[8];
+} hci_controller_info_t;
+
+typedef struct {
+    // @returns 1 if info for controller with bd_addr was found
+    int  (*get)(bd_addr_t bd_addr, hci_controller_info_t * info);
+    void (*put)(hci_controller_info_t * info);
+    void (*remove)(bd_addr_t bd_addr);
+} hci_controller_cache_t;
+
+extern const hci_controller_cache_t hci_controller_cache_memory;
+extern const hci_controller_cache_t hci_controller_cache_fs;
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __HCI_CONTROLLER_CACHE_H
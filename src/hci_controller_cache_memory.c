@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hci_controller_cache_memory.c
+ *
+ *  Keeps info of the last used controller, e.g. to speed up power cycles without reset of the host
+ */
+
+#include <string.h>
+
+#include "hci_controller_cache.h"
+
+static hci_controller_info_t cached_info;
+static int cached_info_valid;
+
+static int cache_get(bd_addr_t bd_addr, hci_controller_info_t * info){
+    if (!cached_info_valid) return 0;
+    if (BD_ADDR_CMP(cached_info.bd_addr, bd_addr)) return 0;
+    memcpy(info, &cached_info, sizeof(hci_controller_info_t));
+    return 1;
+}
+
+static void cache_put(hci_controller_info_t * info){
+    memcpy(&cached_info, info, sizeof(hci_controller_info_t));
+    cached_info_valid = 1;
+}
+
+static void cache_remove(bd_addr_t bd_addr){
+    if (!cached_info_valid) return;
+    if (BD_ADDR_CMP(cached_info.bd_addr, bd_addr)) return;
+    cached_info_valid = 0;
+}
+
+const hci_controller_cache_t hci_controller_cache_memory = {
+    cache_get,
+    cache_put,
+    cache_remove
+};
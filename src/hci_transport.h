@@ -64,8 +64,22 @@ typedef struct {
     int    (*set_baudrate)(uint32_t baudrate);
     // support async transport layers, e.g. IRQ driven without buffers
     int    (*can_send_packet_now)(uint8_t packet_type);
+    // transport with TX buffer: send_packet copies the packet, can_send_packet_now reports free space
+    // and DAEMON_EVENT_HCI_PACKET_SENT signals that space became available again
+    int    tx_buffered;
 } hci_transport_t;
 
+// USB transfer queue statistics
+typedef struct {
+    uint16_t acl_out_transfers;     // ACL OUT transfers allocated
+    uint16_t acl_out_in_flight;     // ACL OUT transfers submitted
+    uint16_t acl_out_in_flight_max;
+    uint32_t acl_out_blocked;       // can_send_packet_now returned 0 as all ACL OUT transfers were in flight
+    uint16_t acl_in_transfers;      // ACL IN transfers allocated
+    uint16_t acl_in_pending;        // ACL IN transfers submitted and waiting for data
+    uint16_t acl_in_pending_min;    // 0 = controller might have had to wait for a free IN transfer
+} hci_transport_usb_stats_t;
+
 typedef struct {
     const char *device_name;
     uint32_t   baudrate_init; // initial baud rate
@@ -80,6 +94,18 @@ extern hci_transport_t * hci_transport_h4_dma_instance(void);
 extern hci_transport_t * hci_transport_h4_iphone_instance(void);
 extern hci_transport_t * hci_transport_h5_instance(void);
 extern hci_transport_t * hci_transport_usb_instance(void);
+extern hci_transport_t * hci_transport_virtual_instance(void);
+
+// H5 sliding window size 1..7 and data integrity check, used for next link establishment
+extern void hci_transport_h5_set_window_size(int window_size);
+extern void hci_transport_h5_enable_crc(int enable);
+
+// number of ACL OUT transfers in flight, 1..HCI_USB_ACL_OUT_TRANSFERS, used for next open, ignored while open
+extern void hci_transport_usb_set_acl_out_transfers(int num_transfers);
+extern const hci_transport_usb_stats_t * hci_transport_usb_get_stats(void);
+
+// directory with sockets of all virtual controllers, default /tmp/btstack-air, used for next open
+extern void hci_transport_virtual_set_air_path(const char * path);
 
 // support for "enforece wake device" in h4 - used by iOS power management
 extern void hci_transport_h4_iphone_set_enforce_wake_device(char *path);
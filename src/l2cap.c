@@ -83,6 +83,9 @@ static btstack_packet_handler_t security_protocol_packet_handler;
 static btstack_packet_handler_t connectionless_channel_packet_handler;
 static uint8_t require_security_level2_for_outgoing_sdp;
 
+// l2cap_run is called once after a batch of packets
+static hci_deferred_run_t l2cap_deferred_run;
+
 // prototypes
 static void l2cap_finialize_channel_close(l2cap_channel_t *channel);
 static l2cap_service_t * l2cap_get_service(uint16_t psm);
@@ -90,6 +93,7 @@ static void l2cap_emit_channel_opened(l2cap_channel_t *channel, uint8_t status);
 static void l2cap_emit_channel_closed(l2cap_channel_t *channel);
 static void l2cap_emit_connection_request(l2cap_channel_t *channel);
 static int l2cap_channel_ready_for_open(l2cap_channel_t *channel);
+void l2cap_run(void);
 
 
 void l2cap_init(){
@@ -110,6 +114,7 @@ void l2cap_init(){
     // register callback with HCI
     //
     hci_register_packet_handler(&l2cap_packet_handler);
+    hci_register_deferred_run(&l2cap_deferred_run, &l2cap_run);
     hci_connectable_control(0); // no services yet
 }
 
@@ -514,11 +519,8 @@ static inline void channelStateVarClearFlag(l2cap_channel_t *channel, L2CAP_CHAN
 
 
 
-// MARK: L2CAP_RUN
-// process outstanding signaling tasks
-void l2cap_run(void){
-    
-    // check pending signaling responses
+// send pending signaling responses as long as ACL buffers are available
+static void l2cap_run_signaling_responses(void){
     while (signaling_responses_pending){
         
         hci_con_handle_t handle = signaling_responses[0].handle;
@@ -586,6 +588,16 @@ void l2cap_run(void){
                 break;
         }
     }
+}
+
+// MARK: L2CAP_RUN
+// process outstanding signaling tasks
+void l2cap_run(void){
+
+    if (hci_defer_run(&l2cap_deferred_run)) return;
+    
+    // check pending signaling responses
+    l2cap_run_signaling_responses();
     
     uint8_t  config_options[4];
     linked_list_iterator_t it;    
@@ -720,6 +732,7 @@ void l2cap_run(void){
         hci_reserve_packet_buffer();
         uint8_t *acl_buffer = hci_get_outgoing_packet_buffer();
         connection->le_con_parameter_update_state = CON_PARAMETER_UPDATE_CHANGE_HCI_CON_PARAMETERS;
+        hci_connection_request_service(connection);
         uint16_t len = l2cap_le_create_connection_parameter_update_response(acl_buffer, connection->con_handle, 0);
         hci_send_acl_packet_buffer(len);
     }
@@ -1033,14 +1046,20 @@ static void l2cap_handle_disconnect_request(l2cap_channel_t *channel, uint16_t i
 
 static void l2cap_register_signaling_response(hci_con_handle_t handle, uint8_t code, uint8_t sig_id, uint16_t data){
     // Vol 3, Part A, 4.3: "The DCID and SCID fields shall be ignored when the result field indi- cates the connection was refused."
-    if (signaling_responses_pending < NR_PENDING_SIGNALING_RESPONSES) {
-        signaling_responses[signaling_responses_pending].handle = handle;
-        signaling_responses[signaling_responses_pending].code = code;
-        signaling_responses[signaling_responses_pending].sig_id = sig_id;
-        signaling_responses[signaling_responses_pending].data = data;
-        signaling_responses_pending++;
-        l2cap_run();
+    if (signaling_responses_pending == NR_PENDING_SIGNALING_RESPONSES){
+        // l2cap_run is deferred during a batch of packets, make room now
+        l2cap_run_signaling_responses();
+    }
+    if (signaling_responses_pending == NR_PENDING_SIGNALING_RESPONSES){
+        log_error("l2cap_register_signaling_response: no room for response code %u, sig_id %u", code, sig_id);
+        return;
     }
+    signaling_responses[signaling_responses_pending].handle = handle;
+    signaling_responses[signaling_responses_pending].code = code;
+    signaling_responses[signaling_responses_pending].sig_id = sig_id;
+    signaling_responses[signaling_responses_pending].data = data;
+    signaling_responses_pending++;
+    l2cap_run();
 }
 
 static void l2cap_handle_connection_request(hci_con_handle_t handle, uint8_t sig_id, uint16_t psm, uint16_t source_cid){
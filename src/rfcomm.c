@@ -116,6 +116,9 @@ static linked_list_t rfcomm_services = NULL;
 
 static gap_security_level_t rfcomm_security_level;
 
+// rfcomm_run is called once after a batch of packets
+static hci_deferred_run_t rfcomm_deferred_run;
+
 static void (*app_packet_handler)(void * connection, uint8_t packet_type,
                                   uint16_t channel, uint8_t *packet, uint16_t size);
 
@@ -789,6 +792,38 @@ static void rfcomm_send_uih_credits(rfcomm_multiplexer_t *multiplexer, uint8_t d
     rfcomm_send_packet_for_multiplexer(multiplexer, address, BT_RFCOMM_UIH_PF, credits, NULL, 0);
 }
 
+// rfcomm_run is deferred during a batch of packets, so a response stored in a single slot might
+// still be pending when the next request arrives. Send it before the slot is reused.
+static void rfcomm_multiplexer_flush_dm(rfcomm_multiplexer_t * multiplexer){
+    if (!multiplexer->send_dm_for_dlci) return;
+    if (!l2cap_can_send_packet_now(multiplexer->l2cap_cid)) return;
+    uint8_t dlci = multiplexer->send_dm_for_dlci;
+    multiplexer->send_dm_for_dlci = 0;
+    rfcomm_send_dm_pf(multiplexer, dlci);
+}
+
+static void rfcomm_multiplexer_flush_nsc_rsp(rfcomm_multiplexer_t * multiplexer){
+    if (!multiplexer->nsc_command) return;
+    if (!l2cap_can_send_packet_now(multiplexer->l2cap_cid)) return;
+    uint8_t command = multiplexer->nsc_command;
+    multiplexer->nsc_command = 0;
+    rfcomm_send_uih_nsc_rsp(multiplexer, command);
+}
+
+static void rfcomm_multiplexer_flush_test_rsp(rfcomm_multiplexer_t * multiplexer){
+    if (!multiplexer->test_data_len) return;
+    if (!l2cap_can_send_packet_now(multiplexer->l2cap_cid)) return;
+    int len = multiplexer->test_data_len;
+    multiplexer->test_data_len = 0;
+    rfcomm_send_uih_test_rsp(multiplexer, multiplexer->test_data, len);
+}
+
+static void rfcomm_multiplexer_send_dm(rfcomm_multiplexer_t * multiplexer, uint8_t dlci){
+    if (multiplexer->send_dm_for_dlci == dlci) return;
+    rfcomm_multiplexer_flush_dm(multiplexer);
+    multiplexer->send_dm_for_dlci = dlci;
+}
+
 // MARK: RFCOMM MULTIPLEXER
 static void rfcomm_multiplexer_stop_timer(rfcomm_multiplexer_t * multiplexer){
     if (multiplexer->timer_active) {
@@ -1107,6 +1142,7 @@ static int rfcomm_multiplexer_l2cap_packet_handler(uint16_t channel, uint8_t *pa
                     if (len > RFCOMM_TEST_DATA_MAX_LEN){
                         len = RFCOMM_TEST_DATA_MAX_LEN;
                     }
+                    rfcomm_multiplexer_flush_test_rsp(multiplexer);
                     multiplexer->test_data_len = len;
                     memcpy(multiplexer->test_data, &packet[payload_offset + 2], len);
                     return 1;
@@ -1377,7 +1413,7 @@ static void rfcomm_channel_state_machine_2(rfcomm_multiplexer_t * multiplexer, u
     // log_info("rfcomm_channel_state_machine_2 service dlci #%u = 0x%08x", dlci, (int) service);
     if (!service) {
         // discard request by sending disconnected mode
-        multiplexer->send_dm_for_dlci = dlci;
+        rfcomm_multiplexer_send_dm(multiplexer, dlci);
         return;
     }
 
@@ -1391,7 +1427,7 @@ static void rfcomm_channel_state_machine_2(rfcomm_multiplexer_t * multiplexer, u
             channel = rfcomm_channel_create(multiplexer, service, dlci >> 1);
             if (!channel){
                 // discard request by sending disconnected mode
-                multiplexer->send_dm_for_dlci = dlci;
+                rfcomm_multiplexer_send_dm(multiplexer, dlci);
             }
             break;
         default:
@@ -1400,7 +1436,7 @@ static void rfcomm_channel_state_machine_2(rfcomm_multiplexer_t * multiplexer, u
 
     if (!channel) {
         // discard request by sending disconnected mode
-        multiplexer->send_dm_for_dlci = dlci;
+        rfcomm_multiplexer_send_dm(multiplexer, dlci);
         return;
     }
     channel->connection = service->connection;
@@ -1541,6 +1577,7 @@ void rfcomm_channel_packet_handler(rfcomm_multiplexer_t * multiplexer,  uint8_t
                 // everything else is an not supported command
                 default: {
                     log_error("Received unknown UIH command packet - 0x%02x", packet[payload_offset]); 
+                    rfcomm_multiplexer_flush_nsc_rsp(multiplexer);
                     multiplexer->nsc_command = packet[payload_offset];
                     break;
                 }
@@ -1630,6 +1667,22 @@ inline static void rfcomm_channel_state_remove(rfcomm_channel_t *channel, RFCOMM
     channel->state_var = (RFCOMM_CHANNEL_STATE_VAR) (channel->state_var & ~event);    
 }
 
+// see rfcomm_multiplexer_flush_dm
+static void rfcomm_channel_flush_rpn_rsp(rfcomm_channel_t *channel){
+    if ((channel->state_var & RFCOMM_CHANNEL_STATE_VAR_SEND_RPN_RSP) == 0) return;
+    if (!l2cap_can_send_packet_now(channel->multiplexer->l2cap_cid)) return;
+    rfcomm_channel_state_remove(channel, RFCOMM_CHANNEL_STATE_VAR_SEND_RPN_RSP);
+    rfcomm_send_uih_rpn_rsp(channel->multiplexer, channel->dlci, &channel->rpn_data);
+}
+
+static void rfcomm_channel_flush_rls_rsp(rfcomm_channel_t *channel){
+    if (channel->rls_line_status == RFCOMM_RLS_STATUS_INVALID) return;
+    if (!l2cap_can_send_packet_now(channel->multiplexer->l2cap_cid)) return;
+    uint8_t line_status = channel->rls_line_status;
+    channel->rls_line_status = RFCOMM_RLS_STATUS_INVALID;
+    rfcomm_send_uih_rls_rsp(channel->multiplexer, channel->dlci, line_status);
+}
+
 static void rfcomm_channel_state_machine(rfcomm_channel_t *channel, rfcomm_channel_event_t *event){
     
     // log_info("rfcomm_channel_state_machine: state %u, state_var %04x, event %u", channel->state, channel->state_var ,event->type);
@@ -1663,6 +1716,7 @@ static void rfcomm_channel_state_machine(rfcomm_channel_t *channel, rfcomm_chann
     if (event->type == CH_EVT_RCVD_RPN_CMD){
         // control port parameters
         rfcomm_channel_event_rpn_t *event_rpn = (rfcomm_channel_event_rpn_t*) event;
+        rfcomm_channel_flush_rpn_rsp(channel);
         rfcomm_rpn_data_update(&channel->rpn_data, &event_rpn->data);
         rfcomm_channel_state_add(channel, RFCOMM_CHANNEL_STATE_VAR_SEND_RPN_RSP);
         // notify client about new settings
@@ -1673,6 +1727,7 @@ static void rfcomm_channel_state_machine(rfcomm_channel_t *channel, rfcomm_chann
     // TODO: integrate in common switch
     if (event->type == CH_EVT_RCVD_RPN_REQ){
         // no values got accepted (no values have beens sent)
+        rfcomm_channel_flush_rpn_rsp(channel);
         channel->rpn_data.parameter_mask_0 = 0x00;
         channel->rpn_data.parameter_mask_1 = 0x00;
         rfcomm_channel_state_add(channel, RFCOMM_CHANNEL_STATE_VAR_SEND_RPN_RSP);
@@ -1681,6 +1736,7 @@ static void rfcomm_channel_state_machine(rfcomm_channel_t *channel, rfcomm_chann
     
     if (event->type == CH_EVT_RCVD_RLS_CMD){ 
         rfcomm_channel_event_rls_t * event_rls = (rfcomm_channel_event_rls_t*) event;
+        rfcomm_channel_flush_rls_rsp(channel);
         channel->rls_line_status = event_rls->line_status & 0x0f;
         log_info("CH_EVT_RCVD_RLS_CMD setting line status to 0x%0x", channel->rls_line_status);
         rfcomm_emit_remote_line_status(channel, event_rls->line_status);
@@ -1972,6 +2028,8 @@ static void rfcomm_channel_state_machine(rfcomm_channel_t *channel, rfcomm_chann
 // MARK: RFCOMM RUN
 // process outstanding signaling tasks
 static void rfcomm_run(void){
+
+    if (hci_defer_run(&rfcomm_deferred_run)) return;
     
     linked_item_t *it;
     linked_item_t *next;
@@ -2016,6 +2074,7 @@ void rfcomm_init(void){
     rfcomm_services     = NULL;
     rfcomm_channels     = NULL;
     rfcomm_security_level = LEVEL_0;
+    hci_register_deferred_run(&rfcomm_deferred_run, &rfcomm_run);
 }
 
 void rfcomm_set_required_security_level(gap_security_level_t security_level){
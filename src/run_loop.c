@@ -45,9 +45,19 @@
 
 #include <stdio.h>
 #include <stdlib.h>  // exit()
+#include <string.h>
 
 #include "run_loop_private.h"
 
+#ifdef ENABLE_RUN_LOOP_PROFILER
+#ifdef HAVE_TIME
+#include <time.h>
+#endif
+#ifdef HAVE_TICK
+#include <btstack/hal_tick.h>
+#endif
+#endif
+
 #include "debug.h"
 #include "btstack-config.h"
 
@@ -63,6 +73,10 @@ extern run_loop_t run_loop_posix;
 extern run_loop_t run_loop_cocoa;
 #endif
 
+#ifdef USE_EPOLL_RUN_LOOP
+extern run_loop_t run_loop_epoll;
+#endif
+
 // assert run loop initialized
 static void run_loop_assert(void){
 #ifndef EMBEDDED
@@ -82,6 +96,10 @@ void run_loop_set_data_source_handler(data_source_t *ds, int (*process)(data_sou
     ds->process = process;
 };
 
+void run_loop_set_callback_handler(run_loop_callback_t *cb, void (*process)(run_loop_callback_t *_cb)){
+    cb->process = process;
+}
+
 
 /**
  * Add data_source to run_loop
@@ -99,6 +117,24 @@ int run_loop_remove_data_source(data_source_t *ds){
     return the_run_loop->remove_data_source(ds);
 }
 
+void run_loop_enable_data_source_callbacks(data_source_t *ds, uint8_t callbacks){
+    run_loop_assert();
+    if ((ds->callbacks & callbacks) == callbacks) return;
+    ds->callbacks |= callbacks;
+    if (the_run_loop->update_data_source){
+        the_run_loop->update_data_source(ds);
+    }
+}
+
+void run_loop_disable_data_source_callbacks(data_source_t *ds, uint8_t callbacks){
+    run_loop_assert();
+    if ((ds->callbacks & callbacks) == 0) return;
+    ds->callbacks &= ~callbacks;
+    if (the_run_loop->update_data_source){
+        the_run_loop->update_data_source(ds);
+    }
+}
+
 void run_loop_set_timer(timer_source_t *a, uint32_t timeout_in_ms){
     run_loop_assert();
     the_run_loop->set_timer(a, timeout_in_ms);
@@ -120,6 +156,255 @@ int run_loop_remove_timer(timer_source_t *ts){
     return the_run_loop->remove_timer(ts);
 }
 
+uint32_t run_loop_get_time_ms(void){
+    run_loop_assert();
+    return the_run_loop->get_time_ms();
+}
+
+void run_loop_execute_on_main_thread(run_loop_callback_t *cb){
+    run_loop_assert();
+    the_run_loop->execute_on_main_thread(cb);
+}
+
+#ifdef ENABLE_RUN_LOOP_PROFILER
+
+// callbacks are identified by their process function
+#ifndef RUN_LOOP_PROFILER_MAX_SOURCES
+#define RUN_LOOP_PROFILER_MAX_SOURCES 32
+#endif
+
+#ifndef RUN_LOOP_PROFILER_STALL_THRESHOLD_MS
+#define RUN_LOOP_PROFILER_STALL_THRESHOLD_MS 100
+#endif
+
+// log-bucket histogram: bucket 0 counts values < 2 us, bucket i values in [2^i, 2^(i+1)) us, last bucket all above
+#define RUN_LOOP_PROFILER_BUCKETS 20
+
+typedef enum {
+    PROFILER_DATA_SOURCE = 0,
+    PROFILER_TIMER,
+    PROFILER_CALLBACK,
+} profiler_source_type_t;
+
+typedef struct {
+    void *   process;
+    profiler_source_type_t type;
+    uint32_t count;
+    uint64_t total_us;
+    uint32_t max_us;
+    uint32_t max_lateness_us;
+    uint32_t duration_histogram[RUN_LOOP_PROFILER_BUCKETS];
+    uint32_t lateness_histogram[RUN_LOOP_PROFILER_BUCKETS];
+} profiler_entry_t;
+
+// last entry collects callbacks that don't fit into the table
+static profiler_entry_t profiler_entries[RUN_LOOP_PROFILER_MAX_SOURCES + 1];
+static uint32_t profiler_iterations;
+static uint32_t profiler_stalls;
+static uint32_t profiler_stall_threshold_us = RUN_LOOP_PROFILER_STALL_THRESHOLD_MS * 1000;
+
+// current iteration
+static uint64_t profiler_iteration_start_us;
+static void *   profiler_iteration_longest_process;
+static uint32_t profiler_iteration_longest_us;
+
+static const char * profiler_type_names[] = { "data source", "timer", "callback" };
+
+static uint64_t profiler_get_time_us(void){
+#ifdef HAVE_TIME
+    // same clock as posix run loop timers
+    struct timeval tv;
+#ifdef CLOCK_MONOTONIC
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    tv.tv_sec  = now.tv_sec;
+    tv.tv_usec = now.tv_nsec / 1000;
+#else
+    gettimeofday(&tv, NULL);
+#endif
+    return ((uint64_t) tv.tv_sec) * 1000000 + tv.tv_usec;
+#elif defined(HAVE_TICK)
+    return ((uint64_t) embedded_get_time_ms()) * 1000;
+#else
+    return 0;
+#endif
+}
+
+static int profiler_bucket(uint32_t value_us){
+    int bucket = 0;
+    while (value_us > 1 && bucket < RUN_LOOP_PROFILER_BUCKETS - 1){
+        value_us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static profiler_entry_t * profiler_entry_for_process(void * process, profiler_source_type_t type){
+    // open addressing, entries are never removed
+    int start = (int) ((((uintptr_t) process) >> 2) % RUN_LOOP_PROFILER_MAX_SOURCES);
+    int i;
+    for (i = 0; i < RUN_LOOP_PROFILER_MAX_SOURCES; i++){
+        profiler_entry_t * entry = &profiler_entries[(start + i) % RUN_LOOP_PROFILER_MAX_SOURCES];
+        if (entry->process == process && entry->type == type) return entry;
+        if (entry->process) continue;
+        entry->process = process;
+        entry->type    = type;
+        return entry;
+    }
+    return &profiler_entries[RUN_LOOP_PROFILER_MAX_SOURCES];
+}
+
+static void profiler_record(void * process, profiler_source_type_t type, uint64_t start_us){
+    uint32_t duration_us = (uint32_t) (profiler_get_time_us() - start_us);
+    profiler_entry_t * entry = profiler_entry_for_process(process, type);
+    entry->count++;
+    entry->total_us += duration_us;
+    if (duration_us > entry->max_us){
+        entry->max_us = duration_us;
+    }
+    entry->duration_histogram[profiler_bucket(duration_us)]++;
+    if (duration_us >= profiler_iteration_longest_us){
+        profiler_iteration_longest_us      = duration_us;
+        profiler_iteration_longest_process = process;
+    }
+}
+
+void run_loop_profiler_iteration_start(void){
+    profiler_iteration_start_us = profiler_get_time_us();
+    profiler_iteration_longest_us = 0;
+    profiler_iteration_longest_process = NULL;
+}
+
+void run_loop_profiler_iteration_end(void){
+    profiler_iterations++;
+    if (!profiler_stall_threshold_us) return;
+    uint32_t duration_us = (uint32_t) (profiler_get_time_us() - profiler_iteration_start_us);
+    if (duration_us <= profiler_stall_threshold_us) return;
+    profiler_stalls++;
+    log_error("run loop stall: iteration took %u us, longest callback %p took %u us",
+        (unsigned int) duration_us, profiler_iteration_longest_process, (unsigned int) profiler_iteration_longest_us);
+}
+
+int run_loop_profiler_process_data_source(data_source_t * ds){
+    void * process = (void *) ds->process;
+    uint64_t start_us = profiler_get_time_us();
+    int result = ds->process(ds);
+    profiler_record(process, PROFILER_DATA_SOURCE, start_us);
+    return result;
+}
+
+void run_loop_profiler_process_timer(timer_source_t * ts){
+    void * process = (void *) ts->process;
+    uint64_t start_us = profiler_get_time_us();
+    // lateness: actual fire time vs. timeout
+    uint32_t lateness_us = 0;
+#ifdef HAVE_TIME
+    uint64_t timeout_us = ((uint64_t) ts->timeout.tv_sec) * 1000000 + ts->timeout.tv_usec;
+    if (start_us > timeout_us){
+        lateness_us = (uint32_t) (start_us - timeout_us);
+    }
+#endif
+#ifdef HAVE_TICK
+    if (embedded_get_ticks() > ts->timeout){
+        lateness_us = (embedded_get_ticks() - ts->timeout) * hal_tick_get_tick_period_in_ms() * 1000;
+    }
+#endif
+    // timer might get re-used by handler, so record lateness first
+    profiler_entry_t * entry = profiler_entry_for_process(process, PROFILER_TIMER);
+    if (lateness_us > entry->max_lateness_us){
+        entry->max_lateness_us = lateness_us;
+    }
+    entry->lateness_histogram[profiler_bucket(lateness_us)]++;
+    ts->process(ts);
+    profiler_record(process, PROFILER_TIMER, start_us);
+}
+
+void run_loop_profiler_process_callback(run_loop_callback_t * cb){
+    void * process = (void *) cb->process;
+    uint64_t start_us = profiler_get_time_us();
+    cb->process(cb);
+    profiler_record(process, PROFILER_CALLBACK, start_us);
+}
+
+static void profiler_dump_histogram(const char * name, uint32_t * histogram){
+    int i;
+    for (i = 0; i < RUN_LOOP_PROFILER_BUCKETS; i++){
+        if (!histogram[i]) continue;
+        if (i == RUN_LOOP_PROFILER_BUCKETS - 1){
+            log_info("    %s >= %lu us: %u", name, 1UL << i, (unsigned int) histogram[i]);
+        } else {
+            log_info("    %s < %lu us: %u", name, 2UL << i, (unsigned int) histogram[i]);
+        }
+    }
+}
+
+void run_loop_profiler_dump(void){
+    int i;
+    log_info("run loop profile: %u iterations, %u stalls > %u us", (unsigned int) profiler_iterations,
+        (unsigned int) profiler_stalls, (unsigned int) profiler_stall_threshold_us);
+    for (i = 0; i <= RUN_LOOP_PROFILER_MAX_SOURCES; i++){
+        profiler_entry_t * entry = &profiler_entries[i];
+        if (!entry->count) continue;
+        log_info("  %s %p%s: count %u, total %lu us, avg %u us, max %u us, max lateness %u us",
+            profiler_type_names[entry->type], entry->process, i == RUN_LOOP_PROFILER_MAX_SOURCES ? " (and others)" : "",
+            (unsigned int) entry->count, (unsigned long) entry->total_us, (unsigned int) (entry->total_us / entry->count),
+            (unsigned int) entry->max_us, (unsigned int) entry->max_lateness_us);
+        profiler_dump_histogram("duration", entry->duration_histogram);
+        if (entry->type == PROFILER_TIMER){
+            profiler_dump_histogram("lateness", entry->lateness_histogram);
+        }
+    }
+}
+
+void run_loop_profiler_reset(void){
+    memset(profiler_entries, 0, sizeof(profiler_entries));
+    profiler_iterations = 0;
+    profiler_stalls = 0;
+}
+
+void run_loop_profiler_set_stall_threshold_ms(uint32_t threshold_ms){
+    profiler_stall_threshold_us = threshold_ms * 1000;
+}
+
+#endif
+
+#ifndef EMBEDDED
+
+// requested callbacks, newest first. producers push with compare-and-swap,
+// the run loop thread takes the whole list at once, so there is no ABA problem
+static run_loop_callback_t * requested_callbacks = NULL;
+
+int run_loop_callbacks_add(run_loop_callback_t * callback){
+    // already queued?
+    if (__atomic_exchange_n(&callback->pending, 1, __ATOMIC_ACQ_REL)) return 0;
+    run_loop_callback_t * head = __atomic_load_n(&requested_callbacks, __ATOMIC_ACQUIRE);
+    do {
+        callback->item.next = (linked_item_t *) head;
+    } while (!__atomic_compare_exchange_n(&requested_callbacks, &head, callback, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+    return head == NULL;
+}
+
+void run_loop_callbacks_process(void){
+    run_loop_callback_t * list = __atomic_exchange_n(&requested_callbacks, NULL, __ATOMIC_ACQ_REL);
+    // reverse list to execute callbacks in order of request
+    run_loop_callback_t * fifo = NULL;
+    while (list){
+        run_loop_callback_t * next = (run_loop_callback_t *) list->item.next;
+        list->item.next = (linked_item_t *) fifo;
+        fifo = list;
+        list = next;
+    }
+    while (fifo){
+        run_loop_callback_t * callback = fifo;
+        fifo = (run_loop_callback_t *) fifo->item.next;
+        // allow callback to be requested again while it is executed
+        __atomic_store_n(&callback->pending, 0, __ATOMIC_RELEASE);
+        run_loop_process_callback(callback);
+    }
+}
+
+#endif
+
 void run_loop_timer_dump(){
     run_loop_assert();
     the_run_loop->dump_timer();
@@ -133,6 +418,184 @@ void run_loop_execute() {
     the_run_loop->execute();
 }
 
+// compare timeouts, timer queue is ordered by this
+static int timer_queue_compare(timer_source_t *a, timer_source_t *b){
+#ifdef HAVE_TIME
+    // pre: 0 <= tv_usec < 1000000
+    if (a->timeout.tv_sec  < b->timeout.tv_sec)  return -1;
+    if (a->timeout.tv_sec  > b->timeout.tv_sec)  return 1;
+    if (a->timeout.tv_usec < b->timeout.tv_usec) return -1;
+    if (a->timeout.tv_usec > b->timeout.tv_usec) return 1;
+#endif
+#ifdef HAVE_TICK
+    if (a->timeout < b->timeout) return -1;
+    if (a->timeout > b->timeout) return 1;
+#endif
+    return 0;
+}
+
+#ifdef TIMER_QUEUE_HEAP
+
+// heap entries know their position (queue_index = pos + 1), this allows to remove
+// any timer in O(log n) and to detect if a timer is queued without trusting its fields
+// timers with same timeout expire in the order they were added, as with the sorted list
+static int timer_queue_heap_compare(timer_source_t *a, timer_source_t *b){
+    int result = timer_queue_compare(a, b);
+    if (result) return result;
+    // sequence numbers may wrap around
+    return (int32_t) (a->queue_sequence - b->queue_sequence) < 0 ? -1 : 1;
+}
+
+static int timer_queue_contains(timer_queue_t * queue, timer_source_t * ts){
+    int pos = ts->queue_index - 1;
+    if (pos < 0 || pos >= queue->count) return 0;
+    return queue->heap[pos] == ts;
+}
+
+static void timer_queue_place(timer_queue_t * queue, int pos, timer_source_t * ts){
+    queue->heap[pos] = ts;
+    ts->queue_index = pos + 1;
+}
+
+static void timer_queue_sift_up(timer_queue_t * queue, int pos){
+    timer_source_t * ts = queue->heap[pos];
+    while (pos > 0){
+        int parent = (pos - 1) / 2;
+        if (timer_queue_heap_compare(queue->heap[parent], ts) <= 0) break;
+        timer_queue_place(queue, pos, queue->heap[parent]);
+        pos = parent;
+    }
+    timer_queue_place(queue, pos, ts);
+}
+
+static void timer_queue_sift_down(timer_queue_t * queue, int pos){
+    timer_source_t * ts = queue->heap[pos];
+    while (1){
+        int child = 2 * pos + 1;
+        if (child >= queue->count) break;
+        if (child + 1 < queue->count && timer_queue_heap_compare(queue->heap[child + 1], queue->heap[child]) < 0){
+            child++;
+        }
+        if (timer_queue_heap_compare(ts, queue->heap[child]) <= 0) break;
+        timer_queue_place(queue, pos, queue->heap[child]);
+        pos = child;
+    }
+    timer_queue_place(queue, pos, ts);
+}
+
+void timer_queue_init(timer_queue_t * queue){
+#ifdef MAX_NO_TIMER_SOURCES
+    queue->size  = MAX_NO_TIMER_SOURCES;
+#else
+    queue->heap  = NULL;
+    queue->size  = 0;
+#endif
+    queue->count = 0;
+    queue->sequence = 0;
+}
+
+int timer_queue_add(timer_queue_t * queue, timer_source_t * ts){
+    if (timer_queue_contains(queue, ts)){
+        log_error( "run_loop_timer_add error: timer to add already in list!");
+        return -1;
+    }
+    if (queue->count == queue->size){
+#ifdef MAX_NO_TIMER_SOURCES
+        log_error("run_loop_timer_add error: more than MAX_NO_TIMER_SOURCES (%u) timers", MAX_NO_TIMER_SOURCES);
+        return -1;
+#else
+        int new_size = queue->size ? queue->size * 2 : 16;
+        timer_source_t ** new_heap = (timer_source_t **) realloc(queue->heap, new_size * sizeof(timer_source_t *));
+        if (!new_heap){
+            log_error("run_loop_timer_add error: cannot grow timer queue");
+            return -1;
+        }
+        queue->heap = new_heap;
+        queue->size = new_size;
+#endif
+    }
+    ts->queue_sequence = queue->sequence++;
+    queue->heap[queue->count++] = ts;
+    timer_queue_sift_up(queue, queue->count - 1);
+    return 0;
+}
+
+int timer_queue_remove(timer_queue_t * queue, timer_source_t * ts){
+    if (!timer_queue_contains(queue, ts)) return -1;
+    int pos = ts->queue_index - 1;
+    ts->queue_index = 0;
+    queue->count--;
+    if (pos == queue->count) return 0;
+    // move last entry into the gap and restore heap order
+    timer_queue_place(queue, pos, queue->heap[queue->count]);
+    if (pos > 0 && timer_queue_heap_compare(queue->heap[pos], queue->heap[(pos - 1) / 2]) < 0){
+        timer_queue_sift_up(queue, pos);
+    } else {
+        timer_queue_sift_down(queue, pos);
+    }
+    return 0;
+}
+
+timer_source_t * timer_queue_first(timer_queue_t * queue){
+    if (!queue->count) return NULL;
+    return queue->heap[0];
+}
+
+#else
+
+void timer_queue_init(timer_queue_t * queue){
+    queue->timers = NULL;
+}
+
+int timer_queue_add(timer_queue_t * queue, timer_source_t * ts){
+    linked_item_t *it;
+    for (it = (linked_item_t *) &queue->timers; it->next ; it = it->next){
+        // don't add timer that's already in there
+        if ((timer_source_t *) it->next == ts){
+            log_error( "run_loop_timer_add error: timer to add already in list!");
+            return -1;
+        }
+        if (timer_queue_compare(ts, (timer_source_t *) it->next) < 0) {
+            break;
+        }
+    }
+    ts->item.next = it->next;
+    it->next = (linked_item_t *) ts;
+    return 0;
+}
+
+int timer_queue_remove(timer_queue_t * queue, timer_source_t * ts){
+    return linked_list_remove(&queue->timers, (linked_item_t *) ts);
+}
+
+timer_source_t * timer_queue_first(timer_queue_t * queue){
+    return (timer_source_t *) queue->timers;
+}
+
+#endif
+
+void timer_queue_dump(timer_queue_t * queue){
+#if defined(ENABLE_LOG_INFO) && (defined(HAVE_TIME) || defined(HAVE_TICK))
+    int i = 0;
+#ifdef TIMER_QUEUE_HEAP
+    // heap order, first entry expires first
+    for (i = 0; i < queue->count; i++){
+        timer_source_t *ts = queue->heap[i];
+#else
+    linked_item_t *it;
+    for (it = (linked_item_t *) queue->timers; it ; it = it->next, i++){
+        timer_source_t *ts = (timer_source_t*) it;
+#endif
+#ifdef HAVE_TIME
+        log_info("timer %u, timeout %u\n", i, (unsigned int) ts->timeout.tv_sec);
+#endif
+#ifdef HAVE_TICK
+        log_info("timer %u, timeout %u\n", i, (unsigned int) ts->timeout);
+#endif
+    }
+#endif
+}
+
 // init must be called before any other run_loop call
 void run_loop_init(RUN_LOOP_TYPE type){
 #ifndef EMBEDDED
@@ -156,6 +619,11 @@ void run_loop_init(RUN_LOOP_TYPE type){
         case RUN_LOOP_COCOA:
             the_run_loop = &run_loop_cocoa;
             break;
+#endif
+#ifdef USE_EPOLL_RUN_LOOP
+        case RUN_LOOP_EPOLL:
+            the_run_loop = &run_loop_epoll;
+            break;
 #endif
         default:
 #ifndef EMBEDDED
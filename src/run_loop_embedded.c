@@ -50,6 +50,9 @@
  *  the idle hook gets called if no data source did indicate that it needs to be
  *  called right away.
  *
+ *  With HAVE_TICKLESS, periodic ticks are stopped during sleep and the MCU is
+ *  woken up by a one-shot tick when the next timer expires, see hal_tick.h
+ *
  */
 
 
@@ -66,7 +69,7 @@
 // the run loop
 static linked_list_t data_sources;
 
-static linked_list_t timers;
+static timer_queue_t timers;
 
 #ifdef HAVE_TICK
 static uint32_t system_ticks;
@@ -74,10 +77,17 @@ static uint32_t system_ticks;
 
 static int trigger_event_received = 0;
 
+// callbacks requested from interrupt handlers, in order of request
+static run_loop_callback_t * requested_callbacks;
+static run_loop_callback_t * requested_callbacks_tail;
+
 /**
  * Add data_source to run_loop
  */
 static void embedded_add_data_source(data_source_t *ds){
+    // data sources are polled in every iteration
+    ds->callbacks = DATA_SOURCE_CALLBACK_READ;
+    ds->ready     = DATA_SOURCE_CALLBACK_READ;
     linked_list_add(&data_sources, (linked_item_t *) ds);
 }
 
@@ -99,23 +109,11 @@ static void embedded_set_timer(timer_source_t *ts, uint32_t timeout_in_ms){
 }
 
 /**
- * Add timer to run_loop (keep list sorted)
+ * Add timer to run_loop
  */
 static void embedded_add_timer(timer_source_t *ts){
 #ifdef HAVE_TICK
-    linked_item_t *it;
-    for (it = (linked_item_t *) &timers; it->next ; it = it->next){
-        // don't add timer that's already in there
-        if ((timer_source_t *) it->next == ts){
-            log_error( "run_loop_timer_add error: timer to add already in list!");
-            return;
-        }
-        if (ts->timeout < ((timer_source_t *) it->next)->timeout) {
-            break;
-        }
-    }
-    ts->item.next = it->next;
-    it->next = (linked_item_t *) ts;
+    timer_queue_add(&timers, ts);
     // log_info("Added timer %x at %u\n", (int) ts, (unsigned int) ts->timeout.tv_sec);
     // embedded_dump_timer();
 #endif
@@ -127,7 +125,7 @@ static void embedded_add_timer(timer_source_t *ts){
 static int embedded_remove_timer(timer_source_t *ts){
 #ifdef HAVE_TICK    
     // log_info("Removed timer %x at %u\n", (int) ts, (unsigned int) ts->timeout.tv_sec);
-    return linked_list_remove(&timers, (linked_item_t *) ts);
+    return timer_queue_remove(&timers, ts);
 #else
     return 0;
 #endif
@@ -135,39 +133,99 @@ static int embedded_remove_timer(timer_source_t *ts){
 
 static void embedded_dump_timer(void){
 #ifdef HAVE_TICK
-#ifdef ENABLE_LOG_INFO 
-    linked_item_t *it;
-    int i = 0;
-    for (it = (linked_item_t *) timers; it ; it = it->next){
-        timer_source_t *ts = (timer_source_t*) it;
-        log_info("timer %u, timeout %u\n", i, (unsigned int) ts->timeout);
-    }
-#endif
+    timer_queue_dump(&timers);
 #endif
 }
 
+/**
+ * Request callback, called from interrupt handler or with interrupts disabled
+ */
+static void embedded_execute_on_main_thread(run_loop_callback_t *callback){
+    if (callback->pending) return;
+    callback->pending = 1;
+    callback->item.next = NULL;
+    if (requested_callbacks){
+        requested_callbacks_tail->item.next = (linked_item_t *) callback;
+    } else {
+        requested_callbacks = callback;
+    }
+    requested_callbacks_tail = callback;
+    trigger_event_received = 1;
+}
+
+static void embedded_process_callbacks(void){
+    if (!requested_callbacks) return;
+    // take list of requested callbacks
+    hal_cpu_disable_irqs();
+    run_loop_callback_t * callback = requested_callbacks;
+    requested_callbacks = NULL;
+    hal_cpu_enable_irqs();
+    while (callback){
+        run_loop_callback_t * next = (run_loop_callback_t *) callback->item.next;
+        // allow callback to be requested again while it is executed
+        callback->pending = 0;
+        run_loop_process_callback(callback);
+        callback = next;
+    }
+}
+
+#if defined(HAVE_TICK) && defined(HAVE_TICKLESS)
+/**
+ * Sleep until next timer expires instead of waking up on every tick, called with IRQs disabled
+ */
+static void embedded_sleep_tickless(void){
+    uint32_t ticks = 0; // no timer
+    timer_source_t *ts = timer_queue_first(&timers);
+    if (ts){
+        // not worth to stop periodic ticks
+        if (ts->timeout <= system_ticks + 1){
+            hal_cpu_enable_irqs_and_sleep();
+            return;
+        }
+        ticks = ts->timeout - system_ticks;
+    }
+    uint32_t sleep_start = system_ticks;
+    if (!hal_tick_start_one_shot(ticks)){
+        hal_cpu_enable_irqs_and_sleep();
+        return;
+    }
+    hal_cpu_enable_irqs_and_sleep();
+    // woken up by timer or other interrupt, tick handler might have been called once
+    hal_cpu_disable_irqs();
+    system_ticks = sleep_start + hal_tick_stop_one_shot();
+    hal_cpu_enable_irqs();
+}
+#endif
+
 /**
  * Execute run_loop once
  */
 void embedded_execute_once(void) {
     data_source_t *ds;
 
+    run_loop_iteration_start();
+
+    // process callbacks requested by interrupt handlers
+    embedded_process_callbacks();
+
     // process data sources
     data_source_t *next;
     for (ds = (data_source_t *) data_sources; ds != NULL ; ds = next){
         next = (data_source_t *) ds->item.next; // cache pointer to next data_source to allow data source to remove itself
-        ds->process(ds);
+        run_loop_process_data_source(ds);
     }
     
 #ifdef HAVE_TICK
     // process timers
-    while (timers) {
-        timer_source_t *ts = (timer_source_t *) timers;
+    timer_source_t *ts;
+    while ((ts = timer_queue_first(&timers)) != NULL) {
         if (ts->timeout > system_ticks) break;
         run_loop_remove_timer(ts);
-        ts->process(ts);
+        run_loop_process_timer(ts);
     }
 #endif
+
+    run_loop_iteration_end();
     
     // disable IRQs and check if run loop iteration has been requested. if not, go to sleep
     hal_cpu_disable_irqs();
@@ -175,7 +233,11 @@ void embedded_execute_once(void) {
         trigger_event_received = 0;
         hal_cpu_enable_irqs();
     } else {
+#if defined(HAVE_TICK) && defined(HAVE_TICKLESS)
+        embedded_sleep_tickless();
+#else
         hal_cpu_enable_irqs_and_sleep();
+#endif
     }
 }
 
@@ -212,6 +274,14 @@ uint32_t embedded_get_time_ms(void){
 
 #endif
 
+static uint32_t embedded_time_ms(void){
+#ifdef HAVE_TICK
+    return embedded_get_time_ms();
+#else
+    return 0;
+#endif
+}
+
 /**
  * trigger run loop iteration
  */
@@ -222,9 +292,10 @@ void embedded_trigger(void){
 static void embedded_init(void){
 
     data_sources = NULL;
+    requested_callbacks = NULL;
 
 #ifdef HAVE_TICK
-    timers = NULL;
+    timer_queue_init(&timers);
     system_ticks = 0;
     hal_tick_init();
     hal_tick_set_handler(&embedded_tick_handler);
@@ -240,4 +311,7 @@ const run_loop_t run_loop_embedded = {
     &embedded_remove_timer,
     &embedded_execute,
     &embedded_dump_timer,
+    &embedded_time_ms,
+    &embedded_execute_on_main_thread,
+    NULL,   // data sources are polled, write callbacks are not supported
 };
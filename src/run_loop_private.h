@@ -57,6 +57,70 @@ extern "C" {
 // 
 void run_loop_timer_dump(void);
 
+// dispatch callbacks, used by the run loop implementations to allow for profiling
+#ifdef ENABLE_RUN_LOOP_PROFILER
+void run_loop_profiler_iteration_start(void);
+void run_loop_profiler_iteration_end(void);
+int  run_loop_profiler_process_data_source(data_source_t * ds);
+void run_loop_profiler_process_timer(timer_source_t * ts);
+void run_loop_profiler_process_callback(run_loop_callback_t * cb);
+#define run_loop_iteration_start()          run_loop_profiler_iteration_start()
+#define run_loop_iteration_end()            run_loop_profiler_iteration_end()
+#define run_loop_process_data_source(ds)    run_loop_profiler_process_data_source(ds)
+#define run_loop_process_timer(ts)          run_loop_profiler_process_timer(ts)
+#define run_loop_process_callback(cb)       run_loop_profiler_process_callback(cb)
+#else
+#define run_loop_iteration_start()
+#define run_loop_iteration_end()
+#define run_loop_process_data_source(ds)    ((ds)->process(ds))
+#define run_loop_process_timer(ts)          ((ts)->process(ts))
+#define run_loop_process_callback(cb)       ((cb)->process(cb))
+#endif
+
+#ifndef EMBEDDED
+// lock-free queue for callbacks requested by other threads, used by the run loop implementations
+// @returns 1 if the queue was empty and the run loop needs to be woken up
+int  run_loop_callbacks_add(run_loop_callback_t * callback);
+// execute requested callbacks, called on the run loop thread
+void run_loop_callbacks_process(void);
+#endif
+
+// timer queue used by the run loop implementations
+// - binary min-heap with O(log n) add/remove if timer sources can be tracked in an array:
+//   static array of MAX_NO_TIMER_SOURCES entries, or growing array if HAVE_MALLOC
+// - sorted linked list otherwise
+#if defined(MAX_NO_TIMER_SOURCES) || defined(HAVE_MALLOC)
+#define TIMER_QUEUE_HEAP
+#endif
+
+typedef struct {
+#ifdef TIMER_QUEUE_HEAP
+#ifdef MAX_NO_TIMER_SOURCES
+    timer_source_t * heap[MAX_NO_TIMER_SOURCES];
+#else
+    timer_source_t ** heap;
+#endif
+    int count;
+    int size;
+    uint32_t sequence;      // next insertion sequence number
+#else
+    linked_list_t timers;
+#endif
+} timer_queue_t;
+
+void timer_queue_init(timer_queue_t * queue);
+
+// @returns 0 if timer was added
+int  timer_queue_add(timer_queue_t * queue, timer_source_t * ts);
+
+// @returns 0 if timer was removed, -1 if it was not in the queue
+int  timer_queue_remove(timer_queue_t * queue, timer_source_t * ts);
+
+// @returns timer with earliest timeout or NULL
+timer_source_t * timer_queue_first(timer_queue_t * queue);
+
+void timer_queue_dump(timer_queue_t * queue);
+
 // internal use only
 typedef struct {
 	void (*init)(void);
@@ -67,8 +131,15 @@ typedef struct {
 	int  (*remove_timer)(timer_source_t *timer); 
 	void (*execute)(void);
 	void (*dump_timer)(void);
+	uint32_t (*get_time_ms)(void);
+	void (*execute_on_main_thread)(run_loop_callback_t *callback);
+	void (*update_data_source)(data_source_t *dataSource);  // optional: enabled callbacks changed
 } run_loop_t;
 
+#ifdef EMBEDDED
+extern const run_loop_t run_loop_embedded;
+#endif
+
 #if defined __cplusplus
 }
 #endif
@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  sco_stream.c
+ *
+ *  Without Synchronous Flow Control, the controller doesn't report sent SCO packets.
+ *  Packets are therefore sent according to the audio clock: the number of bytes due is
+ *  calculated from the time since streaming started, plus a few packets ahead to cover
+ *  run loop latency. A coarse timer is sufficient as late packets are sent in a burst.
+ *  The timer only runs while samples are pending or sent audio is still being played back.
+ *
+ *  Received audio is played back after the jitter buffer has been filled. A packet is late
+ *  if it arrives after all audio received before would have been played back.
+ */
+
+#include <string.h>
+
+#include <btstack/hci_cmds.h>
+#include <btstack/run_loop.h>
+#include <btstack/utils.h>
+
+#include "sco_stream.h"
+#include "hci.h"
+#include "debug.h"
+
+// time and byte counters are moved forward by this to avoid overflows
+#define SCO_STREAM_REBASE_MS 60000
+
+typedef struct {
+    uint8_t  in_use;
+    hci_con_handle_t con_handle;
+    uint16_t sample_rate;
+    uint16_t packet_length;
+    uint16_t jitter_buffer_ms;
+    uint16_t timer_period_ms;
+    timer_source_t timer;
+
+    // outgoing PCM
+    uint8_t  tx_buffer[SCO_STREAM_TX_BUFFER_SIZE];
+    uint16_t tx_pos;                // oldest byte
+    uint16_t tx_len;
+    uint8_t  tx_started;
+    uint32_t tx_start_ms;
+    uint32_t tx_bytes_scheduled;    // sent or skipped since tx_start_ms
+
+    // incoming PCM
+    uint8_t  rx_buffer[SCO_STREAM_RX_BUFFER_SIZE];
+    uint16_t rx_pos;                // oldest byte
+    uint16_t rx_len;
+    uint8_t  rx_playing;
+    uint8_t  rx_anchored;
+    uint32_t rx_anchor_ms;          // arrival of first packet after start or late packet
+    uint32_t rx_anchor_bytes;       // received since rx_anchor_ms
+
+    sco_stream_stats_t stats;
+} sco_stream_t;
+
+static sco_stream_t sco_streams[SCO_STREAM_MAX_STREAMS];
+
+static void sco_stream_free(sco_stream_t * stream){
+    run_loop_remove_timer(&stream->timer);
+    stream->in_use = 0;
+}
+
+// streams of closed connections are freed on next access
+static sco_stream_t * sco_stream_for_handle(hci_con_handle_t con_handle){
+    int i;
+    for (i = 0; i < SCO_STREAM_MAX_STREAMS; i++){
+        if (!sco_streams[i].in_use || sco_streams[i].con_handle != con_handle) continue;
+        if (!hci_connection_for_handle(con_handle)){
+            log_info("sco_stream: connection 0x%04x closed", con_handle);
+            sco_stream_free(&sco_streams[i]);
+            return NULL;
+        }
+        return &sco_streams[i];
+    }
+    return NULL;
+}
+
+static uint32_t sco_stream_bytes_for_ms(sco_stream_t * stream, uint32_t time_ms){
+    return (uint32_t) (((uint64_t) time_ms) * stream->sample_rate * 2 / 1000);
+}
+
+static uint32_t sco_stream_ms_for_bytes(sco_stream_t * stream, uint32_t bytes){
+    return (uint32_t) (((uint64_t) bytes) * 1000 / (stream->sample_rate * 2));
+}
+
+// copy into ring buffer at pos, zeros if data is NULL
+static void sco_stream_ring_store(uint8_t * ring, uint16_t ring_size, uint16_t pos, const uint8_t * data, uint16_t len){
+    while (len){
+        uint16_t chunk = ring_size - pos;
+        if (chunk > len){
+            chunk = len;
+        }
+        if (data){
+            memcpy(&ring[pos], data, chunk);
+            data += chunk;
+        } else {
+            memset(&ring[pos], 0, chunk);
+        }
+        len -= chunk;
+        pos = (pos + chunk) % ring_size;
+    }
+}
+
+static void sco_stream_ring_fetch(const uint8_t * ring, uint16_t ring_size, uint16_t pos, uint8_t * data, uint16_t len){
+    while (len){
+        uint16_t chunk = ring_size - pos;
+        if (chunk > len){
+            chunk = len;
+        }
+        memcpy(data, &ring[pos], chunk);
+        data += chunk;
+        len -= chunk;
+        pos = (pos + chunk) % ring_size;
+    }
+}
+
+static void sco_stream_tx_drop(sco_stream_t * stream, uint32_t len){
+    if (len > stream->tx_len){
+        len = stream->tx_len;
+    }
+    stream->tx_pos = (stream->tx_pos + len) % SCO_STREAM_TX_BUFFER_SIZE;
+    stream->tx_len -= len;
+}
+
+static int sco_stream_send_packet(sco_stream_t * stream){
+    if (!hci_can_send_sco_packet_now(stream->con_handle)) return 0;
+    hci_reserve_packet_buffer();
+    uint8_t * packet = hci_get_outgoing_packet_buffer();
+    uint16_t len = stream->packet_length;
+    uint16_t available = stream->tx_len < len ? stream->tx_len : len;
+    if (available < len){
+        stream->stats.tx_underruns++;
+        memset(&packet[3 + available], 0, len - available);
+    }
+    bt_store_16(packet, 0, stream->con_handle);
+    packet[2] = len;
+    sco_stream_ring_fetch(stream->tx_buffer, SCO_STREAM_TX_BUFFER_SIZE, stream->tx_pos, &packet[3], available);
+    sco_stream_tx_drop(stream, available);
+    stream->stats.tx_packets++;
+    hci_send_sco_packet_buffer(3 + len);
+    return 1;
+}
+
+static void sco_stream_tx_run(sco_stream_t * stream){
+    uint32_t now = run_loop_get_time_ms();
+    uint32_t elapsed_ms = now - stream->tx_start_ms;
+    if (elapsed_ms >= SCO_STREAM_REBASE_MS && stream->tx_bytes_scheduled >= sco_stream_bytes_for_ms(stream, SCO_STREAM_REBASE_MS)){
+        stream->tx_start_ms += SCO_STREAM_REBASE_MS;
+        stream->tx_bytes_scheduled -= sco_stream_bytes_for_ms(stream, SCO_STREAM_REBASE_MS);
+        elapsed_ms -= SCO_STREAM_REBASE_MS;
+    }
+    // nothing left to send and all audio played back, stop until more samples are written
+    if (!stream->tx_len && sco_stream_bytes_for_ms(stream, elapsed_ms) >= stream->tx_bytes_scheduled){
+        stream->tx_started = 0;
+        return;
+    }
+    uint32_t bytes_due = sco_stream_bytes_for_ms(stream, elapsed_ms) + SCO_STREAM_TX_PACKETS_AHEAD * stream->packet_length;
+    if (bytes_due <= stream->tx_bytes_scheduled) return;
+    uint32_t packets_due = (bytes_due - stream->tx_bytes_scheduled) / stream->packet_length;
+
+    // run loop was blocked, sending all missed packets would overflow controller buffers
+    if (packets_due > 2 * SCO_STREAM_TX_PACKETS_AHEAD){
+        uint32_t packets_skipped = packets_due - SCO_STREAM_TX_PACKETS_AHEAD;
+        log_info("sco_stream: skipping %u packets", (unsigned int) packets_skipped);
+        stream->stats.tx_late += packets_skipped;
+        stream->tx_bytes_scheduled += packets_skipped * stream->packet_length;
+        // drop audio of skipped packets to keep latency
+        sco_stream_tx_drop(stream, packets_skipped * stream->packet_length);
+        packets_due = SCO_STREAM_TX_PACKETS_AHEAD;
+    }
+
+    while (packets_due--){
+        // no packets with silence only, the audio clock stops after the written samples
+        if (!stream->tx_len) break;
+        if (!sco_stream_send_packet(stream)) break;
+        stream->tx_bytes_scheduled += stream->packet_length;
+    }
+}
+
+static void sco_stream_timer_handler(timer_source_t * timer){
+    sco_stream_t * stream = (sco_stream_t *) linked_item_get_user(&timer->item);
+    if (!hci_connection_for_handle(stream->con_handle)){
+        log_info("sco_stream: connection 0x%04x closed", stream->con_handle);
+        stream->in_use = 0;
+        return;
+    }
+    sco_stream_tx_run(stream);
+    if (!stream->tx_started) return;
+    run_loop_set_timer(timer, stream->timer_period_ms);
+    run_loop_add_timer(timer);
+}
+
+static void sco_stream_rx_packet(sco_stream_t * stream, uint8_t packet_status, const uint8_t * data, uint16_t len){
+    stream->stats.rx_packets++;
+
+    // check arrival against playback of all audio received since anchor
+    uint32_t now = run_loop_get_time_ms();
+    if (stream->rx_anchored){
+        uint32_t playback_ms = stream->rx_anchor_ms + sco_stream_ms_for_bytes(stream, stream->rx_anchor_bytes);
+        if ((int32_t) (now - playback_ms) > (int32_t) stream->jitter_buffer_ms){
+            stream->stats.rx_late++;
+            stream->rx_anchored = 0;
+        }
+    }
+    if (!stream->rx_anchored){
+        stream->rx_anchored = 1;
+        stream->rx_anchor_ms = now;
+        stream->rx_anchor_bytes = 0;
+    }
+    stream->rx_anchor_bytes += len;
+    if (stream->rx_anchor_bytes >= sco_stream_bytes_for_ms(stream, SCO_STREAM_REBASE_MS)){
+        stream->rx_anchor_ms += SCO_STREAM_REBASE_MS;
+        stream->rx_anchor_bytes -= sco_stream_bytes_for_ms(stream, SCO_STREAM_REBASE_MS);
+    }
+
+    // Packet_Status_Flag, only reported with Erroneous Data Reporting
+    switch (packet_status){
+        case 0:
+            break;
+        case 2:
+            // no data received, play silence
+            stream->stats.rx_lost++;
+            data = NULL;
+            break;
+        default:
+            stream->stats.rx_erroneous++;
+            break;
+    }
+
+    if (stream->rx_len + len > SCO_STREAM_RX_BUFFER_SIZE){
+        stream->stats.rx_overruns++;
+        return;
+    }
+    sco_stream_ring_store(stream->rx_buffer, SCO_STREAM_RX_BUFFER_SIZE, (stream->rx_pos + stream->rx_len) % SCO_STREAM_RX_BUFFER_SIZE, data, len);
+    stream->rx_len += len;
+    if (!stream->rx_playing && stream->rx_len >= sco_stream_bytes_for_ms(stream, stream->jitter_buffer_ms)){
+        stream->rx_playing = 1;
+    }
+}
+
+static void sco_stream_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_SCO_DATA_PACKET || size < 3) return;
+    uint16_t len = packet[2];
+    if (3 + len > size) return;
+    hci_con_handle_t con_handle = READ_BT_16(packet, 0) & 0x0fff;
+    sco_stream_t * stream = sco_stream_for_handle(con_handle);
+    if (!stream) return;
+    sco_stream_rx_packet(stream, (packet[1] >> 4) & 0x03, &packet[3], len);
+}
+
+void sco_stream_init(void){
+    memset(sco_streams, 0, sizeof(sco_streams));
+    hci_register_sco_packet_handler(&sco_stream_packet_handler);
+}
+
+int sco_stream_open(hci_con_handle_t con_handle, const sco_stream_config_t * config){
+    sco_stream_close(con_handle);
+    sco_stream_t * stream = NULL;
+    int i;
+    for (i = 0; i < SCO_STREAM_MAX_STREAMS; i++){
+        if (!sco_streams[i].in_use){
+            stream = &sco_streams[i];
+            break;
+        }
+    }
+    if (!stream){
+        log_error("sco_stream_open: no stream for connection 0x%04x", con_handle);
+        return BTSTACK_MEMORY_ALLOC_FAILED;
+    }
+    memset(stream, 0, sizeof(sco_stream_t));
+    stream->in_use = 1;
+    stream->con_handle = con_handle;
+    stream->sample_rate = config->sample_rate ? config->sample_rate : 8000;
+
+    // default: largest packet supported by controller, 3.75 ms of audio if unknown
+    uint16_t packet_length = config->packet_length;
+    if (!packet_length){
+        packet_length = hci_max_sco_data_packet_length();
+    }
+    if (!packet_length){
+        packet_length = sco_stream_bytes_for_ms(stream, 15) / 4;
+    }
+    if (packet_length > 255){
+        packet_length = 255;
+    }
+    if (packet_length > SCO_STREAM_TX_BUFFER_SIZE){
+        packet_length = SCO_STREAM_TX_BUFFER_SIZE;
+    }
+    stream->packet_length = packet_length & ~1;
+
+    stream->timer_period_ms = sco_stream_ms_for_bytes(stream, stream->packet_length);
+    if (!stream->timer_period_ms){
+        stream->timer_period_ms = 1;
+    }
+    sco_stream_set_jitter_buffer_ms(con_handle, config->jitter_buffer_ms);
+
+    log_info("sco_stream_open: connection 0x%04x, %u Hz, packet length %u, jitter buffer %u ms", con_handle,
+        stream->sample_rate, stream->packet_length, stream->jitter_buffer_ms);
+
+    // timer is started with first samples
+    linked_item_set_user(&stream->timer.item, stream);
+    run_loop_set_timer_handler(&stream->timer, &sco_stream_timer_handler);
+    return 0;
+}
+
+void sco_stream_close(hci_con_handle_t con_handle){
+    sco_stream_t * stream = sco_stream_for_handle(con_handle);
+    if (!stream) return;
+    sco_stream_free(stream);
+}
+
+void sco_stream_set_jitter_buffer_ms(hci_con_handle_t con_handle, uint16_t jitter_buffer_ms){
+    sco_stream_t * stream = sco_stream_for_handle(con_handle);
+    if (!stream) return;
+    // leave room for one more packet
+    uint16_t max_jitter_buffer_ms = sco_stream_ms_for_bytes(stream, SCO_STREAM_RX_BUFFER_SIZE - stream->packet_length);
+    if (jitter_buffer_ms > max_jitter_buffer_ms){
+        log_info("sco_stream: jitter buffer limited to %u ms", max_jitter_buffer_ms);
+        jitter_buffer_ms = max_jitter_buffer_ms;
+    }
+    stream->jitter_buffer_ms = jitter_buffer_ms;
+}
+
+int sco_stream_write_pcm(hci_con_handle_t con_handle, const int16_t * samples, int num_samples){
+    sco_stream_t * stream = sco_stream_for_handle(con_handle);
+    if (!stream) return 0;
+    int num_accepted = (SCO_STREAM_TX_BUFFER_SIZE - stream->tx_len) / 2;
+    if (num_accepted > num_samples){
+        num_accepted = num_samples;
+    }
+    stream->stats.tx_overruns += num_samples - num_accepted;
+    int i;
+    for (i = 0; i < num_accepted; i++){
+        uint8_t sample[2];
+        bt_store_16(sample, 0, (uint16_t) samples[i]);
+        sco_stream_ring_store(stream->tx_buffer, SCO_STREAM_TX_BUFFER_SIZE, (stream->tx_pos + stream->tx_len) % SCO_STREAM_TX_BUFFER_SIZE, sample, 2);
+        stream->tx_len += 2;
+    }
+    if (!stream->tx_started){
+        // audio clock starts with first samples
+        stream->tx_started = 1;
+        stream->tx_start_ms = run_loop_get_time_ms();
+        stream->tx_bytes_scheduled = 0;
+        sco_stream_tx_run(stream);
+        if (stream->tx_started){
+            run_loop_set_timer(&stream->timer, stream->timer_period_ms);
+            run_loop_add_timer(&stream->timer);
+        }
+    }
+    return num_accepted;
+}
+
+int sco_stream_rx_samples_available(hci_con_handle_t con_handle){
+    sco_stream_t * stream = sco_stream_for_handle(con_handle);
+    if (!stream || !stream->rx_playing) return 0;
+    return stream->rx_len / 2;
+}
+
+int sco_stream_read_pcm(hci_con_handle_t con_handle, int16_t * samples, int num_samples){
+    int num_received = sco_stream_rx_samples_available(con_handle);
+    sco_stream_t * stream = sco_stream_for_handle(con_handle);
+    if (num_received > num_samples){
+        num_received = num_samples;
+    }
+    if (stream && stream->rx_playing && num_received < num_samples){
+        // fill jitter buffer again
+        stream->stats.rx_underruns++;
+        stream->rx_playing = 0;
+    }
+    int i;
+    for (i = 0; i < num_received; i++){
+        uint8_t sample[2];
+        sco_stream_ring_fetch(stream->rx_buffer, SCO_STREAM_RX_BUFFER_SIZE, stream->rx_pos, sample, 2);
+        samples[i] = (int16_t) READ_BT_16(sample, 0);
+        stream->rx_pos = (stream->rx_pos + 2) % SCO_STREAM_RX_BUFFER_SIZE;
+        stream->rx_len -= 2;
+    }
+    memset(&samples[num_received], 0, (num_samples - num_received) * sizeof(int16_t));
+    return num_received;
+}
+
+const sco_stream_stats_t * sco_stream_get_stats(hci_con_handle_t con_handle){
+    sco_stream_t * stream = sco_stream_for_handle(con_handle);
+    if (!stream) return NULL;
+    return &stream->stats;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  sco_stream.h
+ *
+ *  Streams 16 bit PCM audio over SCO connections
+ *
+ *  Outgoing PCM is buffered per connection and sent paced to the audio sample rate,
+ *  incoming SCO packets go through a jitter buffer before they can be read.
+ */
+
+#ifndef __SCO_STREAM_H
+#define __SCO_STREAM_H
+
+#include <stdint.h>
+#include <btstack/utils.h>
+
+#include "btstack-config.h"
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+// number of SCO connections with streams
+#ifndef SCO_STREAM_MAX_STREAMS
+    #define SCO_STREAM_MAX_STREAMS 1
+#endif
+
+// PCM bytes buffered for sending, 30 ms for 8 kHz
+#ifndef SCO_STREAM_TX_BUFFER_SIZE
+    #define SCO_STREAM_TX_BUFFER_SIZE 480
+#endif
+
+// PCM bytes buffered after receiving, 60 ms for 8 kHz, limits jitter buffer depth
+#ifndef SCO_STREAM_RX_BUFFER_SIZE
+    #define SCO_STREAM_RX_BUFFER_SIZE 960
+#endif
+
+// number of packets sent ahead of schedule to cover run loop latency, must fit into controller SCO buffers
+#ifndef SCO_STREAM_TX_PACKETS_AHEAD
+    #define SCO_STREAM_TX_PACKETS_AHEAD 2
+#endif
+
+typedef struct {
+    uint16_t sample_rate;       // Hz, 8000 for CVSD
+    uint16_t packet_length;     // PCM bytes per SCO packet, 0 = controller SCO buffer size
+    uint16_t jitter_buffer_ms;  // received audio is delayed by this before playback starts
+} sco_stream_config_t;
+
+typedef struct {
+    uint32_t tx_packets;
+    uint32_t tx_underruns;      // last packets padded with silence as not enough PCM was written
+    uint32_t tx_overruns;       // written samples dropped as buffer was full
+    uint32_t tx_late;           // packets skipped after the run loop was blocked
+    uint32_t rx_packets;
+    uint32_t rx_late;           // packets that arrived after their playback time
+    uint32_t rx_lost;           // packets reported as not received by the controller, played as silence
+    uint32_t rx_erroneous;      // packets with possibly invalid or partially lost data
+    uint32_t rx_overruns;       // packets dropped as jitter buffer was full
+    uint32_t rx_underruns;      // reads without enough received audio
+} sco_stream_stats_t;
+
+// registers SCO packet handler with HCI
+void sco_stream_init(void);
+
+// start streaming on SCO connection, e.g. after HCI_EVENT_SYNCHRONOUS_CONNECTION_COMPLETE
+// @returns 0 if ok, BTSTACK_MEMORY_ALLOC_FAILED if all streams are in use
+int  sco_stream_open(hci_con_handle_t con_handle, const sco_stream_config_t * config);
+void sco_stream_close(hci_con_handle_t con_handle);
+
+// queue samples for sending, first call starts pacing.
+// pacing stops after all written samples were played back and starts again with the next call
+// @returns number of samples accepted
+int  sco_stream_write_pcm(hci_con_handle_t con_handle, const int16_t * samples, int num_samples);
+
+// get received samples, missing samples are filled with silence
+// @returns number of received samples
+int  sco_stream_read_pcm(hci_con_handle_t con_handle, int16_t * samples, int num_samples);
+
+// number of samples that can be read without underrun
+int  sco_stream_rx_samples_available(hci_con_handle_t con_handle);
+
+void sco_stream_set_jitter_buffer_ms(hci_con_handle_t con_handle, uint16_t jitter_buffer_ms);
+
+// @returns statistics or NULL if no stream for connection
+const sco_stream_stats_t * sco_stream_get_stats(hci_con_handle_t con_handle);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __SCO_STREAM_H
@@ -0,0 +1,15 @@
+// configuration for HCI tests with fake transport
+
+#define HAVE_TIME
+#define USE_POSIX_RUN_LOOP
+#define HAVE_MALLOC
+#define ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+#define HAVE_BLE
+#define ENABLE_LE_ADVERTISING_REPORT_FILTER
+#define ENABLE_HCI_CONTROLLER_CACHE
+
+// #define ENABLE_LOG_INFO 
+// #define ENABLE_LOG_ERROR
+
+#define HCI_ACL_PAYLOAD_SIZE 100
+#define LE_ADVERTISING_REPORT_CACHE_SIZE 4
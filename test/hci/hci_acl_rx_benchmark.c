@@ -0,0 +1,121 @@
+// measures cost of incoming ACL packets distributed over many open connections
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+
+#define PACKETS     2000000
+#define PAYLOAD_LEN      27
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static uint32_t num_received_packets;
+
+static int transport_open(void *transport_config){
+    return 0;
+}
+
+static int transport_close(void *transport_config){
+    return 0;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    return 0;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static const char * transport_get_name(void){
+    return "simulated";
+}
+
+static hci_transport_t sim_transport = {
+    transport_open,
+    transport_close,
+    transport_send_packet,
+    transport_register_packet_handler,
+    transport_get_name,
+    NULL,
+    NULL,
+};
+
+static void stack_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_ACL_DATA_PACKET) return;
+    num_received_packets++;
+}
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void inject_event(uint8_t * event, uint16_t size){
+    event[1] = size - 2;
+    transport_packet_handler(HCI_EVENT_PACKET, event, size);
+}
+
+static void open_connection(hci_con_handle_t handle){
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, (uint8_t) (handle >> 8), (uint8_t) handle };
+
+    uint8_t request[12];
+    memset(request, 0, sizeof(request));
+    request[0] = HCI_EVENT_CONNECTION_REQUEST;
+    bt_flip_addr(&request[2], addr);
+    request[11] = 1;    // ACL
+    inject_event(request, sizeof(request));
+
+    uint8_t complete[13];
+    memset(complete, 0, sizeof(complete));
+    complete[0] = HCI_EVENT_CONNECTION_COMPLETE;
+    bt_store_16(complete, 3, handle);
+    bt_flip_addr(&complete[5], addr);
+    complete[11] = 1;   // ACL
+    inject_event(complete, sizeof(complete));
+}
+
+static void run_benchmark(int num_connections){
+    int i;
+    num_received_packets = 0;
+    hci_init(&sim_transport, NULL, NULL, NULL);
+    hci_register_packet_handler(&stack_packet_handler);
+    for (i = 0; i < num_connections; i++){
+        open_connection(i + 1);
+    }
+
+    // complete L2CAP packet in a single ACL packet
+    uint8_t packet[4 + PAYLOAD_LEN];
+    memset(packet, 0, sizeof(packet));
+    bt_store_16(packet, 2, PAYLOAD_LEN);
+    bt_store_16(packet, 4, PAYLOAD_LEN - 4);
+    bt_store_16(packet, 6, 0x0040);
+
+    double start = now_ns();
+    for (i = 0; i < PACKETS; i++){
+        bt_store_16(packet, 0, (0x02 << 12) | ((i % num_connections) + 1));
+        transport_packet_handler(HCI_ACL_DATA_PACKET, packet, sizeof(packet));
+    }
+    double duration_ns = now_ns() - start;
+    printf("%4u connections: %6.1f ns per packet, %5.2f M packets/s%s\n",
+        num_connections, duration_ns / PACKETS, PACKETS * 1000.0 / duration_ns,
+        num_received_packets == PACKETS ? "" : " - PACKETS LOST");
+    hci_close();
+}
+
+int main (int argc, const char * argv[]){
+    run_loop_init(RUN_LOOP_POSIX);
+    printf("%u ACL packets with %u bytes payload\n", PACKETS, PAYLOAD_LEN);
+    run_benchmark(1);
+    run_benchmark(16);
+    run_benchmark(64);
+    run_benchmark(256);
+    return 0;
+}
@@ -0,0 +1,147 @@
+// measures cost of bursts of Number Of Completed Packets events and ACL packets
+// delivered one by one and as one batch, with L2CAP and RFCOMM on top of HCI
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "l2cap.h"
+#include "rfcomm.h"
+
+#define BURSTS      100000
+#define PAYLOAD_LEN     27
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+
+static int transport_open(void *transport_config){
+    return 0;
+}
+
+static int transport_close(void *transport_config){
+    return 0;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    return 0;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static const char * transport_get_name(void){
+    return "simulated";
+}
+
+static hci_transport_t sim_transport = {
+    transport_open,
+    transport_close,
+    transport_send_packet,
+    transport_register_packet_handler,
+    transport_get_name,
+    NULL,
+    NULL,
+};
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void inject_event(uint8_t * event, uint16_t size){
+    event[1] = size - 2;
+    transport_packet_handler(HCI_EVENT_PACKET, event, size);
+}
+
+static void open_connection(hci_con_handle_t handle){
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, (uint8_t) (handle >> 8), (uint8_t) handle };
+
+    uint8_t request[12];
+    memset(request, 0, sizeof(request));
+    request[0] = HCI_EVENT_CONNECTION_REQUEST;
+    bt_flip_addr(&request[2], addr);
+    request[11] = 1;    // ACL
+    inject_event(request, sizeof(request));
+
+    uint8_t complete[13];
+    memset(complete, 0, sizeof(complete));
+    complete[0] = HCI_EVENT_CONNECTION_COMPLETE;
+    bt_store_16(complete, 3, handle);
+    bt_flip_addr(&complete[5], addr);
+    complete[11] = 1;   // ACL
+    inject_event(complete, sizeof(complete));
+}
+
+// alternating Number Of Completed Packets events and ACL packets
+static void deliver_burst(int burst_len, int num_connections, int batch){
+    uint8_t event[7];
+    event[0] = HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS;
+    event[1] = sizeof(event) - 2;
+    event[2] = 1;
+    bt_store_16(event, 5, 1);
+
+    uint8_t packet[4 + PAYLOAD_LEN];
+    memset(packet, 0, sizeof(packet));
+    bt_store_16(packet, 2, PAYLOAD_LEN);
+    bt_store_16(packet, 4, PAYLOAD_LEN - 4);
+    bt_store_16(packet, 6, 0x0040);
+
+    if (batch){
+        hci_batch_begin();
+    }
+    int i;
+    for (i = 0; i < burst_len; i++){
+        hci_con_handle_t handle = (i % num_connections) + 1;
+        if (i & 1){
+            bt_store_16(packet, 0, (0x02 << 12) | handle);
+            transport_packet_handler(HCI_ACL_DATA_PACKET, packet, sizeof(packet));
+        } else {
+            bt_store_16(event, 3, handle);
+            transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+        }
+    }
+    if (batch){
+        hci_batch_end();
+    }
+}
+
+static double run_benchmark(int num_connections, int burst_len, int batch){
+    int i;
+    hci_init(&sim_transport, NULL, NULL, NULL);
+    l2cap_init();
+    rfcomm_init();
+    for (i = 0; i < num_connections; i++){
+        open_connection(i + 1);
+    }
+    double start = now_ns();
+    for (i = 0; i < BURSTS; i++){
+        deliver_burst(burst_len, num_connections, batch);
+    }
+    double duration_ns = now_ns() - start;
+    hci_close();
+    return duration_ns / (BURSTS * burst_len);
+}
+
+static void compare(int num_connections, int burst_len){
+    double single_ns = run_benchmark(num_connections, burst_len, 0);
+    double batch_ns  = run_benchmark(num_connections, burst_len, 1);
+    printf("%4u connections, burst of %2u: %6.1f ns per packet, batched %6.1f ns, %4.1f%% CPU time saved\n",
+        num_connections, burst_len, single_ns, batch_ns, 100.0 * (single_ns - batch_ns) / single_ns);
+}
+
+int main (int argc, const char * argv[]){
+    run_loop_init(RUN_LOOP_POSIX);
+    printf("%u bursts of Number Of Completed Packets events and ACL packets with %u bytes payload\n", BURSTS, PAYLOAD_LEN);
+    compare(1, 2);
+    compare(1, 20);
+    compare(16, 20);
+    compare(64, 20);
+    return 0;
+}
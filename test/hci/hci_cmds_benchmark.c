@@ -0,0 +1,72 @@
+// compares cost of format string based hci_create_cmd() with typed encoders from hci_cmds_encoder.h
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_cmds_encoder.h"
+
+#define ITERATIONS 2000000
+
+static uint8_t buffer[HCI_PACKET_BUFFER_SIZE];
+static bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x01, 0x02, 0x03 };
+static uint32_t checksum;
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char * name, double format_ns, double typed_ns){
+    printf("%-32s hci_create_cmd %6.1f ns, typed encoder %6.1f ns, speedup %4.1fx\n",
+        name, format_ns / ITERATIONS, typed_ns / ITERATIONS, format_ns / typed_ns);
+}
+
+// compiler barrier: forces the encoded bytes to be stored in every iteration
+#define CLOBBER_BUFFER() __asm__ volatile("" : : "r"(buffer) : "memory")
+
+#define BENCHMARK(name, format_call, typed_call) {                          \
+    uint32_t i;                                                             \
+    double start = now_ns();                                                \
+    for (i = 0; i < ITERATIONS; i++){                                       \
+        checksum += format_call;                                            \
+        CLOBBER_BUFFER();                                                   \
+        checksum += buffer[3];                                              \
+    }                                                                       \
+    double middle = now_ns();                                               \
+    for (i = 0; i < ITERATIONS; i++){                                       \
+        checksum += typed_call;                                             \
+        CLOBBER_BUFFER();                                                   \
+        checksum += buffer[3];                                              \
+    }                                                                       \
+    report(name, middle - start, now_ns() - middle);                        \
+}
+
+int main (int argc, const char * argv[]){
+    printf("%u iterations each\n", ITERATIONS);
+    BENCHMARK("reset",
+        hci_create_cmd(buffer, (hci_cmd_t *) &hci_reset),
+        hci_cmd_reset_create(buffer));
+    BENCHMARK("write_scan_enable",
+        hci_create_cmd(buffer, (hci_cmd_t *) &hci_write_scan_enable, i & 3),
+        hci_cmd_write_scan_enable_create(buffer, i & 3));
+    BENCHMARK("disconnect",
+        hci_create_cmd(buffer, (hci_cmd_t *) &hci_disconnect, i & 0xfff, 0x13),
+        hci_cmd_disconnect_create(buffer, i & 0xfff, 0x13));
+    BENCHMARK("create_connection",
+        hci_create_cmd(buffer, (hci_cmd_t *) &hci_create_connection, addr, 0xcc18, 0, 0, 0, i & 1),
+        hci_cmd_create_connection_create(buffer, addr, 0xcc18, 0, 0, 0, i & 1));
+    BENCHMARK("accept_synchronous_connection",
+        hci_create_cmd(buffer, (hci_cmd_t *) &hci_accept_synchronous_connection_command, addr, 8000, 8000, 0xFFFF, 0x0060, 0xFF, i & 0x3F),
+        hci_cmd_accept_synchronous_connection_command_create(buffer, addr, 8000, 8000, 0xFFFF, 0x0060, 0xFF, i & 0x3F));
+    BENCHMARK("write_local_name",
+        hci_create_cmd(buffer, (hci_cmd_t *) &hci_write_local_name, "BTstack 00:1B:DC:01:02:03"),
+        hci_cmd_write_local_name_create(buffer, "BTstack 00:1B:DC:01:02:03"));
+    printf("checksum %08x\n", checksum);
+    return 0;
+}
@@ -0,0 +1,139 @@
+// measures time from power on to HCI_STATE_WORKING against a simulated controller
+// that completes each command after a fixed round trip time
+
+#include <stdio.h>
+#include <string.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+
+#define ROUND_TRIP_US   5000
+#define PROCESSING_US    200
+#define MAX_PENDING       16
+
+typedef struct {
+    uint16_t opcode;
+    uint32_t complete_at_us;
+} pending_command_t;
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static pending_command_t pending[MAX_PENDING];
+static int      num_pending;
+static uint32_t now_us;
+static uint32_t last_complete_us;
+static int      num_cmd_packets;
+static int      num_commands;
+static HCI_STATE stack_state;
+
+static int transport_open(void *transport_config){
+    return 0;
+}
+
+static int transport_close(void *transport_config){
+    return 0;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (packet_type != HCI_COMMAND_DATA_PACKET) return 0;
+    if (num_pending == MAX_PENDING) {
+        printf("controller overrun\n");
+        return 0;
+    }
+    // controller executes commands in order
+    uint32_t start_us = now_us + ROUND_TRIP_US / 2;
+    if (start_us < last_complete_us) {
+        start_us = last_complete_us;
+    }
+    last_complete_us = start_us + PROCESSING_US;
+    pending[num_pending].opcode = READ_BT_16(packet, 0);
+    pending[num_pending].complete_at_us = last_complete_us + ROUND_TRIP_US / 2;
+    num_pending++;
+    num_commands++;
+    return 0;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static const char * transport_get_name(void){
+    return "simulated";
+}
+
+static hci_transport_t sim_transport = {
+    transport_open,
+    transport_close,
+    transport_send_packet,
+    transport_register_packet_handler,
+    transport_get_name,
+    NULL,
+    NULL,
+};
+
+static void stack_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (packet[0] != BTSTACK_EVENT_STATE) return;
+    stack_state = (HCI_STATE) packet[2];
+}
+
+// deliver command complete for oldest pending command
+static void controller_complete_next(void){
+    pending_command_t command = pending[0];
+    num_pending--;
+    memmove(&pending[0], &pending[1], num_pending * sizeof(pending_command_t));
+    now_us = command.complete_at_us;
+
+    uint8_t event[16];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[1] = sizeof(event) - 2;
+    event[2] = num_cmd_packets - num_pending;
+    bt_store_16(event, 3, command.opcode);
+    transport_packet_handler(HCI_EVENT_PACKET, event, sizeof(event));
+}
+
+static void run_init(int controller_cmd_packets, const hci_controller_cache_t * cache){
+    num_pending = 0;
+    now_us = 0;
+    last_complete_us = 0;
+    num_commands = 0;
+    num_cmd_packets = controller_cmd_packets;
+    stack_state = HCI_STATE_OFF;
+
+    hci_init(&sim_transport, NULL, NULL, NULL);
+    hci_register_packet_handler(&stack_packet_handler);
+    hci_set_controller_cache(cache);
+    hci_power_control(HCI_POWER_ON);
+    while (stack_state != HCI_STATE_WORKING && num_pending){
+        controller_complete_next();
+    }
+    printf("Num_HCI_Command_Packets %2u: %2u commands, init done after %5.1f ms%s%s\n",
+        controller_cmd_packets, num_commands, now_us / 1000.0f,
+        hci_controller_info_from_cache() ? ", cached controller info" : "",
+        stack_state == HCI_STATE_WORKING ? "" : " - FAILED");
+    hci_close();
+}
+
+int main (int argc, const char * argv[]){
+    run_loop_init(RUN_LOOP_POSIX);
+    printf("round trip %u us, processing %u us per command\n", ROUND_TRIP_US, PROCESSING_US);
+    run_init(1, NULL);
+    run_init(2, NULL);
+    run_init(4, NULL);
+    run_init(8, NULL);
+
+    // first init fills cache, restart uses it
+    bd_addr_t addr;
+    memset(addr, 0, sizeof(addr));
+    int controller_cmd_packets;
+    for (controller_cmd_packets = 1; controller_cmd_packets <= 4; controller_cmd_packets *= 4){
+        hci_controller_cache_memory.remove(addr);
+        run_init(controller_cmd_packets, &hci_controller_cache_memory);
+        run_init(controller_cmd_packets, &hci_controller_cache_memory);
+    }
+    return 0;
+}
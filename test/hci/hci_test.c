@@ -0,0 +1,1003 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_cmds_encoder.h"
+#include "hci_transport.h"
+
+#define MAX_SENT_PACKETS 100
+
+// fake transport recording all outgoing ACL packets
+typedef struct {
+    hci_con_handle_t handle;
+    uint8_t  boundary_flags;
+    uint16_t len;
+} sent_packet_t;
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static sent_packet_t sent_packets[MAX_SENT_PACKETS];
+static int num_sent_packets;
+static int num_packet_sent_events;
+static HCI_STATE stack_state;
+static uint8_t  received_packet[200];
+static uint16_t received_packet_size;
+static int num_received_packets;
+static int num_advertising_reports;
+static int num_advertising_report_events;   // raw HCI LE Meta events
+static uint8_t last_advertising_report_event[60];
+
+static int transport_open(void *transport_config){
+    return 0;
+}
+
+static int transport_close(void *transport_config){
+    return 0;
+}
+
+static uint16_t sent_commands[MAX_SENT_PACKETS];
+static int num_sent_commands;
+static uint8_t last_command[HCI_CMD_BUFFER_SIZE];
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (packet_type == HCI_COMMAND_DATA_PACKET && num_sent_commands < MAX_SENT_PACKETS){
+        sent_commands[num_sent_commands++] = READ_BT_16(packet, 0);
+        memcpy(last_command, packet, size);
+    }
+    if (packet_type != HCI_ACL_DATA_PACKET) return 0;
+    if (num_sent_packets >= MAX_SENT_PACKETS) return 0;
+    sent_packets[num_sent_packets].handle = READ_ACL_CONNECTION_HANDLE(packet);
+    sent_packets[num_sent_packets].boundary_flags = READ_ACL_FLAGS(packet) & 0x03;
+    sent_packets[num_sent_packets].len = READ_ACL_LENGTH(packet);
+    num_sent_packets++;
+    return 0;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static const char * transport_get_name(void){
+    return "fake";
+}
+
+static hci_transport_t fake_transport = {
+    transport_open,
+    transport_close,
+    transport_send_packet,
+    transport_register_packet_handler,
+    transport_get_name,
+    NULL,
+    NULL,
+};
+
+static void stack_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (packet_type == HCI_ACL_DATA_PACKET){
+        num_received_packets++;
+        received_packet_size = size;
+        memcpy(received_packet, packet, size <= sizeof(received_packet) ? size : sizeof(received_packet));
+        return;
+    }
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (packet[0] == DAEMON_EVENT_HCI_PACKET_SENT){
+        num_packet_sent_events++;
+    }
+    if (packet[0] == BTSTACK_EVENT_STATE){
+        stack_state = (HCI_STATE) packet[2];
+    }
+    if (packet[0] == GAP_LE_ADVERTISING_REPORT){
+        num_advertising_reports++;
+    }
+    if (packet[0] == HCI_EVENT_LE_META && packet[2] == HCI_SUBEVENT_LE_ADVERTISING_REPORT){
+        num_advertising_report_events++;
+        memcpy(last_advertising_report_event, packet, size <= sizeof(last_advertising_report_event) ? size : sizeof(last_advertising_report_event));
+    }
+}
+
+static void inject_event(uint8_t * event, uint16_t size){
+    event[1] = size - 2;
+    transport_packet_handler(HCI_EVENT_PACKET, event, size);
+}
+
+static void command_complete(uint16_t opcode, uint8_t num_cmd_packets){
+    uint8_t event[16];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[2] = num_cmd_packets;
+    bt_store_16(event, 3, opcode);
+    inject_event(event, sizeof(event));
+}
+
+static void set_buffer_size(uint16_t acl_len, uint16_t acl_num){
+    uint8_t event[13];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[2] = 1;
+    bt_store_16(event, 3, hci_read_buffer_size.opcode);
+    bt_store_16(event, 6, acl_len);
+    bt_store_16(event, 9, acl_num);
+    inject_event(event, sizeof(event));
+}
+
+static void open_connection(hci_con_handle_t handle, uint8_t addr_lsb){
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, 0x00, addr_lsb };
+
+    uint8_t request[12];
+    memset(request, 0, sizeof(request));
+    request[0] = HCI_EVENT_CONNECTION_REQUEST;
+    bt_flip_addr(&request[2], addr);
+    request[11] = 1;    // ACL
+    inject_event(request, sizeof(request));
+
+    uint8_t complete[13];
+    memset(complete, 0, sizeof(complete));
+    complete[0] = HCI_EVENT_CONNECTION_COMPLETE;
+    bt_store_16(complete, 3, handle);
+    bt_flip_addr(&complete[5], addr);
+    complete[11] = 1;   // ACL
+    inject_event(complete, sizeof(complete));
+}
+
+static void close_connection(hci_con_handle_t handle){
+    uint8_t event[6];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_DISCONNECTION_COMPLETE;
+    bt_store_16(event, 3, handle);
+    inject_event(event, sizeof(event));
+}
+
+static void complete_packets(hci_con_handle_t handle, uint16_t num_packets){
+    uint8_t event[7];
+    event[0] = HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS;
+    event[2] = 1;
+    bt_store_16(event, 3, handle);
+    bt_store_16(event, 5, num_packets);
+    inject_event(event, sizeof(event));
+}
+
+// inject ACL fragment of L2CAP packet with payload bytes counting up from offset
+static void receive_acl_fragment(hci_con_handle_t handle, int first, uint16_t l2cap_len, uint16_t offset, uint16_t len){
+    uint8_t packet[200];
+    bt_store_16(packet, 0, handle | ((first ? 2 : 1) << 12));
+    bt_store_16(packet, 2, len);
+    uint16_t pos = 4;
+    if (first){
+        bt_store_16(packet, 4, l2cap_len);
+        bt_store_16(packet, 6, 0x0040);
+        pos += 4;
+        len -= 4;
+    }
+    int i;
+    for (i = 0; i < len; i++){
+        packet[pos + i] = (uint8_t) (offset + i);
+    }
+    transport_packet_handler(HCI_ACL_DATA_PACKET, packet, pos + len);
+}
+
+static int send_acl_packet(hci_con_handle_t handle, uint16_t payload_len){
+    if (!hci_can_send_acl_packet_now(handle)) return -1;
+    hci_reserve_packet_buffer();
+    uint8_t * buffer = hci_get_outgoing_packet_buffer();
+    bt_store_16(buffer, 0, handle | (2 << 12));
+    bt_store_16(buffer, 2, payload_len);
+    memset(&buffer[4], 0x55, payload_len);
+    return hci_send_acl_packet_buffer(4 + payload_len);
+}
+
+TEST_GROUP(HCI){
+    void setup(){
+        num_sent_packets = 0;
+        num_packet_sent_events = 0;
+        num_received_packets = 0;
+        num_sent_commands = 0;
+        stack_state = HCI_STATE_OFF;
+        hci_init(&fake_transport, NULL, NULL, NULL);
+        hci_register_packet_handler(&stack_packet_handler);
+        set_buffer_size(HCI_ACL_PAYLOAD_SIZE, 1);
+    }
+    void teardown(){
+        hci_close();
+    }
+};
+
+TEST(HCI, ConnectionLookup){
+    open_connection(0x0001, 0x01);
+    open_connection(0x0011, 0x02);
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, 0x00, 0x02 };
+    hci_connection_t * conn = hci_connection_for_handle(0x0011);
+    CHECK(conn != NULL);
+    POINTERS_EQUAL(conn, hci_connection_for_bd_addr_and_type(addr, BD_ADDR_TYPE_CLASSIC));
+    POINTERS_EQUAL(NULL, hci_connection_for_bd_addr_and_type(addr, BD_ADDR_TYPE_SCO));
+    CHECK_EQUAL(0x0001, hci_connection_for_handle(0x0001)->con_handle);
+    close_connection(0x0011);
+    POINTERS_EQUAL(NULL, hci_connection_for_handle(0x0011));
+    POINTERS_EQUAL(NULL, hci_connection_for_bd_addr_and_type(addr, BD_ADDR_TYPE_CLASSIC));
+    CHECK(hci_connection_for_handle(0x0001) != NULL);
+}
+
+TEST(HCI, PacketsQueuedWithoutControllerBuffers){
+    open_connection(0x0001, 0x01);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(1, num_sent_packets);
+    CHECK_EQUAL(1, num_packet_sent_events);
+    // controller is full, packets are queued up to HCI_ACL_TX_QUEUE_MAX
+    int i;
+    for (i = 0; i < HCI_ACL_TX_QUEUE_MAX; i++){
+        CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    }
+    CHECK_EQUAL(-1, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(1, num_sent_packets);
+    complete_packets(0x0001, 1);
+    CHECK_EQUAL(2, num_sent_packets);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+}
+
+TEST(HCI, QueuesServedRoundRobin){
+    open_connection(0x0001, 0x01);
+    open_connection(0x0002, 0x02);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, HCI_ACL_PAYLOAD_SIZE));
+    CHECK_EQUAL(0, send_acl_packet(0x0001, HCI_ACL_PAYLOAD_SIZE));
+    CHECK_EQUAL(0, send_acl_packet(0x0001, HCI_ACL_PAYLOAD_SIZE));
+    CHECK_EQUAL(0, send_acl_packet(0x0002, HCI_ACL_PAYLOAD_SIZE));
+    CHECK_EQUAL(0, send_acl_packet(0x0002, HCI_ACL_PAYLOAD_SIZE));
+    while (num_sent_packets < 5){
+        int last = num_sent_packets;
+        complete_packets(sent_packets[last-1].handle, 1);
+        CHECK_EQUAL(last + 1, num_sent_packets);
+    }
+    CHECK_EQUAL(0x0001, sent_packets[0].handle);
+    CHECK_EQUAL(0x0002, sent_packets[1].handle);
+    CHECK_EQUAL(0x0001, sent_packets[2].handle);
+    CHECK_EQUAL(0x0002, sent_packets[3].handle);
+    CHECK_EQUAL(0x0001, sent_packets[4].handle);
+}
+
+TEST(HCI, SmallPacketsShareTurn){
+    open_connection(0x0001, 0x01);
+    open_connection(0x0002, 0x02);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(0, send_acl_packet(0x0002, 10));
+    while (num_sent_packets < 4){
+        complete_packets(sent_packets[num_sent_packets-1].handle, 1);
+    }
+    // first packet was sent right away, then one turn covers both queued packets
+    CHECK_EQUAL(0x0001, sent_packets[0].handle);
+    CHECK_EQUAL(0x0002, sent_packets[1].handle);
+    CHECK_EQUAL(0x0001, sent_packets[2].handle);
+    CHECK_EQUAL(0x0001, sent_packets[3].handle);
+}
+
+TEST(HCI, WeightedShares){
+    open_connection(0x0001, 0x01);
+    open_connection(0x0002, 0x02);
+    hci_connection_set_acl_tx_weight(0x0001, 2);
+    int sent[3] = { 0, 0, 0 };
+    while (num_sent_packets < 60){
+        // keep both connections busy
+        while (send_acl_packet(0x0001, HCI_ACL_PAYLOAD_SIZE) == 0);
+        while (send_acl_packet(0x0002, HCI_ACL_PAYLOAD_SIZE) == 0);
+        hci_con_handle_t handle = sent_packets[num_sent_packets-1].handle;
+        sent[handle]++;
+        complete_packets(handle, 1);
+    }
+    CHECK(sent[1] >= 39 && sent[1] <= 41);
+    CHECK(sent[2] >= 19 && sent[2] <= 21);
+    const hci_acl_tx_stats_t * stats = hci_connection_get_acl_tx_stats(0x0001);
+    CHECK(stats != NULL);
+    CHECK_EQUAL(stats->fragments_sent * HCI_ACL_PAYLOAD_SIZE, stats->bytes_sent);
+    CHECK(stats->turns_exhausted > 0);
+    POINTERS_EQUAL(NULL, hci_connection_get_acl_tx_stats(0x0003));
+}
+
+TEST(HCI, FirstTurnNotCountedAsExhausted){
+    open_connection(0x0001, 0x01);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(1, num_sent_packets);
+    CHECK_EQUAL(0, hci_connection_get_acl_tx_stats(0x0001)->turns_exhausted);
+}
+
+TEST(HCI, ControllerBuffersOfClosedConnectionFree){
+    open_connection(0x0001, 0x01);
+    open_connection(0x0002, 0x02);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(0, hci_number_free_acl_slots_for_handle(0x0002));
+    // controller discards packets of closed connection, no Number Of Completed Packets
+    close_connection(0x0001);
+    CHECK_EQUAL(1, hci_number_free_acl_slots_for_handle(0x0002));
+    CHECK_EQUAL(0, send_acl_packet(0x0002, 10));
+    CHECK_EQUAL(2, num_sent_packets);
+}
+
+TEST(HCI, FragmentsInterleaved){
+    set_buffer_size(40, 1);
+    open_connection(0x0001, 0x01);
+    open_connection(0x0002, 0x02);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 100));
+    CHECK_EQUAL(0, send_acl_packet(0x0002, 10));
+    while (num_sent_packets < 4){
+        complete_packets(sent_packets[num_sent_packets-1].handle, 1);
+    }
+    CHECK_EQUAL(0x0001, sent_packets[0].handle);
+    CHECK_EQUAL(2, sent_packets[0].boundary_flags);
+    CHECK_EQUAL(40, sent_packets[0].len);
+    CHECK_EQUAL(0x0002, sent_packets[1].handle);
+    CHECK_EQUAL(2, sent_packets[1].boundary_flags);
+    CHECK_EQUAL(10, sent_packets[1].len);
+    CHECK_EQUAL(0x0001, sent_packets[2].handle);
+    CHECK_EQUAL(1, sent_packets[2].boundary_flags);
+    CHECK_EQUAL(40, sent_packets[2].len);
+    CHECK_EQUAL(0x0001, sent_packets[3].handle);
+    CHECK_EQUAL(1, sent_packets[3].boundary_flags);
+    CHECK_EQUAL(20, sent_packets[3].len);
+}
+
+TEST(HCI, DisconnectReleasesQueuedBuffers){
+    set_buffer_size(HCI_ACL_PAYLOAD_SIZE, 0);
+    open_connection(0x0001, 0x01);
+    open_connection(0x0002, 0x02);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(0, send_acl_packet(0x0002, 10));
+    CHECK_EQUAL(0, send_acl_packet(0x0002, 10));
+    CHECK_EQUAL(0, num_sent_packets);
+    close_connection(0x0001);
+    open_connection(0x0003, 0x03);
+    CHECK_EQUAL(0, send_acl_packet(0x0003, 10));
+    CHECK_EQUAL(0, send_acl_packet(0x0003, 10));
+}
+
+TEST(HCI, BatchDefersRun){
+    open_connection(0x0001, 0x01);
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(0, send_acl_packet(0x0001, 10));
+    CHECK_EQUAL(1, num_sent_packets);
+    hci_batch_begin();
+    complete_packets(0x0001, 1);
+    CHECK_EQUAL(1, num_sent_packets);
+    hci_batch_end();
+    CHECK_EQUAL(2, num_sent_packets);
+}
+
+static int num_deferred_runs;
+static hci_deferred_run_t deferred_run;
+
+static void deferred_run_handler(void){
+    if (hci_defer_run(&deferred_run)) return;
+    num_deferred_runs++;
+}
+
+TEST(HCI, DeferredRunOncePerBatch){
+    num_deferred_runs = 0;
+    hci_register_deferred_run(&deferred_run, &deferred_run_handler);
+    deferred_run_handler();
+    CHECK_EQUAL(1, num_deferred_runs);
+    hci_batch_begin();
+    hci_batch_begin();
+    deferred_run_handler();
+    deferred_run_handler();
+    hci_batch_end();
+    CHECK_EQUAL(1, num_deferred_runs);
+    deferred_run_handler();
+    hci_batch_end();
+    CHECK_EQUAL(2, num_deferred_runs);
+    hci_batch_begin();
+    hci_batch_end();
+    CHECK_EQUAL(2, num_deferred_runs);
+}
+
+static void link_key_request(uint8_t addr_lsb){
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, 0x00, addr_lsb };
+    uint8_t event[8];
+    event[0] = HCI_EVENT_LINK_KEY_REQUEST;
+    bt_flip_addr(&event[2], addr);
+    inject_event(event, sizeof(event));
+}
+
+TEST(HCI, ConnectionsServicedInOrderOfRequest){
+    int i;
+    for (i = 1; i <= 8; i++){
+        open_connection(i, i);
+    }
+    // accept connections and read remote features
+    int num_sent;
+    do {
+        num_sent = num_sent_commands;
+        command_complete(sent_commands[num_sent_commands - 1], 1);
+    } while (num_sent_commands != num_sent);
+    gap_set_bondable_mode(0);
+    num_sent_commands = 0;
+    link_key_request(5);
+    CHECK_EQUAL(1, num_sent_commands);
+    CHECK_EQUAL(hci_link_key_request_negative_reply.opcode, sent_commands[0]);
+    CHECK_EQUAL(5, last_command[3]);
+    // no command credit left, both requests wait
+    link_key_request(7);
+    link_key_request(2);
+    CHECK_EQUAL(1, num_sent_commands);
+    command_complete(hci_link_key_request_negative_reply.opcode, 1);
+    CHECK_EQUAL(2, num_sent_commands);
+    CHECK_EQUAL(7, last_command[3]);
+    command_complete(hci_link_key_request_negative_reply.opcode, 1);
+    CHECK_EQUAL(3, num_sent_commands);
+    CHECK_EQUAL(2, last_command[3]);
+    command_complete(hci_link_key_request_negative_reply.opcode, 1);
+    CHECK_EQUAL(3, num_sent_commands);
+}
+
+TEST(HCI, SingleFragmentDeliveredDirectly){
+    open_connection(0x0001, 0x01);
+    const hci_acl_rx_stats_t * stats = hci_get_acl_rx_stats();
+    receive_acl_fragment(0x0001, 1, 20, 0, 24);
+    CHECK_EQUAL(1, num_received_packets);
+    CHECK_EQUAL(28, received_packet_size);
+    CHECK_EQUAL(1, stats->packets_direct);
+    CHECK_EQUAL(0, stats->buffers_in_use_max);
+}
+
+TEST(HCI, FragmentsReassembled){
+    open_connection(0x0001, 0x01);
+    open_connection(0x0002, 0x02);
+    const hci_acl_rx_stats_t * stats = hci_get_acl_rx_stats();
+    receive_acl_fragment(0x0001, 1, 100, 0, 40);
+    receive_acl_fragment(0x0002, 1, 50, 0, 30);
+    CHECK_EQUAL(2, stats->buffers_in_use);
+    CHECK_EQUAL(108 + 58, stats->bytes_in_use);
+    receive_acl_fragment(0x0001, 0, 100, 36, 40);
+    receive_acl_fragment(0x0001, 0, 100, 76, 24);
+    CHECK_EQUAL(1, num_received_packets);
+    CHECK_EQUAL(108, received_packet_size);
+    CHECK_EQUAL(104, READ_ACL_LENGTH(received_packet));
+    CHECK_EQUAL(100, READ_L2CAP_LENGTH(received_packet));
+    int i;
+    for (i = 0; i < 100; i++){
+        CHECK_EQUAL(i, received_packet[8 + i]);
+    }
+    CHECK_EQUAL(1, stats->buffers_in_use);
+    CHECK_EQUAL(1, stats->packets_reassembled);
+    // buffer of incomplete packet is released on disconnect
+    close_connection(0x0002);
+    CHECK_EQUAL(0, stats->buffers_in_use);
+    CHECK_EQUAL(0, stats->bytes_in_use);
+    CHECK_EQUAL(2, stats->buffers_in_use_max);
+}
+
+TEST(HCI, OversizedFragmentDropped){
+    open_connection(0x0001, 0x01);
+    const hci_acl_rx_stats_t * stats = hci_get_acl_rx_stats();
+    receive_acl_fragment(0x0001, 1, 50, 0, 30);
+    receive_acl_fragment(0x0001, 0, 50, 26, 40);
+    CHECK_EQUAL(0, num_received_packets);
+    CHECK_EQUAL(0, stats->buffers_in_use);
+}
+
+TEST(HCI, InitCommandsPipelined){
+    hci_power_control(HCI_POWER_ON);
+    CHECK_EQUAL(1, num_sent_commands);
+    CHECK_EQUAL(hci_reset.opcode, sent_commands[0]);
+    // reset completes, read bd addr, buffer size and features are sent at once
+    command_complete(hci_reset.opcode, 4);
+    CHECK_EQUAL(4, num_sent_commands);
+    CHECK_EQUAL(3, hci_number_commands_in_flight());
+    CHECK_EQUAL(hci_read_bd_addr.opcode, sent_commands[1]);
+    CHECK_EQUAL(hci_read_buffer_size.opcode, sent_commands[2]);
+    CHECK_EQUAL(hci_read_local_supported_features.opcode, sent_commands[3]);
+    // event mask depends on features
+    command_complete(hci_read_bd_addr.opcode, 2);
+    command_complete(hci_read_buffer_size.opcode, 3);
+    CHECK_EQUAL(4, num_sent_commands);
+    command_complete(hci_read_local_supported_features.opcode, 4);
+    CHECK_EQUAL(8, num_sent_commands);
+    // complete all outstanding commands until init is done
+    int i = 0;
+    while (stack_state != HCI_STATE_WORKING && i < num_sent_commands){
+        command_complete(sent_commands[i++], 4);
+    }
+    CHECK_EQUAL(HCI_STATE_WORKING, stack_state);
+    CHECK_EQUAL(0, hci_number_commands_in_flight());
+}
+
+TEST(HCI, InitWithSingleCommandCredit){
+    hci_power_control(HCI_POWER_ON);
+    int i = 0;
+    while (stack_state != HCI_STATE_WORKING && i < num_sent_commands){
+        CHECK_EQUAL(i + 1, num_sent_commands);
+        CHECK_EQUAL(1, hci_number_commands_in_flight());
+        command_complete(sent_commands[i++], 1);
+    }
+    CHECK_EQUAL(HCI_STATE_WORKING, stack_state);
+}
+
+static int command_sent(uint16_t opcode){
+    int i;
+    for (i = 0; i < num_sent_commands; i++){
+        if (sent_commands[i] == opcode) return 1;
+    }
+    return 0;
+}
+
+// complete init commands one by one
+static void power_on(void){
+    hci_power_control(HCI_POWER_ON);
+    int i = 0;
+    while (stack_state != HCI_STATE_WORKING && i < num_sent_commands){
+        command_complete(sent_commands[i++], 1);
+    }
+}
+
+TEST(HCI, InitEnablesHostFlowControl){
+    power_on();
+    CHECK_EQUAL(HCI_STATE_WORKING, stack_state);
+    CHECK(command_sent(hci_host_buffer_size.opcode));
+    CHECK(command_sent(hci_set_controller_to_host_flow_control.opcode));
+}
+
+TEST(HCI, ReassemblyBuffersReleasedOnPowerOn){
+    open_connection(0x0001, 0x01);
+    const hci_acl_rx_stats_t * stats = hci_get_acl_rx_stats();
+    receive_acl_fragment(0x0001, 1, 100, 0, 40);
+    CHECK_EQUAL(1, stats->buffers_in_use);
+    // connections are dropped when the stack is initialized again
+    power_on();
+    CHECK_EQUAL(0, stats->buffers_in_use);
+    CHECK_EQUAL(0, stats->bytes_in_use);
+    CHECK_EQUAL(1, stats->buffers_in_use_max);
+}
+
+TEST_GROUP(HostFlowControl){
+    void setup(){
+        num_sent_commands = 0;
+        num_received_packets = 0;
+        hci_init(&fake_transport, NULL, NULL, NULL);
+        hci_register_packet_handler(&stack_packet_handler);
+        set_buffer_size(HCI_ACL_PAYLOAD_SIZE, 1);
+        command_complete(hci_set_controller_to_host_flow_control.opcode, 1);
+        open_connection(0x0001, 0x01);
+        num_sent_commands = 0;
+    }
+    void teardown(){
+        hci_close();
+    }
+    void check_completed_packets_reported(hci_con_handle_t handle, uint16_t num_packets){
+        CHECK_EQUAL(1, num_sent_commands);
+        CHECK_EQUAL(hci_host_number_of_completed_packets.opcode, sent_commands[0]);
+        CHECK_EQUAL(1, last_command[3]);
+        CHECK_EQUAL(handle, READ_BT_16(last_command, 4));
+        CHECK_EQUAL(num_packets, READ_BT_16(last_command, 6));
+        num_sent_commands = 0;
+    }
+};
+
+TEST(HostFlowControl, ReportedWhenHalfOfBuffersReleased){
+    receive_acl_fragment(0x0001, 1, 10, 0, 14);
+    CHECK_EQUAL(1, num_received_packets);
+    CHECK_EQUAL(0, num_sent_commands);
+    receive_acl_fragment(0x0001, 1, 10, 0, 14);
+    check_completed_packets_reported(0x0001, HCI_HOST_ACL_PACKET_NUM / 2);
+}
+
+TEST(HostFlowControl, ReportDoesNotUseCommandCredit){
+    command_complete(hci_reset.opcode, 0);
+    receive_acl_fragment(0x0001, 1, 10, 0, 14);
+    receive_acl_fragment(0x0001, 1, 10, 0, 14);
+    check_completed_packets_reported(0x0001, 2);
+    CHECK_FALSE(hci_can_send_command_packet_now());
+}
+
+TEST(HostFlowControl, ManualReleaseHoldsBuffers){
+    hci_set_host_acl_packets_manual_release(1);
+    int i;
+    for (i = 0; i < HCI_HOST_ACL_PACKET_NUM; i++){
+        receive_acl_fragment(0x0001, 1, 10, 0, 14);
+    }
+    CHECK_EQUAL(HCI_HOST_ACL_PACKET_NUM, num_received_packets);
+    CHECK_EQUAL(0, num_sent_commands);
+    hci_host_acl_packet_release(0x0001);
+    CHECK_EQUAL(0, num_sent_commands);
+    hci_host_acl_packet_release(0x0001);
+    check_completed_packets_reported(0x0001, 2);
+}
+
+TEST(HostFlowControl, ReassemblyReleasesCopiedFragments){
+    hci_set_host_acl_packets_manual_release(1);
+    receive_acl_fragment(0x0001, 1, 30, 0, 20);
+    receive_acl_fragment(0x0001, 0, 30, 16, 14);
+    CHECK_EQUAL(1, num_received_packets);
+    CHECK_EQUAL(0, num_sent_commands);
+    hci_host_acl_packet_release(0x0001);
+    check_completed_packets_reported(0x0001, 2);
+}
+
+TEST(HostFlowControl, DisconnectDropsUnreportedPackets){
+    receive_acl_fragment(0x0001, 1, 10, 0, 14);
+    close_connection(0x0001);
+    open_connection(0x0002, 0x02);
+    num_sent_commands = 0;
+    receive_acl_fragment(0x0002, 1, 10, 0, 14);
+    CHECK_EQUAL(0, num_sent_commands);
+    receive_acl_fragment(0x0002, 1, 10, 0, 14);
+    check_completed_packets_reported(0x0002, 2);
+}
+
+static int store_advertising_report(uint8_t * report, uint8_t addr_lsb, int8_t rssi, const uint8_t * data, uint8_t data_length){
+    int pos = 0;
+    report[pos++] = 0;      // ADV_IND
+    report[pos++] = 0;      // public address
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, 0x00, addr_lsb };
+    bt_flip_addr(&report[pos], addr);
+    pos += 6;
+    report[pos++] = data_length;
+    memcpy(&report[pos], data, data_length);
+    pos += data_length;
+    report[pos++] = rssi;
+    return pos;
+}
+
+static void receive_advertising_report(uint8_t addr_lsb, int8_t rssi, const uint8_t * data, uint8_t data_length){
+    uint8_t event[14 + LE_ADVERTISING_DATA_SIZE];
+    int pos = 0;
+    event[pos++] = HCI_EVENT_LE_META;
+    event[pos++] = 0;
+    event[pos++] = HCI_SUBEVENT_LE_ADVERTISING_REPORT;
+    event[pos++] = 1;       // num reports
+    pos += store_advertising_report(&event[pos], addr_lsb, rssi, data, data_length);
+    inject_event(event, pos);
+}
+
+static void receive_advertising_reports(uint8_t addr_lsb_1, uint8_t addr_lsb_2, const uint8_t * data, uint8_t data_length){
+    uint8_t event[24 + 2 * LE_ADVERTISING_DATA_SIZE];
+    int pos = 0;
+    event[pos++] = HCI_EVENT_LE_META;
+    event[pos++] = 0;
+    event[pos++] = HCI_SUBEVENT_LE_ADVERTISING_REPORT;
+    event[pos++] = 2;       // num reports
+    pos += store_advertising_report(&event[pos], addr_lsb_1, -60, data, data_length);
+    pos += store_advertising_report(&event[pos], addr_lsb_2, -60, data, data_length);
+    inject_event(event, pos);
+}
+
+static const uint8_t adv_flags[] = { 0x02, 0x01, 0x06 };
+static const uint8_t adv_flags_changed[] = { 0x02, 0x01, 0x04 };
+static const uint8_t adv_manufacturer_data[] = { 0x02, 0x01, 0x06, 0x03, 0xff, 0x4c, 0x00 };
+
+TEST_GROUP(AdvertisingReportFilter){
+    const le_advertising_report_stats_t * stats;
+    void setup(){
+        num_advertising_reports = 0;
+        num_advertising_report_events = 0;
+        num_sent_commands = 0;
+        stack_state = HCI_STATE_OFF;
+        hci_init(&fake_transport, NULL, NULL, NULL);
+        hci_register_packet_handler(&stack_packet_handler);
+        gap_le_set_advertising_report_filter(60000, 10);
+        stats = gap_le_get_advertising_report_stats();
+        power_on();
+        le_central_start_scan();
+    }
+    void teardown(){
+        hci_close();
+    }
+};
+
+TEST(AdvertisingReportFilter, DuplicatesDropped){
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x01, -62, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(1, num_advertising_reports);
+    CHECK_EQUAL(3, stats->reports_received);
+    CHECK_EQUAL(1, stats->reports_delivered);
+    CHECK_EQUAL(2, stats->duplicates_dropped);
+}
+
+TEST(AdvertisingReportFilter, RawEventsFiltered){
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(1, num_advertising_report_events);
+    // duplicate is removed from event with two reports
+    receive_advertising_reports(0x01, 0x02, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(2, num_advertising_report_events);
+    CHECK_EQUAL(2, num_advertising_reports);
+    CHECK_EQUAL(1, last_advertising_report_event[3]);
+    CHECK_EQUAL(2 + 10 + sizeof(adv_flags), last_advertising_report_event[1]);
+    CHECK_EQUAL(0x02, last_advertising_report_event[4 + 2]);
+}
+
+TEST(AdvertisingReportFilter, StatsResetWhenScanStarts){
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(2, stats->reports_received);
+    le_central_stop_scan();
+    le_central_start_scan();
+    CHECK_EQUAL(0, stats->reports_received);
+    CHECK_EQUAL(0, stats->duplicates_dropped);
+}
+
+TEST(AdvertisingReportFilter, NewAdvertiserOrDataDelivered){
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x02, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x01, -60, adv_flags_changed, sizeof(adv_flags_changed));
+    CHECK_EQUAL(3, num_advertising_reports);
+}
+
+TEST(AdvertisingReportFilter, RssiChangeDelivered){
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x01, -65, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(1, num_advertising_reports);
+    receive_advertising_report(0x01, -70, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(2, num_advertising_reports);
+    // compared against last delivered report
+    receive_advertising_report(0x01, -75, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(2, num_advertising_reports);
+}
+
+TEST(AdvertisingReportFilter, EmptyWindowDeliversAll){
+    gap_le_set_advertising_report_filter(0, 0);
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(2, num_advertising_reports);
+}
+
+TEST(AdvertisingReportFilter, LeastRecentlySeenReplaced){
+    uint8_t i;
+    for (i = 1; i <= LE_ADVERTISING_REPORT_CACHE_SIZE; i++){
+        receive_advertising_report(i, -60, adv_flags, sizeof(adv_flags));
+    }
+    // refresh first advertiser, second one is replaced by new advertiser
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x10, -60, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(LE_ADVERTISING_REPORT_CACHE_SIZE + 1, num_advertising_reports);
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(LE_ADVERTISING_REPORT_CACHE_SIZE + 1, num_advertising_reports);
+    receive_advertising_report(0x02, -60, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(LE_ADVERTISING_REPORT_CACHE_SIZE + 2, num_advertising_reports);
+}
+
+TEST(AdvertisingReportFilter, AdTypeFilter){
+    gap_le_advertising_report_filter_add_ad_type(0xff);
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    receive_advertising_report(0x02, -60, adv_manufacturer_data, sizeof(adv_manufacturer_data));
+    CHECK_EQUAL(1, num_advertising_reports);
+    CHECK_EQUAL(1, stats->reports_filtered);
+    gap_le_advertising_report_filter_clear_ad_types();
+    receive_advertising_report(0x01, -60, adv_flags, sizeof(adv_flags));
+    CHECK_EQUAL(2, num_advertising_reports);
+}
+
+TEST_GROUP(HCICmdsEncoder){
+    uint8_t expected[HCI_PACKET_BUFFER_SIZE];
+    uint8_t buffer[HCI_PACKET_BUFFER_SIZE];
+    bd_addr_t addr;
+    void setup(void){
+        memset(expected, 0x55, sizeof(expected));
+        memset(buffer, 0xaa, sizeof(buffer));
+        bt_flip_addr(addr, (uint8_t *) "\x00\x1b\xdc\x01\x02\x03");
+    }
+    void check_same(uint16_t expected_len, uint16_t len){
+        CHECK_EQUAL(expected_len, len);
+        CHECK_EQUAL(0, memcmp(expected, buffer, len));
+    }
+};
+
+TEST(HCICmdsEncoder, NoParameters){
+    check_same(hci_create_cmd(expected, (hci_cmd_t *) &hci_reset),
+               hci_cmd_reset_create(buffer));
+}
+
+TEST(HCICmdsEncoder, Integers){
+    check_same(hci_create_cmd(expected, (hci_cmd_t *) &hci_set_event_mask, 0xffffffff, 0x1FFFFFFF),
+               hci_cmd_set_event_mask_create(buffer, 0xffffffff, 0x1FFFFFFF));
+    check_same(hci_create_cmd(expected, (hci_cmd_t *) &hci_write_class_of_device, 0x2540c),
+               hci_cmd_write_class_of_device_create(buffer, 0x2540c));
+    check_same(hci_create_cmd(expected, (hci_cmd_t *) &hci_qos_setup, 0x0b01, 0, 1, 0x1234, 0x23456789, 1000, 2000),
+               hci_cmd_qos_setup_create(buffer, 0x0b01, 0, 1, 0x1234, 0x23456789, 1000, 2000));
+}
+
+TEST(HCICmdsEncoder, Addresses){
+    check_same(hci_create_cmd(expected, (hci_cmd_t *) &hci_create_connection, addr, 0xcc18, 0, 0, 0, 1),
+               hci_cmd_create_connection_create(buffer, addr, 0xcc18, 0, 0, 0, 1));
+    link_key_t link_key;
+    memset(link_key, 0x42, sizeof(link_key));
+    check_same(hci_create_cmd(expected, (hci_cmd_t *) &hci_link_key_request_reply, addr, link_key),
+               hci_cmd_link_key_request_reply_create(buffer, addr, link_key));
+}
+
+TEST(HCICmdsEncoder, Name){
+    check_same(hci_create_cmd(expected, (hci_cmd_t *) &hci_write_local_name, "BTstack"),
+               hci_cmd_write_local_name_create(buffer, "BTstack"));
+}
+
+// controller with a patch applied by a vendor command in the init script, which changes the LMP subversion
+#define VENDOR_PATCH_OPCODE 0xfc01
+
+static int controller_patched;
+static uint8_t controller_lmp_subversion;
+static int init_script_pos;
+
+static int fake_control_on(void *config){
+    init_script_pos = 0;
+    return 0;
+}
+
+static int fake_control_next_cmd(void *config, uint8_t * hci_cmd_buffer){
+    if (init_script_pos++) return 0;
+    bt_store_16(hci_cmd_buffer, 0, VENDOR_PATCH_OPCODE);
+    hci_cmd_buffer[2] = 0;
+    return 1;
+}
+
+static bt_control_t fake_control = {
+    fake_control_on,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    fake_control_next_cmd,
+    NULL,
+    NULL,
+    NULL,
+};
+
+static void controller_complete(uint16_t opcode){
+    uint8_t event[16];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[2] = 1;
+    bt_store_16(event, 3, opcode);
+    if (opcode == VENDOR_PATCH_OPCODE){
+        controller_patched = 1;
+    }
+    if (opcode == hci_read_local_version_information.opcode){
+        event[6] = 6;   // HCI version 4.0
+        event[12] = controller_lmp_subversion + controller_patched;
+    }
+    if (opcode == hci_read_buffer_size.opcode){
+        bt_store_16(event, 6, 1021);
+        bt_store_16(event, 9, 8);
+    }
+    if (opcode == hci_read_local_supported_features.opcode){
+        event[10] = 1 << 6; // BR/EDR + LE
+    }
+    inject_event(event, sizeof(event));
+}
+
+static int fake_stack_open;
+
+static void controller_power_on(void){
+    if (fake_stack_open){
+        hci_close();
+    }
+    fake_stack_open = 1;
+    num_sent_commands = 0;
+    stack_state = HCI_STATE_OFF;
+    hci_init(&fake_transport, NULL, &fake_control, NULL);
+    hci_register_packet_handler(&stack_packet_handler);
+    hci_set_controller_cache(&hci_controller_cache_memory);
+    hci_power_control(HCI_POWER_ON);
+    int i = 0;
+    while (stack_state != HCI_STATE_WORKING && i < num_sent_commands){
+        controller_complete(sent_commands[i++]);
+    }
+    CHECK_EQUAL(HCI_STATE_WORKING, stack_state);
+}
+
+TEST_GROUP(ControllerCache){
+    void setup(){
+        bd_addr_t addr;
+        memset(addr, 0, sizeof(addr));
+        hci_controller_cache_memory.remove(addr);
+        controller_patched = 0;
+        controller_lmp_subversion = 1;
+    }
+    void teardown(){
+        hci_close();
+        fake_stack_open = 0;
+    }
+};
+
+TEST(ControllerCache, ColdStartStoresInfo){
+    controller_power_on();
+    CHECK(command_sent(VENDOR_PATCH_OPCODE));
+    CHECK(command_sent(hci_read_buffer_size.opcode));
+    CHECK(command_sent(hci_read_local_supported_features.opcode));
+    CHECK(command_sent(hci_le_read_buffer_size.opcode));
+    CHECK_EQUAL(0, hci_controller_info_from_cache());
+
+    bd_addr_t addr;
+    hci_controller_info_t info;
+    memset(addr, 0, sizeof(addr));
+    CHECK(hci_controller_cache_memory.get(addr, &info));
+    CHECK_EQUAL(HCI_ACL_PAYLOAD_SIZE, info.acl_data_packet_length);
+    CHECK_EQUAL(8, info.acl_packets_total_num);
+    CHECK_EQUAL(1, info.local_version_before_init_script[6]);
+    CHECK_EQUAL(2, info.local_version[6]);
+}
+
+TEST(ControllerCache, RestartWithPatchedControllerSkipsQueriesAndScript){
+    controller_power_on();
+    int cold_commands = num_sent_commands;
+    controller_power_on();
+    CHECK(!command_sent(VENDOR_PATCH_OPCODE));
+    CHECK(!command_sent(hci_read_buffer_size.opcode));
+    CHECK(!command_sent(hci_read_local_supported_features.opcode));
+    CHECK(!command_sent(hci_le_read_buffer_size.opcode));
+    CHECK(num_sent_commands < cold_commands);
+    CHECK_EQUAL(1, hci_controller_info_from_cache());
+}
+
+TEST(ControllerCache, RestartUsesCachedCapabilities){
+    controller_power_on();
+    uint16_t packet_types = hci_usable_acl_packet_types();
+    controller_power_on();
+    CHECK_EQUAL(HCI_ACL_PAYLOAD_SIZE, hci_max_acl_data_packet_length());
+    CHECK_EQUAL(packet_types, hci_usable_acl_packet_types());
+}
+
+TEST(ControllerCache, PowerCycledControllerRunsScriptAgain){
+    controller_power_on();
+    // patch lost, version matches cached version before init script
+    controller_patched = 0;
+    controller_power_on();
+    CHECK(command_sent(VENDOR_PATCH_OPCODE));
+    CHECK(!command_sent(hci_read_buffer_size.opcode));
+    CHECK_EQUAL(1, hci_controller_info_from_cache());
+}
+
+TEST(ControllerCache, ChangedControllerVerifiedByFullInit){
+    controller_power_on();
+    // firmware update
+    controller_patched = 0;
+    controller_lmp_subversion = 5;
+    controller_power_on();
+    CHECK(command_sent(VENDOR_PATCH_OPCODE));
+    CHECK(command_sent(hci_read_buffer_size.opcode));
+    CHECK(command_sent(hci_read_local_supported_features.opcode));
+    CHECK_EQUAL(0, hci_controller_info_from_cache());
+
+    bd_addr_t addr;
+    hci_controller_info_t info;
+    memset(addr, 0, sizeof(addr));
+    CHECK(hci_controller_cache_memory.get(addr, &info));
+    CHECK_EQUAL(6, info.local_version[6]);
+}
+
+static void modify_cached_info(uint32_t magic, uint16_t acl_data_packet_length){
+    bd_addr_t addr;
+    hci_controller_info_t info;
+    memset(addr, 0, sizeof(addr));
+    CHECK(hci_controller_cache_memory.get(addr, &info));
+    info.magic = magic;
+    info.acl_data_packet_length = acl_data_packet_length;
+    info.le_data_packets_length = acl_data_packet_length;
+    hci_controller_cache_memory.put(&info);
+}
+
+TEST(ControllerCache, InvalidEntryIgnored){
+    controller_power_on();
+    modify_cached_info(0, HCI_ACL_PAYLOAD_SIZE);
+    controller_power_on();
+    CHECK(command_sent(hci_read_buffer_size.opcode));
+    CHECK_EQUAL(0, hci_controller_info_from_cache());
+}
+
+TEST(ControllerCache, CachedSizesLimited){
+    controller_power_on();
+    modify_cached_info(HCI_CONTROLLER_INFO_MAGIC, 0xffff);
+    controller_power_on();
+    CHECK_EQUAL(1, hci_controller_info_from_cache());
+    CHECK_EQUAL(HCI_ACL_PAYLOAD_SIZE, hci_max_acl_data_packet_length());
+    CHECK_EQUAL(HCI_ACL_PAYLOAD_SIZE, hci_max_acl_le_data_packet_length());
+}
+
+int main (int argc, const char * argv[]){
+    run_loop_init(RUN_LOOP_POSIX);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,153 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <string.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "l2cap.h"
+#include "l2cap_signaling.h"
+
+#define NUM_REQUESTS 8
+
+// fake transport counting L2CAP signaling responses
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static int num_echo_responses;
+static int num_connection_responses;
+
+static int transport_open(void *transport_config){
+    return 0;
+}
+
+static int transport_close(void *transport_config){
+    return 0;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (packet_type != HCI_ACL_DATA_PACKET) return 0;
+    if (READ_L2CAP_CHANNEL_ID(packet) != L2CAP_CID_SIGNALING) return 0;
+    switch (packet[8]){
+        case ECHO_RESPONSE:
+            num_echo_responses++;
+            break;
+        case CONNECTION_RESPONSE:
+            num_connection_responses++;
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static const char * transport_get_name(void){
+    return "fake";
+}
+
+static hci_transport_t fake_transport = {
+    transport_open,
+    transport_close,
+    transport_send_packet,
+    transport_register_packet_handler,
+    transport_get_name,
+    NULL,
+    NULL,
+};
+
+static void inject_event(uint8_t * event, uint16_t size){
+    event[1] = size - 2;
+    transport_packet_handler(HCI_EVENT_PACKET, event, size);
+}
+
+static void set_buffer_size(uint16_t acl_len, uint16_t acl_num){
+    uint8_t event[13];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[2] = 1;
+    bt_store_16(event, 3, hci_read_buffer_size.opcode);
+    bt_store_16(event, 6, acl_len);
+    bt_store_16(event, 9, acl_num);
+    inject_event(event, sizeof(event));
+}
+
+static void open_connection(hci_con_handle_t handle){
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, 0x00, 0x01 };
+
+    uint8_t request[12];
+    memset(request, 0, sizeof(request));
+    request[0] = HCI_EVENT_CONNECTION_REQUEST;
+    bt_flip_addr(&request[2], addr);
+    request[11] = 1;    // ACL
+    inject_event(request, sizeof(request));
+
+    uint8_t complete[13];
+    memset(complete, 0, sizeof(complete));
+    complete[0] = HCI_EVENT_CONNECTION_COMPLETE;
+    bt_store_16(complete, 3, handle);
+    bt_flip_addr(&complete[5], addr);
+    complete[11] = 1;   // ACL
+    inject_event(complete, sizeof(complete));
+}
+
+static void receive_signaling_request(hci_con_handle_t handle, uint8_t code, uint8_t sig_id, uint8_t * data, uint16_t data_len){
+    uint8_t packet[32];
+    bt_store_16(packet, 0, handle | (2 << 12));
+    bt_store_16(packet, 2, 8 + data_len);
+    bt_store_16(packet, 4, 4 + data_len);
+    bt_store_16(packet, 6, L2CAP_CID_SIGNALING);
+    packet[8] = code;
+    packet[9] = sig_id;
+    bt_store_16(packet, 10, data_len);
+    memcpy(&packet[12], data, data_len);
+    transport_packet_handler(HCI_ACL_DATA_PACKET, packet, 12 + data_len);
+}
+
+TEST_GROUP(L2CAP){
+    void setup(){
+        num_echo_responses = 0;
+        num_connection_responses = 0;
+        hci_init(&fake_transport, NULL, NULL, NULL);
+        l2cap_init();
+        set_buffer_size(HCI_ACL_PAYLOAD_SIZE, 2 * NUM_REQUESTS);
+        open_connection(0x0001);
+    }
+    void teardown(){
+        hci_close();
+    }
+};
+
+TEST(L2CAP, EchoRequestsInBatchAnswered){
+    hci_batch_begin();
+    uint8_t i;
+    for (i = 1; i <= NUM_REQUESTS; i++){
+        receive_signaling_request(0x0001, ECHO_REQUEST, i, NULL, 0);
+    }
+    hci_batch_end();
+    CHECK_EQUAL(NUM_REQUESTS, num_echo_responses);
+}
+
+TEST(L2CAP, RefusedConnectionsInBatchAnswered){
+    hci_batch_begin();
+    uint8_t i;
+    for (i = 1; i <= NUM_REQUESTS; i++){
+        // no service registered for PSM
+        uint8_t request[4];
+        bt_store_16(request, 0, 0x1001);
+        bt_store_16(request, 2, 0x0040 + i);
+        receive_signaling_request(0x0001, CONNECTION_REQUEST, i, request, sizeof(request));
+    }
+    hci_batch_end();
+    CHECK_EQUAL(NUM_REQUESTS, num_connection_responses);
+}
+
+int main (int argc, const char * argv[]){
+    run_loop_init(RUN_LOOP_POSIX);
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
@@ -0,0 +1,11 @@
+// configuration for H4 transport tests with a pty as fake UART
+
+#define HAVE_MALLOC
+
+// packet handler may use pre-buffer for BNEP
+#define HAVE_BNEP
+
+// #define ENABLE_LOG_INFO 
+// #define ENABLE_LOG_ERROR
+
+#define HCI_ACL_PAYLOAD_SIZE 1021
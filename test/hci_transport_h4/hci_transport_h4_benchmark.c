@@ -0,0 +1,170 @@
+// measures H4 receive throughput and read() calls per packet with a pty pair as fake UART
+// a writer thread sends bursts of packets, the main thread processes the transport data source.
+// for transmit, a reader thread drains the pty at about 3 Mbaud and the time spent in send_packet is measured
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "mock.h"
+
+#define NUM_PACKETS 200000
+#define NUM_TX_PACKETS 1000
+
+// read() is wrapped by the linker to count syscalls done by the transport
+extern "C" ssize_t __real_read(int fd, void * buf, size_t count);
+static int num_reads;
+
+extern "C" ssize_t __wrap_read(int fd, void * buf, size_t count){
+    num_reads++;
+    return __real_read(fd, buf, count);
+}
+
+static int master_fd;
+static int num_received;
+static int packet_size;
+static int packets_per_write;
+
+static void packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    num_received++;
+}
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void * writer_thread(void * context){
+    static uint8_t burst[64 * (1 + HCI_ACL_HEADER_SIZE + HCI_ACL_PAYLOAD_SIZE)];
+    int pos = 0;
+    int i;
+    for (i = 0; i < packets_per_write; i++){
+        burst[pos] = HCI_ACL_DATA_PACKET;
+        bt_store_16(burst, pos + 1, 0x2001);
+        bt_store_16(burst, pos + 3, packet_size);
+        memset(&burst[pos + 5], i, packet_size);
+        pos += 5 + packet_size;
+    }
+    int sent;
+    for (sent = 0; sent < NUM_PACKETS; sent += packets_per_write){
+        int written = 0;
+        while (written < pos){
+            int res = write(master_fd, &burst[written], pos - written);
+            if (res <= 0) {
+                usleep(100);
+                continue;
+            }
+            written += res;
+        }
+    }
+    return NULL;
+}
+
+static void run(hci_transport_t * transport, hci_uart_config_t * config, int size, int burst){
+    packet_size = size;
+    packets_per_write = burst;
+    num_received = 0;
+    transport->open(config);
+    uint8_t buffer[16];
+    while (read(master_fd, buffer, sizeof(buffer)) > 0);
+
+    int wakeups = 0;
+    num_reads = 0;
+    pthread_t writer;
+    double start = now_ns();
+    pthread_create(&writer, NULL, &writer_thread, NULL);
+    while (num_received < NUM_PACKETS && mock_data_source_process(1000)){
+        wakeups++;
+    }
+    double duration = now_ns() - start;
+    pthread_join(writer, NULL);
+    transport->close(config);
+
+    printf("%4u bytes payload, %2u packets per write: %5.2f M packets/s, %5.2f read() and %5.2f wakeups per packet%s\n",
+        size, burst, num_received / duration * 1000, (float) num_reads / num_received, (float) wakeups / num_received,
+        num_received == NUM_PACKETS ? "" : " - packets lost");
+}
+
+static volatile int tx_reader_running;
+
+static void * tx_reader_thread(void * context){
+    uint8_t buffer[300];
+    while (tx_reader_running){
+        __real_read(master_fd, buffer, sizeof(buffer));
+        usleep(1000);
+    }
+    return NULL;
+}
+
+static void run_tx(hci_transport_t * transport, hci_uart_config_t * config, int size){
+    static uint8_t packet[HCI_ACL_HEADER_SIZE + HCI_ACL_PAYLOAD_SIZE];
+    bt_store_16(packet, 0, 0x2001);
+    bt_store_16(packet, 2, size);
+    memset(&packet[4], 0x55, size);
+    transport->open(config);
+
+    tx_reader_running = 1;
+    pthread_t reader;
+    pthread_create(&reader, NULL, &tx_reader_thread, NULL);
+    double start = now_ns();
+    double max_send_ns = 0;
+    int sent = 0;
+    while (sent < NUM_TX_PACKETS){
+        if (!transport->can_send_packet_now || transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+            double send_start = now_ns();
+            transport->send_packet(HCI_ACL_DATA_PACKET, packet, 4 + size);
+            double send_ns = now_ns() - send_start;
+            if (send_ns > max_send_ns){
+                max_send_ns = send_ns;
+            }
+            sent++;
+            continue;
+        }
+        // other work would be done here while the uart is congested
+        mock_data_source_process(1);
+    }
+    double duration = now_ns() - start;
+    tx_reader_running = 0;
+    pthread_join(reader, NULL);
+    transport->close(config);
+
+    printf("%4u bytes payload: %u packets queued in %6.1f ms, max %6.3f ms in send_packet\n",
+        size, NUM_TX_PACKETS, duration / 1000000, max_send_ns / 1000000);
+}
+
+int main (int argc, const char * argv[]){
+    char slave_name[64];
+    master_fd = mock_uart_open(slave_name, sizeof(slave_name));
+    if (master_fd < 0){
+        printf("could not open pty\n");
+        return 1;
+    }
+    hci_uart_config_t config;
+    config.device_name = slave_name;
+    config.baudrate_init = 115200;
+    config.baudrate_main = 0;
+    config.flowcontrol = 0;
+    hci_transport_t * transport = hci_transport_h4_instance();
+    transport->register_packet_handler(&packet_handler);
+
+    printf("%u ACL packets over pty\n", NUM_PACKETS);
+    run(transport, &config, 27, 1);
+    run(transport, &config, 27, 16);
+    run(transport, &config, 27, 64);
+    run(transport, &config, 251, 16);
+    run(transport, &config, 1021, 4);
+
+    printf("%u ACL packets to congested pty\n", NUM_TX_PACKETS);
+    run_tx(transport, &config, 27);
+    run_tx(transport, &config, 251);
+    mock_uart_close(master_fd);
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "mock.h"
+
+#define MAX_PACKETS 16
+
+typedef struct {
+    uint8_t  type;
+    uint16_t size;
+    uint8_t  data[HCI_PACKET_BUFFER_SIZE];
+} received_packet_t;
+
+static received_packet_t received[MAX_PACKETS];
+static int num_received;
+
+static void packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (num_received >= MAX_PACKETS) return;
+    received[num_received].type = packet_type;
+    received[num_received].size = size;
+    memcpy(received[num_received].data, packet, size);
+    num_received++;
+    // use pre-buffer like BNEP does
+    memset(packet - HCI_INCOMING_PRE_BUFFER_SIZE, 0xee, HCI_INCOMING_PRE_BUFFER_SIZE);
+}
+
+static int create_packet(uint8_t * buffer, uint8_t type, uint16_t payload_size, uint8_t fill){
+    int header_size;
+    buffer[0] = type;
+    switch (type){
+        case HCI_EVENT_PACKET:
+            buffer[1] = 0x0e;
+            buffer[2] = payload_size;
+            header_size = HCI_EVENT_HEADER_SIZE;
+            break;
+        case HCI_ACL_DATA_PACKET:
+            bt_store_16(buffer, 1, 0x2001);
+            bt_store_16(buffer, 3, payload_size);
+            header_size = HCI_ACL_HEADER_SIZE;
+            break;
+        default:
+            bt_store_16(buffer, 1, 0x0101);
+            buffer[3] = payload_size;
+            header_size = HCI_SCO_HEADER_SIZE;
+            break;
+    }
+    memset(&buffer[1 + header_size], fill, payload_size);
+    return 1 + header_size + payload_size;
+}
+
+static void check_packet(int index, uint8_t type, uint16_t size, uint8_t fill){
+    CHECK(index < num_received);
+    CHECK_EQUAL(type, received[index].type);
+    CHECK_EQUAL(size, received[index].size);
+    CHECK_EQUAL(fill, received[index].data[size - 1]);
+}
+
+static int master_fd;
+static hci_transport_t * transport;
+static char slave_name[64];
+static hci_uart_config_t config;
+
+static void write_uart(uint8_t * data, int size){
+    CHECK_EQUAL(size, write(master_fd, data, size));
+}
+
+// process until expected number of packets was received
+static void process_packets(int expected){
+    while (num_received < expected && mock_data_source_process(500));
+    CHECK_EQUAL(expected, num_received);
+}
+
+TEST_GROUP(H4Transport){
+    void setup(void){
+        num_received = 0;
+        master_fd = mock_uart_open(slave_name, sizeof(slave_name));
+        CHECK(master_fd >= 0);
+        config.device_name = slave_name;
+        config.baudrate_init = 115200;
+        config.baudrate_main = 0;
+        config.flowcontrol = 0;
+        transport = hci_transport_h4_instance();
+        transport->register_packet_handler(&packet_handler);
+        CHECK_EQUAL(0, transport->open(&config));
+        // drop HCI Reset sent by transport
+        uint8_t buffer[16];
+        while (read(master_fd, buffer, sizeof(buffer)) > 0);
+    }
+    void teardown(void){
+        transport->close(&config);
+        mock_uart_close(master_fd);
+    }
+};
+
+TEST(H4Transport, DeliversAllPacketsFromSingleRead){
+    uint8_t data[2000];
+    int pos = 0;
+    pos += create_packet(&data[pos], HCI_EVENT_PACKET, 4, 0x11);
+    pos += create_packet(&data[pos], HCI_ACL_DATA_PACKET, 27, 0x22);
+    pos += create_packet(&data[pos], HCI_SCO_DATA_PACKET, 60, 0x33);
+    pos += create_packet(&data[pos], HCI_ACL_DATA_PACKET, 1021, 0x44);
+    pos += create_packet(&data[pos], HCI_EVENT_PACKET, 255, 0x55);
+    write_uart(data, pos);
+    process_packets(5);
+    check_packet(0, HCI_EVENT_PACKET, 2 + 4, 0x11);
+    check_packet(1, HCI_ACL_DATA_PACKET, 4 + 27, 0x22);
+    check_packet(2, HCI_SCO_DATA_PACKET, 3 + 60, 0x33);
+    check_packet(3, HCI_ACL_DATA_PACKET, 4 + 1021, 0x44);
+    check_packet(4, HCI_EVENT_PACKET, 2 + 255, 0x55);
+}
+
+TEST(H4Transport, PacketsSplitAcrossReads){
+    uint8_t data[100];
+    int pos = 0;
+    pos += create_packet(&data[pos], HCI_ACL_DATA_PACKET, 27, 0x22);
+    pos += create_packet(&data[pos], HCI_EVENT_PACKET, 4, 0x11);
+    int split;
+    for (split = 1; split < pos; split++){
+        num_received = 0;
+        write_uart(data, split);
+        mock_data_source_process(500);
+        CHECK_EQUAL(split < 32 ? 0 : 1, num_received);
+        write_uart(&data[split], pos - split);
+        process_packets(2);
+        check_packet(0, HCI_ACL_DATA_PACKET, 4 + 27, 0x22);
+        check_packet(1, HCI_EVENT_PACKET, 2 + 4, 0x11);
+    }
+}
+
+TEST(H4Transport, ResyncAfterInvalidPacketType){
+    uint8_t data[100];
+    int pos = 0;
+    data[pos++] = 0xff;
+    data[pos++] = 0x00;
+    pos += create_packet(&data[pos], HCI_EVENT_PACKET, 4, 0x11);
+    write_uart(data, pos);
+    process_packets(1);
+    check_packet(0, HCI_EVENT_PACKET, 2 + 4, 0x11);
+}
+
+TEST(H4Transport, DeliversPacketsInBatch){
+    uint8_t data[1000];
+    int pos = 0;
+    int i;
+    for (i = 0; i < 10; i++){
+        pos += create_packet(&data[pos], HCI_ACL_DATA_PACKET, 27, i);
+    }
+    int batches = mock_batch_count();
+    write_uart(data, pos);
+    process_packets(10);
+    for (i = 0; i < 10; i++){
+        check_packet(i, HCI_ACL_DATA_PACKET, 4 + 27, i);
+    }
+    CHECK(mock_batch_count() - batches <= 2);
+}
+
+TEST(H4Transport, SendPacketWritesTypeAndPacket){
+    uint8_t command[] = { 0x03, 0x0c, 0x00 };
+    CHECK(transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET));
+    CHECK_EQUAL(0, transport->send_packet(HCI_COMMAND_DATA_PACKET, command, sizeof(command)));
+    uint8_t buffer[16];
+    int len = 0;
+    int tries;
+    for (tries = 0; tries < 100 && len < 4; tries++){
+        int res = read(master_fd, &buffer[len], sizeof(buffer) - len);
+        if (res > 0) {
+            len += res;
+        } else {
+            usleep(1000);
+        }
+    }
+    CHECK_EQUAL(4, len);
+    CHECK_EQUAL(HCI_COMMAND_DATA_PACKET, buffer[0]);
+    CHECK_EQUAL(0, memcmp(&buffer[1], command, sizeof(command)));
+    CHECK_EQUAL(DATA_SOURCE_CALLBACK_READ, mock_data_source_callbacks());
+}
+
+TEST(H4Transport, SendDoesNotBlockWhenUartCongested){
+    // uart doesn't accept data as long as master side isn't read
+    static uint8_t packet[4 + 1021];
+    int num_sent = 0;
+    while (num_sent < 1000 && transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+        create_packet(packet, HCI_ACL_DATA_PACKET, 1021, num_sent);
+        CHECK_EQUAL(0, transport->send_packet(HCI_ACL_DATA_PACKET, &packet[1], 4 + 1021));
+        num_sent++;
+    }
+    CHECK(num_sent < 1000);
+    CHECK(mock_data_source_callbacks() & DATA_SOURCE_CALLBACK_WRITE);
+
+    // drain uart, transport writes queued packets and reports free space
+    static uint8_t data[1000 * (1 + 4 + 1021)];
+    int expected = num_sent * (1 + 4 + 1021);
+    int len = 0;
+    int idle = 0;
+    while (len < expected && idle < 100){
+        int res = read(master_fd, &data[len], expected - len);
+        if (res > 0){
+            len += res;
+            idle = 0;
+        } else {
+            idle++;
+        }
+        mock_data_source_process(10);
+    }
+    CHECK_EQUAL(expected, len);
+    int i;
+    for (i = 0; i < num_sent; i++){
+        uint8_t * sent = &data[i * (1 + 4 + 1021)];
+        CHECK_EQUAL(HCI_ACL_DATA_PACKET, sent[0]);
+        CHECK_EQUAL(1021, READ_BT_16(sent, 3));
+        CHECK_EQUAL((uint8_t) i, sent[1 + 4 + 1020]);
+    }
+    CHECK_EQUAL(1, num_received);
+    CHECK_EQUAL(HCI_EVENT_PACKET, received[0].type);
+    CHECK_EQUAL(DAEMON_EVENT_HCI_PACKET_SENT, received[0].data[0]);
+    CHECK_EQUAL(DATA_SOURCE_CALLBACK_READ, mock_data_source_callbacks());
+    CHECK(transport->can_send_packet_now(HCI_ACL_DATA_PACKET));
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
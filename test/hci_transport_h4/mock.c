@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  mock.c
+ *
+ *  Minimal run loop and HCI batch hooks for running a POSIX transport without the stack
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <btstack/run_loop.h>
+
+#include "hci.h"
+#include "mock.h"
+
+static data_source_t * data_source;
+static int batch_count;
+
+void run_loop_add_data_source(data_source_t *ds){
+    ds->callbacks = DATA_SOURCE_CALLBACK_READ;
+    data_source = ds;
+}
+
+void run_loop_enable_data_source_callbacks(data_source_t *ds, uint8_t callbacks){
+    ds->callbacks |= callbacks;
+}
+
+void run_loop_disable_data_source_callbacks(data_source_t *ds, uint8_t callbacks){
+    ds->callbacks &= ~callbacks;
+}
+
+int run_loop_remove_data_source(data_source_t *ds){
+    if (data_source != ds) return 0;
+    data_source = NULL;
+    return 1;
+}
+
+void hci_batch_begin(void){
+    batch_count++;
+}
+
+void hci_batch_end(void){
+}
+
+int mock_batch_count(void){
+    return batch_count;
+}
+
+int mock_data_source_process(int timeout_ms){
+    if (!data_source) return 0;
+    struct pollfd pfd;
+    pfd.fd = data_source->fd;
+    pfd.events = 0;
+    if (data_source->callbacks & DATA_SOURCE_CALLBACK_READ){
+        pfd.events |= POLLIN;
+    }
+    if (data_source->callbacks & DATA_SOURCE_CALLBACK_WRITE){
+        pfd.events |= POLLOUT;
+    }
+    if (poll(&pfd, 1, timeout_ms) <= 0) return 0;
+    data_source->ready = 0;
+    if (pfd.revents & POLLIN){
+        data_source->ready |= DATA_SOURCE_CALLBACK_READ;
+    }
+    if (pfd.revents & POLLOUT){
+        data_source->ready |= DATA_SOURCE_CALLBACK_WRITE;
+    }
+    data_source->process(data_source);
+    return 1;
+}
+
+int mock_data_source_callbacks(void){
+    if (!data_source) return 0;
+    return data_source->callbacks;
+}
+
+int mock_uart_open(char * slave_name, int slave_name_len){
+    int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0) return -1;
+    if (grantpt(master_fd) || unlockpt(master_fd)){
+        close(master_fd);
+        return -1;
+    }
+    strncpy(slave_name, ptsname(master_fd), slave_name_len - 1);
+    slave_name[slave_name_len - 1] = 0;
+    // reads on master side are only used to drain data sent by transport
+    fcntl(master_fd, F_SETFL, O_NONBLOCK);
+    return master_fd;
+}
+
+void mock_uart_close(int master_fd){
+    close(master_fd);
+}
@@ -0,0 +1,9 @@
+// configuration for H5 transport tests with a pty and a simulated controller
+
+#define HAVE_TICK
+#define HAVE_MALLOC
+
+// #define ENABLE_LOG_INFO 
+// #define ENABLE_LOG_ERROR
+
+#define HCI_ACL_PAYLOAD_SIZE 1021
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  h5_peer.c
+ *
+ *  Controller side of the Three-Wire UART transport for tests, written independently of
+ *  the transport: byte-wise SLIP decoder and bit-wise CRC. Reliable packets sent by the
+ *  peer are not retransmitted, as the transport under test doesn't drop packets.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "h5_peer.h"
+
+#define PEER_MAX_FRAME (4 + HCI_PACKET_BUFFER_SIZE + 2)
+
+static h5_peer_config_t config;
+static h5_peer_stats_t stats;
+static void (*packet_handler)(uint8_t type, uint8_t * packet, uint16_t size);
+static data_source_t peer_ds;
+static timer_source_t ack_timer;
+
+static int link_active;
+static int crc_used;
+static int window_size;
+
+// receiver
+static uint8_t frame[PEER_MAX_FRAME];
+static int frame_len;
+static int in_frame;
+static int escaped;
+static uint8_t rx_next_seq;
+static int unacked;
+static int reliable_count;
+
+// sender
+static uint8_t tx_next_seq;
+static uint8_t tx_unacked_seq;
+
+static uint16_t crc_bitwise(const uint8_t * data, int size, uint16_t crc){
+    int i, bit;
+    for (i = 0; i < size; i++){
+        crc ^= data[i];
+        for (bit = 0; bit < 8; bit++){
+            crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static uint16_t bit_reverse_16(uint16_t value){
+    uint16_t result = 0;
+    int i;
+    for (i = 0; i < 16; i++){
+        result = (result << 1) | ((value >> i) & 1);
+    }
+    return result;
+}
+
+static void write_all(const uint8_t * data, int size){
+    while (size){
+        int res = write(peer_ds.fd, data, size);
+        if (res < 0){
+            if (errno == EAGAIN) {
+                usleep(100);
+                continue;
+            }
+            return;
+        }
+        data += res;
+        size -= res;
+    }
+}
+
+static int slip_put(uint8_t * buffer, const uint8_t * data, int size){
+    int pos = 0;
+    int i;
+    for (i = 0; i < size; i++){
+        switch (data[i]){
+            case 0xc0:
+                buffer[pos++] = 0xdb;
+                buffer[pos++] = 0xdc;
+                break;
+            case 0xdb:
+                buffer[pos++] = 0xdb;
+                buffer[pos++] = 0xdd;
+                break;
+            default:
+                buffer[pos++] = data[i];
+                break;
+        }
+    }
+    return pos;
+}
+
+static void send_frame(uint8_t type, int reliable, uint8_t seq, const uint8_t * payload, uint16_t size){
+    uint8_t header[4];
+    header[0] = seq | (rx_next_seq << 3) | (crc_used ? 0x40 : 0) | (reliable ? 0x80 : 0);
+    header[1] = type | ((size & 0x0f) << 4);
+    header[2] = size >> 4;
+    header[3] = ~(header[0] + header[1] + header[2]);
+    unacked = 0;
+    run_loop_remove_timer(&ack_timer);
+
+    static uint8_t buffer[2 + 2 * PEER_MAX_FRAME];
+    int pos = 0;
+    buffer[pos++] = 0xc0;
+    pos += slip_put(&buffer[pos], header, 4);
+    pos += slip_put(&buffer[pos], payload, size);
+    if (crc_used){
+        uint16_t crc = crc_bitwise(header, 4, 0xffff);
+        crc = bit_reverse_16(crc_bitwise(payload, size, crc));
+        uint8_t crc_bytes[2] = { (uint8_t) (crc >> 8), (uint8_t) crc };
+        pos += slip_put(&buffer[pos], crc_bytes, 2);
+    }
+    buffer[pos++] = 0xc0;
+    write_all(buffer, pos);
+}
+
+static void send_ack(void){
+    send_frame(0, 0, 0, NULL, 0);
+}
+
+static void ack_timeout_handler(timer_source_t * timer){
+    send_ack();
+}
+
+static void link_control_received(uint8_t * payload, uint16_t size){
+    static const uint8_t sync[]          = { 0x01, 0x7e };
+    static const uint8_t sync_response[] = { 0x02, 0x7d };
+    static const uint8_t conf[]          = { 0x03, 0xfc };
+    if (size < 2) return;
+    if (memcmp(payload, sync, 2) == 0){
+        send_frame(15, 0, 0, sync_response, 2);
+        return;
+    }
+    if (memcmp(payload, conf, 2) == 0){
+        uint8_t host_config = size > 2 ? payload[2] : 0;
+        uint8_t response[3] = { 0x04, 0x7b, (uint8_t) (config.window_size | (config.crc ? 0x10 : 0)) };
+        window_size = config.window_size;
+        if ((host_config & 0x07) < window_size){
+            window_size = host_config & 0x07;
+        }
+        // reply without CRC, used from next packet on
+        crc_used = 0;
+        send_frame(15, 0, 0, response, 3);
+        crc_used = config.crc && (host_config & 0x10);
+        if (!link_active){
+            rx_next_seq = 0;
+            tx_next_seq = 0;
+            tx_unacked_seq = 0;
+        }
+        link_active = 1;
+        return;
+    }
+}
+
+static void frame_received(void){
+    if (frame_len < 4) return;
+    if (((frame[0] + frame[1] + frame[2] + frame[3]) & 0xff) != 0xff) return;
+    uint16_t size = (frame[1] >> 4) | (frame[2] << 4);
+    int crc_present = frame[0] & 0x40;
+    if (frame_len != 4 + size + (crc_present ? 2 : 0)) return;
+    if (crc_present){
+        uint16_t crc = bit_reverse_16(crc_bitwise(frame, 4 + size, 0xffff));
+        if (crc != ((frame[4 + size] << 8) | frame[4 + size + 1])) return;
+        stats.crc_used++;
+    }
+    uint8_t type = frame[1] & 0x0f;
+    if (type == 15){
+        link_control_received(&frame[4], size);
+        return;
+    }
+    if (!link_active) return;
+
+    // acknowledged packets free the window
+    tx_unacked_seq = (frame[0] >> 3) & 0x07;
+
+    if (!(frame[0] & 0x80)) return;
+    reliable_count++;
+    if (config.drop_every && (reliable_count % config.drop_every) == 0){
+        stats.packets_dropped++;
+        return;
+    }
+    if ((frame[0] & 0x07) != rx_next_seq){
+        stats.out_of_order++;
+        unacked++;
+        return;
+    }
+    rx_next_seq = (rx_next_seq + 1) & 0x07;
+    stats.packets_received++;
+    unacked++;
+    if (unacked > stats.max_unacked){
+        stats.max_unacked = unacked;
+    }
+    if (packet_handler){
+        packet_handler(type, &frame[4], size);
+    }
+}
+
+static int peer_process(data_source_t * ds){
+    if (!(ds->ready & DATA_SOURCE_CALLBACK_READ)) return 0;
+    uint8_t buffer[512];
+    int size = read(ds->fd, buffer, sizeof(buffer));
+    int i;
+    for (i = 0; i < size; i++){
+        uint8_t input = buffer[i];
+        if (input == 0xc0){
+            if (in_frame && frame_len){
+                frame_received();
+            }
+            in_frame = 1;
+            escaped = 0;
+            frame_len = 0;
+            continue;
+        }
+        if (!in_frame) continue;
+        if (escaped){
+            escaped = 0;
+            if (input == 0xdc){
+                input = 0xc0;
+            } else if (input == 0xdd){
+                input = 0xdb;
+            } else {
+                in_frame = 0;
+                continue;
+            }
+        } else if (input == 0xdb){
+            escaped = 1;
+            continue;
+        }
+        if (frame_len == PEER_MAX_FRAME){
+            in_frame = 0;
+            continue;
+        }
+        frame[frame_len++] = input;
+    }
+    if (!unacked) return 0;
+    if (!config.ack_delay_ms){
+        send_ack();
+        return 0;
+    }
+    if (!ack_timer.process){
+        run_loop_set_timer_handler(&ack_timer, &ack_timeout_handler);
+    }
+    run_loop_remove_timer(&ack_timer);
+    run_loop_set_timer(&ack_timer, config.ack_delay_ms);
+    run_loop_add_timer(&ack_timer);
+    return 0;
+}
+
+void h5_peer_open(int fd, const h5_peer_config_t * peer_config, void (*handler)(uint8_t type, uint8_t * packet, uint16_t size)){
+    config = *peer_config;
+    packet_handler = handler;
+    memset(&stats, 0, sizeof(stats));
+    link_active = 0;
+    crc_used = 0;
+    window_size = 1;
+    frame_len = 0;
+    in_frame = 0;
+    escaped = 0;
+    rx_next_seq = 0;
+    unacked = 0;
+    reliable_count = 0;
+    tx_next_seq = 0;
+    tx_unacked_seq = 0;
+    ack_timer.process = NULL;
+    peer_ds.fd = fd;
+    peer_ds.process = &peer_process;
+    run_loop_add_data_source(&peer_ds);
+}
+
+void h5_peer_close(void){
+    run_loop_remove_timer(&ack_timer);
+    run_loop_remove_data_source(&peer_ds);
+}
+
+int h5_peer_link_active(void){
+    return link_active;
+}
+
+int h5_peer_can_send_packet_now(void){
+    if (!link_active) return 0;
+    return ((tx_next_seq - tx_unacked_seq) & 0x07) < window_size;
+}
+
+int h5_peer_send_packet(uint8_t type, const uint8_t * packet, uint16_t size){
+    if (!h5_peer_can_send_packet_now()) return 0;
+    send_frame(type, 1, tx_next_seq, packet, size);
+    tx_next_seq = (tx_next_seq + 1) & 0x07;
+    return 1;
+}
+
+void h5_peer_send_sync(void){
+    static const uint8_t sync[] = { 0x01, 0x7e };
+    link_active = 0;
+    crc_used = 0;
+    send_frame(15, 0, 0, sync, 2);
+}
+
+const h5_peer_stats_t * h5_peer_stats(void){
+    return &stats;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  h5_peer.h
+ *
+ *  Controller side of the Three-Wire UART transport, talks to the H5 transport over a pty
+ */
+
+#ifndef __H5_PEER_H
+#define __H5_PEER_H
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int window_size;    // announced in CONFIG RESPONSE
+    int crc;            // data integrity check supported
+    int ack_delay_ms;   // acknowledge received packets after this time to simulate link latency, 0 = right away
+    int drop_every;     // ignore every n-th reliable packet, 0 = never
+} h5_peer_config_t;
+
+typedef struct {
+    int packets_received;   // reliable packets delivered in order
+    int packets_dropped;    // reliable packets ignored on purpose
+    int out_of_order;       // reliable packets with unexpected sequence number
+    int crc_used;           // packets received with CRC
+    int max_unacked;        // max number of received packets not acknowledged yet
+} h5_peer_stats_t;
+
+void h5_peer_open(int fd, const h5_peer_config_t * config, void (*handler)(uint8_t type, uint8_t * packet, uint16_t size));
+void h5_peer_close(void);
+
+// CONFIG RESPONSE was sent
+int  h5_peer_link_active(void);
+
+// window has space for another reliable packet
+int  h5_peer_can_send_packet_now(void);
+
+// send reliable packet, @returns 0 if window is full
+int  h5_peer_send_packet(uint8_t type, const uint8_t * packet, uint16_t size);
+
+// send SYNC as after a controller reset
+void h5_peer_send_sync(void);
+
+const h5_peer_stats_t * h5_peer_stats(void);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __H5_PEER_H
@@ -0,0 +1,93 @@
+// measures ACL throughput of the H5 transport over a pty for each window size
+// the simulated controller acknowledges with a fixed delay, emulating link latency
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "h5_peer.h"
+#include "mock.h"
+
+#define NUM_PACKETS     200
+#define PAYLOAD_SIZE    256
+#define ACK_DELAY_MS      5
+
+static hci_transport_t * transport;
+static int packets_received;
+
+static void host_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+}
+
+static void peer_packet_handler(uint8_t type, uint8_t * packet, uint16_t size){
+    packets_received++;
+}
+
+static int host_can_send(void){
+    return transport->can_send_packet_now(HCI_ACL_DATA_PACKET);
+}
+
+static int all_received(void){
+    return packets_received == NUM_PACKETS;
+}
+
+static double now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void run_benchmark(int window_size, int crc){
+    char slave_name[64];
+    int master_fd = mock_uart_open(slave_name, sizeof(slave_name));
+    hci_uart_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.device_name = slave_name;
+    config.baudrate_init = 115200;
+
+    h5_peer_config_t peer_config = { 7, crc, ACK_DELAY_MS, 0 };
+    hci_transport_h5_set_window_size(window_size);
+    hci_transport_h5_enable_crc(crc);
+    transport = hci_transport_h5_instance();
+    transport->register_packet_handler(&host_packet_handler);
+    transport->open(&config);
+    h5_peer_open(master_fd, &peer_config, &peer_packet_handler);
+    if (!mock_run_loop_run_until(&host_can_send, 2000)){
+        printf("window %u: link establishment failed\n", window_size);
+        return;
+    }
+
+    static uint8_t packet[4 + PAYLOAD_SIZE];
+    bt_store_16(packet, 0, 0x2001);
+    bt_store_16(packet, 2, PAYLOAD_SIZE);
+    packets_received = 0;
+    double start = now_ms();
+    int i;
+    for (i = 0; i < NUM_PACKETS; i++){
+        if (!host_can_send() && !mock_run_loop_run_until(&host_can_send, 2000)) break;
+        transport->send_packet(HCI_ACL_DATA_PACKET, packet, sizeof(packet));
+    }
+    mock_run_loop_run_until(&all_received, 2000);
+    double duration = now_ms() - start;
+    printf("window %u, crc %s: %3u packets in %6.1f ms, %7.1f kB/s\n", window_size, crc ? "on " : "off",
+        packets_received, duration, packets_received * PAYLOAD_SIZE / duration);
+
+    transport->close(&config);
+    h5_peer_close();
+    mock_uart_close(master_fd);
+}
+
+int main (int argc, const char * argv[]){
+    printf("%u packets with %u bytes payload, ack delay %u ms\n", NUM_PACKETS, PAYLOAD_SIZE, ACK_DELAY_MS);
+    int crc;
+    for (crc = 0; crc <= 1; crc++){
+        int window_size;
+        for (window_size = 1; window_size <= 7; window_size++){
+            run_benchmark(window_size, crc);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,246 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <string.h>
+
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "h5_peer.h"
+#include "mock.h"
+
+#define MAX_PACKETS 32
+
+typedef struct {
+    uint8_t  type;
+    uint16_t size;
+    uint8_t  data[HCI_PACKET_BUFFER_SIZE];
+} received_packet_t;
+
+// packets received by host and by peer
+static received_packet_t host_received[MAX_PACKETS];
+static int host_num_received;
+static received_packet_t peer_received[MAX_PACKETS];
+static int peer_num_received;
+static int host_packet_sent_events;
+static int host_hardware_errors;
+
+static void record(received_packet_t * list, int * count, uint8_t type, uint8_t * packet, uint16_t size){
+    if (*count >= MAX_PACKETS) return;
+    list[*count].type = type;
+    list[*count].size = size;
+    memcpy(list[*count].data, packet, size);
+    (*count)++;
+}
+
+static void host_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (packet_type == HCI_EVENT_PACKET && packet[0] == DAEMON_EVENT_HCI_PACKET_SENT){
+        host_packet_sent_events++;
+        return;
+    }
+    if (packet_type == HCI_EVENT_PACKET && packet[0] == HCI_EVENT_HARDWARE_ERROR){
+        host_hardware_errors++;
+        return;
+    }
+    record(host_received, &host_num_received, packet_type, packet, size);
+}
+
+static void peer_packet_handler(uint8_t type, uint8_t * packet, uint16_t size){
+    record(peer_received, &peer_num_received, type, packet, size);
+}
+
+static hci_transport_t * transport;
+static int master_fd;
+static char slave_name[64];
+static hci_uart_config_t config;
+static int expected_count;
+
+static int host_can_send(void){
+    return transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET);
+}
+
+static int peer_received_expected(void){
+    return peer_num_received >= expected_count;
+}
+
+static int host_received_expected(void){
+    return host_num_received >= expected_count;
+}
+
+static int peer_can_send(void){
+    return h5_peer_can_send_packet_now();
+}
+
+static int host_hardware_error(void){
+    return host_hardware_errors > 0;
+}
+
+static void open_link(int host_window, int host_crc, const h5_peer_config_t * peer_config){
+    hci_transport_h5_set_window_size(host_window);
+    hci_transport_h5_enable_crc(host_crc);
+    CHECK_EQUAL(0, transport->open(&config));
+    h5_peer_open(master_fd, peer_config, &peer_packet_handler);
+    CHECK(mock_run_loop_run_until(&host_can_send, 2000));
+    CHECK(h5_peer_link_active());
+}
+
+// ACL packet with payload that needs SLIP escaping
+static int create_acl_packet(uint8_t * packet, uint16_t payload_size, uint8_t index){
+    bt_store_16(packet, 0, 0x2001);
+    bt_store_16(packet, 2, payload_size);
+    int i;
+    for (i = 0; i < payload_size; i++){
+        packet[4 + i] = (i & 1) ? 0xc0 : 0xdb;
+    }
+    packet[4] = index;
+    return 4 + payload_size;
+}
+
+// send packets as fast as the window allows
+static void host_send_acl_packets(int count, uint16_t payload_size){
+    static uint8_t packet[4 + HCI_ACL_PAYLOAD_SIZE];
+    int i;
+    for (i = 0; i < count; i++){
+        if (!transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+            CHECK(mock_run_loop_run_until(&host_can_send, 2000));
+        }
+        int size = create_acl_packet(packet, payload_size, i);
+        CHECK_EQUAL(0, transport->send_packet(HCI_ACL_DATA_PACKET, packet, size));
+    }
+}
+
+TEST_GROUP(H5Transport){
+    void setup(void){
+        host_num_received = 0;
+        peer_num_received = 0;
+        host_packet_sent_events = 0;
+        host_hardware_errors = 0;
+        master_fd = mock_uart_open(slave_name, sizeof(slave_name));
+        CHECK(master_fd >= 0);
+        config.device_name = slave_name;
+        config.baudrate_init = 115200;
+        config.baudrate_main = 0;
+        config.flowcontrol = 0;
+        transport = hci_transport_h5_instance();
+        transport->register_packet_handler(&host_packet_handler);
+    }
+    void teardown(void){
+        transport->close(&config);
+        h5_peer_close();
+        mock_uart_close(master_fd);
+    }
+};
+
+TEST(H5Transport, LinkEstablishment){
+    h5_peer_config_t peer_config = { 7, 1, 0, 0 };
+    CHECK_EQUAL(0, transport->open(&config));
+    CHECK(!transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET));
+    h5_peer_open(master_fd, &peer_config, &peer_packet_handler);
+    CHECK(mock_run_loop_run_until(&host_can_send, 2000));
+    CHECK_EQUAL(1, host_packet_sent_events);
+}
+
+TEST(H5Transport, CommandAndEvent){
+    h5_peer_config_t peer_config = { 4, 0, 0, 0 };
+    open_link(4, 0, &peer_config);
+    uint8_t command[] = { 0x03, 0x0c, 0x02, 0xc0, 0xdb };
+    CHECK_EQUAL(0, transport->send_packet(HCI_COMMAND_DATA_PACKET, command, sizeof(command)));
+    expected_count = 1;
+    CHECK(mock_run_loop_run_until(&peer_received_expected, 1000));
+    CHECK_EQUAL(HCI_COMMAND_DATA_PACKET, peer_received[0].type);
+    CHECK_EQUAL(sizeof(command), peer_received[0].size);
+    CHECK_EQUAL(0, memcmp(command, peer_received[0].data, sizeof(command)));
+    CHECK_EQUAL(0, h5_peer_stats()->crc_used);
+
+    uint8_t event[] = { HCI_EVENT_COMMAND_COMPLETE, 4, 1, 0x03, 0x0c, 0x00 };
+    CHECK(h5_peer_send_packet(HCI_EVENT_PACKET, event, sizeof(event)));
+    CHECK(mock_run_loop_run_until(&host_received_expected, 1000));
+    CHECK_EQUAL(HCI_EVENT_PACKET, host_received[0].type);
+    CHECK_EQUAL(sizeof(event), host_received[0].size);
+    CHECK_EQUAL(0, memcmp(event, host_received[0].data, sizeof(event)));
+}
+
+TEST(H5Transport, DataIntegrityCheck){
+    h5_peer_config_t peer_config = { 4, 1, 0, 0 };
+    open_link(4, 1, &peer_config);
+    host_send_acl_packets(8, 100);
+    expected_count = 8;
+    CHECK(mock_run_loop_run_until(&peer_received_expected, 1000));
+    CHECK_EQUAL(8, h5_peer_stats()->crc_used);
+
+    uint8_t event[] = { HCI_EVENT_COMMAND_COMPLETE, 4, 1, 0xc0, 0xdb, 0x00 };
+    CHECK(h5_peer_send_packet(HCI_EVENT_PACKET, event, sizeof(event)));
+    expected_count = 1;
+    CHECK(mock_run_loop_run_until(&host_received_expected, 1000));
+    CHECK_EQUAL(0, memcmp(event, host_received[0].data, sizeof(event)));
+}
+
+TEST(H5Transport, WindowLimitsPacketsInFlight){
+    // peer acknowledges late, so the window fills up
+    h5_peer_config_t peer_config = { 7, 0, 50, 0 };
+    open_link(3, 0, &peer_config);
+    static uint8_t packet[4 + 27];
+    int sent = 0;
+    while (transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+        transport->send_packet(HCI_ACL_DATA_PACKET, packet, create_acl_packet(packet, 27, sent));
+        sent++;
+    }
+    CHECK_EQUAL(3, sent);
+    int packet_sent_events = host_packet_sent_events;
+    CHECK(mock_run_loop_run_until(&host_can_send, 1000));
+    CHECK(host_packet_sent_events > packet_sent_events);
+
+    host_send_acl_packets(20, 27);
+    expected_count = 23;
+    CHECK(mock_run_loop_run_until(&peer_received_expected, 2000));
+    CHECK_EQUAL(3, h5_peer_stats()->max_unacked);
+}
+
+TEST(H5Transport, LostPacketsAreResent){
+    h5_peer_config_t peer_config = { 4, 1, 0, 3 };
+    open_link(4, 1, &peer_config);
+    host_send_acl_packets(12, 200);
+    expected_count = 12;
+    CHECK(mock_run_loop_run_until(&peer_received_expected, 5000));
+    CHECK(h5_peer_stats()->packets_dropped > 0);
+    int i;
+    for (i = 0; i < 12; i++){
+        CHECK_EQUAL(4 + 200, peer_received[i].size);
+        CHECK_EQUAL(i, peer_received[i].data[4]);
+    }
+}
+
+TEST(H5Transport, ReceivesPacketsInOrder){
+    h5_peer_config_t peer_config = { 4, 0, 0, 0 };
+    open_link(4, 0, &peer_config);
+    static uint8_t packet[4 + 300];
+    int i;
+    for (i = 0; i < 20; i++){
+        while (!h5_peer_send_packet(HCI_ACL_DATA_PACKET, packet, create_acl_packet(packet, 300, i))){
+            CHECK(mock_run_loop_run_until(&peer_can_send, 1000));
+        }
+    }
+    expected_count = 20;
+    CHECK(mock_run_loop_run_until(&host_received_expected, 1000));
+    for (i = 0; i < 20; i++){
+        CHECK_EQUAL(HCI_ACL_DATA_PACKET, host_received[i].type);
+        CHECK_EQUAL(4 + 300, host_received[i].size);
+        CHECK_EQUAL(i, host_received[i].data[4]);
+    }
+}
+
+TEST(H5Transport, PeerResetCausesHardwareError){
+    h5_peer_config_t peer_config = { 4, 0, 0, 0 };
+    open_link(4, 0, &peer_config);
+    h5_peer_send_sync();
+    CHECK(mock_run_loop_run_until(&host_hardware_error, 1000));
+    CHECK(!transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET));
+    // link is established again
+    CHECK(mock_run_loop_run_until(&host_can_send, 2000));
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
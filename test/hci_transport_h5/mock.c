@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  mock.c
+ *
+ *  Run loop in real time for a transport and a simulated peer, without the stack
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <btstack/run_loop.h>
+
+#include "hci.h"
+#include "mock.h"
+
+#define MOCK_MAX_DATA_SOURCES 4
+#define MOCK_MAX_TIMERS       8
+
+static data_source_t  * data_sources[MOCK_MAX_DATA_SOURCES];
+static timer_source_t * timers[MOCK_MAX_TIMERS];
+
+void hci_batch_begin(void){
+}
+
+void hci_batch_end(void){
+}
+
+void run_loop_add_data_source(data_source_t *ds){
+    int i;
+    ds->callbacks = DATA_SOURCE_CALLBACK_READ;
+    for (i = 0; i < MOCK_MAX_DATA_SOURCES; i++){
+        if (data_sources[i]) continue;
+        data_sources[i] = ds;
+        return;
+    }
+}
+
+int run_loop_remove_data_source(data_source_t *ds){
+    int i;
+    for (i = 0; i < MOCK_MAX_DATA_SOURCES; i++){
+        if (data_sources[i] != ds) continue;
+        data_sources[i] = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void run_loop_enable_data_source_callbacks(data_source_t *ds, uint8_t callbacks){
+    ds->callbacks |= callbacks;
+}
+
+void run_loop_disable_data_source_callbacks(data_source_t *ds, uint8_t callbacks){
+    ds->callbacks &= ~callbacks;
+}
+
+uint32_t run_loop_get_time_ms(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t) (now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+void run_loop_set_timer(timer_source_t *ts, uint32_t timeout_in_ms){
+    ts->timeout = run_loop_get_time_ms() + timeout_in_ms;
+}
+
+void run_loop_set_timer_handler(timer_source_t *ts, void (*process)(timer_source_t *_ts)){
+    ts->process = process;
+}
+
+void run_loop_add_timer(timer_source_t *ts){
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (timers[i]) continue;
+        timers[i] = ts;
+        return;
+    }
+}
+
+int run_loop_remove_timer(timer_source_t *ts){
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (timers[i] != ts) continue;
+        timers[i] = NULL;
+        return 0;
+    }
+    return -1;
+}
+
+static int mock_data_source_registered(data_source_t *ds){
+    int i;
+    for (i = 0; i < MOCK_MAX_DATA_SOURCES; i++){
+        if (data_sources[i] == ds) return 1;
+    }
+    return 0;
+}
+
+// @returns earliest timer or NULL
+static timer_source_t * mock_next_timer(void){
+    timer_source_t * next = NULL;
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (!timers[i]) continue;
+        if (next && (int32_t) (timers[i]->timeout - next->timeout) >= 0) continue;
+        next = timers[i];
+    }
+    return next;
+}
+
+static void mock_run_loop_iteration(int timeout_ms){
+    struct pollfd pfds[MOCK_MAX_DATA_SOURCES];
+    data_source_t * ds_polled[MOCK_MAX_DATA_SOURCES];
+    int num_pfds = 0;
+    int i;
+
+    timer_source_t * next = mock_next_timer();
+    if (next){
+        int32_t delta = (int32_t) (next->timeout - run_loop_get_time_ms());
+        if (delta < 0) delta = 0;
+        if (delta < timeout_ms) timeout_ms = delta;
+    }
+
+    for (i = 0; i < MOCK_MAX_DATA_SOURCES; i++){
+        data_source_t * ds = data_sources[i];
+        if (!ds) continue;
+        pfds[num_pfds].fd = ds->fd;
+        pfds[num_pfds].events  = 0;
+        pfds[num_pfds].revents = 0;
+        if (ds->callbacks & DATA_SOURCE_CALLBACK_READ){
+            pfds[num_pfds].events |= POLLIN;
+        }
+        if (ds->callbacks & DATA_SOURCE_CALLBACK_WRITE){
+            pfds[num_pfds].events |= POLLOUT;
+        }
+        ds_polled[num_pfds++] = ds;
+    }
+    poll(pfds, num_pfds, timeout_ms);
+
+    for (i = 0; i < num_pfds; i++){
+        data_source_t * ds = ds_polled[i];
+        // data source might have been removed by another one
+        if (!mock_data_source_registered(ds)) continue;
+        ds->ready = 0;
+        if (pfds[i].revents & POLLIN){
+            ds->ready |= DATA_SOURCE_CALLBACK_READ;
+        }
+        if (pfds[i].revents & POLLOUT){
+            ds->ready |= DATA_SOURCE_CALLBACK_WRITE;
+        }
+        if (ds->ready){
+            ds->process(ds);
+        }
+    }
+
+    // process expired timers, timer is removed before processing to allow handler to re-register
+    uint32_t now = run_loop_get_time_ms();
+    while ((next = mock_next_timer()) != NULL){
+        if ((int32_t) (next->timeout - now) > 0) break;
+        run_loop_remove_timer(next);
+        next->process(next);
+    }
+}
+
+int mock_run_loop_run_until(int (*done)(void), uint32_t timeout_ms){
+    uint32_t end = run_loop_get_time_ms() + timeout_ms;
+    while (!done()){
+        int32_t remaining = (int32_t) (end - run_loop_get_time_ms());
+        if (remaining <= 0) return 0;
+        mock_run_loop_iteration(remaining);
+    }
+    return 1;
+}
+
+int mock_uart_open(char * slave_name, int slave_name_len){
+    int master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_fd < 0) return -1;
+    if (grantpt(master_fd) || unlockpt(master_fd)){
+        close(master_fd);
+        return -1;
+    }
+    strncpy(slave_name, ptsname(master_fd), slave_name_len - 1);
+    slave_name[slave_name_len - 1] = 0;
+    fcntl(master_fd, F_SETFL, O_NONBLOCK);
+    return master_fd;
+}
+
+void mock_uart_close(int master_fd){
+    close(master_fd);
+}
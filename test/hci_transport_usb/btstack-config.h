@@ -0,0 +1,15 @@
+// configuration for USB transport tests with a simulated libusb device
+
+#define HAVE_TICK
+#define HAVE_MALLOC
+
+// #define ENABLE_LOG_INFO 
+// #define ENABLE_LOG_ERROR
+
+#define HCI_ACL_PAYLOAD_SIZE 1021
+
+// skip device scan
+#define USB_VENDOR_ID  0x0a12
+#define USB_PRODUCT_ID 0x0001
+
+#define HCI_USB_ACL_OUT_TRANSFERS 8
@@ -0,0 +1,122 @@
+// measures ACL OUT throughput of the USB transport against a simulated controller
+// for different numbers of bulk OUT transfers in flight, HCI command to event round trip
+// time and run loop wakeups while idle
+
+#include <stdio.h>
+#include <string.h>
+
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "mock.h"
+
+#define NUM_PACKETS     1000
+#define PAYLOAD_SIZE    1021
+#define BYTES_PER_MS    1000
+#define LATENCY_US      1000
+#define NUM_COMMANDS     100
+#define RESPONSE_US      200
+
+static hci_transport_t * transport;
+static int packets_received;
+static int events_received;
+
+static void host_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (packet_type == HCI_EVENT_PACKET && packet[0] == HCI_EVENT_COMMAND_COMPLETE){
+        events_received++;
+    }
+}
+
+static void device_out_handler(uint8_t endpoint, const uint8_t * data, int size){
+    if (endpoint) {
+        packets_received++;
+    }
+}
+
+static int host_can_send(void){
+    return transport->can_send_packet_now(HCI_ACL_DATA_PACKET);
+}
+
+static int all_received(void){
+    return packets_received == NUM_PACKETS;
+}
+
+static int event_received(void){
+    return events_received > 0;
+}
+
+static void run_benchmark(int num_transfers){
+    mock_usb_config_t config = { BYTES_PER_MS, LATENCY_US };
+    mock_usb_init(&config);
+    mock_usb_register_out_handler(&device_out_handler);
+    hci_transport_usb_set_acl_out_transfers(num_transfers);
+    transport = hci_transport_usb_instance();
+    transport->register_packet_handler(&host_packet_handler);
+    transport->open(NULL);
+
+    static uint8_t packet[4 + PAYLOAD_SIZE];
+    bt_store_16(packet, 0, 0x2001);
+    bt_store_16(packet, 2, PAYLOAD_SIZE);
+    packets_received = 0;
+    uint32_t start_us = mock_usb_time_us();
+    int i;
+    for (i = 0; i < NUM_PACKETS; i++){
+        if (!host_can_send() && !mock_run_loop_run_until(&host_can_send, 1000)) break;
+        transport->send_packet(HCI_ACL_DATA_PACKET, packet, sizeof(packet));
+    }
+    mock_run_loop_run_until(&all_received, 1000);
+    uint32_t duration_us = mock_usb_time_us() - start_us;
+    const hci_transport_usb_stats_t * stats = hci_transport_usb_get_stats();
+    printf("%u transfers: %4u packets in %5u ms, %6.1f kB/s, max in flight %u\n", num_transfers,
+        packets_received, duration_us / 1000, packets_received * PAYLOAD_SIZE * 1000.0 / duration_us,
+        stats->acl_out_in_flight_max);
+    transport->close(NULL);
+}
+
+static void run_round_trip_benchmark(void){
+    mock_usb_config_t config = { BYTES_PER_MS, LATENCY_US };
+    mock_usb_init(&config);
+    uint8_t event[] = { HCI_EVENT_COMMAND_COMPLETE, 4, 1, 0x03, 0x0c, 0x00 };
+    mock_usb_set_command_response(event, sizeof(event), RESPONSE_US);
+    transport = hci_transport_usb_instance();
+    transport->register_packet_handler(&host_packet_handler);
+    transport->open(NULL);
+
+    uint8_t command[] = { 0x03, 0x0c, 0x00 };
+    uint32_t total_us = 0;
+    uint32_t max_us = 0;
+    int i;
+    for (i = 0; i < NUM_COMMANDS; i++){
+        events_received = 0;
+        if (!transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET)) {
+            mock_run_loop_run_for(1);
+        }
+        uint32_t start_us = mock_usb_time_us();
+        transport->send_packet(HCI_COMMAND_DATA_PACKET, command, sizeof(command));
+        if (!mock_run_loop_run_until(&event_received, 100)) break;
+        uint32_t round_trip_us = mock_usb_time_us() - start_us;
+        total_us += round_trip_us;
+        if (round_trip_us > max_us){
+            max_us = round_trip_us;
+        }
+    }
+    printf("command to event round trip: avg %u us, max %u us over %u commands, controller needs %u us\n",
+        total_us / i, max_us, i, RESPONSE_US + LATENCY_US);
+
+    int wakeups = mock_run_loop_wakeups();
+    mock_run_loop_run_for(1000);
+    printf("idle: %u wakeups per second\n", mock_run_loop_wakeups() - wakeups);
+    transport->close(NULL);
+}
+
+int main (int argc, const char * argv[]){
+    printf("%u packets with %u bytes payload, bus %u kB/s, completion latency %u us\n",
+        NUM_PACKETS, PAYLOAD_SIZE, BYTES_PER_MS, LATENCY_US);
+    int num_transfers;
+    for (num_transfers = 1; num_transfers <= 8; num_transfers *= 2){
+        run_benchmark(num_transfers);
+    }
+    run_round_trip_benchmark();
+    return 0;
+}
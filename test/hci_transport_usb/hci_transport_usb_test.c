@@ -0,0 +1,266 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <poll.h>
+#include <string.h>
+
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "mock.h"
+
+#define MAX_PACKETS 16
+
+typedef struct {
+    uint8_t  type;
+    uint16_t size;
+    uint8_t  data[HCI_ACL_BUFFER_SIZE];
+} received_packet_t;
+
+// packets received by host and by device
+static received_packet_t host_received[MAX_PACKETS];
+static int host_num_received;
+static received_packet_t device_received[MAX_PACKETS];
+static int device_num_received;
+static int packet_sent_events;
+
+static hci_transport_t * transport;
+
+static void record(received_packet_t * list, int * count, uint8_t type, const uint8_t * packet, uint16_t size){
+    if (*count >= MAX_PACKETS) return;
+    list[*count].type = type;
+    list[*count].size = size;
+    memcpy(list[*count].data, packet, size);
+    (*count)++;
+}
+
+static void host_packet_handler(uint8_t packet_type, uint8_t *packet, uint16_t size){
+    if (packet_type == HCI_EVENT_PACKET && packet[0] == DAEMON_EVENT_HCI_PACKET_SENT){
+        packet_sent_events++;
+        return;
+    }
+    record(host_received, &host_num_received, packet_type, packet, size);
+}
+
+static void device_out_handler(uint8_t endpoint, const uint8_t * data, int size){
+    record(device_received, &device_num_received, endpoint, data, size);
+}
+
+static int expected_count;
+
+static int device_received_expected(void){
+    return device_num_received >= expected_count;
+}
+
+static int host_received_expected(void){
+    return host_num_received >= expected_count;
+}
+
+static int host_can_send_acl(void){
+    return transport->can_send_packet_now(HCI_ACL_DATA_PACKET);
+}
+
+static int create_acl_packet(uint8_t * packet, uint16_t payload_size, uint8_t index){
+    bt_store_16(packet, 0, 0x2001);
+    bt_store_16(packet, 2, payload_size);
+    memset(&packet[4], index, payload_size);
+    return 4 + payload_size;
+}
+
+TEST_GROUP(USBTransport){
+    void setup(void){
+        mock_usb_config_t config = { 1000, 500 };
+        mock_usb_init(&config);
+        mock_usb_register_out_handler(&device_out_handler);
+        host_num_received = 0;
+        device_num_received = 0;
+        packet_sent_events = 0;
+        hci_transport_usb_set_acl_out_transfers(4);
+        transport = hci_transport_usb_instance();
+        transport->register_packet_handler(&host_packet_handler);
+    }
+    void teardown(void){
+        transport->close(NULL);
+        CHECK_EQUAL(0, mock_usb_transfers_allocated());
+    }
+};
+
+TEST(USBTransport, TransfersQueuedUpToLimit){
+    hci_transport_usb_set_acl_out_transfers(3);
+    CHECK_EQUAL(0, transport->open(NULL));
+    uint8_t packet[4 + 100];
+    int sent = 0;
+    while (transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+        CHECK_EQUAL(0, transport->send_packet(HCI_ACL_DATA_PACKET, packet, create_acl_packet(packet, 100, sent)));
+        sent++;
+    }
+    CHECK_EQUAL(3, sent);
+    const hci_transport_usb_stats_t * stats = hci_transport_usb_get_stats();
+    CHECK_EQUAL(3, stats->acl_out_transfers);
+    CHECK_EQUAL(3, stats->acl_out_in_flight);
+    CHECK_EQUAL(1, stats->acl_out_blocked);
+
+    // completion of first transfer unblocks sender
+    CHECK(mock_run_loop_run_until(&host_can_send_acl, 100));
+    CHECK_EQUAL(1, packet_sent_events);
+    expected_count = 3;
+    CHECK(mock_run_loop_run_until(&device_received_expected, 100));
+    CHECK_EQUAL(0, stats->acl_out_in_flight);
+    CHECK_EQUAL(3, stats->acl_out_in_flight_max);
+    CHECK_EQUAL(1, packet_sent_events);
+    int i;
+    for (i = 0; i < 3; i++){
+        CHECK_EQUAL(0x02, device_received[i].type);
+        CHECK_EQUAL(4 + 100, device_received[i].size);
+        CHECK_EQUAL(i, device_received[i].data[4]);
+    }
+}
+
+TEST(USBTransport, TransfersAreRecycled){
+    CHECK_EQUAL(0, transport->open(NULL));
+    int allocated = mock_usb_transfers_allocated();
+    uint8_t packet[4 + 200];
+    int i;
+    for (i = 0; i < 12; i++){
+        if (!transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+            CHECK(mock_run_loop_run_until(&host_can_send_acl, 100));
+        }
+        CHECK_EQUAL(0, transport->send_packet(HCI_ACL_DATA_PACKET, packet, create_acl_packet(packet, 200, i)));
+    }
+    expected_count = 12;
+    CHECK(mock_run_loop_run_until(&device_received_expected, 100));
+    CHECK_EQUAL(allocated, mock_usb_transfers_allocated());
+    for (i = 0; i < 12; i++){
+        CHECK_EQUAL(i, device_received[i].data[4]);
+    }
+}
+
+TEST(USBTransport, PacketIsCopied){
+    CHECK_EQUAL(0, transport->open(NULL));
+    uint8_t packet[4 + 10];
+    transport->send_packet(HCI_ACL_DATA_PACKET, packet, create_acl_packet(packet, 10, 0x55));
+    // hci.c reuses buffer right away
+    create_acl_packet(packet, 10, 0xaa);
+    expected_count = 1;
+    CHECK(mock_run_loop_run_until(&device_received_expected, 100));
+    CHECK_EQUAL(0x55, device_received[0].data[4]);
+}
+
+TEST(USBTransport, CommandAndEvent){
+    CHECK_EQUAL(0, transport->open(NULL));
+    uint8_t command[] = { 0x03, 0x0c, 0x00 };
+    CHECK(transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET));
+    CHECK_EQUAL(0, transport->send_packet(HCI_COMMAND_DATA_PACKET, command, sizeof(command)));
+    CHECK(!transport->can_send_packet_now(HCI_COMMAND_DATA_PACKET));
+    expected_count = 1;
+    CHECK(mock_run_loop_run_until(&device_received_expected, 100));
+    CHECK_EQUAL(0, device_received[0].type);
+    CHECK_EQUAL(sizeof(command), device_received[0].size);
+    CHECK_EQUAL(0, memcmp(command, device_received[0].data, sizeof(command)));
+    CHECK_EQUAL(1, packet_sent_events);
+
+    uint8_t event[] = { HCI_EVENT_COMMAND_COMPLETE, 4, 1, 0x03, 0x0c, 0x00 };
+    CHECK(mock_usb_send(0x81, event, sizeof(event)));
+    CHECK(mock_run_loop_run_until(&host_received_expected, 100));
+    CHECK_EQUAL(HCI_EVENT_PACKET, host_received[0].type);
+    CHECK_EQUAL(0, memcmp(event, host_received[0].data, sizeof(event)));
+}
+
+TEST(USBTransport, AclInTransfersResubmitted){
+    CHECK_EQUAL(0, transport->open(NULL));
+    const hci_transport_usb_stats_t * stats = hci_transport_usb_get_stats();
+    CHECK_EQUAL(4, stats->acl_in_transfers);
+    CHECK_EQUAL(4, stats->acl_in_pending);
+    uint8_t packet[4 + 50];
+    int i;
+    // device can send as many packets as IN transfers are submitted
+    for (i = 0; i < 4; i++){
+        CHECK(mock_usb_send(0x82, packet, create_acl_packet(packet, 50, i)));
+    }
+    CHECK(!mock_usb_send(0x82, packet, create_acl_packet(packet, 50, 4)));
+    expected_count = 4;
+    CHECK(mock_run_loop_run_until(&host_received_expected, 100));
+    CHECK_EQUAL(4, stats->acl_in_pending);
+    CHECK_EQUAL(0, stats->acl_in_pending_min);
+    for (i = 4; i < 8; i++){
+        CHECK(mock_usb_send(0x82, packet, create_acl_packet(packet, 50, i)));
+    }
+    expected_count = 8;
+    CHECK(mock_run_loop_run_until(&host_received_expected, 100));
+    for (i = 0; i < 8; i++){
+        CHECK_EQUAL(HCI_ACL_DATA_PACKET, host_received[i].type);
+        CHECK_EQUAL(4 + 50, host_received[i].size);
+        CHECK_EQUAL(i, host_received[i].data[4]);
+    }
+}
+
+TEST(USBTransport, CompletionsSignalledByPollfds){
+    CHECK_EQUAL(0, transport->open(NULL));
+    // usbfs signals completions with POLLOUT, libusb handles timeouts itself
+    data_source_t * ds = mock_run_loop_data_source_for_fd(MOCK_USB_FD);
+    CHECK(ds != NULL);
+    CHECK_EQUAL(DATA_SOURCE_CALLBACK_WRITE, ds->callbacks);
+    CHECK_EQUAL(0, mock_run_loop_timers());
+
+    // event is handled right when its transfer completes
+    uint8_t event[] = { HCI_EVENT_COMMAND_COMPLETE, 4, 1, 0x03, 0x0c, 0x00 };
+    uint32_t start_us = mock_usb_time_us();
+    CHECK(mock_usb_send(0x81, event, sizeof(event)));
+    expected_count = 1;
+    CHECK(mock_run_loop_run_until(&host_received_expected, 100));
+    CHECK_EQUAL(500, mock_usb_time_us() - start_us);
+
+    // no wakeups while idle
+    int wakeups = mock_run_loop_wakeups();
+    mock_run_loop_run_for(1000);
+    CHECK_EQUAL(wakeups, mock_run_loop_wakeups());
+}
+
+TEST(USBTransport, PollfdsAddedAndRemoved){
+    CHECK_EQUAL(0, transport->open(NULL));
+    CHECK_EQUAL(1, mock_run_loop_data_sources());
+    mock_usb_add_pollfd(43, POLLIN);
+    CHECK_EQUAL(2, mock_run_loop_data_sources());
+    CHECK_EQUAL(DATA_SOURCE_CALLBACK_READ, mock_run_loop_data_source_for_fd(43)->callbacks);
+    mock_usb_remove_pollfd(43);
+    CHECK_EQUAL(1, mock_run_loop_data_sources());
+    transport->close(NULL);
+    CHECK_EQUAL(0, mock_run_loop_data_sources());
+    // notifiers are unregistered on close
+    mock_usb_add_pollfd(43, POLLIN);
+    CHECK_EQUAL(0, mock_run_loop_data_sources());
+}
+
+TEST(USBTransport, CloseCancelsTransfersInFlight){
+    CHECK_EQUAL(0, transport->open(NULL));
+    uint8_t packet[4 + 100];
+    while (transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+        transport->send_packet(HCI_ACL_DATA_PACKET, packet, create_acl_packet(packet, 100, 0));
+    }
+    transport->close(NULL);
+    CHECK_EQUAL(0, mock_usb_transfers_submitted());
+}
+
+TEST(USBTransport, LimitIgnoredWhileOpen){
+    hci_transport_usb_set_acl_out_transfers(2);
+    CHECK_EQUAL(0, transport->open(NULL));
+    uint8_t packet[4 + 100];
+    int sent = 0;
+    while (transport->can_send_packet_now(HCI_ACL_DATA_PACKET)){
+        transport->send_packet(HCI_ACL_DATA_PACKET, packet, create_acl_packet(packet, 100, sent));
+        sent++;
+    }
+    CHECK_EQUAL(2, sent);
+    hci_transport_usb_set_acl_out_transfers(4);
+    CHECK_EQUAL(2, hci_transport_usb_get_stats()->acl_out_transfers);
+    hci_transport_usb_set_acl_out_transfers(1);
+    CHECK_EQUAL(2, hci_transport_usb_get_stats()->acl_out_transfers);
+    transport->close(NULL);
+    CHECK_EQUAL(0, mock_usb_transfers_submitted());
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
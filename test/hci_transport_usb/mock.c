@@ -0,0 +1,487 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  mock.c
+ *
+ *  libusb and run loop with simulated time, USB device behaves like a Bluetooth controller
+ *  that accepts bulk OUT data at a fixed rate and reports completions with a fixed latency.
+ *  Completions are signalled on MOCK_USB_FD with POLLOUT, as usbfs does on Linux
+ */
+
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <btstack/run_loop.h>
+
+#include "hci.h"
+#include "libusb.h"
+#include "mock.h"
+
+#define MOCK_MAX_DATA_SOURCES  4
+#define MOCK_MAX_TIMERS        8
+#define MOCK_MAX_TRANSFERS    32
+
+// submitted transfer, pending IN transfers wait for mock_usb_send
+typedef struct {
+    struct libusb_transfer * transfer;
+    int      waiting;
+    uint32_t complete_at_us;
+    enum libusb_transfer_status status;
+} mock_transfer_t;
+
+static data_source_t  * data_sources[MOCK_MAX_DATA_SOURCES];
+static timer_source_t * timers[MOCK_MAX_TIMERS];
+
+static mock_usb_config_t usb_config;
+static uint32_t now_us;
+static uint32_t bus_free_us;
+static mock_transfer_t submitted[MOCK_MAX_TRANSFERS];
+static int num_submitted;
+static int num_allocated;
+static int device_handle;
+static void (*out_handler)(uint8_t endpoint, const uint8_t * data, int size);
+static uint8_t  command_response[258];
+static int      command_response_size;
+static uint32_t command_response_delay_us;
+static libusb_pollfd_added_cb   pollfd_added;
+static libusb_pollfd_removed_cb pollfd_removed;
+static int wakeups;
+
+void mock_usb_init(const mock_usb_config_t * config){
+    usb_config = *config;
+    now_us = 0;
+    bus_free_us = 0;
+    num_submitted = 0;
+    out_handler = NULL;
+    command_response_size = 0;
+    wakeups = 0;
+    memset(timers, 0, sizeof(timers));
+    memset(data_sources, 0, sizeof(data_sources));
+}
+
+void mock_usb_register_out_handler(void (*handler)(uint8_t endpoint, const uint8_t * data, int size)){
+    out_handler = handler;
+}
+
+int mock_usb_transfers_allocated(void){
+    return num_allocated;
+}
+
+int mock_usb_transfers_submitted(void){
+    return num_submitted;
+}
+
+uint32_t mock_usb_time_us(void){
+    return now_us;
+}
+
+void mock_usb_set_command_response(const uint8_t * event, int size, uint32_t delay_us){
+    memcpy(command_response, event, size);
+    command_response_size = size;
+    command_response_delay_us = delay_us;
+}
+
+void mock_usb_add_pollfd(int fd, short events){
+    if (pollfd_added){
+        (*pollfd_added)(fd, events, NULL);
+    }
+}
+
+void mock_usb_remove_pollfd(int fd){
+    if (pollfd_removed){
+        (*pollfd_removed)(fd, NULL);
+    }
+}
+
+// device sends data, host sees completion at given time
+static int mock_usb_send_at(uint8_t endpoint, const uint8_t * data, int size, uint32_t complete_at_us){
+    int i;
+    for (i = 0; i < num_submitted; i++){
+        mock_transfer_t * pending = &submitted[i];
+        if (!pending->waiting || pending->transfer->endpoint != endpoint) continue;
+        if (size > pending->transfer->length){
+            size = pending->transfer->length;
+        }
+        memcpy(pending->transfer->buffer, data, size);
+        pending->transfer->actual_length = size;
+        pending->waiting = 0;
+        pending->complete_at_us = complete_at_us;
+        return 1;
+    }
+    return 0;
+}
+
+int mock_usb_send(uint8_t endpoint, const uint8_t * data, int size){
+    return mock_usb_send_at(endpoint, data, size, now_us + usb_config.completion_latency_us);
+}
+
+// libusb
+
+int libusb_init(libusb_context **ctx){
+    return 0;
+}
+
+void libusb_exit(libusb_context *ctx){
+}
+
+void libusb_set_debug(libusb_context *ctx, int level){
+}
+
+const char * libusb_error_name(int errcode){
+    return "mock error";
+}
+
+libusb_device_handle * libusb_open_device_with_vid_pid(libusb_context *ctx, uint16_t vendor_id, uint16_t product_id){
+    return (libusb_device_handle *) &device_handle;
+}
+
+void libusb_close(libusb_device_handle *dev_handle){
+}
+
+int libusb_kernel_driver_active(libusb_device_handle *dev, int interface_number){
+    return 0;
+}
+
+int libusb_detach_kernel_driver(libusb_device_handle *dev, int interface_number){
+    return 0;
+}
+
+int libusb_attach_kernel_driver(libusb_device_handle *dev, int interface_number){
+    return 0;
+}
+
+int libusb_set_configuration(libusb_device_handle *dev, int configuration){
+    return 0;
+}
+
+int libusb_claim_interface(libusb_device_handle *dev, int interface_number){
+    return 0;
+}
+
+int libusb_release_interface(libusb_device_handle *dev, int interface_number){
+    return 0;
+}
+
+int libusb_set_interface_alt_setting(libusb_device_handle *dev, int interface_number, int alternate_setting){
+    return 0;
+}
+
+int libusb_clear_halt(libusb_device_handle *dev, unsigned char endpoint){
+    return 0;
+}
+
+struct libusb_transfer * libusb_alloc_transfer(int iso_packets){
+    int size = sizeof(struct libusb_transfer) + iso_packets * sizeof(struct libusb_iso_packet_descriptor);
+    struct libusb_transfer * transfer = (struct libusb_transfer *) malloc(size);
+    memset(transfer, 0, size);
+    transfer->num_iso_packets = iso_packets;
+    num_allocated++;
+    return transfer;
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer){
+    free(transfer);
+    num_allocated--;
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer){
+    if (num_submitted == MOCK_MAX_TRANSFERS) return LIBUSB_ERROR_BUSY;
+    mock_transfer_t * pending = &submitted[num_submitted++];
+    pending->transfer = transfer;
+    pending->status   = LIBUSB_TRANSFER_COMPLETED;
+    if (transfer->endpoint & 0x80){
+        pending->waiting = 1;
+        return 0;
+    }
+    // OUT data stages are serialized on the bus
+    uint32_t start_us = now_us > bus_free_us ? now_us : bus_free_us;
+    bus_free_us = start_us + transfer->length * 1000 / usb_config.bytes_per_ms;
+    pending->waiting = 0;
+    pending->complete_at_us = bus_free_us + usb_config.completion_latency_us;
+    transfer->actual_length = transfer->length;
+    if (transfer->endpoint == 0 && command_response_size){
+        // controller answers after processing the command
+        uint32_t response_us = bus_free_us + command_response_delay_us;
+        mock_usb_send_at(0x81, command_response, command_response_size, response_us + usb_config.completion_latency_us);
+    }
+    return 0;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer){
+    int i;
+    for (i = 0; i < num_submitted; i++){
+        if (submitted[i].transfer != transfer) continue;
+        submitted[i].waiting = 0;
+        submitted[i].complete_at_us = now_us;
+        submitted[i].status = LIBUSB_TRANSFER_CANCELLED;
+        return 0;
+    }
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+// @returns index of earliest completed transfer or -1
+static int mock_usb_next_completion(void){
+    int next = -1;
+    int i;
+    for (i = 0; i < num_submitted; i++){
+        if (submitted[i].waiting) continue;
+        if (next >= 0 && (int32_t) (submitted[i].complete_at_us - submitted[next].complete_at_us) >= 0) continue;
+        next = i;
+    }
+    return next;
+}
+
+int libusb_handle_events_timeout(libusb_context *ctx, struct timeval *tv){
+    while (1){
+        int next = mock_usb_next_completion();
+        if (next < 0) break;
+        if ((int32_t) (submitted[next].complete_at_us - now_us) > 0) break;
+        mock_transfer_t completed = submitted[next];
+        num_submitted--;
+        memmove(&submitted[next], &submitted[next + 1], (num_submitted - next) * sizeof(mock_transfer_t));
+        struct libusb_transfer * transfer = completed.transfer;
+        transfer->status = completed.status;
+        if (completed.status == LIBUSB_TRANSFER_COMPLETED && !(transfer->endpoint & 0x80) && out_handler){
+            int setup_size = transfer->type == LIBUSB_TRANSFER_TYPE_CONTROL ? LIBUSB_CONTROL_SETUP_SIZE : 0;
+            (*out_handler)(transfer->endpoint, transfer->buffer + setup_size, transfer->actual_length - setup_size);
+        }
+        (*transfer->callback)(transfer);
+    }
+    return 0;
+}
+
+int libusb_pollfds_handle_timeouts(libusb_context *ctx){
+    return 1;
+}
+
+int libusb_get_next_timeout(libusb_context *ctx, struct timeval *tv){
+    return 0;
+}
+
+// single usbfs file descriptor, array is freed by caller
+const struct libusb_pollfd ** libusb_get_pollfds(libusb_context *ctx){
+    static struct libusb_pollfd usb_pollfd = { MOCK_USB_FD, POLLOUT };
+    const struct libusb_pollfd ** pollfds = (const struct libusb_pollfd **) malloc(2 * sizeof(struct libusb_pollfd *));
+    pollfds[0] = &usb_pollfd;
+    pollfds[1] = NULL;
+    return pollfds;
+}
+
+void libusb_set_pollfd_notifiers(libusb_context *ctx, libusb_pollfd_added_cb added_cb,
+    libusb_pollfd_removed_cb removed_cb, void *user_data){
+    pollfd_added   = added_cb;
+    pollfd_removed = removed_cb;
+}
+
+// run loop and HCI batch hooks
+
+void hci_batch_begin(void){
+}
+
+void hci_batch_end(void){
+}
+
+void run_loop_add_data_source(data_source_t *ds){
+    int i;
+    ds->callbacks = DATA_SOURCE_CALLBACK_READ;
+    for (i = 0; i < MOCK_MAX_DATA_SOURCES; i++){
+        if (data_sources[i]) continue;
+        data_sources[i] = ds;
+        return;
+    }
+}
+
+int run_loop_remove_data_source(data_source_t *ds){
+    int i;
+    for (i = 0; i < MOCK_MAX_DATA_SOURCES; i++){
+        if (data_sources[i] != ds) continue;
+        data_sources[i] = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void run_loop_enable_data_source_callbacks(data_source_t *ds, uint8_t callbacks){
+    ds->callbacks |= callbacks;
+}
+
+void run_loop_disable_data_source_callbacks(data_source_t *ds, uint8_t callbacks){
+    ds->callbacks &= ~callbacks;
+}
+
+int mock_run_loop_data_sources(void){
+    int count = 0;
+    int i;
+    for (i = 0; i < MOCK_MAX_DATA_SOURCES; i++){
+        if (data_sources[i]) count++;
+    }
+    return count;
+}
+
+data_source_t * mock_run_loop_data_source_for_fd(int fd){
+    int i;
+    for (i = 0; i < MOCK_MAX_DATA_SOURCES; i++){
+        if (data_sources[i] && data_sources[i]->fd == fd) return data_sources[i];
+    }
+    return NULL;
+}
+
+int mock_run_loop_timers(void){
+    int count = 0;
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (timers[i]) count++;
+    }
+    return count;
+}
+
+int mock_run_loop_wakeups(void){
+    return wakeups;
+}
+
+uint32_t run_loop_get_time_ms(void){
+    return now_us / 1000;
+}
+
+void run_loop_set_timer(timer_source_t *ts, uint32_t timeout_in_ms){
+    ts->timeout = run_loop_get_time_ms() + timeout_in_ms;
+}
+
+void run_loop_add_timer(timer_source_t *ts){
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (timers[i]) continue;
+        timers[i] = ts;
+        return;
+    }
+}
+
+int run_loop_remove_timer(timer_source_t *ts){
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (timers[i] != ts) continue;
+        timers[i] = NULL;
+        return 0;
+    }
+    return -1;
+}
+
+// @returns earliest timer or NULL
+static timer_source_t * mock_next_timer(void){
+    timer_source_t * next = NULL;
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (!timers[i]) continue;
+        if (next && (int32_t) (timers[i]->timeout - next->timeout) >= 0) continue;
+        next = timers[i];
+    }
+    return next;
+}
+
+// @returns data source polled for completions or NULL
+static data_source_t * mock_usb_data_source(void){
+    data_source_t * ds = mock_run_loop_data_source_for_fd(MOCK_USB_FD);
+    if (!ds || !(ds->callbacks & DATA_SOURCE_CALLBACK_WRITE)) return NULL;
+    return ds;
+}
+
+// @returns time of next timer or completion signalled on fd, 0 if nothing is pending
+static int mock_run_loop_next_event(uint32_t * event_us){
+    int pending = 0;
+    timer_source_t * next = mock_next_timer();
+    if (next){
+        *event_us = next->timeout * 1000;
+        pending = 1;
+    }
+    int completion = mock_usb_next_completion();
+    if (completion >= 0 && mock_usb_data_source()){
+        uint32_t complete_at_us = submitted[completion].complete_at_us;
+        if (!pending || (int32_t) (complete_at_us - *event_us) < 0){
+            *event_us = complete_at_us;
+        }
+        pending = 1;
+    }
+    return pending;
+}
+
+static void mock_run_loop_process(void){
+    // timer is removed before processing to allow handler to re-register
+    timer_source_t * next = mock_next_timer();
+    if (next && (int32_t) (next->timeout * 1000 - now_us) <= 0){
+        wakeups++;
+        run_loop_remove_timer(next);
+        next->process(next);
+        return;
+    }
+    data_source_t * ds = mock_usb_data_source();
+    int completion = mock_usb_next_completion();
+    if (ds && completion >= 0 && (int32_t) (submitted[completion].complete_at_us - now_us) <= 0){
+        wakeups++;
+        ds->ready = DATA_SOURCE_CALLBACK_WRITE;
+        ds->process(ds);
+    }
+}
+
+int mock_run_loop_step(void){
+    uint32_t event_us;
+    if (!mock_run_loop_next_event(&event_us)) return 0;
+    if ((int32_t) (event_us - now_us) > 0){
+        now_us = event_us;
+    }
+    mock_run_loop_process();
+    return 1;
+}
+
+void mock_run_loop_run_for(uint32_t duration_ms){
+    uint32_t end_us = now_us + duration_ms * 1000;
+    uint32_t event_us;
+    while (mock_run_loop_next_event(&event_us) && (int32_t) (event_us - end_us) <= 0){
+        mock_run_loop_step();
+    }
+    now_us = end_us;
+}
+
+int mock_run_loop_run_until(int (*done)(void), uint32_t timeout_ms){
+    uint32_t end_us = now_us + timeout_ms * 1000;
+    while (!(*done)()){
+        if ((int32_t) (now_us - end_us) >= 0) return 0;
+        if (!mock_run_loop_step()) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  mock.h
+ */
+
+#ifndef __MOCK_H
+#define __MOCK_H
+
+#include <stdint.h>
+
+#include <btstack/run_loop.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+// simulated USB Bluetooth controller
+typedef struct {
+    int bytes_per_ms;           // bulk OUT throughput of bus and controller
+    int completion_latency_us;  // from end of data stage until host sees the completion
+} mock_usb_config_t;
+
+// reset simulated time and device
+void mock_usb_init(const mock_usb_config_t * config);
+
+// data received by device on OUT endpoint, called on transfer completion
+void mock_usb_register_out_handler(void (*handler)(uint8_t endpoint, const uint8_t * data, int size));
+
+// device sends data on IN endpoint, @returns 0 if no transfer was submitted by the host
+int  mock_usb_send(uint8_t endpoint, const uint8_t * data, int size);
+
+// number of allocated / submitted transfers
+int  mock_usb_transfers_allocated(void);
+int  mock_usb_transfers_submitted(void);
+
+// device answers each HCI command with event, delay_us after command was received
+void mock_usb_set_command_response(const uint8_t * event, int size, uint32_t delay_us);
+
+// file descriptor used by libusb to signal completions with POLLOUT, as usbfs on Linux
+#define MOCK_USB_FD 42
+
+// libusb opens or closes another file descriptor, reported by the pollfd notifiers
+void mock_usb_add_pollfd(int fd, short events);
+void mock_usb_remove_pollfd(int fd);
+
+uint32_t mock_usb_time_us(void);
+
+// data sources and timers registered by transport
+int  mock_run_loop_data_sources(void);
+int  mock_run_loop_timers(void);
+data_source_t * mock_run_loop_data_source_for_fd(int fd);
+
+// number of processed timers and data sources
+int  mock_run_loop_wakeups(void);
+
+// advance simulated time to next timer or completion signalled on MOCK_USB_FD, process it.
+// @returns 0 if nothing is pending
+int  mock_run_loop_step(void);
+
+// process all timers and completions for the given time
+void mock_run_loop_run_for(uint32_t duration_ms);
+
+// step run loop until done() returns true, @returns 0 on timeout in simulated time
+int  mock_run_loop_run_until(int (*done)(void), uint32_t timeout_ms);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __MOCK_H
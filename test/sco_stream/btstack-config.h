@@ -0,0 +1,9 @@
+// configuration for SCO stream tests with fake transport and virtual time
+
+#define HAVE_TICK
+#define HAVE_MALLOC
+
+// #define ENABLE_LOG_INFO 
+// #define ENABLE_LOG_ERROR
+
+#define HCI_ACL_PAYLOAD_SIZE 100
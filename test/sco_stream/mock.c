@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  mock.c
+ *
+ *  Run loop with virtual time in ms, timers fire only from mock_run_loop_advance_ms
+ */
+
+#include <string.h>
+
+#include <btstack/run_loop.h>
+
+#include "mock.h"
+
+#define MOCK_MAX_TIMERS 8
+
+static timer_source_t * timers[MOCK_MAX_TIMERS];
+static uint32_t time_ms;
+
+void run_loop_init(RUN_LOOP_TYPE type){
+    memset(timers, 0, sizeof(timers));
+    time_ms = 0;
+}
+
+void run_loop_set_timer(timer_source_t *ts, uint32_t timeout_in_ms){
+    ts->timeout = time_ms + timeout_in_ms;
+}
+
+void run_loop_set_timer_handler(timer_source_t *ts, void (*process)(timer_source_t *_ts)){
+    ts->process = process;
+}
+
+uint32_t run_loop_get_time_ms(void){
+    return time_ms;
+}
+
+int run_loop_remove_timer(timer_source_t *ts){
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (timers[i] != ts) continue;
+        timers[i] = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void run_loop_add_timer(timer_source_t *ts){
+    int i;
+    run_loop_remove_timer(ts);
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (timers[i]) continue;
+        timers[i] = ts;
+        return;
+    }
+}
+
+// fire expired timers, earliest first
+static int mock_run_loop_fire_next(void){
+    timer_source_t * next = NULL;
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (!timers[i] || (int32_t) (timers[i]->timeout - time_ms) > 0) continue;
+        if (next && (int32_t) (timers[i]->timeout - next->timeout) >= 0) continue;
+        next = timers[i];
+    }
+    if (!next) return 0;
+    run_loop_remove_timer(next);
+    next->process(next);
+    return 1;
+}
+
+void mock_run_loop_advance_ms(uint32_t ms){
+    while (ms--){
+        time_ms++;
+        while (mock_run_loop_fire_next());
+    }
+}
+
+void mock_run_loop_stall_ms(uint32_t ms){
+    time_ms += ms;
+    while (mock_run_loop_fire_next());
+}
+
+int mock_run_loop_num_timers(void){
+    int num_timers = 0;
+    int i;
+    for (i = 0; i < MOCK_MAX_TIMERS; i++){
+        if (timers[i]) num_timers++;
+    }
+    return num_timers;
+}
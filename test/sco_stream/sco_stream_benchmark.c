@@ -0,0 +1,232 @@
+// measures end-to-end audio latency and underruns of sco_stream through a simulated controller
+// that sends one SCO packet per air slot and loops it back with random delay,
+// while the host run loop is blocked from time to time
+
+#include <stdio.h>
+#include <string.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "sco_stream.h"
+#include "mock.h"
+
+#define SCO_HANDLE          0x0101
+#define SCO_LEN             60
+#define SCO_SLOT_US         3750
+#define CONTROLLER_BUFFERS  8
+#define MAX_JITTER_MS       8
+#define STALL_PERIOD_MS     500
+#define STALL_MS            15
+#define CHUNK_SAMPLES       80      // 10 ms at 8 kHz
+#define SIMULATED_MS        3000
+
+typedef struct {
+    uint8_t  data[3 + SCO_LEN];
+    uint32_t deliver_ms;
+} sco_packet_t;
+
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+
+// controller buffers and air
+static sco_packet_t tx_queue[CONTROLLER_BUFFERS];
+static int      tx_queue_len;
+static sco_packet_t rx_queue[64];
+static int      rx_queue_len;
+static uint32_t next_slot_us;
+static uint32_t random_state;
+static uint32_t controller_drops;
+static uint32_t air_gaps;
+
+// producer and consumer
+static uint32_t samples_written;
+static uint32_t samples_read;
+static uint64_t latency_sum_ms;
+static uint32_t latency_count;
+static uint32_t latency_max_ms;
+
+static int transport_open(void *transport_config){
+    return 0;
+}
+
+static int transport_close(void *transport_config){
+    return 0;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (packet_type != HCI_SCO_DATA_PACKET) return 0;
+    if (tx_queue_len == CONTROLLER_BUFFERS){
+        controller_drops++;
+        return 0;
+    }
+    memcpy(tx_queue[tx_queue_len++].data, packet, size);
+    return 0;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static const char * transport_get_name(void){
+    return "simulated";
+}
+
+static hci_transport_t sim_transport = {
+    transport_open,
+    transport_close,
+    transport_send_packet,
+    transport_register_packet_handler,
+    transport_get_name,
+    NULL,
+    NULL,
+};
+
+static void inject_event(uint8_t * event, uint16_t size){
+    event[1] = size - 2;
+    transport_packet_handler(HCI_EVENT_PACKET, event, size);
+}
+
+static void controller_setup(void){
+    uint8_t event[13];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[2] = 1;
+    bt_store_16(event, 3, hci_read_buffer_size.opcode);
+    bt_store_16(event, 6, HCI_ACL_PAYLOAD_SIZE);
+    event[8] = SCO_LEN;
+    bt_store_16(event, 9, 1);
+    bt_store_16(event, 11, CONTROLLER_BUFFERS);
+    inject_event(event, sizeof(event));
+
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, 0x00, 0x01 };
+    uint8_t complete[19];
+    memset(complete, 0, sizeof(complete));
+    complete[0] = HCI_EVENT_SYNCHRONOUS_CONNECTION_COMPLETE;
+    bt_store_16(complete, 3, SCO_HANDLE);
+    bt_flip_addr(&complete[5], addr);
+    inject_event(complete, sizeof(complete));
+}
+
+static uint32_t random_ms(uint32_t max){
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 16) % (max + 1);
+}
+
+// send one packet per slot, the peer loops it back after a random delay
+static void controller_run(uint32_t now_ms){
+    while (next_slot_us <= now_ms * 1000){
+        next_slot_us += SCO_SLOT_US;
+        if (!tx_queue_len){
+            air_gaps++;
+            continue;
+        }
+        sco_packet_t * packet = &rx_queue[rx_queue_len++];
+        memcpy(packet->data, tx_queue[0].data, sizeof(packet->data));
+        tx_queue_len--;
+        memmove(&tx_queue[0], &tx_queue[1], tx_queue_len * sizeof(sco_packet_t));
+        // packets are received in order
+        packet->deliver_ms = now_ms + random_ms(MAX_JITTER_MS);
+        if (rx_queue_len > 1 && packet->deliver_ms < rx_queue[rx_queue_len - 2].deliver_ms){
+            packet->deliver_ms = rx_queue[rx_queue_len - 2].deliver_ms;
+        }
+    }
+}
+
+static void controller_deliver(uint32_t now_ms){
+    while (rx_queue_len && rx_queue[0].deliver_ms <= now_ms){
+        transport_packet_handler(HCI_SCO_DATA_PACKET, rx_queue[0].data, sizeof(rx_queue[0].data));
+        rx_queue_len--;
+        memmove(&rx_queue[0], &rx_queue[1], rx_queue_len * sizeof(sco_packet_t));
+    }
+}
+
+// sample values count written samples, 0 is silence
+static void producer_run(void){
+    int16_t samples[CHUNK_SAMPLES];
+    int i;
+    for (i = 0; i < CHUNK_SAMPLES; i++){
+        samples[i] = (samples_written + i) % 32767 + 1;
+    }
+    sco_stream_write_pcm(SCO_HANDLE, samples, CHUNK_SAMPLES);
+    samples_written += CHUNK_SAMPLES;
+}
+
+// latency: time since the first received sample in chunk was written
+static void consumer_run(uint32_t now_ms){
+    int16_t samples[CHUNK_SAMPLES];
+    sco_stream_read_pcm(SCO_HANDLE, samples, CHUNK_SAMPLES);
+    samples_read += CHUNK_SAMPLES;
+    int i;
+    for (i = 0; i < CHUNK_SAMPLES; i++){
+        if (!samples[i]) continue;
+        uint32_t written_ms = ((samples[i] - 1) / CHUNK_SAMPLES) * 10;
+        uint32_t latency_ms = now_ms - written_ms;
+        latency_sum_ms += latency_ms;
+        latency_count++;
+        if (latency_ms > latency_max_ms){
+            latency_max_ms = latency_ms;
+        }
+        break;
+    }
+}
+
+static void run_scenario(uint16_t jitter_buffer_ms){
+    tx_queue_len = 0;
+    rx_queue_len = 0;
+    next_slot_us = 0;
+    random_state = 1;
+    controller_drops = 0;
+    air_gaps = 0;
+    samples_written = 0;
+    samples_read = 0;
+    latency_sum_ms = 0;
+    latency_count = 0;
+    latency_max_ms = 0;
+
+    run_loop_init(RUN_LOOP_EMBEDDED);
+    hci_init(&sim_transport, NULL, NULL, NULL);
+    controller_setup();
+    sco_stream_init();
+    sco_stream_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.sample_rate = 8000;
+    config.jitter_buffer_ms = jitter_buffer_ms;
+    sco_stream_open(SCO_HANDLE, &config);
+
+    uint32_t now_ms;
+    for (now_ms = 0; now_ms < SIMULATED_MS; now_ms++){
+        controller_run(now_ms);
+        // host is blocked, audio device keeps running
+        if (now_ms % STALL_PERIOD_MS >= STALL_PERIOD_MS - STALL_MS) continue;
+        if (now_ms > run_loop_get_time_ms()){
+            mock_run_loop_stall_ms(now_ms - run_loop_get_time_ms());
+        }
+        controller_deliver(now_ms);
+        while (samples_written <= now_ms * 8){
+            producer_run();
+        }
+        while (samples_read + CHUNK_SAMPLES <= now_ms * 8){
+            consumer_run(now_ms);
+        }
+    }
+
+    const sco_stream_stats_t * stats = sco_stream_get_stats(SCO_HANDLE);
+    printf("jitter buffer %2u ms: latency mean %5.1f ms, max %3u ms, tx underruns %3u, tx late %3u, rx late %3u, rx underruns %3u, controller drops %u, air gaps %u\n",
+        jitter_buffer_ms, latency_count ? (double) latency_sum_ms / latency_count : 0.0, latency_max_ms,
+        stats->tx_underruns, stats->tx_late, stats->rx_late, stats->rx_underruns, controller_drops, air_gaps);
+    sco_stream_close(SCO_HANDLE);
+    hci_close();
+}
+
+int main (int argc, const char * argv[]){
+    printf("%u ms simulated, %u us SCO interval, loopback delay 0-%u ms, run loop blocked for %u ms every %u ms\n",
+        SIMULATED_MS, SCO_SLOT_US, MAX_JITTER_MS, STALL_MS, STALL_PERIOD_MS);
+    run_scenario(0);
+    run_scenario(10);
+    run_scenario(20);
+    run_scenario(40);
+    return 0;
+}
@@ -0,0 +1,302 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <string.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "sco_stream.h"
+#include "mock.h"
+
+#define MAX_SENT_PACKETS 100
+#define SCO_HANDLE       0x0101
+#define SCO_LEN          60
+
+// fake transport recording all outgoing SCO packets
+static void (*transport_packet_handler)(uint8_t packet_type, uint8_t *packet, uint16_t size);
+static uint8_t sent_packets[MAX_SENT_PACKETS][3 + SCO_LEN];
+static int num_sent_packets;
+
+static int transport_open(void *transport_config){
+    return 0;
+}
+
+static int transport_close(void *transport_config){
+    return 0;
+}
+
+static int transport_send_packet(uint8_t packet_type, uint8_t *packet, int size){
+    if (packet_type != HCI_SCO_DATA_PACKET) return 0;
+    if (num_sent_packets >= MAX_SENT_PACKETS) return 0;
+    memcpy(sent_packets[num_sent_packets++], packet, size <= 3 + SCO_LEN ? size : 3 + SCO_LEN);
+    return 0;
+}
+
+static void transport_register_packet_handler(void (*handler)(uint8_t packet_type, uint8_t *packet, uint16_t size)){
+    transport_packet_handler = handler;
+}
+
+static const char * transport_get_name(void){
+    return "fake";
+}
+
+static hci_transport_t fake_transport = {
+    transport_open,
+    transport_close,
+    transport_send_packet,
+    transport_register_packet_handler,
+    transport_get_name,
+    NULL,
+    NULL,
+};
+
+static void inject_event(uint8_t * event, uint16_t size){
+    event[1] = size - 2;
+    transport_packet_handler(HCI_EVENT_PACKET, event, size);
+}
+
+static void set_buffer_size(uint8_t sco_len, uint16_t sco_num){
+    uint8_t event[13];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[2] = 1;
+    bt_store_16(event, 3, hci_read_buffer_size.opcode);
+    bt_store_16(event, 6, HCI_ACL_PAYLOAD_SIZE);
+    event[8] = sco_len;
+    bt_store_16(event, 9, 1);
+    bt_store_16(event, 11, sco_num);
+    inject_event(event, sizeof(event));
+}
+
+static void open_sco_connection(hci_con_handle_t handle){
+    bd_addr_t addr = { 0x00, 0x1b, 0xdc, 0x00, 0x00, 0x01 };
+    uint8_t event[19];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_SYNCHRONOUS_CONNECTION_COMPLETE;
+    bt_store_16(event, 3, handle);
+    bt_flip_addr(&event[5], addr);
+    inject_event(event, sizeof(event));
+}
+
+static void close_connection(hci_con_handle_t handle){
+    uint8_t event[6];
+    memset(event, 0, sizeof(event));
+    event[0] = HCI_EVENT_DISCONNECTION_COMPLETE;
+    bt_store_16(event, 3, handle);
+    event[5] = 0x13;
+    inject_event(event, sizeof(event));
+}
+
+// SCO packet with samples first_sample, first_sample + 1, ...
+static void inject_sco_packet(uint8_t packet_status, int16_t first_sample){
+    uint8_t packet[3 + SCO_LEN];
+    bt_store_16(packet, 0, SCO_HANDLE | (packet_status << 12));
+    packet[2] = SCO_LEN;
+    int i;
+    for (i = 0; i < SCO_LEN / 2; i++){
+        bt_store_16(packet, 3 + 2 * i, first_sample + i);
+    }
+    transport_packet_handler(HCI_SCO_DATA_PACKET, packet, sizeof(packet));
+}
+
+static void write_samples(int num_samples){
+    int16_t samples[400];
+    int i;
+    for (i = 0; i < num_samples; i++){
+        samples[i] = i + 1;
+    }
+    CHECK_EQUAL(num_samples, sco_stream_write_pcm(SCO_HANDLE, samples, num_samples));
+}
+
+TEST_GROUP(SCOStream){
+    sco_stream_config_t config;
+    void setup(){
+        num_sent_packets = 0;
+        run_loop_init(RUN_LOOP_EMBEDDED);
+        hci_init(&fake_transport, NULL, NULL, NULL);
+        set_buffer_size(SCO_LEN, 8);
+        open_sco_connection(SCO_HANDLE);
+        sco_stream_init();
+        memset(&config, 0, sizeof(config));
+        config.sample_rate = 8000;
+    }
+    void teardown(){
+        sco_stream_close(SCO_HANDLE);
+        hci_close();
+    }
+    const sco_stream_stats_t * stats(){
+        return sco_stream_get_stats(SCO_HANDLE);
+    }
+};
+
+TEST(SCOStream, OpenUsesControllerPacketLength){
+    CHECK_EQUAL(0, sco_stream_open(SCO_HANDLE, &config));
+    CHECK(stats() != NULL);
+    write_samples(SCO_LEN / 2);
+    CHECK(num_sent_packets > 0);
+    CHECK_EQUAL(SCO_HANDLE, READ_BT_16(sent_packets[0], 0));
+    CHECK_EQUAL(SCO_LEN, sent_packets[0][2]);
+}
+
+TEST(SCOStream, OpenFailsWithoutFreeStream){
+    CHECK_EQUAL(0, sco_stream_open(SCO_HANDLE, &config));
+    CHECK_EQUAL(BTSTACK_MEMORY_ALLOC_FAILED, sco_stream_open(SCO_HANDLE + 1, &config));
+}
+
+TEST(SCOStream, PacketsPacedToAudioClock){
+    sco_stream_open(SCO_HANDLE, &config);
+    // 10 ms of audio
+    write_samples(80);
+    CHECK_EQUAL(SCO_STREAM_TX_PACKETS_AHEAD, num_sent_packets);
+    CHECK_EQUAL(1, READ_BT_16(sent_packets[0], 3));
+    CHECK_EQUAL(31, READ_BT_16(sent_packets[1], 3));
+    // third packet of 3.75 ms is due and only partially filled
+    mock_run_loop_advance_ms(7);
+    CHECK_EQUAL(SCO_STREAM_TX_PACKETS_AHEAD + 1, num_sent_packets);
+    CHECK_EQUAL((uint32_t) num_sent_packets, stats()->tx_packets);
+    CHECK_EQUAL(61, READ_BT_16(sent_packets[2], 3));
+    CHECK_EQUAL(0, READ_BT_16(sent_packets[2], 3 + 40));
+    CHECK_EQUAL(1u, stats()->tx_underruns);
+    // 1 s of audio written in time
+    int i;
+    for (i = 0; i < 100; i++){
+        write_samples(80);
+        mock_run_loop_advance_ms(10);
+    }
+    // 1007 ms of audio clock plus packets sent ahead
+    CHECK_EQUAL(SCO_STREAM_TX_PACKETS_AHEAD + 268, stats()->tx_packets);
+    CHECK_EQUAL(0u, stats()->tx_late);
+}
+
+TEST(SCOStream, TimerOnlyWhileSending){
+    sco_stream_open(SCO_HANDLE, &config);
+    CHECK_EQUAL(0, mock_run_loop_num_timers());
+    write_samples(80);
+    CHECK_EQUAL(1, mock_run_loop_num_timers());
+    // all written audio played back
+    mock_run_loop_advance_ms(15);
+    CHECK_EQUAL(0, mock_run_loop_num_timers());
+    CHECK_EQUAL(SCO_STREAM_TX_PACKETS_AHEAD + 1, num_sent_packets);
+    mock_run_loop_advance_ms(100);
+    CHECK_EQUAL(SCO_STREAM_TX_PACKETS_AHEAD + 1, num_sent_packets);
+    // audio clock starts again
+    write_samples(80);
+    CHECK_EQUAL(1, mock_run_loop_num_timers());
+    CHECK_EQUAL(2 * SCO_STREAM_TX_PACKETS_AHEAD + 1, num_sent_packets);
+    CHECK_EQUAL(1, READ_BT_16(sent_packets[SCO_STREAM_TX_PACKETS_AHEAD + 1], 3));
+}
+
+TEST(SCOStream, TransmitOverrun){
+    sco_stream_open(SCO_HANDLE, &config);
+    int16_t samples[400];
+    memset(samples, 0, sizeof(samples));
+    sco_stream_write_pcm(SCO_HANDLE, samples, 400);
+    CHECK_EQUAL(400 - SCO_STREAM_TX_BUFFER_SIZE / 2, stats()->tx_overruns);
+    // only room for packets sent right away
+    CHECK_EQUAL(SCO_STREAM_TX_PACKETS_AHEAD * SCO_LEN / 2, sco_stream_write_pcm(SCO_HANDLE, samples, 400));
+}
+
+TEST(SCOStream, StalledRunLoopSkipsPackets){
+    sco_stream_open(SCO_HANDLE, &config);
+    write_samples(240);
+    num_sent_packets = 0;
+    // 100 ms = 26 packets due, skip all but the ones to send ahead, dropping the written audio
+    mock_run_loop_stall_ms(100);
+    CHECK_EQUAL(0, num_sent_packets);
+    CHECK_EQUAL(24, stats()->tx_late);
+    mock_run_loop_advance_ms(15);
+    CHECK_EQUAL(0, num_sent_packets);
+    CHECK_EQUAL(0, mock_run_loop_num_timers());
+    // new audio sent right away
+    write_samples(80);
+    CHECK_EQUAL(SCO_STREAM_TX_PACKETS_AHEAD, num_sent_packets);
+}
+
+TEST(SCOStream, JitterBufferDelaysPlayback){
+    config.jitter_buffer_ms = 20;
+    sco_stream_open(SCO_HANDLE, &config);
+    int16_t samples[200];
+    int i;
+    // 20 ms = 5.33 packets
+    for (i = 0; i < 5; i++){
+        inject_sco_packet(0, 30 * i);
+        CHECK_EQUAL(0, sco_stream_rx_samples_available(SCO_HANDLE));
+        samples[0] = 1;
+        CHECK_EQUAL(0, sco_stream_read_pcm(SCO_HANDLE, samples, 10));
+        CHECK_EQUAL(0, samples[0]);
+        mock_run_loop_advance_ms(3);
+    }
+    inject_sco_packet(0, 150);
+    CHECK_EQUAL(180, sco_stream_rx_samples_available(SCO_HANDLE));
+    CHECK_EQUAL(160, sco_stream_read_pcm(SCO_HANDLE, samples, 160));
+    for (i = 0; i < 160; i++){
+        CHECK_EQUAL(i, samples[i]);
+    }
+    CHECK_EQUAL(6, stats()->rx_packets);
+    CHECK_EQUAL(0, stats()->rx_underruns);
+}
+
+TEST(SCOStream, ReceiveUnderrunRefillsJitterBuffer){
+    config.jitter_buffer_ms = 5;
+    sco_stream_open(SCO_HANDLE, &config);
+    inject_sco_packet(0, 0);
+    inject_sco_packet(0, 30);
+    int16_t samples[100];
+    CHECK_EQUAL(60, sco_stream_read_pcm(SCO_HANDLE, samples, 80));
+    CHECK_EQUAL(0, samples[79]);
+    CHECK_EQUAL(1, stats()->rx_underruns);
+    inject_sco_packet(0, 60);
+    CHECK_EQUAL(0, sco_stream_rx_samples_available(SCO_HANDLE));
+    inject_sco_packet(0, 90);
+    CHECK_EQUAL(60, sco_stream_rx_samples_available(SCO_HANDLE));
+}
+
+TEST(SCOStream, LateLostAndErroneousPackets){
+    config.jitter_buffer_ms = 10;
+    sco_stream_open(SCO_HANDLE, &config);
+    inject_sco_packet(0, 0);
+    // 3.75 ms of audio + 10 ms jitter buffer
+    mock_run_loop_advance_ms(13);
+    inject_sco_packet(0, 30);
+    CHECK_EQUAL(0, stats()->rx_late);
+    mock_run_loop_advance_ms(30);
+    inject_sco_packet(0, 60);
+    CHECK_EQUAL(1, stats()->rx_late);
+    inject_sco_packet(2, 90);
+    CHECK_EQUAL(1, stats()->rx_lost);
+    inject_sco_packet(1, 120);
+    CHECK_EQUAL(1, stats()->rx_erroneous);
+    CHECK_EQUAL(5, stats()->rx_packets);
+
+    // lost packet is played as silence
+    int16_t samples[150];
+    CHECK_EQUAL(150, sco_stream_read_pcm(SCO_HANDLE, samples, 150));
+    CHECK_EQUAL(89, samples[89]);
+    CHECK_EQUAL(0, samples[90]);
+    CHECK_EQUAL(0, samples[119]);
+    CHECK_EQUAL(120, samples[120]);
+}
+
+TEST(SCOStream, ReceiveOverrun){
+    sco_stream_open(SCO_HANDLE, &config);
+    int i;
+    for (i = 0; i < SCO_STREAM_RX_BUFFER_SIZE / SCO_LEN + 1; i++){
+        inject_sco_packet(0, 0);
+    }
+    CHECK_EQUAL(1, stats()->rx_overruns);
+}
+
+TEST(SCOStream, ClosedWithConnection){
+    sco_stream_open(SCO_HANDLE, &config);
+    close_connection(SCO_HANDLE);
+    mock_run_loop_advance_ms(10);
+    POINTERS_EQUAL(NULL, stats());
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
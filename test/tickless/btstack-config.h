@@ -0,0 +1,10 @@
+// configuration for embedded run loop with simulated HAL
+
+#define EMBEDDED
+#define HAVE_TICK
+#define HAVE_TICKLESS
+
+#define MAX_NO_TIMER_SOURCES 32
+
+// #define ENABLE_LOG_INFO 
+// #define ENABLE_LOG_ERROR
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hal_sim.c
+ *
+ *  Simulated hal_cpu and hal_tick for running the embedded run loop on a PC.
+ *  Sleeping advances the virtual time to the next tick, one-shot expiry, or
+ *  scheduled interrupt, whichever comes first.
+ */
+
+#include "hal_sim.h"
+
+#include <btstack/hal_cpu.h>
+#include <btstack/hal_tick.h>
+
+#include <stddef.h>
+
+#define HAL_SIM_MAX_IRQS 16
+
+typedef struct {
+    uint32_t time;
+    void (*handler)(void);
+} hal_sim_irq_t;
+
+static void (*tick_handler)(void);
+static uint32_t sim_time;
+static uint32_t sim_wakeups;
+static int      sim_idle_forever;
+static int      irqs_enabled;
+
+static int      one_shot_supported;
+static int      one_shot_active;
+static uint32_t one_shot_start;
+static uint32_t one_shot_ticks;
+
+static hal_sim_irq_t irqs[HAL_SIM_MAX_IRQS];
+static int num_irqs;
+
+void hal_sim_reset(void){
+    sim_time = 0;
+    sim_wakeups = 0;
+    sim_idle_forever = 0;
+    irqs_enabled = 1;
+    one_shot_supported = 1;
+    one_shot_active = 0;
+    num_irqs = 0;
+}
+
+void hal_sim_set_one_shot_supported(int supported){
+    one_shot_supported = supported;
+}
+
+void hal_sim_schedule_irq(uint32_t time_in_ticks, void (*handler)(void)){
+    if (num_irqs == HAL_SIM_MAX_IRQS) return;
+    irqs[num_irqs].time    = time_in_ticks;
+    irqs[num_irqs].handler = handler;
+    num_irqs++;
+}
+
+uint32_t hal_sim_get_time(void){
+    return sim_time;
+}
+
+uint32_t hal_sim_get_wakeups(void){
+    return sim_wakeups;
+}
+
+int hal_sim_idle_forever(void){
+    return sim_idle_forever;
+}
+
+// hal_cpu
+
+void hal_cpu_disable_irqs(void){
+    irqs_enabled = 0;
+}
+
+void hal_cpu_enable_irqs(void){
+    irqs_enabled = 1;
+}
+
+void hal_cpu_enable_irqs_and_sleep(void){
+    int i;
+    irqs_enabled = 1;
+
+    // next tick interrupt, 0 if none
+    uint32_t next_tick = sim_time + 1;
+    if (one_shot_active){
+        next_tick = one_shot_ticks ? one_shot_start + one_shot_ticks : 0;
+    }
+
+    // earliest scheduled interrupt
+    int next_irq = -1;
+    for (i = 0; i < num_irqs; i++){
+        if (next_irq < 0 || irqs[i].time < irqs[next_irq].time){
+            next_irq = i;
+        }
+    }
+
+    if (next_irq >= 0 && (!next_tick || irqs[next_irq].time <= next_tick)){
+        void (*handler)(void) = irqs[next_irq].handler;
+        if (irqs[next_irq].time > sim_time){
+            sim_time = irqs[next_irq].time;
+        }
+        irqs[next_irq] = irqs[--num_irqs];
+        sim_wakeups++;
+        (*handler)();
+        return;
+    }
+
+    if (!next_tick){
+        sim_idle_forever = 1;
+        return;
+    }
+
+    sim_time = next_tick;
+    sim_wakeups++;
+    if (tick_handler){
+        (*tick_handler)();
+    }
+}
+
+// hal_tick
+
+void hal_tick_init(void){
+    one_shot_active = 0;
+}
+
+void hal_tick_set_handler(void (*handler)(void)){
+    tick_handler = handler;
+}
+
+int hal_tick_get_tick_period_in_ms(void){
+    return HAL_SIM_TICK_PERIOD_MS;
+}
+
+int hal_tick_start_one_shot(uint32_t ticks){
+    if (!one_shot_supported) return 0;
+    one_shot_active = 1;
+    one_shot_start  = sim_time;
+    one_shot_ticks  = ticks;
+    return 1;
+}
+
+uint32_t hal_tick_stop_one_shot(void){
+    one_shot_active = 0;
+    return sim_time - one_shot_start;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at 
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+
+/*
+ *  hal_sim.h
+ *
+ *  Simulated hal_cpu and hal_tick for running the embedded run loop on a PC.
+ *  Time is virtual and advances only while the run loop sleeps.
+ */
+
+#ifndef __HAL_SIM_H
+#define __HAL_SIM_H
+
+#include <stdint.h>
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#define HAL_SIM_TICK_PERIOD_MS 10
+
+// reset virtual time, statistics and pending interrupts
+void     hal_sim_reset(void);
+
+// allow or refuse one-shot mode, refusing it forces periodic ticks
+void     hal_sim_set_one_shot_supported(int supported);
+
+// raise interrupt at given virtual time in ticks, the handler is called from hal_cpu_enable_irqs_and_sleep
+void     hal_sim_schedule_irq(uint32_t time_in_ticks, void (*handler)(void));
+
+// virtual time in ticks
+uint32_t hal_sim_get_time(void);
+
+// number of times the CPU was woken up from sleep
+uint32_t hal_sim_get_wakeups(void);
+
+// run loop went to sleep without any pending wakeup source
+int      hal_sim_idle_forever(void);
+
+#if defined __cplusplus
+}
+#endif
+
+#endif // __HAL_SIM_H
@@ -0,0 +1,57 @@
+// count MCU wakeups of the embedded run loop with periodic ticks and in tickless mode
+
+#include <stdio.h>
+
+#include <btstack/run_loop.h>
+#include "hal_sim.h"
+
+#define SIMULATED_TIME_MS (10 * 60 * 1000)
+#define MAX_TIMERS 8
+
+static timer_source_t timers[MAX_TIMERS];
+static uint32_t periods_ms[MAX_TIMERS];
+static uint32_t timer_events;
+
+static void timer_handler(timer_source_t * ts){
+    int index = ts - timers;
+    timer_events++;
+    run_loop_set_timer(ts, periods_ms[index]);
+    run_loop_add_timer(ts);
+}
+
+static uint32_t run_scenario(int one_shot_supported, int num_timers, const uint32_t * periods){
+    int i;
+    hal_sim_reset();
+    hal_sim_set_one_shot_supported(one_shot_supported);
+    run_loop_init(RUN_LOOP_EMBEDDED);
+    timer_events = 0;
+    for (i = 0; i < num_timers; i++){
+        periods_ms[i] = periods[i];
+        run_loop_set_timer_handler(&timers[i], &timer_handler);
+        run_loop_set_timer(&timers[i], periods[i]);
+        run_loop_add_timer(&timers[i]);
+    }
+    while (hal_sim_get_time() < SIMULATED_TIME_MS / HAL_SIM_TICK_PERIOD_MS && !hal_sim_idle_forever()){
+        embedded_execute_once();
+    }
+    return hal_sim_get_wakeups();
+}
+
+static void benchmark(const char * name, int num_timers, const uint32_t * periods){
+    uint32_t periodic = run_scenario(0, num_timers, periods);
+    uint32_t periodic_events = timer_events;
+    uint32_t tickless = run_scenario(1, num_timers, periods);
+    printf("%-24s timer events %6u / %6u, wakeups periodic %6u, tickless %6u (%5.1f%%)\n", name,
+        periodic_events, timer_events, periodic, tickless, 100.0 * tickless / periodic);
+}
+
+int main(void){
+    const uint32_t idle[]      = { 10000 };
+    const uint32_t connected[] = { 250, 1000, 10000 };
+    const uint32_t busy[]      = { 20, 100, 250, 1000, 5000 };
+    printf("simulated time %u s, tick period %u ms\n", SIMULATED_TIME_MS / 1000, HAL_SIM_TICK_PERIOD_MS);
+    benchmark("idle",      sizeof(idle)      / sizeof(uint32_t), idle);
+    benchmark("connected", sizeof(connected) / sizeof(uint32_t), connected);
+    benchmark("busy",      sizeof(busy)      / sizeof(uint32_t), busy);
+    return 0;
+}
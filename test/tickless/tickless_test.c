@@ -0,0 +1,118 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <btstack/run_loop.h>
+#include "hal_sim.h"
+
+static timer_source_t timer;
+static int      timer_fired;
+static uint32_t timer_fired_at;
+static int      periodic_count;
+
+static void timer_handler(timer_source_t * ts){
+    timer_fired++;
+    timer_fired_at = embedded_get_ticks();
+}
+
+static void periodic_handler(timer_source_t * ts){
+    periodic_count++;
+    run_loop_set_timer(ts, 100);
+    run_loop_add_timer(ts);
+}
+
+static void irq_handler(void){
+    embedded_trigger();
+}
+
+static void run_until(uint32_t time_in_ticks){
+    while (hal_sim_get_time() < time_in_ticks && !hal_sim_idle_forever()){
+        embedded_execute_once();
+    }
+}
+
+TEST_GROUP(Tickless){
+    void setup(){
+        hal_sim_reset();
+        run_loop_init(RUN_LOOP_EMBEDDED);
+        timer_fired = 0;
+        timer_fired_at = 0;
+        periodic_count = 0;
+        run_loop_set_timer_handler(&timer, &timer_handler);
+    }
+};
+
+TEST(Tickless, TimerFiresAfterSingleWakeup){
+    run_loop_set_timer(&timer, 1000);
+    run_loop_add_timer(&timer);
+    run_until(200);
+    CHECK_EQUAL(1, timer_fired);
+    // one tick added for unknown phase of current tick
+    CHECK_EQUAL(1u + 1000 / HAL_SIM_TICK_PERIOD_MS, timer_fired_at);
+    CHECK_EQUAL(1u, hal_sim_get_wakeups());
+}
+
+TEST(Tickless, FallbackToPeriodicTicks){
+    hal_sim_set_one_shot_supported(0);
+    run_loop_set_timer(&timer, 1000);
+    run_loop_add_timer(&timer);
+    run_until(200);
+    CHECK_EQUAL(1, timer_fired);
+    CHECK_EQUAL(1u + 1000 / HAL_SIM_TICK_PERIOD_MS, timer_fired_at);
+    // woken up on every tick until timer expired, idle afterwards
+    CHECK_EQUAL(200u, hal_sim_get_wakeups());
+}
+
+TEST(Tickless, InterruptBeforeTimeout){
+    run_loop_set_timer(&timer, 1000);
+    run_loop_add_timer(&timer);
+    hal_sim_schedule_irq(30, &irq_handler);
+    run_until(200);
+    CHECK_EQUAL(1, timer_fired);
+    CHECK_EQUAL(1u + 1000 / HAL_SIM_TICK_PERIOD_MS, timer_fired_at);
+    CHECK_EQUAL(2u, hal_sim_get_wakeups());
+}
+
+TEST(Tickless, SystemTicksFollowSleep){
+    hal_sim_schedule_irq(42, &irq_handler);
+    run_until(200);
+    CHECK_EQUAL(42u, embedded_get_ticks());
+    CHECK(hal_sim_idle_forever());
+}
+
+TEST(Tickless, NoTimerNoWakeup){
+    run_until(1000);
+    CHECK_EQUAL(0u, hal_sim_get_wakeups());
+    CHECK(hal_sim_idle_forever());
+}
+
+TEST(Tickless, ShortTimerUsesPeriodicTick){
+    run_loop_set_timer(&timer, 0);
+    run_loop_add_timer(&timer);
+    run_until(10);
+    CHECK_EQUAL(1, timer_fired);
+    CHECK_EQUAL(2u, timer_fired_at);
+}
+
+TEST(Tickless, PeriodicTimerSameAsWithTicks){
+    run_loop_set_timer_handler(&timer, &periodic_handler);
+    run_loop_set_timer(&timer, 100);
+    run_loop_add_timer(&timer);
+    run_until(1000);
+    int tickless_count = periodic_count;
+    uint32_t tickless_wakeups = hal_sim_get_wakeups();
+
+    setup();
+    hal_sim_set_one_shot_supported(0);
+    run_loop_set_timer_handler(&timer, &periodic_handler);
+    run_loop_set_timer(&timer, 100);
+    run_loop_add_timer(&timer);
+    run_until(1000);
+    CHECK_EQUAL(periodic_count, tickless_count);
+    CHECK_EQUAL(1000u, hal_sim_get_wakeups());
+    // one wakeup per timer event, the last one ends the simulation before the timer is processed
+    CHECK_EQUAL((uint32_t) tickless_count + 1, tickless_wakeups);
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
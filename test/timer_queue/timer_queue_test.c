@@ -0,0 +1,141 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <btstack/run_loop.h>
+#include "run_loop_private.h"
+
+#define NUM_TIMERS 100
+
+static timer_queue_t queue;
+static timer_source_t timers[NUM_TIMERS];
+
+static void set_timeout(timer_source_t * ts, int sec, int usec){
+    ts->timeout.tv_sec  = sec;
+    ts->timeout.tv_usec = usec;
+}
+
+static int timeout_compare(timer_source_t * a, timer_source_t * b){
+    if (a->timeout.tv_sec != b->timeout.tv_sec) return a->timeout.tv_sec < b->timeout.tv_sec ? -1 : 1;
+    if (a->timeout.tv_usec != b->timeout.tv_usec) return a->timeout.tv_usec < b->timeout.tv_usec ? -1 : 1;
+    return 0;
+}
+
+// pop all timers and check that they come out sorted, returns number of timers
+static int drain_sorted(void){
+    int count = 0;
+    timer_source_t * last = NULL;
+    timer_source_t * ts;
+    while ((ts = timer_queue_first(&queue)) != NULL){
+        if (last) CHECK(timeout_compare(last, ts) <= 0);
+        CHECK_EQUAL(0, timer_queue_remove(&queue, ts));
+        last = ts;
+        count++;
+    }
+    return count;
+}
+
+TEST_GROUP(TimerQueue){
+    void setup(){
+        timer_queue_init(&queue);
+        memset(timers, 0, sizeof(timers));
+        srand(1234);
+    }
+};
+
+TEST(TimerQueue, Empty){
+    POINTERS_EQUAL(NULL, timer_queue_first(&queue));
+    CHECK_EQUAL(-1, timer_queue_remove(&queue, &timers[0]));
+}
+
+TEST(TimerQueue, FirstIsEarliest){
+    set_timeout(&timers[0], 10, 0);
+    set_timeout(&timers[1], 5, 500);
+    set_timeout(&timers[2], 5, 100);
+    timer_queue_add(&queue, &timers[0]);
+    timer_queue_add(&queue, &timers[1]);
+    timer_queue_add(&queue, &timers[2]);
+    POINTERS_EQUAL(&timers[2], timer_queue_first(&queue));
+    CHECK_EQUAL(0, timer_queue_remove(&queue, &timers[2]));
+    POINTERS_EQUAL(&timers[1], timer_queue_first(&queue));
+    CHECK_EQUAL(0, timer_queue_remove(&queue, &timers[1]));
+    POINTERS_EQUAL(&timers[0], timer_queue_first(&queue));
+}
+
+TEST(TimerQueue, AddTwice){
+    set_timeout(&timers[0], 1, 0);
+    CHECK_EQUAL(0, timer_queue_add(&queue, &timers[0]));
+    CHECK_EQUAL(-1, timer_queue_add(&queue, &timers[0]));
+    CHECK_EQUAL(1, drain_sorted());
+}
+
+TEST(TimerQueue, RemoveUnknownTimer){
+    set_timeout(&timers[0], 1, 0);
+    set_timeout(&timers[1], 2, 0);
+    timer_queue_add(&queue, &timers[0]);
+    // never added timer with stale or garbage position
+    timers[2].queue_index = 1;
+    CHECK_EQUAL(-1, timer_queue_remove(&queue, &timers[2]));
+    timers[2].queue_index = 12345;
+    CHECK_EQUAL(-1, timer_queue_remove(&queue, &timers[2]));
+    timers[2].queue_index = -7;
+    CHECK_EQUAL(-1, timer_queue_remove(&queue, &timers[2]));
+    CHECK_EQUAL(1, drain_sorted());
+}
+
+TEST(TimerQueue, RandomOrder){
+    int i;
+    for (i = 0; i < NUM_TIMERS; i++){
+        set_timeout(&timers[i], rand() % 10, rand() % 1000000);
+        CHECK_EQUAL(0, timer_queue_add(&queue, &timers[i]));
+    }
+    CHECK_EQUAL(NUM_TIMERS, drain_sorted());
+}
+
+TEST(TimerQueue, RemoveAndReAdd){
+    int i;
+    for (i = 0; i < NUM_TIMERS; i++){
+        set_timeout(&timers[i], rand() % 10, rand() % 1000000);
+        timer_queue_add(&queue, &timers[i]);
+    }
+    // remove every third timer, re-arm every fifth
+    for (i = 0; i < NUM_TIMERS; i += 3){
+        CHECK_EQUAL(0, timer_queue_remove(&queue, &timers[i]));
+        CHECK_EQUAL(-1, timer_queue_remove(&queue, &timers[i]));
+    }
+    int expected = NUM_TIMERS - (NUM_TIMERS + 2) / 3;
+    for (i = 0; i < NUM_TIMERS; i += 5){
+        if (timer_queue_remove(&queue, &timers[i]) < 0) expected++;
+        set_timeout(&timers[i], rand() % 10, rand() % 1000000);
+        CHECK_EQUAL(0, timer_queue_add(&queue, &timers[i]));
+    }
+    CHECK_EQUAL(expected, drain_sorted());
+}
+
+TEST(TimerQueue, EqualTimeoutsInInsertionOrder){
+    int i;
+    // two timeouts, interleaved
+    for (i = 0; i < NUM_TIMERS; i++){
+        set_timeout(&timers[i], i % 2, 0);
+        CHECK_EQUAL(0, timer_queue_add(&queue, &timers[i]));
+    }
+    // re-added timer goes behind the others with the same timeout
+    CHECK_EQUAL(0, timer_queue_remove(&queue, &timers[0]));
+    CHECK_EQUAL(0, timer_queue_add(&queue, &timers[0]));
+    for (i = 2; i < NUM_TIMERS; i += 2){
+        POINTERS_EQUAL(&timers[i], timer_queue_first(&queue));
+        timer_queue_remove(&queue, &timers[i]);
+    }
+    POINTERS_EQUAL(&timers[0], timer_queue_first(&queue));
+    timer_queue_remove(&queue, &timers[0]);
+    for (i = 1; i < NUM_TIMERS; i += 2){
+        POINTERS_EQUAL(&timers[i], timer_queue_first(&queue));
+        timer_queue_remove(&queue, &timers[i]);
+    }
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
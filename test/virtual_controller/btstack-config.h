@@ -0,0 +1,12 @@
+// configuration for virtual controller tests and benchmark
+
+#define HAVE_TIME
+#define USE_POSIX_RUN_LOOP
+#define HAVE_MALLOC
+#define HAVE_BLE
+#define ENABLE_HCI_CONTROLLER_TO_HOST_FLOW_CONTROL
+
+// #define ENABLE_LOG_INFO 
+// #define ENABLE_LOG_ERROR
+
+#define HCI_ACL_PAYLOAD_SIZE 1021
@@ -0,0 +1,331 @@
+// measures L2CAP, RFCOMM and LE throughput and connection setup time between two BTstack
+// processes connected by virtual controllers with configurable bandwidth, latency and buffers
+//
+// the stack keeps its state in globals, so each instance runs in its own process
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include <btstack/run_loop.h>
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "hci_transport.h"
+#include "l2cap.h"
+#include "remote_device_db.h"
+#include "rfcomm.h"
+#include "virtual_controller.h"
+
+#define DATA_VOLUME     100000
+#define PSM_BENCHMARK   0x1001
+#define RFCOMM_CHANNEL  1
+#define TIMEOUT_S       30
+
+typedef enum {
+    BENCHMARK_L2CAP,
+    BENCHMARK_RFCOMM,
+    BENCHMARK_LE,
+} benchmark_t;
+
+static bd_addr_t server_addr = { 0x00, 0x1b, 0xdc, 0x0f, 0x00, 0x01 };
+static bd_addr_t client_addr = { 0x00, 0x1b, 0xdc, 0x0f, 0x00, 0x02 };
+
+static benchmark_t benchmark;
+static virtual_controller_config_t config;
+static int ready_fd;
+static timer_source_t finish_timer;
+
+// server
+static hci_con_handle_t handle;
+static uint32_t received_bytes;
+static double   first_data_s;
+
+// client
+static double   connect_s;
+static uint16_t cid;
+static uint16_t mtu;
+static uint32_t sent_bytes;
+static uint8_t  data[HCI_ACL_PAYLOAD_SIZE];
+static timer_source_t retry_timer;
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void finish_handler(timer_source_t * timer){
+    hci_close();
+    exit(0);
+}
+
+// close after the stack is done with the Disconnection Complete event
+static void finish(void){
+    run_loop_set_timer_handler(&finish_timer, finish_handler);
+    run_loop_set_timer(&finish_timer, 0);
+    run_loop_add_timer(&finish_timer);
+}
+
+static void server_received(uint16_t size){
+    if (!received_bytes){
+        first_data_s = now_s();
+    }
+    received_bytes += size;
+    if (received_bytes < DATA_VOLUME) return;
+    double duration_s = now_s() - first_data_s;
+    printf(", %7.1f kB/s", received_bytes / duration_s / 1000.0);
+    // exit after the client got the disconnect
+    gap_disconnect(handle);
+}
+
+static void server_ready(void){
+    uint8_t ready = 1;
+    write(ready_fd, &ready, 1);
+    close(ready_fd);
+}
+
+static void server_packet_handler(void * connection, uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    switch (packet_type){
+        case L2CAP_DATA_PACKET:
+        case RFCOMM_DATA_PACKET:
+            server_received(size);
+            return;
+        case HCI_EVENT_PACKET:
+            break;
+        default:
+            return;
+    }
+    switch (packet[0]){
+        case BTSTACK_EVENT_STATE:
+            if (packet[2] != HCI_STATE_WORKING) break;
+            if (benchmark == BENCHMARK_LE){
+                bd_addr_t null_addr;
+                memset(null_addr, 0, sizeof(null_addr));
+                hci_send_cmd(&hci_le_set_advertising_parameters, 0x0030, 0x0030, 0, 0, 0, null_addr, 0x07, 0);
+                break;
+            }
+            hci_connectable_control(1);
+            server_ready();
+            break;
+        case HCI_EVENT_COMMAND_COMPLETE:
+            if (COMMAND_COMPLETE_EVENT(packet, hci_le_set_advertising_parameters)){
+                hci_send_cmd(&hci_le_set_advertise_enable, 1);
+            }
+            if (COMMAND_COMPLETE_EVENT(packet, hci_le_set_advertise_enable)){
+                server_ready();
+            }
+            break;
+        case HCI_EVENT_CONNECTION_COMPLETE:
+            handle = READ_BT_16(packet, 3);
+            break;
+        case HCI_EVENT_LE_META:
+            if (packet[2] != HCI_SUBEVENT_LE_CONNECTION_COMPLETE) break;
+            handle = READ_BT_16(packet, 4);
+            break;
+        case HCI_EVENT_DISCONNECTION_COMPLETE:
+            finish();
+            break;
+        case L2CAP_EVENT_INCOMING_CONNECTION:
+            l2cap_accept_connection_internal(READ_BT_16(packet, 12));
+            break;
+        case RFCOMM_EVENT_INCOMING_CONNECTION:
+            rfcomm_accept_connection_internal(READ_BT_16(packet, 9));
+            break;
+        default:
+            break;
+    }
+}
+
+static void server_fixed_channel_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type != ATT_DATA_PACKET) return;
+    server_received(size);
+}
+
+static void client_send(void){
+    while (cid && sent_bytes < DATA_VOLUME){
+        uint16_t len = mtu;
+        switch (benchmark){
+            case BENCHMARK_L2CAP:
+                if (!l2cap_can_send_packet_now(cid)) return;
+                l2cap_send_internal(cid, data, len);
+                break;
+            case BENCHMARK_RFCOMM:
+                if (!rfcomm_can_send_packet_now(cid)) return;
+                rfcomm_send_internal(cid, data, len);
+                break;
+            case BENCHMARK_LE:
+                if (!l2cap_can_send_fixed_channel_packet_now(cid)) return;
+                l2cap_send_connectionless(cid, L2CAP_CID_ATTRIBUTE_PROTOCOL, data, len);
+                break;
+        }
+        sent_bytes += len;
+    }
+}
+
+static void client_connect(void){
+    connect_s = now_s();
+    switch (benchmark){
+        case BENCHMARK_L2CAP:
+            l2cap_create_channel_internal(NULL, NULL, server_addr, PSM_BENCHMARK, HCI_ACL_PAYLOAD_SIZE - L2CAP_HEADER_SIZE);
+            break;
+        case BENCHMARK_RFCOMM:
+            rfcomm_create_channel_internal(NULL, server_addr, RFCOMM_CHANNEL);
+            break;
+        case BENCHMARK_LE:
+            le_central_connect(server_addr, BD_ADDR_TYPE_LE_PUBLIC);
+            break;
+    }
+}
+
+static void client_retry_handler(timer_source_t * timer){
+    client_connect();
+}
+
+// server might still be busy with its init
+static void client_retry(void){
+    run_loop_set_timer_handler(&retry_timer, client_retry_handler);
+    run_loop_set_timer(&retry_timer, 100);
+    run_loop_add_timer(&retry_timer);
+}
+
+static void client_connected(uint16_t new_cid, uint16_t new_mtu){
+    printf(", setup %6.1f ms", (now_s() - connect_s) * 1000.0);
+    fflush(stdout);
+    cid = new_cid;
+    mtu = new_mtu;
+    client_send();
+}
+
+static void client_fixed_channel_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    if (packet[0] != DAEMON_EVENT_HCI_PACKET_SENT) return;
+    client_send();
+}
+
+static void client_packet_handler(void * connection, uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size){
+    if (packet_type != HCI_EVENT_PACKET) return;
+    switch (packet[0]){
+        case BTSTACK_EVENT_STATE:
+            if (packet[2] != HCI_STATE_WORKING) break;
+            client_connect();
+            break;
+        case L2CAP_EVENT_CHANNEL_OPENED:
+            if (benchmark != BENCHMARK_L2CAP) break;
+            if (packet[2]) {
+                client_retry();
+                break;
+            }
+            client_connected(READ_BT_16(packet, 13), READ_BT_16(packet, 19));
+            break;
+        case RFCOMM_EVENT_OPEN_CHANNEL_COMPLETE:
+            if (packet[2]) {
+                client_retry();
+                break;
+            }
+            client_connected(READ_BT_16(packet, 12), READ_BT_16(packet, 14));
+            break;
+        case HCI_EVENT_LE_META:
+            if (packet[2] != HCI_SUBEVENT_LE_CONNECTION_COMPLETE) break;
+            if (packet[3]) {
+                client_retry();
+                break;
+            }
+            client_connected(READ_BT_16(packet, 4), config.le_packet_length - L2CAP_HEADER_SIZE);
+            break;
+        case HCI_EVENT_DISCONNECTION_COMPLETE:
+            finish();
+            break;
+        case DAEMON_EVENT_HCI_PACKET_SENT:
+        case L2CAP_EVENT_CREDITS:
+        case RFCOMM_EVENT_CREDITS:
+            client_send();
+            break;
+        default:
+            break;
+    }
+}
+
+static void run_instance(int server){
+    alarm(TIMEOUT_S);
+    run_loop_init(RUN_LOOP_POSIX);
+    memcpy(config.bd_addr, server ? server_addr : client_addr, 6);
+    hci_init(hci_transport_virtual_instance(), &config, NULL, &remote_device_db_memory);
+    l2cap_init();
+    rfcomm_init();
+    if (server){
+        l2cap_register_packet_handler(server_packet_handler);
+        l2cap_register_service_internal(NULL, NULL, PSM_BENCHMARK, HCI_ACL_PAYLOAD_SIZE - L2CAP_HEADER_SIZE, LEVEL_0);
+        l2cap_register_fixed_channel(server_fixed_channel_handler, L2CAP_CID_ATTRIBUTE_PROTOCOL);
+        rfcomm_register_packet_handler(server_packet_handler);
+        rfcomm_register_service_internal(NULL, RFCOMM_CHANNEL, 0xffff);
+    } else {
+        l2cap_register_packet_handler(client_packet_handler);
+        l2cap_register_fixed_channel(client_fixed_channel_handler, L2CAP_CID_ATTRIBUTE_PROTOCOL);
+        rfcomm_register_packet_handler(client_packet_handler);
+    }
+    hci_power_control(HCI_POWER_ON);
+    run_loop_execute();
+}
+
+static void run_benchmark(benchmark_t new_benchmark, const char * name, uint32_t bandwidth, uint32_t latency_us, uint16_t acl_packets){
+    benchmark = new_benchmark;
+    virtual_controller_config_init(&config, server_addr);
+    config.bandwidth = bandwidth;
+    config.latency_us = latency_us;
+    config.acl_packets = acl_packets;
+    config.le_packets = acl_packets;
+    printf("%-6s %5u kB/s link, latency %5.1f ms, %u buffers", name, bandwidth / 1000, latency_us / 1000.0, acl_packets);
+    fflush(stdout);
+
+    int ready_pipe[2];
+    if (pipe(ready_pipe) < 0) return;
+    pid_t server = fork();
+    if (server == 0){
+        close(ready_pipe[0]);
+        ready_fd = ready_pipe[1];
+        run_instance(1);
+    }
+    close(ready_pipe[1]);
+    uint8_t ready = 0;
+    read(ready_pipe[0], &ready, 1);
+    close(ready_pipe[0]);
+
+    pid_t client = fork();
+    if (client == 0){
+        run_instance(0);
+    }
+    int status;
+    waitpid(server, &status, 0);
+    if (!WIFEXITED(status)) {
+        printf(" - FAILED");
+    }
+    // client exits when the server disconnects
+    waitpid(client, &status, 0);
+    printf("\n");
+}
+
+int main (int argc, const char * argv[]){
+    char air_path[64];
+    snprintf(air_path, sizeof(air_path), "/tmp/btstack-air-%u", (int) getpid());
+    hci_transport_virtual_set_air_path(air_path);
+    memset(data, 0x55, sizeof(data));
+    printf("%u bytes per run\n", DATA_VOLUME);
+
+    run_benchmark(BENCHMARK_L2CAP,  "L2CAP",  125000,  1000, 4);
+    run_benchmark(BENCHMARK_L2CAP,  "L2CAP",  375000,  1000, 8);
+    run_benchmark(BENCHMARK_L2CAP,  "L2CAP",  125000, 10000, 4);
+    run_benchmark(BENCHMARK_RFCOMM, "RFCOMM", 125000,  1000, 4);
+    run_benchmark(BENCHMARK_RFCOMM, "RFCOMM", 375000,  1000, 8);
+    run_benchmark(BENCHMARK_RFCOMM, "RFCOMM", 125000, 10000, 4);
+    run_benchmark(BENCHMARK_LE,     "LE",     125000,  1000, 8);
+    run_benchmark(BENCHMARK_LE,     "LE",     125000, 10000, 8);
+
+    rmdir(air_path);
+    return 0;
+}
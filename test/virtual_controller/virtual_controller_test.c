@@ -0,0 +1,483 @@
+#include "CppUTest/TestHarness.h"
+#include "CppUTest/CommandLineTestRunner.h"
+
+#include <string.h>
+
+#include <btstack/hci_cmds.h>
+#include <btstack/utils.h>
+
+#include "hci.h"
+#include "virtual_controller.h"
+
+// controllers exchange air messages in memory, time is simulated
+
+#define NUM_CONTROLLERS 3
+#define MAX_PACKETS 64
+
+typedef struct {
+    uint32_t time_us;
+    uint8_t  type;
+    uint16_t size;
+    uint8_t  data[HCI_PACKET_BUFFER_SIZE];
+} received_packet_t;
+
+static virtual_controller_t controllers[NUM_CONTROLLERS];
+static received_packet_t received[NUM_CONTROLLERS][MAX_PACKETS];
+static int num_received[NUM_CONTROLLERS];
+static uint32_t now_us;
+static int air_busy;
+static int air_busy_count;
+
+static bd_addr_t addr[NUM_CONTROLLERS] = {
+    { 0x00, 0x1b, 0xdc, 0x00, 0x00, 0x01 },
+    { 0x00, 0x1b, 0xdc, 0x00, 0x00, 0x02 },
+    { 0x00, 0x1b, 0xdc, 0x00, 0x00, 0x03 },
+};
+
+static int index_for_controller(virtual_controller_t * controller){
+    return controller - controllers;
+}
+
+static void host_handler(virtual_controller_t * controller, uint8_t packet_type, uint8_t * packet, uint16_t size){
+    int index = index_for_controller(controller);
+    if (num_received[index] >= MAX_PACKETS) return;
+    received_packet_t * entry = &received[index][num_received[index]++];
+    entry->time_us = now_us;
+    entry->type = packet_type;
+    entry->size = size;
+    memcpy(entry->data, packet, size);
+}
+
+static int air_handler(virtual_controller_t * controller, const uint8_t * destination, uint8_t * message, uint16_t size){
+    if (air_busy){
+        air_busy_count++;
+        return 1;
+    }
+    int i;
+    for (i = 0; i < NUM_CONTROLLERS; i++){
+        if (&controllers[i] == controller) continue;
+        if (destination && BD_ADDR_CMP(destination, addr[i])) continue;
+        virtual_controller_receive(&controllers[i], now_us, message, size);
+    }
+    return 0;
+}
+
+// advance simulated time until all controllers are idle or limit is reached
+static void run_until(uint32_t limit_us){
+    while (1){
+        int i;
+        int pending = 0;
+        uint32_t next_us = 0;
+        for (i = 0; i < NUM_CONTROLLERS; i++){
+            uint32_t when_us;
+            if (!virtual_controller_next_event(&controllers[i], now_us, &when_us)) continue;
+            if (!pending || (int32_t)(when_us - next_us) < 0) next_us = when_us;
+            pending = 1;
+        }
+        if (!pending || (int32_t)(next_us - limit_us) > 0) break;
+        now_us = next_us;
+        for (i = 0; i < NUM_CONTROLLERS; i++){
+            virtual_controller_process(&controllers[i], now_us);
+        }
+    }
+    if ((int32_t)(limit_us - now_us) > 0) now_us = limit_us;
+}
+
+static void run_until_idle(void){
+    run_until(now_us + 10000000);
+}
+
+static void send_packet(int index, uint8_t packet_type, uint8_t * packet, uint16_t size){
+    virtual_controller_send_packet(&controllers[index], now_us, packet_type, packet, size);
+}
+
+static void send_cmd(int index, const hci_cmd_t * cmd, ...){
+    uint8_t packet[HCI_CMD_BUFFER_SIZE];
+    va_list argptr;
+    va_start(argptr, cmd);
+    uint16_t size = hci_create_cmd_internal(packet, cmd, argptr);
+    va_end(argptr);
+    send_packet(index, HCI_COMMAND_DATA_PACKET, packet, size);
+}
+
+static received_packet_t * find_event(int index, uint8_t event_code){
+    int i;
+    for (i = 0; i < num_received[index]; i++){
+        received_packet_t * entry = &received[index][i];
+        if (entry->type == HCI_EVENT_PACKET && entry->data[0] == event_code) return entry;
+    }
+    return NULL;
+}
+
+static received_packet_t * find_le_event(int index, uint8_t subevent_code){
+    int i;
+    for (i = 0; i < num_received[index]; i++){
+        received_packet_t * entry = &received[index][i];
+        if (entry->type == HCI_EVENT_PACKET && entry->data[0] == HCI_EVENT_LE_META && entry->data[2] == subevent_code) return entry;
+    }
+    return NULL;
+}
+
+static int count_packets(int index, uint8_t packet_type){
+    int i;
+    int count = 0;
+    for (i = 0; i < num_received[index]; i++){
+        if (received[index][i].type == packet_type) count++;
+    }
+    return count;
+}
+
+static void clear_received(void){
+    memset(num_received, 0, sizeof(num_received));
+}
+
+// @returns connection handle of controller 'index'
+static hci_con_handle_t connect_classic(int index, int peer){
+    send_cmd(peer, &hci_write_scan_enable, 2);
+    send_cmd(index, &hci_create_connection, addr[peer], 0xcc18, 0, 0, 0, 1);
+    // accept before page timeout
+    run_until(now_us + 10000);
+    CHECK(find_event(peer, HCI_EVENT_CONNECTION_REQUEST) != NULL);
+    send_cmd(peer, &hci_accept_connection_request, addr[index], 1);
+    run_until_idle();
+    received_packet_t * event = find_event(index, HCI_EVENT_CONNECTION_COMPLETE);
+    CHECK(event != NULL);
+    CHECK_EQUAL(0, event->data[2]);
+    CHECK(find_event(peer, HCI_EVENT_CONNECTION_COMPLETE) != NULL);
+    return READ_BT_16(event->data, 3);
+}
+
+static void connect_le(int master, int slave, hci_con_handle_t * master_handle, hci_con_handle_t * slave_handle){
+    send_cmd(slave, &hci_le_set_advertising_parameters, 0x0030, 0x0030, 0, 0, 0, addr[master], 0x07, 0);
+    send_cmd(slave, &hci_le_set_advertise_enable, 1);
+    send_cmd(master, &hci_le_create_connection, 0x0060, 0x0030, 0, 0, addr[slave], 0, 0x0008, 0x0018, 0, 0x0048, 0, 0);
+    run_until_idle();
+    received_packet_t * master_event = find_le_event(master, HCI_SUBEVENT_LE_CONNECTION_COMPLETE);
+    received_packet_t * slave_event  = find_le_event(slave,  HCI_SUBEVENT_LE_CONNECTION_COMPLETE);
+    CHECK(master_event != NULL);
+    CHECK(slave_event != NULL);
+    CHECK_EQUAL(0, master_event->data[3]);
+    CHECK_EQUAL(0, master_event->data[6]);  // master
+    CHECK_EQUAL(1, slave_event->data[6]);   // slave
+    *master_handle = READ_BT_16(master_event->data, 4);
+    *slave_handle  = READ_BT_16(slave_event->data, 4);
+}
+
+static void send_acl(int index, hci_con_handle_t handle, uint16_t len){
+    static uint8_t packet[4 + 1021];
+    bt_store_16(packet, 0, 0x2000 | handle);
+    bt_store_16(packet, 2, len);
+    memset(&packet[4], len & 0xff, len);
+    send_packet(index, HCI_ACL_DATA_PACKET, packet, 4 + len);
+}
+
+TEST_GROUP(VirtualController){
+    void setup(void){
+        int i;
+        now_us = 0x7fff0000;  // wraps during tests
+        air_busy = 0;
+        air_busy_count = 0;
+        clear_received();
+        for (i = 0; i < NUM_CONTROLLERS; i++){
+            virtual_controller_config_t config;
+            virtual_controller_config_init(&config, addr[i]);
+            virtual_controller_init(&controllers[i], &config, &host_handler, &air_handler, NULL);
+        }
+    }
+    void teardown(void){
+        int i;
+        for (i = 0; i < NUM_CONTROLLERS; i++){
+            virtual_controller_close(&controllers[i]);
+        }
+    }
+};
+
+TEST(VirtualController, CommandsAreCompleted){
+    send_cmd(0, &hci_reset);
+    send_cmd(0, &hci_read_buffer_size);
+    send_cmd(0, &hci_read_bd_addr);
+    CHECK_EQUAL(0, num_received[0]);
+    run_until_idle();
+    CHECK_EQUAL(3, num_received[0]);
+    received_packet_t * event = &received[0][1];
+    CHECK_EQUAL(HCI_EVENT_COMMAND_COMPLETE, event->data[0]);
+    CHECK_EQUAL(1, event->data[2]);
+    CHECK_EQUAL(hci_read_buffer_size.opcode, READ_BT_16(event->data, 3));
+    CHECK_EQUAL(0, event->data[5]);
+    CHECK_EQUAL(1021, READ_BT_16(event->data, 6));
+    CHECK_EQUAL(4, READ_BT_16(event->data, 9));
+    bd_addr_t bd_addr;
+    bt_flip_addr(bd_addr, &received[0][2].data[6]);
+    CHECK_EQUAL(0, BD_ADDR_CMP(bd_addr, addr[0]));
+}
+
+TEST(VirtualController, LEEncryptMatchesFIPS197){
+    // FIPS-197 Appendix C.1, HCI parameters are little endian
+    const uint8_t key[16]       = { 0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x00 };
+    const uint8_t plaintext[16] = { 0xff, 0xee, 0xdd, 0xcc, 0xbb, 0xaa, 0x99, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11, 0x00 };
+    const uint8_t expected[16]  = { 0x5a, 0xc5, 0xb4, 0x70, 0x80, 0xb7, 0xcd, 0xd8, 0x30, 0x04, 0x7b, 0x6a, 0xd8, 0xe0, 0xc4, 0x69 };
+    send_cmd(0, &hci_le_encrypt, key, plaintext);
+    run_until_idle();
+    received_packet_t * event = find_event(0, HCI_EVENT_COMMAND_COMPLETE);
+    CHECK(event != NULL);
+    CHECK_EQUAL(0, event->data[5]);
+    CHECK_EQUAL(0, memcmp(&event->data[6], expected, 16));
+}
+
+TEST(VirtualController, ClassicConnectionAndDisconnect){
+    hci_con_handle_t handle = connect_classic(0, 1);
+    received_packet_t * event = find_event(1, HCI_EVENT_CONNECTION_REQUEST);
+    bd_addr_t peer;
+    bt_flip_addr(peer, &event->data[2]);
+    CHECK_EQUAL(0, BD_ADDR_CMP(peer, addr[0]));
+    // request and accept each take one latency
+    CHECK(find_event(0, HCI_EVENT_CONNECTION_COMPLETE)->time_us - received[0][0].time_us >= 2000);
+
+    clear_received();
+    send_cmd(0, &hci_disconnect, handle, 0x13);
+    run_until_idle();
+    event = find_event(0, HCI_EVENT_DISCONNECTION_COMPLETE);
+    CHECK(event != NULL);
+    CHECK_EQUAL(ERROR_CODE_CONNECTION_TERMINATED_BY_LOCAL_HOST, event->data[5]);
+    event = find_event(1, HCI_EVENT_DISCONNECTION_COMPLETE);
+    CHECK(event != NULL);
+    CHECK_EQUAL(0x13, event->data[5]);
+
+    // handle is gone
+    clear_received();
+    send_cmd(0, &hci_disconnect, handle, 0x13);
+    run_until_idle();
+    CHECK_EQUAL(ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, find_event(0, HCI_EVENT_COMMAND_STATUS)->data[2]);
+}
+
+TEST(VirtualController, PageTimeoutWithoutPageScan){
+    send_cmd(0, &hci_create_connection, addr[1], 0xcc18, 0, 0, 0, 1);
+    run_until_idle();
+    received_packet_t * event = find_event(0, HCI_EVENT_CONNECTION_COMPLETE);
+    CHECK(event != NULL);
+    CHECK_EQUAL(ERROR_CODE_PAGE_TIMEOUT, event->data[2]);
+    CHECK(find_event(1, HCI_EVENT_CONNECTION_REQUEST) == NULL);
+    // default page timeout 0x2000 slots
+    CHECK_EQUAL(0x2000 * 625, event->time_us - received[0][0].time_us);
+}
+
+TEST(VirtualController, AclDataIsLimitedByBuffersAndBandwidth){
+    hci_con_handle_t handle = connect_classic(0, 1);
+    clear_received();
+    uint32_t start_us = now_us;
+    int i;
+    for (i = 0; i < 5; i++){
+        send_acl(0, handle, 1021);
+    }
+    run_until_idle();
+    // 4 controller buffers
+    CHECK(find_event(0, HCI_EVENT_DATA_BUFFER_OVERFLOW) != NULL);
+    CHECK_EQUAL(4, count_packets(1, HCI_ACL_DATA_PACKET));
+    int completed = 0;
+    for (i = 0; i < num_received[0]; i++){
+        if (received[0][i].data[0] != HCI_EVENT_NUMBER_OF_COMPLETED_PACKETS) continue;
+        CHECK_EQUAL(handle, READ_BT_16(received[0][i].data, 3));
+        completed += READ_BT_16(received[0][i].data, 5);
+    }
+    CHECK_EQUAL(4, completed);
+    // 1025 bytes take 8200 us at 125000 bytes/s, last packet arrives one latency later
+    uint32_t last_us = 0;
+    for (i = 0; i < num_received[1]; i++){
+        if (received[1][i].type != HCI_ACL_DATA_PACKET) continue;
+        CHECK_EQUAL(1025, received[1][i].size);
+        CHECK_EQUAL(1021, READ_ACL_LENGTH(received[1][i].data));
+        last_us = received[1][i].time_us;
+    }
+    CHECK_EQUAL(4 * 8200 + 1000, last_us - start_us);
+}
+
+TEST(VirtualController, AclDataWaitsForHostBuffers){
+    hci_con_handle_t handle = connect_classic(0, 1);
+    hci_con_handle_t peer_handle = READ_BT_16(find_event(1, HCI_EVENT_CONNECTION_COMPLETE)->data, 3);
+    send_cmd(1, &hci_set_controller_to_host_flow_control, 1);
+    send_cmd(1, &hci_host_buffer_size, 1021, 0, 2, 0);
+    run_until_idle();
+    clear_received();
+    int i;
+    for (i = 0; i < 4; i++){
+        send_acl(0, handle, 100);
+    }
+    run_until_idle();
+    CHECK_EQUAL(2, count_packets(1, HCI_ACL_DATA_PACKET));
+    send_cmd(1, &hci_host_number_of_completed_packets, 1, peer_handle, 2);
+    run_until_idle();
+    CHECK_EQUAL(4, count_packets(1, HCI_ACL_DATA_PACKET));
+}
+
+TEST(VirtualController, BlockedAirIsRetried){
+    hci_con_handle_t handle = connect_classic(0, 1);
+    clear_received();
+    air_busy = 1;
+    send_acl(0, handle, 100);
+    run_until(now_us + 20000);
+    CHECK(air_busy_count > 0);
+    CHECK_EQUAL(0, count_packets(1, HCI_ACL_DATA_PACKET));
+    air_busy = 0;
+    run_until_idle();
+    CHECK_EQUAL(1, count_packets(1, HCI_ACL_DATA_PACKET));
+}
+
+TEST(VirtualController, SecureSimplePairing){
+    hci_con_handle_t handle = connect_classic(0, 1);
+    send_cmd(0, &hci_write_simple_pairing_mode, 1);
+    send_cmd(1, &hci_write_simple_pairing_mode, 1);
+    run_until_idle();
+    clear_received();
+    send_cmd(0, &hci_authentication_requested, handle);
+    run_until_idle();
+    CHECK(find_event(0, HCI_EVENT_LINK_KEY_REQUEST) != NULL);
+    send_cmd(0, &hci_link_key_request_negative_reply, addr[1]);
+    run_until_idle();
+    CHECK(find_event(0, HCI_EVENT_IO_CAPABILITY_REQUEST) != NULL);
+    send_cmd(0, &hci_io_capability_request_reply, addr[1], 1, 0, 0);
+    run_until_idle();
+    CHECK(find_event(1, HCI_EVENT_IO_CAPABILITY_RESPONSE) != NULL);
+    CHECK(find_event(1, HCI_EVENT_IO_CAPABILITY_REQUEST) != NULL);
+    send_cmd(1, &hci_io_capability_request_reply, addr[0], 1, 0, 0);
+    run_until_idle();
+    received_packet_t * request_0 = find_event(0, HCI_EVENT_USER_CONFIRMATION_REQUEST);
+    received_packet_t * request_1 = find_event(1, HCI_EVENT_USER_CONFIRMATION_REQUEST);
+    CHECK(request_0 != NULL);
+    CHECK(request_1 != NULL);
+    CHECK_EQUAL(READ_BT_32(request_0->data, 8), READ_BT_32(request_1->data, 8));
+    send_cmd(1, &hci_user_confirmation_request_reply, addr[0]);
+    send_cmd(0, &hci_user_confirmation_request_reply, addr[1]);
+    run_until_idle();
+    received_packet_t * event = find_event(0, HCI_EVENT_AUTHENTICATION_COMPLETE_EVENT);
+    CHECK(event != NULL);
+    CHECK_EQUAL(0, event->data[2]);
+    CHECK(find_event(1, HCI_EVENT_SIMPLE_PAIRING_COMPLETE) != NULL);
+    received_packet_t * key_0 = find_event(0, HCI_EVENT_LINK_KEY_NOTIFICATION);
+    received_packet_t * key_1 = find_event(1, HCI_EVENT_LINK_KEY_NOTIFICATION);
+    CHECK(key_0 != NULL);
+    CHECK(key_1 != NULL);
+    CHECK_EQUAL(0, memcmp(&key_0->data[8], &key_1->data[8], 17));
+    CHECK_EQUAL(AUTHENTICATED_COMBINATION_KEY_GENERATED_FROM_P192, key_0->data[24]);
+
+    // encryption with new key
+    clear_received();
+    send_cmd(0, &hci_set_connection_encryption, handle, 1);
+    run_until_idle();
+    CHECK_EQUAL(1, find_event(0, HCI_EVENT_ENCRYPTION_CHANGE)->data[5]);
+    CHECK_EQUAL(1, find_event(1, HCI_EVENT_ENCRYPTION_CHANGE)->data[5]);
+}
+
+TEST(VirtualController, SynchronousConnection){
+    hci_con_handle_t handle = connect_classic(0, 1);
+    clear_received();
+    send_cmd(0, &hci_setup_synchronous_connection_command, handle, 8000, 8000, 0xffff, 0x0060, 0xff, 0x003f);
+    run_until(now_us + 10000);
+    received_packet_t * event = find_event(1, HCI_EVENT_CONNECTION_REQUEST);
+    CHECK(event != NULL);
+    CHECK_EQUAL(2, event->data[11]);
+    send_cmd(1, &hci_accept_synchronous_connection_command, addr[0], 8000, 8000, 0xffff, 0x0060, 0xff, 0x003f);
+    run_until_idle();
+    event = find_event(0, HCI_EVENT_SYNCHRONOUS_CONNECTION_COMPLETE);
+    CHECK(event != NULL);
+    CHECK_EQUAL(0, event->data[2]);
+    CHECK(find_event(1, HCI_EVENT_SYNCHRONOUS_CONNECTION_COMPLETE) != NULL);
+    hci_con_handle_t sco_handle = READ_BT_16(event->data, 3);
+
+    // 60 byte SCO packets at 8000 bytes/s
+    clear_received();
+    uint8_t packet[3 + 60];
+    bt_store_16(packet, 0, sco_handle);
+    packet[2] = 60;
+    uint32_t start_us = now_us;
+    send_packet(0, HCI_SCO_DATA_PACKET, packet, sizeof(packet));
+    send_packet(0, HCI_SCO_DATA_PACKET, packet, sizeof(packet));
+    run_until_idle();
+    CHECK_EQUAL(2, count_packets(1, HCI_SCO_DATA_PACKET));
+    CHECK_EQUAL(2 * 7500 + 1000, received[1][1].time_us - start_us);
+
+    // SCO ends with ACL
+    clear_received();
+    send_cmd(0, &hci_disconnect, handle, 0x13);
+    run_until_idle();
+    CHECK_EQUAL(2, num_received[1]);
+    CHECK_EQUAL(HCI_EVENT_DISCONNECTION_COMPLETE, received[1][0].data[0]);
+    CHECK_EQUAL(HCI_EVENT_DISCONNECTION_COMPLETE, received[1][1].data[0]);
+}
+
+TEST(VirtualController, Inquiry){
+    send_cmd(1, &hci_write_scan_enable, 1);
+    send_cmd(2, &hci_write_scan_enable, 3);
+    send_cmd(0, &hci_inquiry, 0x9e8b33, 2, 0);
+    run_until_idle();
+    int results = 0;
+    int i;
+    for (i = 0; i < num_received[0]; i++){
+        if (received[0][i].data[0] == HCI_EVENT_INQUIRY_RESULT) results++;
+    }
+    CHECK_EQUAL(2, results);
+    CHECK(find_event(0, HCI_EVENT_INQUIRY_COMPLETE) != NULL);
+}
+
+TEST(VirtualController, LEConnectionAndEncryption){
+    hci_con_handle_t master_handle;
+    hci_con_handle_t slave_handle;
+    connect_le(0, 1, &master_handle, &slave_handle);
+    // third controller isn't involved
+    CHECK(find_le_event(2, HCI_SUBEVENT_LE_CONNECTION_COMPLETE) == NULL);
+
+    // LE buffers
+    clear_received();
+    send_acl(1, slave_handle, 27);
+    run_until_idle();
+    CHECK_EQUAL(1, count_packets(0, HCI_ACL_DATA_PACKET));
+    send_acl(1, slave_handle, 28);
+    run_until_idle();
+    CHECK_EQUAL(1, count_packets(0, HCI_ACL_DATA_PACKET));
+
+    uint8_t ltk[16];
+    memset(ltk, 0x55, sizeof(ltk));
+    clear_received();
+    send_cmd(0, &hci_le_start_encryption, master_handle, 0x01020304, 0x05060708, 0x1234, ltk);
+    run_until_idle();
+    received_packet_t * event = find_le_event(1, HCI_SUBEVENT_LE_LONG_TERM_KEY_REQUEST);
+    CHECK(event != NULL);
+    CHECK_EQUAL(slave_handle, READ_BT_16(event->data, 3));
+    CHECK_EQUAL(0x1234, READ_BT_16(event->data, 13));
+    send_cmd(1, &hci_le_long_term_key_request_reply, slave_handle, ltk);
+    run_until_idle();
+    event = find_event(0, HCI_EVENT_ENCRYPTION_CHANGE);
+    CHECK(event != NULL);
+    CHECK_EQUAL(0, event->data[2]);
+    CHECK_EQUAL(1, event->data[5]);
+    CHECK_EQUAL(1, find_event(1, HCI_EVENT_ENCRYPTION_CHANGE)->data[5]);
+}
+
+TEST(VirtualController, LEScanning){
+    uint8_t adv_data[31];
+    memset(adv_data, 0, sizeof(adv_data));
+    adv_data[0] = 2;
+    adv_data[1] = 0x01;
+    adv_data[2] = 0x06;
+    send_cmd(1, &hci_le_set_advertising_data, 3, adv_data);
+    send_cmd(1, &hci_le_set_advertising_parameters, 0x0030, 0x0030, 0, 0, 0, addr[0], 0x07, 0);
+    send_cmd(1, &hci_le_set_advertise_enable, 1);
+    send_cmd(0, &hci_le_set_scan_enable, 1, 1);
+    run_until(now_us + 100000);
+    send_cmd(1, &hci_le_set_advertise_enable, 0);
+    run_until_idle();
+    received_packet_t * event = find_le_event(0, HCI_SUBEVENT_LE_ADVERTISING_REPORT);
+    CHECK(event != NULL);
+    CHECK_EQUAL(3, event->data[12]);
+    CHECK_EQUAL(0, memcmp(&event->data[13], adv_data, 3));
+    // duplicates filtered
+    int reports = 0;
+    int i;
+    for (i = 0; i < num_received[0]; i++){
+        if (received[0][i].data[0] == HCI_EVENT_LE_META) reports++;
+    }
+    CHECK_EQUAL(1, reports);
+}
+
+int main (int argc, const char * argv[]){
+    return CommandLineTestRunner::RunAllTests(argc, argv);
+}
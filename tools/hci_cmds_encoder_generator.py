@@ -0,0 +1,196 @@
+#!/usr/bin/env python
+# BlueKitchen GmbH (c) 2014
+
+# Generates typed HCI command encoders for all hci_cmd_t entries in src/hci_cmds.c
+# Each encoder writes the command with fixed offsets, no format string is interpreted
+
+import re
+
+copyright = """/*
+ * Copyright (C) 2014 BlueKitchen GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holders nor the names of
+ *    contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ * 4. Any redistribution, use, or modification is done solely for
+ *    personal benefit and not for any commercial purpose or for
+ *    monetary gain.
+ *
+ * THIS SOFTWARE IS PROVIDED BY BLUEKITCHEN GMBH AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHIAS
+ * RINGWALD OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Please inquire about commercial licensing options at
+ * contact@bluekitchen-gmbh.com
+ *
+ */
+"""
+
+hfile_header_begin = """
+/*
+ *  hci_cmds_encoder.h
+ *
+ *  @brief Typed encoders for HCI commands
+ *
+ *  @note code automatically generated by tools/hci_cmds_encoder_generator.py from src/hci_cmds.c
+ *
+ *  Each hci_cmd_NAME_create(buffer, ...) writes the same bytes as
+ *  hci_create_cmd(buffer, &hci_NAME, ...) and returns the command size.
+ *  The hci_cmd_t table is still used for the daemon's socket protocol.
+ */
+
+#ifndef __HCI_CMDS_ENCODER_H
+#define __HCI_CMDS_ENCODER_H
+
+#if defined __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <btstack/utils.h>
+
+// UTF-8 name, zero padded to 248 bytes
+static inline void hci_cmd_store_name(uint8_t * buffer, const char * name){
+    uint16_t len = strlen(name);
+    if (len > 248) {
+        len = 248;
+    }
+    memcpy(buffer, name, len);
+    memset(&buffer[len], 0, 248 - len);
+}
+"""
+
+hfile_header_end = """
+#if defined __cplusplus
+}
+#endif
+
+#endif // __HCI_CMDS_ENCODER_H
+"""
+
+hci_h_path = '../src/hci.h'
+hci_cmds_c_path = '../src/hci_cmds.c'
+file_name = '../src/hci_cmds_encoder.h'
+
+param_types = { '1' : 'uint8_t', '2' : 'uint16_t', 'H' : 'hci_con_handle_t', '3' : 'uint32_t', '4' : 'uint32_t',
+                'B' : 'const bd_addr_t', 'D' : 'const uint8_t *', 'E' : 'const uint8_t *', 'N' : 'const char *',
+                'P' : 'const uint8_t *', 'A' : 'const uint8_t *'}
+
+param_sizes = { '1' : 1, '2' : 2, 'H' : 2, '3' : 3, '4' : 4, 'B' : 6, 'D' : 8, 'E' : 240, 'N' : 248, 'P' : 16, 'A' : 31}
+
+defines = dict()
+
+def read_defines(infile):
+    with open (infile, 'r') as fin:
+        for line in fin:
+            parts = re.match('#define\s+(\w+)\s+(\w*)',line)
+            if parts and len(parts.groups()) == 2:
+                (key, value) = parts.groups()
+                defines[key] = value
+
+def value_for(term):
+    if term in defines:
+        return int(defines[term], 0)
+    return int(term, 0)
+
+def param_name(param, used):
+    name = re.sub('\W', '_', param.lower())
+    if name in used or name in ['buffer', 'int', 'char']:
+        name = '%s_%u' % (name, len(used) + 1)
+    used.add(name)
+    return name
+
+def create_encoder(name, opcode, format, params):
+    if len(params) != len(format):
+        params = ['arg%u' % (i + 1) for i in range(len(format))]
+    used = set()
+    names = [param_name(param, used) for param in params]
+
+    args = ['uint8_t * buffer']
+    for (f, arg_name) in zip(format, names):
+        args.append('%s %s' % (param_types[f], arg_name))
+
+    lines = []
+    lines.append('buffer[0] = 0x%02x;' % (opcode & 0xff))
+    lines.append('buffer[1] = 0x%02x;' % (opcode >> 8))
+    pos = 3
+    for (f, arg_name) in zip(format, names):
+        if f == '1':
+            lines.append('buffer[%u] = %s;' % (pos, arg_name))
+        elif f in ['2', 'H', '3', '4']:
+            for i in range(param_sizes[f]):
+                shift = ' >> %u' % (8 * i) if i else ''
+                lines.append('buffer[%u] = %s%s;' % (pos + i, arg_name, shift))
+        elif f == 'B':
+            for i in range(6):
+                lines.append('buffer[%u] = %s[%u];' % (pos + i, arg_name, 5 - i))
+        elif f == 'N':
+            lines.append('hci_cmd_store_name(&buffer[%u], %s);' % (pos, arg_name))
+        else:
+            lines.append('memcpy(&buffer[%u], %s, %u);' % (pos, arg_name, param_sizes[f]))
+        pos += param_sizes[f]
+    lines.insert(2, 'buffer[2] = %u;' % (pos - 3))
+    lines.append('return %u;' % pos)
+
+    code = '\n// %s, opcode 0x%04x, format "%s"\n' % (name, opcode, format)
+    code += 'static inline uint16_t hci_cmd_%s_create(%s){\n' % (name[len('hci_'):], ', '.join(args))
+    for line in lines:
+        code += '    %s\n' % line
+    code += '}\n'
+    return code
+
+def parse_commands(infile):
+    encoders = []
+    with open (infile, 'r') as fin:
+        params = []
+        command_name = None
+        for line in fin:
+            parts = re.match('.*@param\s*(\w*)\s*', line)
+            if parts and len(parts.groups()) == 1:
+                params.append(parts.groups()[0])
+                continue
+
+            declaration = re.match('const\s+hci_cmd_t\s+(\w+)[\s=]+', line)
+            if declaration:
+                command_name = declaration.groups()[0]
+                continue
+
+            definition = re.match('\s*OPCODE\\(\s*(\w+)\s*,\s+(\w+)\s*\\)\s*,\s\\"(\w*)\\".*', line)
+            if definition:
+                (ogf, ocf, format) = definition.groups()
+                if command_name.startswith('hci_') and all(f in param_types for f in format):
+                    opcode = value_for(ocf) | value_for(ogf) << 10
+                    encoders.append(create_encoder(command_name, opcode, format, params))
+                params = []
+                continue
+    return encoders
+
+read_defines(hci_h_path)
+
+f = open(file_name, 'w')
+f.write(copyright)
+f.write(hfile_header_begin)
+for encoder in parse_commands(hci_cmds_c_path):
+    f.write(encoder)
+f.write(hfile_header_end)
+f.close()